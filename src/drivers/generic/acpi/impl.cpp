@@ -227,7 +227,8 @@ extern "C" {
 	}
 	uacpi_u64 uacpi_kernel_get_ticks(void)
 	{
-		return 10000 /* 1ms is 1000000ns, so we divide that to get 10000 ticks. */;
+		// uACPI wants 100ns ticks.
+		return thread::GetMonotonicTime() / 100;
 	}
 #if defined(__x86_64__) || defined(_WIN64)
 #pragma GCC push_options
@@ -246,15 +247,11 @@ extern "C" {
 #endif
 	void uacpi_kernel_sleep(uacpi_u64 msec)
 	{
-		auto currentThread = thread::GetCurrentCpuLocalPtr()->currentThread;
-		currentThread->blockCallback.callback = [](thread::Thread*, void* userdata)
-			{
-				size_t wakeTime = (size_t)userdata;
-				return thread::g_timerTicks >= wakeTime;
-			};
-		currentThread->blockCallback.userdata = (void*)(thread::g_timerTicks + msec);
-		currentThread->status = thread::THREAD_STATUS_CAN_RUN | thread::THREAD_STATUS_BLOCKED;
-		thread::callScheduler(false);
+		if (!msec)
+			return;
+		// Nothing wakes this queue, so the thread sleeps until the wait times out.
+		locks::WaitQueue sleepQueue;
+		sleepQueue.Wait(msec * 1000000);
 	}
 	void* uacpi_kernel_map(uacpi_phys_addr addr, uacpi_size)
 	{
@@ -314,8 +311,8 @@ return (byte*)ret + addr % pageSize;*/
 			while (*e > 0);
 			return UACPI_TRUE;
 		}
-		uint64_t wakeTime = thread::g_timerTicks + t;
-		while (*e > 0 && thread::g_timerTicks >= wakeTime);
+		uint64_t wakeTime = thread::GetMonotonicTime() + t * 1000000;
+		while (*e > 0 && thread::GetMonotonicTime() >= wakeTime);
 		bool ret = *e > 0;
 		*e -= ret;
 		return ret;
@@ -22,6 +22,13 @@
 
 #include <allocators/vmm/vmm.h>
 
+#include <multitasking/locks/mutex.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#include <arch/x86_64/memory_manager/physical/allocate.h>
+#endif
+
 #include "cache.h"
 #include "fat_structs.h"
 
@@ -127,16 +134,17 @@ namespace fatDriver
 	}
 	static bool FAT32LookForEntriesInDirectory(
 		const vfs::DriveHandle& ,
-		partition& , 
-		generic_bpb* bpb, 
+		partition& part, 
+		generic_bpb* , 
 		const fat_dirEntry* directory, 
+		size_t nEntries,
 		const utils::String &initPath,
 		utils::Vector<temp_directoryEntryCache*>& cacheEntries)
 	{
 		utils::String curPath = initPath;
 		bool isLFN = false;
 		utils::Vector<const fat_lfn*> lfnEntriesInOrder;
-		for (const fat_dirEntry* curEnt = directory; curEnt->fname[0]; curEnt++)
+		for (const fat_dirEntry* curEnt = directory; curEnt < (directory + nEntries) && curEnt->fname[0]; curEnt++)
 		{
 			if (curEnt->fname[0] == 0 || curEnt->fname[0] == -27 /* 0xE5 */)
 				continue;
@@ -201,13 +209,9 @@ namespace fatDriver
 			if (curEnt->fAttribs & fat_dirEntry::HIDDEN)
 				cache->_cacheEntry->fileAttributes |= driverInterface::FILE_ATTRIBUTES_HIDDEN;
 			cache->_cacheEntry->path = (char*)utils::memcpy(new char[curPath.length() + 1], curPath.data(), curPath.length());
-			uint32_t baseCluster = ((uint32_t)curEnt->cluster0_15 | (uint32_t)(curEnt->cluster16_31 << 16));
-			size_t bytesPerCluster = (bpb->sectorsPerCluster * bpb->bytesPerSector);
-			uint32_t lastCluster = baseCluster + curEnt->filesize / bytesPerCluster + ((curEnt->filesize % bytesPerCluster) != 0);
-			if (curEnt->fAttribs & fat_dirEntry::DIRECTORY)
-				lastCluster++; // The driver however, needs to find out the amount of clusters the directory takes
-			for (uint32_t curCluster = baseCluster; curCluster < lastCluster; curCluster++)
-				cache->_cacheEntry->clusters.push_back(curCluster);
+			// The rest of the cluster chain is read from the FAT when the file is first used.
+			cache->_cacheEntry->firstCluster = ((uint32_t)curEnt->cluster0_15 | (uint32_t)(curEnt->cluster16_31 << 16));
+			cache->_cacheEntry->owner = &part;
 			cache->directoryEntry = new fat_dirEntry{ *curEnt };
 			curPath = initPath;
 			cacheEntries.push_back(cache);
@@ -216,77 +220,25 @@ namespace fatDriver
 		}
 		return true;
 	}
-	static bool InitializeCacheForFAT32Partition(const vfs::DriveHandle& handle, partition& part, generic_bpb* bpb)
+	static size_t bytesPerCluster(const generic_bpb* bpb)
 	{
-		const auto& ebpb = bpb->ebpb.fat32_ebpb;
-		auto RootDirSectors = ((bpb->nRootDirectoryEntries * 32) + (bpb->bytesPerSector - 1)) / bpb->bytesPerSector;
-		uint32_t FatSz = bpb->sectorsPerFAT == 0 ? ebpb.sectorsPerFAT : bpb->sectorsPerFAT;
-		uint32_t TotSec = bpb->totalSectorCountOnVolume16 == 0 ? bpb->totalSectorCountOnVolume32 : bpb->totalSectorCountOnVolume16;
-		auto DataSec = TotSec - (bpb->nResvSectors + (bpb->nFats * FatSz) + RootDirSectors);
-		auto ClusterCount = DataSec / bpb->sectorsPerCluster;
-		part.ClusterCount = ClusterCount;
-		part.DataSec = DataSec;
-		part.FirstDataSec = (bpb->nResvSectors + (bpb->nFats * FatSz) + RootDirSectors);
-		part.TotSec = TotSec;
-		part.FatSz = FatSz;
-		part.RootDirSectors = RootDirSectors;
-		size_t bytesPerSector = 0;
-		size_t partLBAOffset = 0;
-		handle.QueryInfo(nullptr, &bytesPerSector, nullptr);
-		handle.QueryPartitionInfo(nullptr, &partLBAOffset, nullptr);
-		// TODO: Change from Vector to a specialized class specifically made for holding sectors.
-		// This will allow for less heap fragmentation.
-		// Omar Berrow - I'm sure I'll do it tomorrow (January 15, 2024)
-		// We'll see...
-		// Omar Berrow - (4:45 PM, January 14 2024) I ended up doing it now and not forgetting!
-		// Anyway Imma leave these comments for the next person to see them.
-		// Omar Berrow - (6:37 PM, January 18 2024) Lol it's kind of surprising how I didn't forget. I also decided to move the class into vfs/devManip/ so it can be used by all.
-		utils::SectorStorage currentCluster{ bpb->sectorsPerCluster * bytesPerSector }, otherCluster{ bpb->sectorsPerCluster * bytesPerSector };
-		bytesPerSector = bytesPerSector > bpb->bytesPerSector ? bytesPerSector : bpb->bytesPerSector;
-		auto sector = fat32FirstSectorOfCluster(ebpb.rootDirectoryCluster, *bpb, part.FirstDataSec);
-		//sector -= partLBAOffset;
-		if (!handle.ReadSectors(currentCluster.data(), nullptr, sector, bpb->sectorsPerCluster))
-			return false;
-		const fat_dirEntry* entry = (fat_dirEntry*)currentCluster.data();
-		{
-			const fat_dirEntry* lastElement = entry + ((bpb->sectorsPerCluster * bytesPerSector - 32) / 32);
-			for (size_t cluster = 1; lastElement->fname[0] != 0; cluster++)
-			{
-				size_t oldLength = currentCluster.length();
-				currentCluster.resize(oldLength + bpb->sectorsPerCluster * bytesPerSector);
-				entry = (fat_dirEntry*)currentCluster.data();
-				lastElement = entry + (oldLength / sizeof(fat_dirEntry)) + ((bpb->sectorsPerCluster * bytesPerSector - 32) / 32);
-				if (!handle.ReadSectors(otherCluster.data() + oldLength, nullptr, sector + (cluster * bpb->sectorsPerCluster), bpb->sectorsPerCluster))
-					return false;
-			}
-		}
-		utils::Vector<temp_directoryEntryCache*> cacheEntries;
-		// Look in the root directory.
-		FAT32LookForEntriesInDirectory(handle,part,bpb, entry,"",cacheEntries);
-		for (size_t i = 0; i < cacheEntries.length(); i++)
+		return (size_t)bpb->sectorsPerCluster * bpb->bytesPerSector;
+	}
+	// Reads a directory's clusters into buffer, which must be big enough to hold all of the extents.
+	static bool ReadDirectory(const vfs::DriveHandle& handle, partition& part, generic_bpb* bpb, const utils::Vector<clusterExtent>& extents, byte* buffer)
+	{
+		for (size_t i = 0; i < extents.length(); i++)
 		{
-			auto ent = cacheEntries[i];
-			if (ent->_cacheEntry->fileAttributes & driverInterface::FILE_ATTRIBUTES_FILE)
-				continue;
-			const fat_dirEntry* child = (fat_dirEntry*)otherCluster.data();
-			const fat_dirEntry* lastElement = child + ((bpb->sectorsPerCluster * bytesPerSector - 32) / 32);
-			sector = fat32FirstSectorOfCluster(ent->_cacheEntry->clusters.at(0), *bpb, part.FirstDataSec);
-			if (!handle.ReadSectors(otherCluster.data(), nullptr, sector, bpb->sectorsPerCluster))
+			const clusterExtent& extent = extents[i];
+			auto sector = fat32FirstSectorOfCluster(extent.diskCluster, *bpb, part.FirstDataSec);
+			if (!handle.ReadSectors(buffer + extent.fileCluster * bytesPerCluster(bpb), nullptr, sector, (size_t)extent.nClusters * bpb->sectorsPerCluster))
 				return false;
-			for (size_t cluster = 1; lastElement->fname[0] != 0; cluster++)
-			{
-				size_t oldLength = otherCluster.length();
-				otherCluster.resize(oldLength + bpb->sectorsPerCluster * bytesPerSector);
-				child = (fat_dirEntry*)otherCluster.data();
-				lastElement = child + (oldLength / sizeof(fat_dirEntry)) + ((bpb->sectorsPerCluster * bytesPerSector - sizeof(fat_dirEntry)) / sizeof(fat_dirEntry));
-				if (!handle.ReadSectors(otherCluster.data() + oldLength, nullptr, sector + cluster * bpb->sectorsPerCluster, bpb->sectorsPerCluster))
-					return false;
-			}
-			utils::String initPath = ent->_cacheEntry->path;
-			initPath.push_back('/');
- 			FAT32LookForEntriesInDirectory(handle,part,bpb, child,initPath,cacheEntries);
-			otherCluster.resize(bpb->sectorsPerCluster * bytesPerSector);
 		}
+		return true;
+	}
+	// Adds the entries read from a directory to the partition's cache.
+	static void AddEntries(partition& part, cacheEntry* directory, utils::Vector<temp_directoryEntryCache*>& cacheEntries)
+	{
 		for (size_t i = 0; i < cacheEntries.length(); i++)
 		{
 			auto ent = cacheEntries[i];
@@ -298,6 +250,10 @@ namespace fatDriver
 			ent->_cacheEntry->prev = part.tail;
 			part.tail = ent->_cacheEntry;
 			part.nCacheEntries++;
+			ent->_cacheEntry->parent = directory;
+			ent->_cacheEntry->nextSibling = directory->firstChild;
+			directory->firstChild = ent->_cacheEntry;
+			PathIndexInsert(part, ent->_cacheEntry);
 			// Omar Berrow, January 19 2024 at 8:31 PM:
 			// If anyone read the comment in interface.cpp today at 8:12 PM and is wondering, "but wait, the cache DOES set it," I had done that after writing the comment.
 			// Decided to say it so it's clear.
@@ -305,6 +261,197 @@ namespace fatDriver
 			delete ent->directoryEntry;
 			delete ent;
 		}
+	}
+	static void lruUnlink(partition& part, cacheEntry* directory)
+	{
+		if (directory->lruNext)
+			directory->lruNext->lruPrev = directory->lruPrev;
+		if (directory->lruPrev)
+			directory->lruPrev->lruNext = directory->lruNext;
+		if (part.lruHead == directory)
+			part.lruHead = directory->lruNext;
+		if (part.lruTail == directory)
+			part.lruTail = directory->lruPrev;
+		directory->lruNext = directory->lruPrev = nullptr;
+		directory->onLRU = false;
+		part.nEvictable--;
+	}
+	static void lruPush(partition& part, cacheEntry* directory)
+	{
+		directory->lruNext = part.lruHead;
+		if (part.lruHead)
+			part.lruHead->lruPrev = directory;
+		part.lruHead = directory;
+		if (!part.lruTail)
+			part.lruTail = directory;
+		directory->onLRU = true;
+		part.nEvictable++;
+	}
+	// Adds the entry to the evictable list or removes it from it, depending on whether it can be evicted now.
+	static void updateLRU(partition& part, cacheEntry* entry)
+	{
+		bool evictable = entry != part.root && entry->childrenLoaded && entry->firstChild && !entry->subtreeRefs;
+		if (evictable && !entry->onLRU)
+			lruPush(part, entry);
+		else if (!evictable && entry->onLRU)
+			lruUnlink(part, entry);
+	}
+	void PinEntry(partition& part, cacheEntry* entry)
+	{
+		entry->refs++;
+		for (cacheEntry* current = entry; current; current = current->parent)
+			if (!current->subtreeRefs++)
+				updateLRU(part, current);
+	}
+	void UnpinEntry(partition& part, cacheEntry* entry)
+	{
+		entry->refs--;
+		for (cacheEntry* current = entry; current; current = current->parent)
+			if (!--current->subtreeRefs)
+				updateLRU(part, current);
+	}
+	bool LoadDirectory(partition& part, cacheEntry* directory)
+	{
+		if (directory->childrenLoaded)
+			return true;
+		if (!(directory->fileAttributes & driverInterface::FILE_ATTRIBUTES_DIRECTORY))
+			return false;
+		generic_bpb* bpb = part.bpb;
+		const auto* extents = GetFileExtents(directory);
+		if (!extents)
+			return false;
+		// TODO: Change from Vector to a specialized class specifically made for holding sectors.
+		// This will allow for less heap fragmentation.
+		// Omar Berrow - I'm sure I'll do it tomorrow (January 15, 2024)
+		// We'll see...
+		// Omar Berrow - (4:45 PM, January 14 2024) I ended up doing it now and not forgetting!
+		// Anyway Imma leave these comments for the next person to see them.
+		// Omar Berrow - (6:37 PM, January 18 2024) Lol it's kind of surprising how I didn't forget. I also decided to move the class into vfs/devManip/ so it can be used by all.
+		utils::SectorStorage buffer{ CountClusters(*extents) * bytesPerCluster(bpb) };
+		if (!ReadDirectory(*part.drive, part, bpb, *extents, buffer.data()))
+			return false;
+		// The root's path is empty, so its entries' paths don't start with a slash.
+		utils::String initPath = directory->path;
+		if (directory != part.root)
+			initPath.push_back('/');
+		utils::Vector<temp_directoryEntryCache*> cacheEntries;
+		FAT32LookForEntriesInDirectory(*part.drive, part, bpb, (fat_dirEntry*)buffer.data(), buffer.length() / sizeof(fat_dirEntry), initPath, cacheEntries);
+		AddEntries(part, directory, cacheEntries);
+		directory->childrenLoaded = true;
+		updateLRU(part, directory);
+		return true;
+	}
+	// Marks the entry and its parents as used.
+	// The parents are moved to the head after their children, so a directory is never evicted before the directories in it.
+	static void touch(partition& part, cacheEntry* entry)
+	{
+		for (; entry; entry = entry->parent)
+		{
+			if (!entry->onLRU)
+				continue;
+			lruUnlink(part, entry);
+			lruPush(part, entry);
+		}
+	}
+	// Returns whether the name of the entry (the last component of its path) is the first len characters of name.
+	static bool nameEquals(const partition& part, const cacheEntry* entry, const char* name, size_t len)
+	{
+		const char* entName = entry->path;
+		if (entry->parent != part.root)
+			entName += utils::strlen(entry->parent->path) + 1;
+		return utils::strlen(entName) == len && utils::memcmp(entName, name, len);
+	}
+	cacheEntry* LookupPath(partition& part, const char* path)
+	{
+		// Only evict before anything is looked up, so no entry on the path can be freed under us.
+		EvictColdDirectories(part);
+		if (cacheEntry* entry = PathIndexLookup(part, path))
+		{
+			touch(part, entry);
+			return entry;
+		}
+		// The path's directories might not have been read yet, walk it from the root.
+		cacheEntry* current = part.root;
+		while (*path)
+		{
+			for (; *path == '/'; path++);
+			if (!*path)
+				break;
+			size_t len = 0;
+			for (; path[len] && path[len] != '/'; len++);
+			if (!LoadDirectory(part, current))
+				return nullptr;
+			cacheEntry* child = current->firstChild;
+			for (; child && !nameEquals(part, child, path, len); child = child->nextSibling);
+			if (!child)
+				return nullptr;
+			current = child;
+			path += len;
+		}
+		if (current == part.root)
+			return nullptr;
+		touch(part, current);
+		return current;
+	}
+	static void unloadDirectory(partition& part, cacheEntry* directory)
+	{
+		for (cacheEntry* child = directory->firstChild; child; )
+		{
+			cacheEntry* next = child->nextSibling;
+			unloadDirectory(part, child);
+			if (child->onLRU)
+				lruUnlink(part, child);
+			if (child->next)
+				child->next->prev = child->prev;
+			if (child->prev)
+				child->prev->next = child->next;
+			if (part.head == child)
+				part.head = child->next;
+			if (part.tail == child)
+				part.tail = child->prev;
+			part.nCacheEntries--;
+			PathIndexRemove(part, child);
+			delete[] child->path;
+			delete child;
+			child = next;
+		}
+		directory->firstChild = nullptr;
+		directory->childrenLoaded = false;
+	}
+	void EvictColdDirectories(partition& part)
+	{
+		// Nothing under a directory in the list is pinned, so its whole subtree can be freed.
+		while (part.nCacheEntries > FAT_MAX_CACHED_ENTRIES && !part.nIterators && part.nEvictable)
+		{
+			cacheEntry* coldest = part.lruTail;
+			unloadDirectory(part, coldest);
+			lruUnlink(part, coldest);
+		}
+	}
+	static bool InitializeCacheForFAT32Partition(const vfs::DriveHandle&, partition& part, generic_bpb* bpb)
+	{
+		const auto& ebpb = bpb->ebpb.fat32_ebpb;
+		auto RootDirSectors = ((bpb->nRootDirectoryEntries * 32) + (bpb->bytesPerSector - 1)) / bpb->bytesPerSector;
+		uint32_t FatSz = bpb->sectorsPerFAT == 0 ? ebpb.sectorsPerFAT : bpb->sectorsPerFAT;
+		uint32_t TotSec = bpb->totalSectorCountOnVolume16 == 0 ? bpb->totalSectorCountOnVolume32 : bpb->totalSectorCountOnVolume16;
+		auto DataSec = TotSec - (bpb->nResvSectors + (bpb->nFats * FatSz) + RootDirSectors);
+		auto ClusterCount = DataSec / bpb->sectorsPerCluster;
+		part.ClusterCount = ClusterCount;
+		part.DataSec = DataSec;
+		part.FirstDataSec = (bpb->nResvSectors + (bpb->nFats * FatSz) + RootDirSectors);
+		part.TotSec = TotSec;
+		part.FatSz = FatSz;
+		part.RootDirSectors = RootDirSectors;
+		part.bpb = bpb;
+		if (!InitializeFatTable(part))
+			return false;
+		// Directories are read the first time they're looked up or iterated over, see LoadDirectory.
+		part.root = new cacheEntry{};
+		part.root->path = new char[1]{};
+		part.root->fileAttributes = driverInterface::FILE_ATTRIBUTES_DIRECTORY;
+		part.root->firstCluster = ebpb.rootDirectoryCluster;
+		part.root->owner = &part;
+		part.lock = new locks::Mutex{};
 		return true;
 	}
 	static bool InitializeCacheForPartition(const vfs::DriveHandle& handle, partition& part, generic_bpb* bpb)
@@ -322,16 +469,23 @@ namespace fatDriver
 		case fatType::FAT16:
 			break;
 		}
+		if (!ret)
+			FreeFatTable(part);
 		if (ret)
 		{
 			// FIXME: part.owner.*id is always zero.
 			part.bpb = bpb;
 			g_partitions.push_back(part);
-			auto& owner = g_partitions[g_partitions.length() - 1];
-			for (auto node = owner.head; node;)
+			// The vector might've moved the other partitions, so update all of them.
+			for (size_t i = 0; i < g_partitions.length(); i++)
 			{
-				node->owner = &owner;
-				node = node->next;
+				auto& owner = g_partitions[i];
+				owner.root->owner = &owner;
+				for (auto node = owner.head; node;)
+				{
+					node->owner = &owner;
+					node = node->next;
+				}
 			}
 			partitionIdPair p;
 			utils::memzero(&p, sizeof(p));
@@ -343,7 +497,7 @@ namespace fatDriver
 	}
 	void ProbeDrives()
 	{	
-		vfs::DriveHandle drvHandle, partHandle;
+		vfs::DriveHandle drvHandle;
 		for (vfs::DriveIterator iter; iter; )
 		{
 			// Loop over the drive's partitions.
@@ -358,22 +512,25 @@ namespace fatDriver
 			{
 				char* partPath = new char[logger::sprintf(nullptr, "%*sP%d:/", dPath.length(), dPath.data(), part)];
 				logger::sprintf(partPath, "%*sP%d:/", dPath.length(), dPath.data(), part);
-				partHandle.OpenDrive(partPath);
+				// The handle is kept by the partition if it has a FAT filesystem, as the FAT and the files' clusters are read lazily.
+				vfs::DriveHandle* partHandle = new vfs::DriveHandle{};
+				partHandle->OpenDrive(partPath);
 				logger::log("FAT Driver: Probing partition at %s.\n", partPath);
 				delete[] partPath;
 				generic_bpb* bpb = nullptr;
-				if (Probe(partHandle, &bpb))
+				bool keepHandle = false;
+				if (Probe(*partHandle, &bpb))
 				{
 					partition _part;
 					utils::memzero(&_part, sizeof(_part));
-					_part.driveId = partHandle.GetDriveId();
-					_part.partitionId = partHandle.GetPartitionId();
+					_part.driveId = partHandle->GetDriveId();
+					_part.partitionId = partHandle->GetPartitionId();
 					_part.fat_type = GetFatType(bpb);
 					logger::log("FAT Driver: Partition at D%dP%d:/ contains a FAT%d filesystem (we hope). Initializing cache for partition.\n", 
 						_part.driveId,
 						_part.partitionId, 
 						_part.fat_type);
-					vfs::PartitionEntry* entry = (vfs::PartitionEntry*)partHandle.GetNode();
+					vfs::PartitionEntry* entry = (vfs::PartitionEntry*)partHandle->GetNode();
 					entry->filesystemDriver = (driverInterface::driverIdentity*)thread::GetCurrentCpuLocalPtr()->currentThread->driverIdentity;
 					switch (_part.fat_type)
 					{
@@ -389,11 +546,32 @@ namespace fatDriver
 					default:
 						break;
 					}
-					InitializeCacheForPartition(partHandle, _part, bpb);
+					_part.drive = partHandle;
+#if defined(__x86_64__) || defined(_WIN64)
+					// Measure how long setting up the partition takes, and how much memory it takes, as both used to grow with the volume's file count.
+					memory::PhysicalMemoryStatistics statsBefore{}, statsAfter{};
+					memory::GetPhysicalMemoryStatistics(&statsBefore);
+					uint64_t start = rdtsc();
+#endif
+					keepHandle = InitializeCacheForPartition(*partHandle, _part, bpb);
+#if defined(__x86_64__) || defined(_WIN64)
+					uint64_t time = rdtsc() - start;
+					memory::GetPhysicalMemoryStatistics(&statsAfter);
+					logger::log("FAT Driver: Initialized the cache for D%dP%d:/ in %ld cycles. Physical pages used: %ld before, %ld after.\n",
+						_part.driveId,
+						_part.partitionId,
+						time,
+						statsBefore.usedPages,
+						statsAfter.usedPages);
+#endif
 					// Don't free the bpb, it's used in the cache entries.
 					//delete bpb;
 				}
-				partHandle.Close();
+				if (!keepHandle)
+				{
+					partHandle->Close();
+					delete partHandle;
+				}
 			}
 			drvHandle.Close();
 		}
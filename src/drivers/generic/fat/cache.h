@@ -11,8 +11,26 @@
 #include <utils/vector.h>
 #include <utils/pair.h>
 
+#include "fatTable.h"
+#include "pathIndex.h"
+
+// How many cache entries a partition can hold before the least recently used directories are unloaded.
+#define FAT_MAX_CACHED_ENTRIES 16384
+
 #define fat32FirstSectorOfCluster(cluster, bpb, first_data_sector) (uint32_t)((((cluster) - 2) * (bpb).sectorsPerCluster) + (first_data_sector))
 
+namespace obos
+{
+	namespace vfs
+	{
+		class DriveHandle;
+	}
+	namespace locks
+	{
+		class Mutex;
+	}
+}
+
 namespace fatDriver
 {
 	struct cacheEntry
@@ -20,9 +38,27 @@ namespace fatDriver
 		char* path = nullptr;
 		uint8_t fileAttributes = 0; // See obos::driverInterface::fileAttributes
 		size_t filesize = 0; // Shouldn't ever pass 0xffffffff because well, FAT32.
-		obos::utils::Vector<uint64_t> clusters; // Must be in growing order.
+		uint32_t firstCluster = 0; // Zero if the file is empty.
+		// The file's cluster chain. Built from the FAT the first time it's needed, see GetFileExtents.
+		obos::utils::Vector<clusterExtent> extents;
+		bool extentsLoaded = false;
 		struct partition* owner = nullptr;
 		cacheEntry *next, *prev;
+		// The directory the entry is in, and the entry's siblings in that directory.
+		cacheEntry* parent = nullptr;
+		cacheEntry *firstChild = nullptr, *nextSibling = nullptr;
+		// Whether the directory's entries were read from the disk.
+		bool childrenLoaded = false;
+		// While non-zero, the entry (and therefore its parents) can't be evicted. See PinEntry.
+		size_t refs = 0;
+		// The refs of the entry and of everything under it.
+		size_t subtreeRefs = 0;
+		// The entry's place in the partition's list of evictable directories, see partition::lruHead.
+		cacheEntry *lruNext = nullptr, *lruPrev = nullptr;
+		bool onLRU = false;
+		// The next entry in the path index's bucket.
+		cacheEntry* hashNext = nullptr;
+		size_t pathHash = 0;
 	};
 	enum class fatType
 	{
@@ -39,6 +75,18 @@ namespace fatDriver
 		cacheEntry *head = nullptr,
                    *tail = nullptr;
 		::size_t nCacheEntries = 0;
+		pathIndex index;
+		// The root directory. It's not in the entry list, and is never evicted.
+		cacheEntry* root = nullptr;
+		// Protects the entries and the index.
+		obos::locks::Mutex* lock = nullptr;
+		// The loaded directories with children and no pinned entries under them, which are the ones that can be evicted.
+		// The most recently used directory is at the head. The root is never in the list.
+		cacheEntry *lruHead = nullptr,
+		           *lruTail = nullptr;
+		::size_t nEvictable = 0;
+		// Entries aren't evicted while there are file iterators on the partition, as they walk the entry list.
+		::size_t nIterators = 0;
 		uint32_t FatSz = 0;
 		uint32_t RootDirSectors = 0;
 		uint32_t TotSec = 0;
@@ -46,6 +94,9 @@ namespace fatDriver
 		uint32_t FirstDataSec = 0;
 		uint32_t ClusterCount = 0;
 		struct generic_bpb* bpb;
+		// Kept open for as long as the partition is mounted.
+		obos::vfs::DriveHandle* drive = nullptr;
+		fatTable* fat = nullptr;
 	};
 	bool operator==(const partition& first, const partition& second);
 	extern obos::utils::Vector<partition> g_partitions;
@@ -53,4 +104,15 @@ namespace fatDriver
 	extern obos::utils::Hashmap<partitionIdPair, ::size_t> g_partitionToIndex;
 
 	void ProbeDrives();
+	// The following functions expect the partition's lock to be held.
+
+	// Reads a directory's entries into the cache, if they weren't already.
+	bool LoadDirectory(partition& part, cacheEntry* directory);
+	// Finds a file's cache entry, reading the directories on its path if needed.
+	cacheEntry* LookupPath(partition& part, const char* path);
+	// Unloads the least recently used directories until the partition's cache is within FAT_MAX_CACHED_ENTRIES.
+	void EvictColdDirectories(partition& part);
+	// Keeps an entry, and the directories it's in, from being evicted until UnpinEntry is called.
+	void PinEntry(partition& part, cacheEntry* entry);
+	void UnpinEntry(partition& part, cacheEntry* entry);
 }
\ No newline at end of file
@@ -0,0 +1,188 @@
+/*
+	drivers/generic/fat/fatTable.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <klog.h>
+#include <utils/vector.h>
+
+#include <vfs/devManip/driveHandle.h>
+
+#include "cache.h"
+#include "fatTable.h"
+#include "fat_structs.h"
+
+using namespace obos;
+
+// The cluster numbers at or above this end a chain.
+#define FAT32_END_OF_CHAIN 0x0FFFFFF8
+#define FAT32_BAD_CLUSTER 0x0FFFFFF7
+#define FAT32_CLUSTER_MASK 0x0FFFFFFF
+
+namespace fatDriver
+{
+	bool InitializeFatTable(partition& part)
+	{
+		if (!part.drive || !part.bpb || !part.bpb->bytesPerSector || FAT_TABLE_PAGE_SIZE % part.bpb->bytesPerSector)
+			return false;
+		fatTable* table = new fatTable{};
+		table->firstSector = part.bpb->nResvSectors;
+		table->nSectors = part.FatSz;
+		table->bytesPerSector = part.bpb->bytesPerSector;
+		// Only the entries of the data clusters are needed, which can be less than the whole FAT.
+		size_t nEntries = (size_t)part.ClusterCount + 2;
+		size_t fatEntries = (size_t)part.FatSz * part.bpb->bytesPerSector / sizeof(uint32_t);
+		if (nEntries > fatEntries)
+			nEntries = fatEntries;
+		const size_t entriesPerPage = FAT_TABLE_PAGE_SIZE / sizeof(uint32_t);
+		table->nPages = (nEntries + entriesPerPage - 1) / entriesPerPage;
+		table->pages = new uint32_t*[table->nPages]{};
+		part.fat = table;
+		return true;
+	}
+	void FreeFatTable(partition& part)
+	{
+		fatTable* table = part.fat;
+		if (!table)
+			return;
+		for (size_t i = 0; i < table->nPages; i++)
+			delete[] table->pages[i];
+		delete[] table->pages;
+		delete table;
+		part.fat = nullptr;
+	}
+	// Returns the FAT entry of a cluster. Expects the table to be locked.
+	static bool readEntry(partition& part, uint32_t cluster, uint32_t* entry)
+	{
+		fatTable* table = part.fat;
+		const size_t entriesPerPage = FAT_TABLE_PAGE_SIZE / sizeof(uint32_t);
+		const size_t pageIndex = cluster / entriesPerPage;
+		if (pageIndex >= table->nPages)
+			return false;
+		uint32_t*& page = table->pages[pageIndex];
+		if (!page)
+		{
+			const uint32_t sectorsPerPage = FAT_TABLE_PAGE_SIZE / table->bytesPerSector;
+			const uint32_t sector = pageIndex * sectorsPerPage;
+			uint32_t nSectors = sectorsPerPage;
+			if (sector + nSectors > table->nSectors)
+				nSectors = table->nSectors - sector;
+			uint32_t* newPage = new uint32_t[entriesPerPage]{};
+			if (!part.drive->ReadSectors(newPage, nullptr, table->firstSector + sector, nSectors))
+			{
+				delete[] newPage;
+				return false;
+			}
+			page = newPage;
+		}
+		*entry = page[cluster % entriesPerPage] & FAT32_CLUSTER_MASK;
+		return true;
+	}
+	// Follows the chain one cluster. Expects the table to be locked.
+	static bool nextCluster(partition& part, uint32_t cluster, uint32_t* next)
+	{
+		uint32_t entry = 0;
+		if (!readEntry(part, cluster, &entry))
+			return false;
+		if (entry >= FAT32_END_OF_CHAIN)
+		{
+			*next = 0;
+			return true;
+		}
+		// Free or bad clusters, or clusters outside of the partition, can't be part of a chain.
+		if (entry < 2 || entry == FAT32_BAD_CLUSTER || entry > part.ClusterCount + 1)
+			return false;
+		*next = entry;
+		return true;
+	}
+	bool GetNextCluster(partition& part, uint32_t cluster, uint32_t* next)
+	{
+		if (!part.fat || !next)
+			return false;
+		part.fat->lock.Lock();
+		bool ret = nextCluster(part, cluster, next);
+		part.fat->lock.Unlock();
+		return ret;
+	}
+	// Expects the table to be locked.
+	static bool buildExtents(partition& part, uint32_t firstCluster, utils::Vector<clusterExtent>& extents)
+	{
+		extents.clear();
+		if (!firstCluster)
+			return true; // An empty file.
+		if (firstCluster < 2 || firstCluster > part.ClusterCount + 1)
+			return false;
+		uint32_t fileCluster = 0;
+		clusterExtent current{ 0, firstCluster, 1 };
+		// A chain can't be longer than the partition, so anything longer loops.
+		for (uint32_t cluster = firstCluster; ; fileCluster++)
+		{
+			if (fileCluster > part.ClusterCount)
+			{
+				logger::warning("FAT Driver: The cluster chain starting at cluster %d loops.\n", firstCluster);
+				return false;
+			}
+			uint32_t next = 0;
+			if (!nextCluster(part, cluster, &next))
+				return false;
+			if (!next)
+				break;
+			if (next == current.diskCluster + current.nClusters)
+				current.nClusters++;
+			else
+			{
+				extents.push_back(current);
+				current = { fileCluster + 1, next, 1 };
+			}
+			cluster = next;
+		}
+		extents.push_back(current);
+		return true;
+	}
+	bool BuildExtents(partition& part, uint32_t firstCluster, utils::Vector<clusterExtent>& extents)
+	{
+		if (!part.fat)
+			return false;
+		part.fat->lock.Lock();
+		bool ret = buildExtents(part, firstCluster, extents);
+		part.fat->lock.Unlock();
+		return ret;
+	}
+	const utils::Vector<clusterExtent>* GetFileExtents(cacheEntry* entry)
+	{
+		partition& part = *entry->owner;
+		if (!part.fat)
+			return nullptr;
+		part.fat->lock.Lock();
+		bool ret = entry->extentsLoaded;
+		if (!ret)
+			ret = entry->extentsLoaded = buildExtents(part, entry->firstCluster, entry->extents);
+		part.fat->lock.Unlock();
+		return ret ? &entry->extents : nullptr;
+	}
+	const clusterExtent* FindExtent(const utils::Vector<clusterExtent>& extents, uint32_t fileCluster)
+	{
+		size_t low = 0, high = extents.length();
+		while (low < high)
+		{
+			size_t mid = low + (high - low) / 2;
+			const clusterExtent& extent = extents[mid];
+			if (fileCluster < extent.fileCluster)
+				high = mid;
+			else if (fileCluster >= extent.fileCluster + extent.nClusters)
+				low = mid + 1;
+			else
+				return &extent;
+		}
+		return nullptr;
+	}
+	size_t CountClusters(const utils::Vector<clusterExtent>& extents)
+	{
+		if (!extents.length())
+			return 0;
+		const clusterExtent& last = extents[extents.length() - 1];
+		return (size_t)last.fileCluster + last.nClusters;
+	}
+}
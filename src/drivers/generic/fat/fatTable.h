@@ -0,0 +1,57 @@
+/*
+	drivers/generic/fat/fatTable.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <utils/vector.h>
+
+#include <multitasking/locks/mutex.h>
+
+// The size of a page of the cached FAT, in bytes.
+#define FAT_TABLE_PAGE_SIZE 4096
+
+namespace fatDriver
+{
+	struct partition;
+	struct cacheEntry;
+	// A run of a file's clusters that are contiguous on disk.
+	struct clusterExtent
+	{
+		// The index in the file of the run's first cluster.
+		uint32_t fileCluster;
+		uint32_t diskCluster;
+		uint32_t nClusters;
+	};
+	// A partition's FAT, read from the drive a page at a time, as it's needed.
+	struct fatTable
+	{
+		// The FAT's first sector, relative to the partition.
+		uint32_t firstSector = 0;
+		uint32_t nSectors = 0;
+		uint32_t bytesPerSector = 0;
+		// The pages of the FAT, or nullptr for pages that weren't read yet.
+		uint32_t** pages = nullptr;
+		size_t nPages = 0;
+		// Protects the pages, and the extents of the partition's files.
+		obos::locks::Mutex lock;
+	};
+
+	// Sets up the partition's FAT cache. None of the FAT is read until it's used.
+	bool InitializeFatTable(partition& part);
+	void FreeFatTable(partition& part);
+	// Follows the cluster chain one cluster. Sets *next to zero at the end of the chain.
+	// Returns false if the FAT couldn't be read, or the chain is corrupted.
+	bool GetNextCluster(partition& part, uint32_t cluster, uint32_t* next);
+	// Walks the cluster chain starting at firstCluster, merging contiguous clusters into extents.
+	bool BuildExtents(partition& part, uint32_t firstCluster, obos::utils::Vector<clusterExtent>& extents);
+	// Returns the file's extents, building them the first time. Returns nullptr if the cluster chain couldn't be read.
+	const obos::utils::Vector<clusterExtent>* GetFileExtents(cacheEntry* entry);
+	// Finds the extent that holds a cluster of a file, with a binary search. Returns nullptr if the file is shorter than that.
+	const clusterExtent* FindExtent(const obos::utils::Vector<clusterExtent>& extents, uint32_t fileCluster);
+	// Returns the amount of clusters in the extents.
+	size_t CountClusters(const obos::utils::Vector<clusterExtent>& extents);
+}
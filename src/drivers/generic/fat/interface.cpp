@@ -12,24 +12,21 @@
 
 #include <driverInterface/struct.h>
 
+#include <multitasking/locks/mutex.h>
+
 #include "cache.h"
 #include "fat_structs.h"
 
 using namespace obos;
 
-namespace obos
-{
-	namespace vfs
-	{
-		OBOS_EXPORT void dividePathToTokens(const char* filepath, const char**& tokens, size_t& nTokens, bool useOffset = true);
-	}
-}
-
 namespace fatDriver
 {
 	struct fileIterator
 	{
 		cacheEntry* currentNode;
+		partition* part;
+		// Set if the iterator only goes over the files directly in a directory.
+		bool directoryOnly;
 		fileIterator* next, *prev; // The next file iterator in the file iterator list.
 	};
 	struct
@@ -37,49 +34,6 @@ namespace fatDriver
 		fileIterator *head, *tail;
 		size_t size;
 	} g_iterators;
-	static bool pathStrcmp(const char* p1, const char* p2)
-	{
-		for (; *p1 == '/'; p1++);
-		for (; *p2 == '/'; p2++);
-		const char** p1Tok = nullptr;
-		size_t nP1Tok = 0;
-		const char** p2Tok = nullptr;
-		size_t nP2Tok = 0;
-		vfs::dividePathToTokens(p1, p1Tok, nP1Tok, false);
-		vfs::dividePathToTokens(p2, p2Tok, nP2Tok, false);
-		bool ret = true;
-		if (nP1Tok != nP2Tok)
-		{
-			ret = false;
-			goto finish;
-		}
-		for (size_t i = 0; i < nP1Tok; i++)
-		{
-			if (!utils::strcmp(p1Tok[i], p2Tok[i]))
-			{
-				ret = false;
-				goto finish;
-			}
-		}
-		finish:
-		for (size_t i = 0; i < nP1Tok; i++)
-			delete[] p1Tok[i];
-		for (size_t i = 0; i < nP2Tok; i++)
-			delete[] p2Tok[i];
-		delete[] p1Tok;
-		delete[] p2Tok;
-		return ret;
-	}
-	static cacheEntry* FindCacheEntry(partition& part, const char* path)
-	{
-		for (auto* ret = part.head; ret; )
-		{
-			if (pathStrcmp(ret->path, path))
-				return ret;
-			ret = ret->next;
-		}
-		return nullptr;
-	}
 	bool QueryFileProperties(
 		const char* path,
 		uint32_t driveId, uint32_t partitionIdOnDrive,
@@ -93,19 +47,13 @@ namespace fatDriver
 		if (!g_partitionToIndex.contains(p))
 			return false;
 		auto& partition = g_partitions[g_partitionToIndex.at(p)];
-		auto entry = FindCacheEntry(partition, path);
-		if (!entry)
-		{
-			if (oFAttribs)
-				*oFAttribs = driverInterface::FILE_DOESNT_EXIST;
-			if (oFsizeBytes)
-				*oFsizeBytes = 0;
-			return true;
-		}
+		partition.lock->Lock();
+		auto entry = LookupPath(partition, path);
 		if (oFAttribs)
-			*oFAttribs = (driverInterface::fileAttributes)entry->fileAttributes;
+			*oFAttribs = entry ? (driverInterface::fileAttributes)entry->fileAttributes : driverInterface::FILE_DOESNT_EXIST;
 		if (oFsizeBytes)
-			*oFsizeBytes = entry->filesize;
+			*oFsizeBytes = entry ? entry->filesize : 0;
+		partition.lock->Unlock();
 		return true;
 	}
 	bool FileIteratorCreate(
@@ -119,8 +67,18 @@ namespace fatDriver
 		if (!g_partitionToIndex.contains(p))
 			return false;
 		auto& partition = g_partitions[g_partitionToIndex.at(p)];
-		fileIterator* newIter = new fileIterator;
+		partition.lock->Lock();
+		// The root directory's entries are the first in the list, and the rest are read as the iterator reaches their directory.
+		if (!LoadDirectory(partition, partition.root))
+		{
+			partition.lock->Unlock();
+			return false;
+		}
+		fileIterator* newIter = new fileIterator{};
 		newIter->currentNode = partition.head;
+		newIter->part = &partition;
+		partition.nIterators++;
+		partition.lock->Unlock();
 		if (g_iterators.tail)
 			g_iterators.tail->next = newIter;
 		if (!g_iterators.head)
@@ -167,6 +125,44 @@ namespace fatDriver
 		*oIter = (uintptr_t)newIter;
 		return true;
 	}
+	bool DirectoryIteratorCreate(
+		uint32_t driveId, uint32_t partitionIdOnDrive,
+		const char* path,
+		uintptr_t* oIter)
+	{
+		partitionIdPair p;
+		utils::memzero(&p, sizeof(p));
+		p.first = driveId;
+		p.second = partitionIdOnDrive;
+		if (!g_partitionToIndex.contains(p) || !path || !oIter)
+			return false;
+		auto& partition = g_partitions[g_partitionToIndex.at(p)];
+		partition.lock->Lock();
+		const char* iter = path;
+		for (; *iter == '/'; iter++);
+		cacheEntry* directory = *iter ? LookupPath(partition, path) : partition.root;
+		if (!directory || !LoadDirectory(partition, directory))
+		{
+			partition.lock->Unlock();
+			return false;
+		}
+		fileIterator* newIter = new fileIterator{};
+		newIter->currentNode = directory->firstChild;
+		newIter->part = &partition;
+		newIter->directoryOnly = true;
+		// Keeps the directory's entries from being evicted while they're iterated over.
+		partition.nIterators++;
+		partition.lock->Unlock();
+		if (g_iterators.tail)
+			g_iterators.tail->next = newIter;
+		if (!g_iterators.head)
+			g_iterators.head = newIter;
+		newIter->prev = g_iterators.tail;
+		g_iterators.tail = newIter;
+		g_iterators.size++;
+		*oIter = (uintptr_t)newIter;
+		return true;
+	}
 	bool FileIteratorNext(
 		uintptr_t _iter,
 		const char** oFilepath,
@@ -193,15 +189,23 @@ namespace fatDriver
 				*oFsizeBytes = 0;
 			return true;
 		}
-		bool ret = QueryFileProperties(iter->currentNode->path, iter->currentNode->owner->driveId, iter->currentNode->owner->partitionId, oFsizeBytes, oFAttribs);
-		if (!ret)
-			return false;
-		size_t szFilepath = obos::utils::strlen(iter->currentNode->path);
+		partition& part = *iter->part;
+		part.lock->Lock();
+		cacheEntry* node = iter->currentNode;
+		// Read the directory's entries so they're appended to the list, and the iterator reaches them later.
+		if (!iter->directoryOnly && (node->fileAttributes & driverInterface::FILE_ATTRIBUTES_DIRECTORY))
+			LoadDirectory(part, node);
+		if (oFAttribs)
+			*oFAttribs = (driverInterface::fileAttributes)node->fileAttributes;
+		if (oFsizeBytes)
+			*oFsizeBytes = node->filesize;
+		size_t szFilepath = obos::utils::strlen(node->path);
 		if (oFilepath)
-			*oFilepath = (const char*)obos::utils::memcpy(kcalloc(szFilepath + 1, 1), iter->currentNode->path, szFilepath);
+			*oFilepath = (const char*)obos::utils::memcpy(kcalloc(szFilepath + 1, 1), node->path, szFilepath);
 		if (freeFunction)
 			*freeFunction = kfree;
-		iter->currentNode = iter->currentNode->next;
+		iter->currentNode = iter->directoryOnly ? node->nextSibling : node->next;
+		part.lock->Unlock();
 		return true;
 	}
 	bool FileIteratorClose(uintptr_t _iter)
@@ -225,6 +229,9 @@ namespace fatDriver
 		if (g_iterators.tail == iter)
 			g_iterators.tail = iter->prev;
 		g_iterators.size--;
+		iter->part->lock->Lock();
+		iter->part->nIterators--;
+		iter->part->lock->Unlock();
 		kfree(iter);
 		return true;
 	}
@@ -242,51 +249,82 @@ namespace fatDriver
 		if (!g_partitionToIndex.contains(p))
 			return false;
 		auto& partition = g_partitions[g_partitionToIndex.at(p)];
-		auto entry = FindCacheEntry(partition, path);
-		if (!entry)
-			return false;
-		if (nToSkip >= entry->filesize)
-			return false;
-		if ((nToSkip + nToRead) > entry->filesize)
+		if (partition.fat_type != fatType::FAT32)
+			return false; // TODO: Implement FAT12 and FAT16
+		partition.lock->Lock();
+		auto entry = LookupPath(partition, path);
+		if (!entry || nToSkip >= entry->filesize || (nToSkip + nToRead) > entry->filesize)
+		{
+			partition.lock->Unlock();
 			return false;
+		}
+		// Keep the entry from being evicted while it's read.
+		PinEntry(partition, entry);
+		partition.lock->Unlock();
 		auto bpb = partition.bpb;
-		// Read the appropriate clusters.
-		size_t bytesPerCluster = ((size_t)bpb->sectorsPerCluster * bpb->bytesPerSector);
-		size_t nClusters = nToRead / bytesPerCluster + ((nToRead % bytesPerCluster) != 0);
-		uint32_t clusterIndex = nToSkip / bytesPerCluster;
-		vfs::DriveHandle drv;
-		size_t drvPathSz = logger::sprintf(nullptr, "D%dP%d:/", driveId, partitionIdOnDrive) + 1;
-		char* drvPath = new char[drvPathSz];
-		utils::memzero(drvPath, drvPathSz);
-		logger::sprintf(drvPath, "D%dP%d:/", driveId, partitionIdOnDrive);
-		drv.OpenDrive(drvPath);
-		delete[] drvPath;
-		size_t sectorSize = 0;
-		drv.QueryInfo(nullptr, &sectorSize, nullptr);
-		char* fbuffer = new char[bytesPerCluster * nClusters];
-		switch (partition.fat_type)
+		const auto* extents = GetFileExtents(entry);
+		if (!extents)
 		{
-		case fatType::FAT32:
+			partition.lock->Lock();
+			UnpinEntry(partition, entry);
+			partition.lock->Unlock();
+			return false;
+		}
+		const size_t bytesPerSector = bpb->bytesPerSector;
+		const size_t bytesPerCluster = (size_t)bpb->sectorsPerCluster * bytesPerSector;
+		// Holds sectors the caller only wants part of.
+		byte* partialSector = nullptr;
+		bool ret = true;
+		while (nToRead)
 		{
-			char* currentCluster = fbuffer;
-			for (size_t i = clusterIndex; i < nClusters; i++, currentCluster += bytesPerCluster)
+			const clusterExtent* extent = FindExtent(*extents, nToSkip / bytesPerCluster);
+			if (!extent)
+			{
+				ret = false;
+				break;
+			}
+			// Everything until the end of the extent is contiguous on disk, so it can be read at once.
+			const size_t offsetInExtent = nToSkip - (size_t)extent->fileCluster * bytesPerCluster;
+			size_t nContiguous = (size_t)extent->nClusters * bytesPerCluster - offsetInExtent;
+			if (nContiguous > nToRead)
+				nContiguous = nToRead;
+			const uint64_t lba = fat32FirstSectorOfCluster(extent->diskCluster, *bpb, partition.FirstDataSec) + offsetInExtent / bytesPerSector;
+			const size_t offsetInSector = offsetInExtent % bytesPerSector;
+			size_t nCopied = 0;
+			if (offsetInSector || nContiguous < bytesPerSector)
 			{
-				uint64_t sector = fat32FirstSectorOfCluster(entry->clusters[i], *bpb, partition.FirstDataSec);
-				if (!drv.ReadSectors(currentCluster, nullptr, sector, bpb->sectorsPerCluster))
+				// The head or the tail of the read, which goes through the drive's buffer cache.
+				if (!partialSector)
+					partialSector = new byte[bytesPerSector];
+				if (!partition.drive->ReadSectors(partialSector, nullptr, lba, 1))
 				{
-					delete[] currentCluster;
-					return false;
+					ret = false;
+					break;
 				}
+				nCopied = bytesPerSector - offsetInSector;
+				if (nCopied > nContiguous)
+					nCopied = nContiguous;
+				utils::memcpy(buff, partialSector + offsetInSector, nCopied);
 			}
-			break;
-		}
-		// TODO: Implement FAT12 and FAT16
-		default:
-			break;
+			else
+			{
+				// Whole sectors are read straight into the caller's buffer.
+				const size_t nSectors = nContiguous / bytesPerSector;
+				if (!partition.drive->ReadSectors(buff, nullptr, lba, nSectors))
+				{
+					ret = false;
+					break;
+				}
+				nCopied = nSectors * bytesPerSector;
+			}
+			buff += nCopied;
+			nToSkip += nCopied;
+			nToRead -= nCopied;
 		}
-		vfs::uoff_t initialBufferOffset = (nToSkip % bytesPerCluster);
-		size_t nToCopy = nToRead;
-		utils::memcpy(buff, fbuffer + initialBufferOffset, nToCopy);
-		return true;
+		delete[] partialSector;
+		partition.lock->Lock();
+		UnpinEntry(partition, entry);
+		partition.lock->Unlock();
+		return ret;
 	}
 }
\ No newline at end of file
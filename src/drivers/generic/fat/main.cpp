@@ -33,6 +33,10 @@ namespace fatDriver
 	bool FileIteratorCreate(
 		uint32_t driveId, uint32_t partitionIdOnDrive,
 		uintptr_t* oIter);
+	bool DirectoryIteratorCreate(
+		uint32_t driveId, uint32_t partitionIdOnDrive,
+		const char* path,
+		uintptr_t* oIter);
 	bool FileIteratorNext(
 		uintptr_t iter,
 		const char** oFilepath,
@@ -63,7 +67,8 @@ driverInterface::driverHeader DEFINE_IN_SECTION g_driverHeader = {
 				.FileIteratorNext = fatDriver::FileIteratorNext,
 				.FileIteratorClose = fatDriver::FileIteratorClose,
 				.ReadFile = fatDriver::ReadFile,
-				.unused = { nullptr,nullptr,nullptr,nullptr }
+				.DirectoryIteratorCreate = fatDriver::DirectoryIteratorCreate,
+				.unused = { nullptr,nullptr,nullptr }
 			}
 		}
 	}
@@ -0,0 +1,106 @@
+/*
+	drivers/generic/fat/pathIndex.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+
+#include "cache.h"
+#include "pathIndex.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325
+#define FNV_PRIME 0x100000001b3
+#define INITIAL_BUCKET_COUNT 64
+
+namespace fatDriver
+{
+	size_t HashPath(const char* path)
+	{
+		size_t hash = FNV_OFFSET_BASIS;
+		bool first = true;
+		while (*path)
+		{
+			for (; *path == '/'; path++);
+			if (!*path)
+				break;
+			// Separate the components, so "a/bc" and "ab/c" hash differently.
+			if (!first)
+				hash = (hash ^ '/') * FNV_PRIME;
+			first = false;
+			for (; *path && *path != '/'; path++)
+				hash = (hash ^ (byte)*path) * FNV_PRIME;
+		}
+		return hash;
+	}
+	bool PathsEqual(const char* p1, const char* p2)
+	{
+		while (true)
+		{
+			for (; *p1 == '/'; p1++);
+			for (; *p2 == '/'; p2++);
+			if (!*p1 || !*p2)
+				return !*p1 && !*p2;
+			for (; *p1 && *p1 != '/' && *p1 == *p2; p1++, p2++);
+			// Both components must have ended at the same place.
+			if ((*p1 && *p1 != '/') || (*p2 && *p2 != '/'))
+				return false;
+		}
+	}
+	static void rehash(pathIndex& index, size_t nBuckets)
+	{
+		cacheEntry** buckets = new cacheEntry*[nBuckets]{};
+		for (size_t i = 0; i < index.nBuckets; i++)
+		{
+			for (cacheEntry* entry = index.buckets[i]; entry; )
+			{
+				cacheEntry* next = entry->hashNext;
+				cacheEntry*& bucket = buckets[entry->pathHash % nBuckets];
+				entry->hashNext = bucket;
+				bucket = entry;
+				entry = next;
+			}
+		}
+		delete[] index.buckets;
+		index.buckets = buckets;
+		index.nBuckets = nBuckets;
+	}
+	void PathIndexInsert(partition& part, cacheEntry* entry)
+	{
+		pathIndex& index = part.index;
+		// Keep the load factor at or below one.
+		if (index.nEntries + 1 > index.nBuckets)
+			rehash(index, index.nBuckets ? index.nBuckets * 2 : INITIAL_BUCKET_COUNT);
+		entry->pathHash = HashPath(entry->path);
+		cacheEntry*& bucket = index.buckets[entry->pathHash % index.nBuckets];
+		entry->hashNext = bucket;
+		bucket = entry;
+		index.nEntries++;
+	}
+	void PathIndexRemove(partition& part, cacheEntry* entry)
+	{
+		pathIndex& index = part.index;
+		if (!index.nBuckets)
+			return;
+		for (cacheEntry** node = &index.buckets[entry->pathHash % index.nBuckets]; *node; node = &(*node)->hashNext)
+		{
+			if (*node != entry)
+				continue;
+			*node = entry->hashNext;
+			entry->hashNext = nullptr;
+			index.nEntries--;
+			return;
+		}
+	}
+	cacheEntry* PathIndexLookup(const partition& part, const char* path)
+	{
+		const pathIndex& index = part.index;
+		if (!index.nBuckets)
+			return nullptr;
+		size_t hash = HashPath(path);
+		for (cacheEntry* entry = index.buckets[hash % index.nBuckets]; entry; entry = entry->hashNext)
+			if (entry->pathHash == hash && PathsEqual(entry->path, path))
+				return entry;
+		return nullptr;
+	}
+}
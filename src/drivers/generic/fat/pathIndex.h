@@ -0,0 +1,31 @@
+/*
+	drivers/generic/fat/pathIndex.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+namespace fatDriver
+{
+	struct partition;
+	struct cacheEntry;
+	// A hash table of a partition's cache entries, keyed on their path.
+	// The entries are chained through cacheEntry::hashNext, so lookups never allocate.
+	struct pathIndex
+	{
+		cacheEntry** buckets;
+		size_t nBuckets;
+		size_t nEntries;
+	};
+
+	// Hashes a path's components, ignoring leading, trailing, and repeated slashes.
+	size_t HashPath(const char* path);
+	// Compares two paths component by component, ignoring leading, trailing, and repeated slashes.
+	bool PathsEqual(const char* p1, const char* p2);
+	void PathIndexInsert(partition& part, cacheEntry* entry);
+	void PathIndexRemove(partition& part, cacheEntry* entry);
+	cacheEntry* PathIndexLookup(const partition& part, const char* path);
+}
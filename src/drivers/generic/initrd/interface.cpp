@@ -20,6 +20,34 @@ struct
 	size_t size;
 } g_iterators;
 
+// Returns whether the path is directly in the directory. Trailing slashes are ignored.
+static bool isInDirectory(const char* path, const char* directory, size_t directoryLen)
+{
+	size_t len = obos::utils::strlen(path);
+	for (; len && path[len - 1] == '/'; len--);
+	if (directoryLen)
+	{
+		if (len <= directoryLen + 1 || !obos::utils::memcmp(path, directory, directoryLen) || path[directoryLen] != '/')
+			return false;
+		path += directoryLen + 1;
+		len -= directoryLen + 1;
+	}
+	if (!len)
+		return false;
+	for (size_t i = 0; i < len; i++)
+		if (path[i] == '/')
+			return false;
+	return true;
+}
+// Skips the files the iterator doesn't go over.
+static void skipToNext(fileIterator* iter)
+{
+	if (!iter->directory)
+		return;
+	while (iter->currentNode && !isInDirectory(iter->currentNode->cache->entry->path, iter->directory, iter->directoryLen))
+		iter->currentNode = iter->currentNode->next;
+}
+
 namespace initrdInterface
 {
 	bool QueryFileProperties(
@@ -60,6 +88,24 @@ namespace initrdInterface
 		*oIter = (uintptr_t)iter;
 		return true;
 	}
+	bool DirIterCreate(
+		uint32_t driveId, uint32_t partitionIdOnDrive,
+		const char* path,
+		uintptr_t* oIter)
+	{
+		if (!path)
+			return false;
+		for (; *path == '/'; path++);
+		size_t len = obos::utils::strlen(path);
+		for (; len && path[len - 1] == '/'; len--);
+		if (!IterCreate(driveId, partitionIdOnDrive, oIter))
+			return false;
+		fileIterator* iter = (fileIterator*)*oIter;
+		iter->directory = (char*)obos::utils::memcpy(kcalloc(len + 1, 1), path, len);
+		iter->directoryLen = len;
+		skipToNext(iter);
+		return true;
+	}
 	bool IterNext(
 		uintptr_t _iter,
 		const char** oFilepath,
@@ -95,6 +141,7 @@ namespace initrdInterface
 		if (freeFunction)
 			*freeFunction = kfree;
 		iter->currentNode = iter->currentNode->next;
+		skipToNext(iter);
 		return true;
 	}
 	bool IterClose(uintptr_t _iter)
@@ -118,6 +165,8 @@ namespace initrdInterface
 		if (g_iterators.tail == iter)
 			g_iterators.tail = iter->prev;
 		g_iterators.size--;
+		if (iter->directory)
+			kfree(iter->directory);
 		kfree(iter);
 		return true;
 	}
@@ -20,6 +20,10 @@ namespace initrdInterface
 	bool IterCreate(
 		uint32_t driveId, uint32_t partitionIdOnDrive,
 		uintptr_t* oIter);
+	bool DirIterCreate(
+		uint32_t driveId, uint32_t partitionIdOnDrive,
+		const char* path,
+		uintptr_t* oIter);
 	bool IterNext(
 		uintptr_t iter,
 		const char** oFilepath,
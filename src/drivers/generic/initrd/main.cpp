@@ -40,7 +40,8 @@ driverInterface::driverHeader DEFINE_IN_SECTION g_driverHeader = {
 				.FileIteratorNext = initrdInterface::IterNext,
 				.FileIteratorClose = initrdInterface::IterClose,
 				.ReadFile = initrdInterface::ReadFile,
-				.unused = { nullptr,nullptr,nullptr,nullptr }
+				.DirectoryIteratorCreate = initrdInterface::DirIterCreate,
+				.unused = { nullptr,nullptr,nullptr }
 			}
 		}
 	}
@@ -52,6 +52,9 @@ struct ustarEntryCacheNode
 struct fileIterator
 {
 	ustarEntryCacheNode* currentNode;
+	// If non-null, only the files directly in this directory are iterated over.
+	char* directory;
+	size_t directoryLen;
 	fileIterator *next, *prev; // The next file iterator in the file iterator list.
 };
 struct filesystemCache
@@ -0,0 +1,221 @@
+/*
+	drivers/x86_64/nvme/interface.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <memory_manipulation.h>
+
+#include <driverInterface/struct.h>
+#include <driverInterface/blockRequest.h>
+
+#include <allocators/vmm/vmm.h>
+
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+
+#include "structs.h"
+#include "queue.h"
+
+using namespace obos;
+
+Namespace* GetNamespaceFromKernelDriveID(uint32_t id)
+{
+	for (size_t i = 0; i < g_nNamespaces; i++)
+		if (g_namespaces[i].kernelID == id)
+			return &g_namespaces[i];
+	return nullptr;
+}
+
+// Transfers nSectors sectors between the namespace and buff, on the current cpu's queue.
+// The controller reads or writes buff's pages directly, unless buff isn't dword-aligned, in which case it goes through a kernel buffer.
+static bool Transfer(Namespace* ns, bool write, uint64_t lbaOffset, size_t nSectors, byte* buff)
+{
+	const size_t size = nSectors * ns->sectorSize;
+	Request req{};
+	req.ns = ns;
+	req.write = write;
+	req.pageMap = memory::getCurrentPageMap();
+	req.lba = lbaOffset;
+	req.buff = buff;
+	req.nSectorsLeft = nSectors;
+	if ((uintptr_t)buff & 3)
+	{
+		req.bounce = new byte[size];
+		if (!req.bounce)
+			return false;
+		if (write)
+			utils::memcpy(req.bounce, buff, size);
+		req.buff = req.bounce;
+	}
+	memory::TouchBufferForDMA(req.buff, size, !write);
+	Queue* queue = GetQueue(ns->controller);
+	SubmitRequest(queue, &req);
+	bool ret = WaitForRequest(queue, &req);
+	// The copy is done here, and not on completion, as buff could be in this process' memory.
+	if (req.bounce && ret && !write)
+		utils::memcpy(buff, req.bounce, size);
+	delete[] req.bounce;
+	return ret;
+}
+
+bool DriveReadSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void** buff,
+	size_t* oNSectorsRead
+	)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(driveId);
+	if (!ns)
+		return false;
+	if ((lbaOffset + nSectorsToRead) > ns->nSectors)
+	{
+		if (oNSectorsRead)
+			*oNSectorsRead = 0;
+		return true;
+	}
+	size_t size = nSectorsToRead * ns->sectorSize;
+	memory::VirtualAllocator vallocator{ nullptr };
+	byte* response = (byte*)vallocator.VirtualAlloc(nullptr, size, memory::PROT_NO_COW_ON_ALLOCATE);
+	if (!response)
+		return false;
+	if (!Transfer(ns, false, lbaOffset, nSectorsToRead, response))
+	{
+		vallocator.VirtualFree(response, size);
+		return false;
+	}
+	if (oNSectorsRead)
+		*oNSectorsRead = nSectorsToRead;
+	if (buff)
+		*buff = response;
+	else
+		vallocator.VirtualFree(response, size);
+	return true;
+}
+bool DriveReadSectorsInto(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void* buff,
+	size_t* oNSectorsRead
+	)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(driveId);
+	if (!ns || !buff)
+		return false;
+	if ((lbaOffset + nSectorsToRead) > ns->nSectors)
+	{
+		if (oNSectorsRead)
+			*oNSectorsRead = 0;
+		return true;
+	}
+	if (!Transfer(ns, false, lbaOffset, nSectorsToRead, (byte*)buff))
+		return false;
+	if (oNSectorsRead)
+		*oNSectorsRead = nSectorsToRead;
+	return true;
+}
+bool DriveWriteSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToWrite,
+	char* buff,
+	size_t* oNSectorsWrote
+	)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(driveId);
+	if (!ns || !buff)
+		return false;
+	if ((lbaOffset + nSectorsToWrite) > ns->nSectors)
+	{
+		if (oNSectorsWrote)
+			*oNSectorsWrote = 0;
+		return true;
+	}
+	bool ret = Transfer(ns, true, lbaOffset, nSectorsToWrite, (byte*)buff);
+	if (ret && oNSectorsWrote)
+		*oNSectorsWrote = nSectorsToWrite;
+	return ret;
+}
+bool DriveSubmitRequest(driverInterface::BlockRequest* request)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(request->driveId);
+	if (!ns)
+		return false;
+	const bool write = request->operation == driverInterface::BlockRequest::OPERATION_WRITE;
+	if (!request->nSectors || (request->lbaOffset + request->nSectors) > ns->nSectors)
+	{
+		driverInterface::CompleteBlockRequest(request, driverInterface::BlockRequest::STATUS_SUCCESS, 0);
+		return true;
+	}
+	const size_t size = request->nSectors * ns->sectorSize;
+	Request* req = new Request{};
+	req->blockRequest = request;
+	req->ns = ns;
+	req->write = write;
+	req->pageMap = memory::getCurrentPageMap();
+	req->lba = request->lbaOffset;
+	req->buff = (byte*)request->buffer;
+	req->nSectorsLeft = request->nSectors;
+	if ((uintptr_t)request->buffer & 3)
+	{
+		// Reads are copied back on completion, which can be in any address space, so only kernel memory can be bounced.
+		if ((uintptr_t)request->buffer < 0xffff800000000000)
+		{
+			delete req;
+			return false;
+		}
+		req->bounce = new byte[size];
+		if (!req->bounce)
+		{
+			delete req;
+			return false;
+		}
+		req->bounceTo = (byte*)request->buffer;
+		if (write)
+			utils::memcpy(req->bounce, request->buffer, size);
+		req->buff = req->bounce;
+	}
+	memory::TouchBufferForDMA(req->buff, size, !write);
+	request->driverData = req;
+	SubmitRequest(GetQueue(ns->controller), req);
+	return true;
+}
+bool DriveCancelRequest(driverInterface::BlockRequest* request)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(request->driveId);
+	if (!ns)
+		return false;
+	// The request could've been submitted on any cpu's queue.
+	Controller* ctrl = ns->controller;
+	for (uint16_t i = 0; i < ctrl->nQueues; i++)
+		if (CancelRequest(ctrl->queues[i], request))
+			return true;
+	return false;
+}
+void DrivePoll(uint32_t driveId)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(driveId);
+	if (!ns)
+		return;
+	Controller* ctrl = ns->controller;
+	for (uint16_t i = 0; i < ctrl->nQueues; i++)
+		PollQueue(ctrl->queues[i]);
+}
+bool DriveQueryInfo(
+	uint32_t driveId,
+	uint64_t *oNSectors,
+	uint64_t *oBytesPerSector
+	)
+{
+	Namespace* ns = GetNamespaceFromKernelDriveID(driveId);
+	if (!ns)
+		return false;
+	if (oNSectors)
+		*oNSectors = ns->nSectors;
+	if (oBytesPerSector)
+		*oBytesPerSector = ns->sectorSize;
+	return true;
+}
@@ -0,0 +1,448 @@
+/*
+	drivers/x86_64/nvme/main.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <klog.h>
+#include <memory_manipulation.h>
+
+#include <driverInterface/struct.h>
+#include <driverInterface/register.h>
+
+#include <multitasking/threadAPI/thrHandle.h>
+#include <multitasking/cpu_local.h>
+
+#include <driverInterface/x86_64/enumerate_pci.h>
+
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+#include <arch/x86_64/memory_manager/physical/allocate.h>
+
+#include <allocators/vmm/arch.h>
+
+#include <x86_64-utils/asm.h>
+
+#include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/irq/irq.h>
+
+#include "structs.h"
+#include "queue.h"
+
+using namespace obos;
+
+namespace obos
+{
+	namespace memory
+	{
+		OBOS_EXPORT void* MapPhysicalAddress(PageMap* pageMap, uintptr_t phys, void* to, uintptr_t cpuFlags);
+	}
+}
+
+#ifdef __GNUC__
+#define DEFINE_IN_SECTION __attribute__((section(OBOS_DRIVER_HEADER_SECTION_NAME)))
+#else
+#define DEFINE_IN_SECTION
+#endif
+
+extern bool DriveReadSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void** buff,
+	size_t* oNSectorsRead
+	);
+extern bool DriveWriteSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToWrite,
+	char* buff,
+	size_t* oNSectorsWrote
+	);
+extern bool DriveReadSectorsInto(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void* buff,
+	size_t* oNSectorsRead
+	);
+extern bool DriveQueryInfo(
+	uint32_t driveId,
+	uint64_t *oNSectors,
+	uint64_t *oBytesPerSector
+	);
+extern bool DriveSubmitRequest(driverInterface::BlockRequest* request);
+extern bool DriveCancelRequest(driverInterface::BlockRequest* request);
+extern void DrivePoll(uint32_t driveId);
+
+driverInterface::driverHeader DEFINE_IN_SECTION g_driverHeader = {
+	.magicNumber = obos::driverInterface::OBOS_DRIVER_HEADER_MAGIC,
+	.driverId = 7,
+	.driverType = obos::driverInterface::OBOS_SERVICE_TYPE_STORAGE_DEVICE,
+	.requests = driverInterface::driverHeader::REQUEST_SET_STACK_SIZE,
+	.stackSize = 0x8000,
+	.functionTable = {
+		.GetServiceType = []()->driverInterface::serviceType { return driverInterface::serviceType::OBOS_SERVICE_TYPE_STORAGE_DEVICE; },
+		.serviceSpecific = {
+			.storageDevice = {
+				.ReadSectors = DriveReadSectors,
+				.WriteSectors = DriveWriteSectors,
+				.QueryDiskInfo = DriveQueryInfo,
+				.ReadSectorsInto = DriveReadSectorsInto,
+				.SubmitRequest = DriveSubmitRequest,
+				.CancelRequest = DriveCancelRequest,
+				.PollDrive = DrivePoll,
+				.unused = {nullptr,nullptr,}
+			}
+		}
+	},
+	.howToIdentifyDevice = 0b1, // PCI
+	.pciInfo = {
+		.classCode = 0x1, // Class code 0x01
+		.subclass = 1<<8, // Subclass: 0x08
+		.progIf = 1<<2 // Prog IF: 0x02
+	}
+};
+
+#ifndef __pie__
+#error Not compiling with -fPIE
+#endif
+
+Controller g_controllers[NVME_MAX_CONTROLLERS];
+size_t g_nControllers;
+Namespace g_namespaces[NVME_MAX_NAMESPACES];
+size_t g_nNamespaces;
+static size_t s_nVectorsUsed;
+// The vector every controller without MSI-X shares, or zero if none was allocated yet.
+static uint8_t s_intxVector;
+
+template<typename T>
+static T readRegister(Controller* ctrl, size_t offset)
+{
+	return *(volatile T*)(ctrl->registers + offset);
+}
+template<typename T>
+static void writeRegister(Controller* ctrl, size_t offset, T val)
+{
+	*(volatile T*)(ctrl->registers + offset) = val;
+}
+// Allocates an interrupt vector for a queue, or for the controllers sharing INTx if 'queue' is nullptr. Returns zero if there are none left.
+static uint8_t allocateVector(Queue* queue)
+{
+	if (s_nVectorsUsed == NVME_MAX_VECTORS)
+		return 0;
+	size_t i = s_nVectorsUsed++;
+	g_vectors[i].queue = queue;
+	g_vectors[i].used = true;
+	uint8_t vector = NVME_IRQ_VECTOR_BASE + i;
+	RegisterInterruptHandler(vector, NVMeInterruptHandler);
+	return vector;
+}
+// Maps part of a memory BAR, with caching disabled. Returns nullptr if the BAR isn't in memory space.
+static volatile byte* mapBar(Controller* ctrl, uint8_t bar, uint32_t offset, size_t length)
+{
+	uint8_t reg = PCI_GetRegisterOffset(4 + bar, 0);
+	uint32_t low = driverInterface::pciReadDwordRegister(ctrl->bus, ctrl->slot, ctrl->function, reg);
+	if ((low & 1) || !length)
+		return nullptr;
+	uintptr_t phys = low & ~0xf;
+	if (((low >> 1) & 0b11) == 0b10 /* 64-bit */)
+		phys |= (uintptr_t)driverInterface::pciReadDwordRegister(ctrl->bus, ctrl->slot, ctrl->function, reg + 4) << 32;
+	phys += offset;
+	uintptr_t base = phys & ~(uintptr_t)0xfff;
+	size_t nPages = (((phys + length + 0xfff) & ~(uintptr_t)0xfff) - base) / 0x1000;
+	byte* virt = (byte*)memory::_Impl_FindUsableAddress(nullptr, nPages);
+	if (!virt)
+		return nullptr;
+	for (size_t i = 0; i < nPages; i++)
+	{
+		memory::MapPhysicalAddress(
+			memory::getCurrentPageMap(),
+			base + i * 0x1000,
+			virt + i * 0x1000,
+			(1<<0)|(1<<1)|(1<<4)|(((uintptr_t)1)<<63) /*PRESENT,WRITE,CACHE_DISABLE,EXECUTE_DISABLE*/
+			);
+	}
+	return virt + (phys & 0xfff);
+}
+// Finds the controller's MSI-X capability. Returns zero if it has none.
+static uint8_t findMSIX(Controller* ctrl)
+{
+	// Status bit 4: The device has a capabilities list.
+	if (!(driverInterface::pciReadWordRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(1, 2)) & (1<<4)))
+		return 0;
+	uint8_t capability = driverInterface::pciReadByteRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(13, 0)) & ~0b11;
+	for (; capability; capability = driverInterface::pciReadByteRegister(ctrl->bus, ctrl->slot, ctrl->function, capability + 1) & ~0b11)
+		if (driverInterface::pciReadByteRegister(ctrl->bus, ctrl->slot, ctrl->function, capability) == 0x11 /* MSI-X */)
+			return capability;
+	return 0;
+}
+// Enables MSI-X with every vector masked, and maps its table. Returns nullptr if the controller can't use MSI-X.
+static volatile uint32_t* enableMSIX(Controller* ctrl, uint8_t capability, uint16_t* nTableEntries)
+{
+	uint16_t messageControl = driverInterface::pciReadWordRegister(ctrl->bus, ctrl->slot, ctrl->function, capability + 2);
+	uint32_t table = driverInterface::pciReadDwordRegister(ctrl->bus, ctrl->slot, ctrl->function, capability + 4);
+	*nTableEntries = (messageControl & 0x7ff) + 1;
+	volatile uint32_t* msixTable = (volatile uint32_t*)mapBar(ctrl, table & 0b111, table & ~0b111, *nTableEntries * 16);
+	if (!msixTable)
+		return nullptr;
+	// Mask every vector, including the admin queue's, which is polled.
+	for (uint16_t i = 0; i < *nTableEntries; i++)
+		msixTable[i * 4 + 3] = 1;
+	messageControl |= (1<<15);
+	messageControl &= ~(1<<14);
+	driverInterface::pciWriteWordRegister(ctrl->bus, ctrl->slot, ctrl->function, capability + 2, messageControl);
+	// Turn off INTx, so the interrupt isn't delivered twice.
+	uint16_t pciCommand = driverInterface::pciReadWordRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(1, 0));
+	driverInterface::pciWriteWordRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(1, 0), pciCommand | (1<<10));
+	ctrl->msix = true;
+	return msixTable;
+}
+// Waits for CSTS.RDY to become 'ready'. Returns false if the controller reported a fatal error.
+static bool waitForReady(Controller* ctrl, bool ready)
+{
+	while (true)
+	{
+		uint32_t status = readRegister<uint32_t>(ctrl, NVME_REG_CSTS);
+		if (status & NVME_CSTS_FATAL)
+			return false;
+		if (((status & NVME_CSTS_READY) != 0) == ready)
+			return true;
+		pause();
+	}
+}
+static bool identify(Controller* ctrl, uint8_t cns, uint32_t nsid, uintptr_t bufferPhys)
+{
+	SubmissionEntry command{};
+	command.cdw0 = NVME_ADMIN_IDENTIFY;
+	command.nsid = nsid;
+	command.prp1 = bufferPhys;
+	command.cdw10 = cns;
+	return AdminCommand(ctrl, &command, nullptr);
+}
+// Creates the I/O queue pair on the controller. 'interruptVector' is the MSI-X table entry of the completion queue.
+static bool createQueuePair(Controller* ctrl, Queue* queue, uint16_t interruptVector)
+{
+	SubmissionEntry command{};
+	command.cdw0 = NVME_ADMIN_CREATE_IO_CQ;
+	command.prp1 = queue->cqPhys;
+	command.cdw10 = ((uint32_t)(queue->size - 1) << 16) | queue->id;
+	command.cdw11 = ((uint32_t)interruptVector << 16) | (1<<1) /* Interrupts enabled */ | (1<<0) /* Physically contiguous */;
+	if (!AdminCommand(ctrl, &command, nullptr))
+		return false;
+	command = SubmissionEntry{};
+	command.cdw0 = NVME_ADMIN_CREATE_IO_SQ;
+	command.prp1 = queue->sqPhys;
+	command.cdw10 = ((uint32_t)(queue->size - 1) << 16) | queue->id;
+	command.cdw11 = ((uint32_t)queue->id << 16) | (1<<0) /* Physically contiguous */;
+	return AdminCommand(ctrl, &command, nullptr);
+}
+// Registers each of the controller's namespaces as a drive.
+static void findNamespaces(Controller* ctrl, uint32_t nNamespaces, uintptr_t bufferPhys, volatile byte* buffer)
+{
+	for (uint32_t nsid = 1; nsid <= nNamespaces && g_nNamespaces < NVME_MAX_NAMESPACES; nsid++)
+	{
+		if (!identify(ctrl, NVME_IDENTIFY_NAMESPACE, nsid, bufferPhys))
+			continue;
+		uint64_t nSectors = *(volatile uint64_t*)(buffer + 0);
+		if (!nSectors)
+			continue; // The namespace isn't active.
+		uint8_t formattedLBASize = buffer[26];
+		uint32_t lbaFormat = *(volatile uint32_t*)(buffer + 128 + (formattedLBASize & 0xf) * 4);
+		uint16_t metadataSize = lbaFormat & 0xffff;
+		uint8_t lbaDataSize = (lbaFormat >> 16) & 0xff;
+		// Metadata at the end of each sector would be mixed in with the data.
+		if (lbaDataSize < 9 || lbaDataSize > 12 || (metadataSize && (formattedLBASize & (1<<4))))
+		{
+			logger::warning("NVMe: Namespace %d has an unsupported format. Ignoring it.\n", nsid);
+			continue;
+		}
+		Namespace& ns = g_namespaces[g_nNamespaces++];
+		ns.controller = ctrl;
+		ns.nsid = nsid;
+		ns.sectorSize = 1 << lbaDataSize;
+		ns.nSectors = nSectors;
+		ns.kernelID = driverInterface::RegisterDevice(driverInterface::DeviceType::Drive);
+		logger::info("NVMe: Found namespace %d on %02x:%02x.%x. Kernel drive ID: %d, sector count: 0x%016X, sector size 0x%08X, queues: %d%s.\n",
+			nsid,
+			ctrl->bus, ctrl->slot, ctrl->function,
+			ns.kernelID,
+			ns.nSectors,
+			ns.sectorSize,
+			ctrl->nQueues,
+			ctrl->msix ? ", MSI-X" : "");
+	}
+}
+static bool InitializeController(Controller* ctrl)
+{
+	uint16_t pciCommand = driverInterface::pciReadWordRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(1, 0));
+	// DMA Bus mastering, and memory space access are on.
+	pciCommand |= 6;
+	driverInterface::pciWriteWordRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(1, 0), pciCommand);
+
+	// Map the registers, with the doorbells of every queue we could use.
+	ctrl->registers = mapBar(ctrl, 0, 0, 0x1000);
+	if (!ctrl->registers)
+		return false;
+	const uint64_t cap = readRegister<uint64_t>(ctrl, NVME_REG_CAP);
+	ctrl->doorbellStride = 4 << ((cap >> 32) & 0xf);
+	if ((cap >> 48) & 0xf /* MPSMIN */)
+	{
+		logger::warning("NVMe: %02x:%02x.%x doesn't support 4 KiB pages.\n", ctrl->bus, ctrl->slot, ctrl->function);
+		return false;
+	}
+	ctrl->registers = mapBar(ctrl, 0, 0, NVME_REG_DOORBELLS + 2 * (NVME_MAX_QUEUES + 1) * ctrl->doorbellStride);
+	if (!ctrl->registers)
+		return false;
+	const size_t maxQueueSize = (cap & 0xffff) + 1;
+
+	// Reset the controller, and give it the admin queue.
+	writeRegister<uint32_t>(ctrl, NVME_REG_CC, readRegister<uint32_t>(ctrl, NVME_REG_CC) & ~NVME_CC_ENABLE);
+	if (!waitForReady(ctrl, false))
+		return false;
+	const uint16_t adminSize = maxQueueSize < NVME_ADMIN_QUEUE_SIZE ? maxQueueSize : NVME_ADMIN_QUEUE_SIZE;
+	if (!AllocateQueue(ctrl, &ctrl->admin, 0, adminSize))
+		return false;
+	writeRegister<uint32_t>(ctrl, NVME_REG_AQA, ((uint32_t)(adminSize - 1) << 16) | (adminSize - 1));
+	writeRegister<uint64_t>(ctrl, NVME_REG_ASQ, ctrl->admin.sqPhys);
+	writeRegister<uint64_t>(ctrl, NVME_REG_ACQ, ctrl->admin.cqPhys);
+	writeRegister<uint32_t>(ctrl, NVME_REG_CC, NVME_CC_IOSQES | NVME_CC_IOCQES | NVME_CC_ENABLE);
+	if (!waitForReady(ctrl, true))
+	{
+		logger::warning("NVMe: %02x:%02x.%x reported a fatal error while being enabled.\n", ctrl->bus, ctrl->slot, ctrl->function);
+		return false;
+	}
+
+	uintptr_t identifyPhys = memory::allocatePhysicalPage();
+	if (!identifyPhys)
+		return false;
+	volatile byte* identifyBuffer = (volatile byte*)memory::mapPageTable((uintptr_t*)identifyPhys);
+	if (!identify(ctrl, NVME_IDENTIFY_CONTROLLER, 0, identifyPhys))
+	{
+		memory::freePhysicalPage(identifyPhys);
+		return false;
+	}
+	// MDTS is a power of two, in units of the minimum page size.
+	if (uint8_t mdts = identifyBuffer[77])
+		ctrl->maxTransferSize = (size_t)NVME_PAGE_SIZE << mdts;
+	const uint32_t nNamespaces = *(volatile uint32_t*)(identifyBuffer + 516);
+
+	// Use a queue pair per cpu, if the controller has enough of them, and each can get its own vector.
+	uint16_t nTableEntries = 0;
+	volatile uint32_t* msixTable = nullptr;
+	if (uint8_t capability = findMSIX(ctrl); capability && s_nVectorsUsed < NVME_MAX_VECTORS)
+		msixTable = enableMSIX(ctrl, capability, &nTableEntries);
+	const size_t nCpus = thread::g_nCPUs;
+	size_t nQueues = nCpus;
+	if (nQueues > NVME_MAX_QUEUES)
+		nQueues = NVME_MAX_QUEUES;
+	if (msixTable)
+	{
+		if (nQueues > NVME_MAX_VECTORS - s_nVectorsUsed)
+			nQueues = NVME_MAX_VECTORS - s_nVectorsUsed;
+		// Table entry zero is the admin queue's.
+		if (nQueues > (size_t)nTableEntries - 1)
+			nQueues = nTableEntries - 1;
+	}
+	else
+		nQueues = 1;
+	if (!nQueues)
+		nQueues = 1;
+	SubmissionEntry command{};
+	command.cdw0 = NVME_ADMIN_SET_FEATURES;
+	command.cdw10 = NVME_FEATURE_NUMBER_OF_QUEUES;
+	command.cdw11 = ((uint32_t)(nQueues - 1) << 16) | (nQueues - 1);
+	uint32_t allocated = 0;
+	if (!AdminCommand(ctrl, &command, &allocated))
+	{
+		memory::freePhysicalPage(identifyPhys);
+		return false;
+	}
+	// The controller can give us fewer, or more, than we asked for.
+	if (nQueues > (allocated & 0xffff) + 1)
+		nQueues = (allocated & 0xffff) + 1;
+	if (nQueues > (allocated >> 16) + 1)
+		nQueues = (allocated >> 16) + 1;
+
+	const uint16_t ioSize = maxQueueSize < NVME_IO_QUEUE_SIZE ? maxQueueSize : NVME_IO_QUEUE_SIZE;
+	for (uint16_t i = 0; i < nQueues; i++)
+	{
+		Queue* queue = new Queue{};
+		if (!AllocateQueue(ctrl, queue, i + 1, ioSize))
+		{
+			delete queue;
+			break;
+		}
+		const uint16_t interruptVector = msixTable ? i + 1 : 0;
+		if (!createQueuePair(ctrl, queue, interruptVector))
+		{
+			logger::warning("NVMe: %02x:%02x.%x: Could not create I/O queue %d.\n", ctrl->bus, ctrl->slot, ctrl->function, i + 1);
+			break;
+		}
+		if (msixTable)
+		{
+			// Send the queue's interrupts to the cpu that submits to it.
+			queue->vector = allocateVector(queue);
+			volatile uint32_t* entry = msixTable + interruptVector * 4;
+			entry[0] = 0xFEE00000 | ((uint32_t)thread::g_cpuInfo[i % nCpus].arch_specific.lapicId << 12);
+			entry[1] = 0;
+			entry[2] = queue->vector;
+			entry[3] = 0; // Unmask the vector.
+		}
+		ctrl->queues[ctrl->nQueues++] = queue;
+	}
+	if (!ctrl->nQueues)
+	{
+		memory::freePhysicalPage(identifyPhys);
+		return false;
+	}
+	if (!msixTable)
+	{
+		if (!s_intxVector)
+			s_intxVector = allocateVector(nullptr);
+		uint8_t irq = driverInterface::pciReadByteRegister(ctrl->bus, ctrl->slot, ctrl->function, PCI_GetRegisterOffset(15, 0));
+		if (!s_intxVector || irq == 0xff || !MapIRQToVector(irq, s_intxVector))
+			logger::warning("NVMe: %02x:%02x.%x: Could not route the controller's interrupt. Requests will be polled.\n", ctrl->bus, ctrl->slot, ctrl->function);
+	}
+
+	findNamespaces(ctrl, nNamespaces, identifyPhys, identifyBuffer);
+	memory::freePhysicalPage(identifyPhys);
+	return true;
+}
+
+extern "C" void _start()
+{
+	uint32_t exitCode = 0;
+	for (uint16_t bus = 0; bus < 256; bus++)
+	{
+		driverInterface::enumerateBus((uint8_t)bus, [](void*, uint8_t slot, uint8_t function, uint8_t bus, uint8_t classCode, uint8_t subclass, uint8_t progIF)->bool
+			{
+				if (g_nControllers == NVME_MAX_CONTROLLERS)
+					return true;
+				// Mass storage controller, non-volatile memory controller, NVM Express.
+				if (classCode != 0x01 || subclass != 0x08 || progIF != 0x02)
+					return true;
+				Controller* ctrl = &g_controllers[g_nControllers];
+				ctrl->bus = bus;
+				ctrl->slot = slot;
+				ctrl->function = function;
+				logger::log("NVMe: Initializing controller %02x:%02x.%x.\n", bus, slot, function);
+				if (InitializeController(ctrl))
+					g_nControllers++;
+				else
+				{
+					logger::warning("NVMe: Could not initialize controller %02x:%02x.%x.\n", bus, slot, function);
+					*ctrl = Controller{};
+				}
+				return true;
+			}, nullptr);
+	}
+	if (!g_nNamespaces)
+	{
+		logger::error("NVMe: No namespaces found.\n");
+		exitCode = 1;
+	}
+	g_driverHeader.driver_initialized = true;
+	while (!g_driverHeader.driver_finished_loading);
+	thread::ExitThread(exitCode);
+}
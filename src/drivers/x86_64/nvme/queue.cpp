@@ -0,0 +1,437 @@
+/*
+	drivers/x86_64/nvme/queue.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <memory_manipulation.h>
+
+#include <driverInterface/blockRequest.h>
+
+#include <multitasking/cpu_local.h>
+
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+#include <arch/x86_64/memory_manager/physical/allocate.h>
+
+#include <allocators/vmm/arch.h>
+
+#include <x86_64-utils/asm.h>
+
+#include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/irq/irq.h>
+
+#include "structs.h"
+#include "queue.h"
+
+using namespace obos;
+
+// How long a thread sleeps on a request before polling the queue, in case the interrupt was lost.
+#define REQUEST_POLL_INTERVAL 10000000
+
+VectorEntry g_vectors[NVME_MAX_VECTORS];
+
+static void lockQueue(Queue* queue)
+{
+	while (__atomic_exchange_n(&queue->lock, true, __ATOMIC_ACQUIRE))
+		pause();
+}
+static void unlockQueue(Queue* queue)
+{
+	__atomic_store_n(&queue->lock, false, __ATOMIC_RELEASE);
+}
+static bool canBlock()
+{
+	// Threads can't block with interrupts off (ex: in the page fault handler).
+	return getEflags() & x86_64_flags::RFLAGS_INTERRUPT_ENABLE;
+}
+static volatile uint32_t* doorbell(Controller* ctrl, uint16_t queueId, bool completionQueue)
+{
+	return (volatile uint32_t*)(ctrl->registers + NVME_REG_DOORBELLS + (2 * queueId + completionQueue) * ctrl->doorbellStride);
+}
+
+bool AllocateQueue(Controller* ctrl, Queue* queue, uint16_t id, uint16_t size)
+{
+	const size_t sqPages = (size * sizeof(SubmissionEntry) + 0xfff) / 0x1000;
+	const size_t cqPages = (size * sizeof(CompletionEntry) + 0xfff) / 0x1000;
+	uintptr_t sq = memory::allocatePhysicalPage(sqPages);
+	if (!sq)
+		return false;
+	uintptr_t cq = memory::allocatePhysicalPage(cqPages);
+	if (!cq)
+	{
+		memory::freePhysicalPage(sq, sqPages);
+		return false;
+	}
+	// The admin queue's commands only use the first PRP entry, so it doesn't need lists.
+	const size_t listsPerPage = NVME_PAGE_SIZE / (NVME_PRP_LIST_ENTRIES * sizeof(uint64_t));
+	const size_t listPages = id ? (size - 1 + listsPerPage - 1) / listsPerPage : 0;
+	uintptr_t lists = listPages ? memory::allocatePhysicalPage(listPages) : 0;
+	if (listPages && !lists)
+	{
+		memory::freePhysicalPage(sq, sqPages);
+		memory::freePhysicalPage(cq, cqPages);
+		return false;
+	}
+	queue->controller = ctrl;
+	queue->id = id;
+	queue->size = size;
+	queue->sq = (volatile SubmissionEntry*)memory::mapPageTable((uintptr_t*)sq);
+	queue->cq = (volatile CompletionEntry*)memory::mapPageTable((uintptr_t*)cq);
+	utils::memzero((void*)queue->sq, sqPages * 0x1000);
+	utils::memzero((void*)queue->cq, cqPages * 0x1000);
+	queue->sqPhys = sq;
+	queue->cqPhys = cq;
+	queue->sqTailDoorbell = doorbell(ctrl, id, false);
+	queue->cqHeadDoorbell = doorbell(ctrl, id, true);
+	queue->sqTail = 0;
+	queue->cqHead = 0;
+	queue->phase = 1;
+	queue->commands = new Queue::Command[size - 1]{};
+	queue->freeIds = new uint16_t[size - 1];
+	queue->nFree = size - 1;
+	for (uint16_t i = 0; i < size - 1; i++)
+	{
+		queue->freeIds[i] = i;
+		if (!lists)
+			continue;
+		const uintptr_t listPhys = lists + i * NVME_PRP_LIST_ENTRIES * sizeof(uint64_t);
+		queue->commands[i].prpListPhys = listPhys;
+		queue->commands[i].prpList = (uint64_t*)memory::mapPageTable((uintptr_t*)(listPhys & ~(uintptr_t)0xfff)) + (listPhys & 0xfff) / sizeof(uint64_t);
+	}
+	return true;
+}
+bool AdminCommand(Controller* ctrl, SubmissionEntry* command, uint32_t* result)
+{
+	Queue& queue = ctrl->admin;
+	command->cdw0 = (command->cdw0 & 0xffff) | ((uint32_t)queue.sqTail << 16);
+	utils::memcpy((void*)&queue.sq[queue.sqTail], command, sizeof(*command));
+	queue.sqTail = (queue.sqTail + 1) % queue.size;
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	*queue.sqTailDoorbell = queue.sqTail;
+	volatile CompletionEntry* completion = &queue.cq[queue.cqHead];
+	while ((completion->status & 1) != queue.phase)
+		pause();
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	const uint16_t status = completion->status >> 1;
+	if (result)
+		*result = completion->result;
+	if (++queue.cqHead == queue.size)
+	{
+		queue.cqHead = 0;
+		queue.phase ^= 1;
+	}
+	*queue.cqHeadDoorbell = queue.cqHead;
+	return !status;
+}
+Queue* GetQueue(Controller* ctrl)
+{
+	// Each cpu has its own queue pair, whose interrupts go to that cpu, so submissions on different cpus don't contend.
+	return ctrl->queues[thread::GetCurrentCpuLocalPtr()->cpuId % ctrl->nQueues];
+}
+
+static void removePending(Queue* queue, Request* req)
+{
+	Request* prev = nullptr;
+	for (Request* cur = queue->pendingHead; cur; prev = cur, cur = cur->next)
+	{
+		if (cur != req)
+			continue;
+		if (prev)
+			prev->next = cur->next;
+		else
+			queue->pendingHead = cur->next;
+		if (queue->pendingTail == cur)
+			queue->pendingTail = prev;
+		cur->next = nullptr;
+		return;
+	}
+}
+// Puts 'finished' on the list of requests to complete.
+static void finishRequest(Request* req, Request*& finished)
+{
+	req->next = finished;
+	finished = req;
+}
+// Fills in the command's PRP entries for the start of the request's buffer. Returns how many bytes they describe.
+static size_t buildPRPs(Queue* queue, Queue::Command& command, Request* req, uint64_t* prp1, uint64_t* prp2)
+{
+	const size_t sectorSize = req->ns->sectorSize;
+	size_t maxBytes = req->nSectorsLeft * sectorSize;
+	if (queue->controller->maxTransferSize && maxBytes > queue->controller->maxTransferSize)
+		maxBytes = queue->controller->maxTransferSize;
+	// NLB is 16 bits.
+	if (maxBytes > 0x10000 * sectorSize)
+		maxBytes = 0x10000 * sectorSize;
+	// Every page after the first starts at zero, as the buffer is contiguous in virtual memory, so a page per entry is enough.
+	// The first entry is in prp1, the rest are in the PRP list, or prp2 if there's only one more.
+	size_t nBytes = 0;
+	size_t nPages = 0;
+	while (nBytes < maxBytes && nPages < NVME_PRP_LIST_ENTRIES + 1)
+	{
+		uintptr_t virt = (uintptr_t)req->buff + nBytes;
+		size_t chunk = NVME_PAGE_SIZE - (virt & 0xfff);
+		if (chunk > maxBytes - nBytes)
+			chunk = maxBytes - nBytes;
+		uintptr_t phys = memory::GetPhysicalAddress(req->pageMap, virt);
+		if (!phys)
+			break;
+		if (!nPages)
+			*prp1 = phys;
+		else
+			command.prpList[nPages - 1] = phys;
+		nPages++;
+		nBytes += chunk;
+	}
+	// Commands transfer whole sectors.
+	nBytes -= nBytes % sectorSize;
+	if (!nBytes)
+		return 0;
+	nPages = (((uintptr_t)req->buff & 0xfff) + nBytes + 0xfff) / NVME_PAGE_SIZE;
+	if (nPages == 1)
+		*prp2 = 0;
+	else if (nPages == 2)
+		*prp2 = command.prpList[0];
+	else
+		*prp2 = command.prpListPhys;
+	return nBytes;
+}
+// Issues commands for the pending requests while there are free command ids. Expects the queue to be locked, with interrupts off.
+static void dispatch(Queue* queue, Request*& finished)
+{
+	bool issued = false;
+	while (Request* req = queue->pendingHead)
+	{
+		if (!queue->nFree)
+			break;
+		const uint16_t id = queue->freeIds[queue->nFree - 1];
+		Queue::Command& command = queue->commands[id];
+		uint64_t prp1 = 0, prp2 = 0;
+		const size_t nBytes = buildPRPs(queue, command, req, &prp1, &prp2);
+		if (!nBytes)
+		{
+			// The buffer was unmapped.
+			removePending(queue, req);
+			req->failed = true;
+			req->nSectorsLeft = 0;
+			if (!req->nCommands)
+				finishRequest(req, finished);
+			continue;
+		}
+		queue->nFree--;
+		const size_t count = nBytes / req->ns->sectorSize;
+		volatile SubmissionEntry* entry = &queue->sq[queue->sqTail];
+		entry->cdw0 = (req->write ? NVME_IO_WRITE : NVME_IO_READ) | ((uint32_t)id << 16);
+		entry->nsid = req->ns->nsid;
+		entry->cdw2 = 0;
+		entry->cdw3 = 0;
+		entry->mptr = 0;
+		entry->prp1 = prp1;
+		entry->prp2 = prp2;
+		entry->cdw10 = (uint32_t)req->lba;
+		entry->cdw11 = (uint32_t)(req->lba >> 32);
+		entry->cdw12 = (uint32_t)(count - 1);
+		entry->cdw13 = 0;
+		entry->cdw14 = 0;
+		entry->cdw15 = 0;
+		queue->sqTail = (queue->sqTail + 1) % queue->size;
+		command.owner = req;
+		command.nSectors = count;
+		issued = true;
+		req->nCommands++;
+		req->started = true;
+		req->lba += count;
+		req->buff += nBytes;
+		req->nSectorsLeft -= count;
+		if (!req->nSectorsLeft)
+			removePending(queue, req);
+	}
+	if (!issued)
+		return;
+	// The controller can't see the new tail before the entries.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	*queue->sqTailDoorbell = queue->sqTail;
+}
+// Frees the command ids of every command the controller finished. Expects the queue to be locked, with interrupts off.
+// Requests that finished are put in 'finished', to be completed once the queue is unlocked.
+static void completeCommands(Queue* queue, Request*& finished)
+{
+	bool reaped = false;
+	while (true)
+	{
+		volatile CompletionEntry* completion = &queue->cq[queue->cqHead];
+		if ((completion->status & 1) != queue->phase)
+			break;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		const uint16_t id = completion->commandId;
+		const bool succeeded = !(completion->status >> 1);
+		if (++queue->cqHead == queue->size)
+		{
+			queue->cqHead = 0;
+			queue->phase ^= 1;
+		}
+		reaped = true;
+		if (id >= queue->size - 1 || !queue->commands[id].owner)
+			continue;
+		Queue::Command& command = queue->commands[id];
+		Request* req = command.owner;
+		command.owner = nullptr;
+		queue->freeIds[queue->nFree++] = id;
+		req->nCommands--;
+		if (!succeeded)
+		{
+			// Don't issue the rest of a failed request.
+			if (!req->failed && req->nSectorsLeft)
+				removePending(queue, req);
+			req->failed = true;
+			req->nSectorsLeft = 0;
+		}
+		else
+			req->nSectorsDone += command.nSectors;
+		if (!req->nCommands && !req->nSectorsLeft)
+			finishRequest(req, finished);
+	}
+	// Tell the controller the entries can be reused, which also deasserts INTx.
+	if (reaped)
+		*queue->cqHeadDoorbell = queue->cqHead;
+}
+static bool setDone(thread::Thread*, void* udata)
+{
+	((Request*)udata)->done = true;
+	return true;
+}
+// Completes the requests in 'finished'. Must be called with the queue unlocked, as completion callbacks can submit more requests.
+static void finishRequests(Queue* queue, Request* finished)
+{
+	while (finished)
+	{
+		Request* next = finished->next;
+		if (driverInterface::BlockRequest* request = finished->blockRequest)
+		{
+			bool failed = finished->failed;
+			size_t nSectorsDone = finished->nSectorsDone;
+			// Only kernel buffers are bounced for asynchronous requests, so they can be copied to from any address space.
+			if (finished->bounceTo && !failed && !finished->write)
+				utils::memcpy(finished->bounceTo, finished->bounce, nSectorsDone * finished->ns->sectorSize);
+			finished->next = __atomic_load_n(&queue->reapList, __ATOMIC_RELAXED);
+			while (!__atomic_compare_exchange_n(&queue->reapList, &finished->next, finished, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+				;
+			driverInterface::CompleteBlockRequest(request, failed ? driverInterface::BlockRequest::STATUS_FAILED : driverInterface::BlockRequest::STATUS_SUCCESS, failed ? 0 : nSectorsDone);
+		}
+		else
+			// The waiter can return as soon as it sees done, so it's set with the wait queue locked.
+			finished->completion.WakeOne(setDone, finished);
+		finished = next;
+	}
+}
+// Frees the asynchronous requests that finished. This can't be called in the interrupt handler.
+static void reapRequests(Queue* queue)
+{
+	Request* list = __atomic_exchange_n(&queue->reapList, nullptr, __ATOMIC_ACQUIRE);
+	while (list)
+	{
+		Request* next = list->next;
+		delete[] list->bounce;
+		delete list;
+		list = next;
+	}
+}
+void PollQueue(Queue* queue)
+{
+	Request* finished = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockQueue(queue);
+	completeCommands(queue, finished);
+	dispatch(queue, finished);
+	unlockQueue(queue);
+	finishRequests(queue, finished);
+	restorePreviousInterruptStatus(flags);
+}
+void SubmitRequest(Queue* queue, Request* req)
+{
+	if (canBlock())
+		reapRequests(queue);
+	req->next = nullptr;
+	Request* finished = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockQueue(queue);
+	if (queue->pendingTail)
+		queue->pendingTail->next = req;
+	else
+		queue->pendingHead = req;
+	queue->pendingTail = req;
+	dispatch(queue, finished);
+	unlockQueue(queue);
+	finishRequests(queue, finished);
+	restorePreviousInterruptStatus(flags);
+}
+bool CancelRequest(Queue* queue, driverInterface::BlockRequest* request)
+{
+	// Look for the request in the pending list instead of using driverData, as it could've already been freed.
+	Request* req = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockQueue(queue);
+	for (Request* cur = queue->pendingHead; cur; cur = cur->next)
+	{
+		if (cur->blockRequest != request)
+			continue;
+		if (!cur->started)
+		{
+			removePending(queue, cur);
+			req = cur;
+		}
+		break;
+	}
+	unlockQueue(queue);
+	restorePreviousInterruptStatus(flags);
+	if (!req)
+		return false;
+	request->driverData = nullptr;
+	delete[] req->bounce;
+	delete req;
+	driverInterface::CompleteBlockRequest(request, driverInterface::BlockRequest::STATUS_CANCELLED, 0);
+	return true;
+}
+static bool requestDone(void* udata)
+{
+	return ((Request*)udata)->done;
+}
+bool WaitForRequest(Queue* queue, Request* req)
+{
+	while (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE))
+	{
+		if (canBlock())
+		{
+			if (req->completion.WaitFor(requestDone, req, REQUEST_POLL_INTERVAL))
+				break;
+		}
+		else
+			pause();
+		PollQueue(queue);
+	}
+	// done is set before the completion is unlocked. Wait for that, as the request is freed as soon as we return.
+	req->completion.WakeAll();
+	return !req->failed;
+}
+void NVMeInterruptHandler(interrupt_frame* frame)
+{
+	size_t vector = frame->intNumber - NVME_IRQ_VECTOR_BASE;
+	if (vector < NVME_MAX_VECTORS && g_vectors[vector].used)
+	{
+		if (g_vectors[vector].queue)
+			PollQueue(g_vectors[vector].queue);
+		else
+		{
+			// The INTx line can be shared, so check every controller using it.
+			for (size_t i = 0; i < g_nControllers; i++)
+			{
+				Controller* ctrl = &g_controllers[i];
+				if (ctrl->msix)
+					continue;
+				for (uint16_t q = 0; q < ctrl->nQueues; q++)
+					PollQueue(ctrl->queues[q]);
+			}
+		}
+	}
+	SendEOI();
+}
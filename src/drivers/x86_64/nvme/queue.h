@@ -0,0 +1,44 @@
+/*
+	drivers/x86_64/nvme/queue.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+namespace obos
+{
+	struct interrupt_frame;
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+}
+
+// What an interrupt vector used by the driver completes.
+struct VectorEntry
+{
+	// The queue the vector belongs to, or nullptr if it's a shared INTx line, where every controller not using MSI-X is checked.
+	struct Queue* queue;
+	bool used;
+};
+extern VectorEntry g_vectors[];
+
+// Allocates a queue pair's rings, command ids, and PRP lists. The queues still need to be created on the controller.
+bool AllocateQueue(struct Controller* ctrl, struct Queue* queue, uint16_t id, uint16_t size);
+// Sends an admin command, and polls for its completion. Returns false if the command failed.
+bool AdminCommand(struct Controller* ctrl, struct SubmissionEntry* command, uint32_t* result);
+// Returns the queue the current cpu submits to.
+struct Queue* GetQueue(struct Controller* ctrl);
+// Queues a request, and issues as much of it as there are free command ids for.
+// The buffer's pages must be faulted in, as the rest of the request can be issued from the interrupt handler.
+void SubmitRequest(struct Queue* queue, struct Request* req);
+// Cancels an asynchronous request if it's pending on the queue, and none of its commands were issued.
+bool CancelRequest(struct Queue* queue, obos::driverInterface::BlockRequest* request);
+// Waits for a request submitted without a BlockRequest. Returns false if the transfer failed.
+bool WaitForRequest(struct Queue* queue, struct Request* req);
+// Completes the commands the controller finished, for when interrupts are off or were lost.
+void PollQueue(struct Queue* queue);
+void NVMeInterruptHandler(obos::interrupt_frame* frame);
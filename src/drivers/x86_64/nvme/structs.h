@@ -0,0 +1,198 @@
+/*
+	drivers/x86_64/nvme/structs.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+#include <multitasking/locks/waitQueue.h>
+
+// The first of the interrupt vectors used by the driver. Each I/O queue with an MSI-X vector gets its own.
+#define NVME_IRQ_VECTOR_BASE 0x60
+#define NVME_MAX_VECTORS 16
+#define NVME_MAX_CONTROLLERS 4
+#define NVME_MAX_NAMESPACES 8
+// The driver uses a queue pair per cpu on each controller, up to this many.
+#define NVME_MAX_QUEUES 16
+#define NVME_ADMIN_QUEUE_SIZE 32
+#define NVME_IO_QUEUE_SIZE 64
+// The most entries in a command's PRP list. Lists are carved out of shared pages, so they never cross a page.
+#define NVME_PRP_LIST_ENTRIES 64
+#define NVME_PAGE_SIZE 4096
+
+// Controller registers, as offsets from BAR0.
+enum
+{
+	NVME_REG_CAP = 0x00,
+	NVME_REG_VS = 0x08,
+	NVME_REG_INTMS = 0x0C,
+	NVME_REG_INTMC = 0x10,
+	NVME_REG_CC = 0x14,
+	NVME_REG_CSTS = 0x1C,
+	NVME_REG_AQA = 0x24,
+	NVME_REG_ASQ = 0x28,
+	NVME_REG_ACQ = 0x30,
+	NVME_REG_DOORBELLS = 0x1000,
+};
+enum
+{
+	NVME_CC_ENABLE = (1<<0),
+	// 64-byte submission queue entries, and 16-byte completion queue entries.
+	NVME_CC_IOSQES = (6<<16),
+	NVME_CC_IOCQES = (4<<20),
+};
+enum
+{
+	NVME_CSTS_READY = (1<<0),
+	NVME_CSTS_FATAL = (1<<1),
+};
+enum
+{
+	NVME_ADMIN_CREATE_IO_SQ = 0x01,
+	NVME_ADMIN_CREATE_IO_CQ = 0x05,
+	NVME_ADMIN_IDENTIFY = 0x06,
+	NVME_ADMIN_SET_FEATURES = 0x09,
+};
+enum
+{
+	NVME_IDENTIFY_NAMESPACE = 0,
+	NVME_IDENTIFY_CONTROLLER = 1,
+};
+#define NVME_FEATURE_NUMBER_OF_QUEUES 0x07
+enum
+{
+	NVME_IO_WRITE = 0x01,
+	NVME_IO_READ = 0x02,
+};
+
+struct SubmissionEntry
+{
+	// Bits 0-7: The opcode, bits 16-31: The command id.
+	uint32_t cdw0;
+	uint32_t nsid;
+	uint32_t cdw2, cdw3;
+	uint64_t mptr;
+	uint64_t prp1;
+	uint64_t prp2;
+	uint32_t cdw10, cdw11, cdw12, cdw13, cdw14, cdw15;
+};
+static_assert(sizeof(SubmissionEntry) == 64, "struct SubmissionEntry has an invalid size.");
+struct CompletionEntry
+{
+	uint32_t result;
+	uint32_t reserved;
+	uint16_t sqHead;
+	uint16_t sqId;
+	uint16_t commandId;
+	// Bit 0: The phase tag, bits 1-15: The status.
+	uint16_t status;
+};
+static_assert(sizeof(CompletionEntry) == 16, "struct CompletionEntry has an invalid size.");
+
+namespace obos
+{
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+	namespace memory
+	{
+		class PageMap;
+	}
+}
+
+struct Namespace
+{
+	struct Controller* controller = nullptr;
+	uint32_t nsid = 0;
+	uint32_t sectorSize = 512;
+	uint64_t nSectors = 0;
+	uint32_t kernelID = 0xffffffff;
+};
+// A transfer, which is split into as many commands as the queue needs.
+struct Request
+{
+	// The request being done, or nullptr if a thread is waiting on 'completion'.
+	obos::driverInterface::BlockRequest* blockRequest = nullptr;
+	Namespace* ns = nullptr;
+	bool write = false;
+	// The address space the buffer is in.
+	obos::memory::PageMap* pageMap = nullptr;
+	// Where the next command starts, in the namespace's sectors.
+	uint64_t lba = 0;
+	byte* buff = nullptr;
+	// The sectors that still need a command.
+	size_t nSectorsLeft = 0;
+	size_t nSectorsDone = 0;
+	// The commands in flight.
+	size_t nCommands = 0;
+	bool started = false;
+	bool failed = false;
+	// Set with 'completion' locked, when a synchronous transfer finishes.
+	bool done = false;
+	obos::locks::WaitQueue completion;
+	// PRP entries have to be dword-aligned, so a buffer that isn't goes through a kernel buffer.
+	// For asynchronous reads, this is copied to 'bounceTo' before the request completes.
+	byte* bounce = nullptr;
+	byte* bounceTo = nullptr;
+	size_t bounceSize = 0;
+	// The queue's pending list, or the list of requests to free.
+	Request* next = nullptr;
+};
+struct Queue
+{
+	struct Controller* controller = nullptr;
+	uint16_t id = 0;
+	uint16_t size = 0;
+	// Physically contiguous, and mapped through the HHDM.
+	volatile SubmissionEntry* sq = nullptr;
+	volatile CompletionEntry* cq = nullptr;
+	uintptr_t sqPhys = 0, cqPhys = 0;
+	volatile uint32_t* sqTailDoorbell = nullptr;
+	volatile uint32_t* cqHeadDoorbell = nullptr;
+	uint16_t sqTail = 0;
+	uint16_t cqHead = 0;
+	// The phase tag of new completions. Flips every time the completion queue wraps.
+	uint8_t phase = 1;
+	struct Command
+	{
+		// The request the command is part of, or nullptr if the command id is free.
+		Request* owner;
+		size_t nSectors;
+		uint64_t* prpList;
+		uintptr_t prpListPhys;
+	} *commands = nullptr;
+	// The free command ids. There's one less than the queue's size, so the submission queue can't overflow.
+	uint16_t* freeIds = nullptr;
+	uint16_t nFree = 0;
+	// The interrupt vector of the queue, or zero if it shares the controller's INTx line.
+	uint8_t vector = 0;
+	// Protects everything above, and the pending list.
+	bool lock = false;
+	Request *pendingHead = nullptr, *pendingTail = nullptr;
+	// Finished asynchronous requests, freed on the next submission, as they can't be freed in the interrupt handler.
+	Request* reapList = nullptr;
+};
+struct Controller
+{
+	uint8_t bus = 0, slot = 0, function = 0;
+	volatile byte* registers = nullptr;
+	// The distance between doorbells, in bytes.
+	uint32_t doorbellStride = 4;
+	// The most bytes one command transfers, or zero if the controller doesn't limit it.
+	size_t maxTransferSize = 0;
+	// Whether the I/O queues' interrupts are delivered with MSI-X. Otherwise, all queues share the INTx line.
+	bool msix = false;
+	// The admin queue. Admin commands are only sent during initialization, and are polled.
+	Queue admin;
+	uint16_t nQueues = 0;
+	Queue* queues[NVME_MAX_QUEUES]{};
+};
+
+extern Controller g_controllers[NVME_MAX_CONTROLLERS];
+extern size_t g_nControllers;
+extern Namespace g_namespaces[NVME_MAX_NAMESPACES];
+extern size_t g_nNamespaces;
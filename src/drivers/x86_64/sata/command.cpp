@@ -5,8 +5,15 @@
 */
 
 #include <int.h>
+#include <memory_manipulation.h>
+
 #include <x86_64-utils/asm.h>
 
+#include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/irq/irq.h>
+
+#include <driverInterface/blockRequest.h>
+
 #include "command.h"
 #include "structs.h"
 
@@ -51,4 +58,371 @@ asm(
 "	leave;"
 "	ret;"
 ".att_syntax prefix;"
-);
\ No newline at end of file
+);
+
+using namespace obos;
+
+// How long a thread sleeps on a command before polling the port, in case the interrupt was lost.
+#define COMMAND_POLL_INTERVAL 10000000
+
+static void lockPort(Port* port)
+{
+	while (__atomic_exchange_n(&port->issueLock, true, __ATOMIC_ACQUIRE))
+		pause();
+}
+static void unlockPort(Port* port)
+{
+	__atomic_store_n(&port->issueLock, false, __ATOMIC_RELEASE);
+}
+static bool canBlock()
+{
+	// Threads can't block with interrupts off (ex: in the page fault handler).
+	return getEflags() & x86_64_flags::RFLAGS_INTERRUPT_ENABLE;
+}
+// Restarts the port after an error, so it can process commands again.
+static void recoverPort(volatile HBA_PORT* pPort)
+{
+	StopCommandEngine(pPort);
+	pPort->serr = 0xFFFFFFFF;
+	pPort->is = 0xFFFFFFFF;
+	if (pPort->tfd & 0x88)
+	{
+		// Command List Override, to clear BSY and DRQ.
+		pPort->cmd = pPort->cmd | (1<<3);
+		while (pPort->cmd & (1<<3))
+			pause();
+	}
+	StartCommandEngine(pPort);
+}
+static void removePending(Port* port, AsyncRequest* req)
+{
+	AsyncRequest* prev = nullptr;
+	for (AsyncRequest* cur = port->pendingHead; cur; prev = cur, cur = cur->next)
+	{
+		if (cur != req)
+			continue;
+		if (prev)
+			prev->next = cur->next;
+		else
+			port->pendingHead = cur->next;
+		if (port->pendingTail == cur)
+			port->pendingTail = prev;
+		cur->next = nullptr;
+		return;
+	}
+}
+// Completes every command the HBA finished. Expects the port to be locked, with interrupts off.
+// Asynchronous requests that finished are put in 'finished', to be completed once the port is unlocked.
+static void completeCommands(Port* port, AsyncRequest*& finished)
+{
+	volatile HBA_PORT* pPort = port->hbaPort;
+	uint32_t is = pPort->is;
+	pPort->is = is;
+	uint32_t active = pPort->ci | pPort->sact;
+	uint32_t completed = port->slotsIssued & ~active;
+	uint32_t failed = 0;
+	if (is & HBA_PxIS_ERROR_MASK)
+	{
+		// The HBA stops on an error, so fail everything that's still outstanding.
+		failed = port->slotsIssued & active;
+		recoverPort(pPort);
+	}
+	port->slotsIssued &= ~(completed | failed);
+	for (uint32_t slots = completed | failed; slots; slots &= slots - 1)
+	{
+		uint32_t slot = __builtin_ctz(slots);
+		Port::CommandSlot& cmdSlot = port->slots[slot];
+		if (AsyncRequest* req = cmdSlot.owner)
+		{
+			cmdSlot.owner = nullptr;
+			req->slotsOwned &= ~(1u << slot);
+			if ((failed >> slot) & 1)
+			{
+				// Don't issue the rest of a failed request.
+				if (!req->failed && req->nSectorsLeft)
+					removePending(port, req);
+				req->failed = true;
+				req->nSectorsLeft = 0;
+			}
+			else
+			{
+				if (cmdSlot.bounceTo)
+					utils::memcpy(cmdSlot.bounceTo, cmdSlot.bounceBuffer, cmdSlot.nSectors * port->sectorSize);
+				req->nSectorsDone += cmdSlot.nSectors;
+			}
+			cmdSlot.bounceTo = nullptr;
+			ReleaseCommandSlot(port, slot);
+			if (!req->slotsOwned && !req->nSectorsLeft)
+			{
+				req->next = finished;
+				finished = req;
+			}
+			continue;
+		}
+		cmdSlot.failed = (failed >> slot) & 1;
+		__atomic_store_n(&cmdSlot.done, true, __ATOMIC_RELEASE);
+		cmdSlot.completion.WakeAll();
+	}
+}
+// Sets the command's bits in the port's registers. Expects the port to be locked, with interrupts off.
+static void issueCommand(Port* port, uint32_t slot, bool queued)
+{
+	volatile HBA_PORT* pPort = port->hbaPort;
+	// The interrupt handler can't see the slot as issued before the HBA does, or it would think it completed.
+	port->slotsIssued |= (1u << slot);
+	if (queued)
+		pPort->sact = (1u << slot);
+	pPort->ci = (1u << slot);
+}
+// Issues commands for the queued asynchronous requests on any free slots. Expects the port to be locked, with interrupts off.
+static void dispatch(Port* port, AsyncRequest*& finished)
+{
+	while (AsyncRequest* req = port->pendingHead)
+	{
+		uint32_t slot = 0;
+		if (!TryAcquireCommandSlot(port, &slot))
+			break;
+		uint16_t nEntries = 0;
+		size_t count = 0;
+		const size_t maxSectors = req->nSectorsLeft < 0xffff ? req->nSectorsLeft : 0xffff;
+		// PRDT entries need to be word-aligned.
+		bool bounce = (uintptr_t)req->buff & 1;
+		if (!bounce)
+		{
+			count = BuildPRDT(*port, port->cmdTables[slot], req->pageMap, req->buff, maxSectors, req->write, false, &nEntries);
+			bounce = !count;
+		}
+		if (bounce && req->canBounce)
+		{
+			count = BuildBouncePRDT(*port, slot, maxSectors, &nEntries);
+			if (count && req->write)
+				utils::memcpy(port->slots[slot].bounceBuffer, req->buff, count * port->sectorSize);
+		}
+		if (!count)
+		{
+			// The buffer was unmapped, or isn't reachable by the HBA.
+			ReleaseCommandSlot(port, slot);
+			removePending(port, req);
+			req->failed = true;
+			req->nSectorsLeft = 0;
+			if (!req->slotsOwned)
+			{
+				req->next = finished;
+				finished = req;
+			}
+			continue;
+		}
+		SetupCommand(*port, slot, req->write, req->lba, count, nEntries);
+		Port::CommandSlot& cmdSlot = port->slots[slot];
+		cmdSlot.owner = req;
+		cmdSlot.nSectors = count;
+		cmdSlot.bounceTo = bounce && !req->write ? req->buff : nullptr;
+		cmdSlot.done = false;
+		cmdSlot.failed = false;
+		req->slotsOwned |= (1u << slot);
+		req->started = true;
+		req->lba += count;
+		req->buff += count * port->sectorSize;
+		req->nSectorsLeft -= count;
+		if (!req->nSectorsLeft)
+			removePending(port, req);
+		issueCommand(port, slot, port->supportsNCQ);
+	}
+}
+// Completes the requests in 'finished'. Must be called with the port unlocked, as completion callbacks can submit more requests.
+static void finishRequests(Port* port, AsyncRequest* finished)
+{
+	while (finished)
+	{
+		AsyncRequest* next = finished->next;
+		driverInterface::BlockRequest* request = finished->request;
+		bool failed = finished->failed;
+		size_t nSectorsDone = finished->nSectorsDone;
+		finished->next = __atomic_load_n(&port->reapList, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(&port->reapList, &finished->next, finished, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+			;
+		CompleteBlockRequest(request, failed ? driverInterface::BlockRequest::STATUS_FAILED : driverInterface::BlockRequest::STATUS_SUCCESS, failed ? 0 : nSectorsDone);
+		finished = next;
+	}
+}
+// Frees the requests that finished. This can't be called in the interrupt handler.
+static void reapRequests(Port* port)
+{
+	AsyncRequest* list = __atomic_exchange_n(&port->reapList, nullptr, __ATOMIC_ACQUIRE);
+	while (list)
+	{
+		AsyncRequest* next = list->next;
+		delete list;
+		list = next;
+	}
+}
+static void pollPort(Port* port)
+{
+	AsyncRequest* finished = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockPort(port);
+	completeCommands(port, finished);
+	dispatch(port, finished);
+	unlockPort(port);
+	finishRequests(port, finished);
+	restorePreviousInterruptStatus(flags);
+}
+
+struct slotRequest
+{
+	Port* port;
+	uint32_t slot;
+};
+static bool tryAcquireSlot(void* udata)
+{
+	slotRequest* req = (slotRequest*)udata;
+	Port* port = req->port;
+	uint32_t inUse = __atomic_load_n(&port->slotsInUse, __ATOMIC_SEQ_CST);
+	while (true)
+	{
+		uint32_t freeSlots = ~inUse & port->slotMask;
+		if (!freeSlots)
+			return false;
+		uint32_t slot = __builtin_ctz(freeSlots);
+		if (__atomic_compare_exchange_n(&port->slotsInUse, &inUse, inUse | (1u << slot), false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+		{
+			req->slot = slot;
+			return true;
+		}
+	}
+}
+bool TryAcquireCommandSlot(Port* port, uint32_t* slot)
+{
+	slotRequest req{ port, 0 };
+	if (!tryAcquireSlot(&req))
+		return false;
+	*slot = req.slot;
+	return true;
+}
+uint32_t AcquireCommandSlot(Port* port)
+{
+	slotRequest req{ port, 0 };
+	if (tryAcquireSlot(&req))
+		return req.slot;
+	if (!canBlock())
+	{
+		// The slots' owners might be waiting for a completion only this cpu can see.
+		while (!tryAcquireSlot(&req))
+		{
+			pollPort(port);
+			pause();
+		}
+		return req.slot;
+	}
+	port->slotWaiters.WaitFor(tryAcquireSlot, &req);
+	return req.slot;
+}
+void ReleaseCommandSlot(Port* port, uint32_t slot)
+{
+	__atomic_and_fetch(&port->slotsInUse, ~(1u << slot), __ATOMIC_SEQ_CST);
+	port->slotWaiters.WakeOne();
+}
+void SubmitCommand(Port* port, uint32_t slot, bool queued)
+{
+	port->slots[slot].done = false;
+	port->slots[slot].failed = false;
+	port->slots[slot].owner = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockPort(port);
+	issueCommand(port, slot, queued);
+	unlockPort(port);
+	restorePreviousInterruptStatus(flags);
+}
+static bool slotDone(void* udata)
+{
+	return __atomic_load_n(&((Port::CommandSlot*)udata)->done, __ATOMIC_ACQUIRE);
+}
+bool WaitForCommand(Port* port, uint32_t slot)
+{
+	Port::CommandSlot& cmdSlot = port->slots[slot];
+	while (!slotDone(&cmdSlot))
+	{
+		if (canBlock())
+			cmdSlot.completion.WaitFor(slotDone, &cmdSlot, COMMAND_POLL_INTERVAL);
+		if (!slotDone(&cmdSlot))
+		{
+			pollPort(port);
+			if (!canBlock())
+				pause();
+		}
+	}
+	return !cmdSlot.failed;
+}
+void EnablePortInterrupts(Port* port)
+{
+	volatile HBA_PORT* pPort = port->hbaPort;
+	pPort->is = 0xFFFFFFFF;
+	pPort->ie = HBA_PxIS_ERROR_MASK | HBA_PxIS_COMPLETION_MASK;
+}
+bool SubmitAsyncRequest(Port* port, AsyncRequest* req)
+{
+	reapRequests(port);
+	AsyncRequest* finished = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockPort(port);
+	req->next = nullptr;
+	if (port->pendingTail)
+		port->pendingTail->next = req;
+	else
+		port->pendingHead = req;
+	port->pendingTail = req;
+	dispatch(port, finished);
+	unlockPort(port);
+	finishRequests(port, finished);
+	restorePreviousInterruptStatus(flags);
+	return true;
+}
+bool CancelAsyncRequest(Port* port, driverInterface::BlockRequest* request)
+{
+	AsyncRequest* found = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockPort(port);
+	// Requests are only looked up in the pending queue, as a request that isn't there could've been freed already.
+	for (AsyncRequest* req = port->pendingHead; req; req = req->next)
+	{
+		if (req->request != request)
+			continue;
+		if (!req->started)
+		{
+			removePending(port, req);
+			found = req;
+		}
+		break;
+	}
+	unlockPort(port);
+	restorePreviousInterruptStatus(flags);
+	if (!found)
+		return false;
+	delete found;
+	CompleteBlockRequest(request, driverInterface::BlockRequest::STATUS_CANCELLED, 0);
+	return true;
+}
+void PollPort(Port* port)
+{
+	pollPort(port);
+}
+void AHCIInterruptHandler(interrupt_frame*)
+{
+	uint32_t is = g_generalHostControl->is;
+	for (uint32_t ports = is; ports; ports &= ports - 1)
+	{
+		Port* port = &g_ports[__builtin_ctz(ports)];
+		if (port->driveType == Port::DRIVE_TYPE_INVALID || !port->hbaPort)
+			continue;
+		AsyncRequest* finished = nullptr;
+		lockPort(port);
+		completeCommands(port, finished);
+		// Reuse the slots that just freed up.
+		dispatch(port, finished);
+		unlockPort(port);
+		finishRequests(port, finished);
+	}
+	// PxIS has to be cleared before IS.
+	g_generalHostControl->is = is;
+	SendEOI();
+}
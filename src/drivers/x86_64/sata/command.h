@@ -8,6 +8,49 @@
 
 #include <int.h>
 
+namespace obos
+{
+	struct interrupt_frame;
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+	namespace memory
+	{
+		class PageMap;
+	}
+}
+
 uint32_t FindCMDSlot(volatile struct HBA_PORT* pPort);
 void StopCommandEngine(volatile struct HBA_PORT* pPort);
-void StartCommandEngine(volatile struct HBA_PORT* pPort);
\ No newline at end of file
+void StartCommandEngine(volatile struct HBA_PORT* pPort);
+
+// Claims a free command slot on the port, blocking until one is free.
+uint32_t AcquireCommandSlot(struct Port* port);
+// Claims a free command slot on the port if there is one.
+bool TryAcquireCommandSlot(struct Port* port, uint32_t* slot);
+void ReleaseCommandSlot(struct Port* port, uint32_t slot);
+// Issues the command set up in the slot. The slot must've been claimed by the caller.
+void SubmitCommand(struct Port* port, uint32_t slot, bool queued);
+// Waits for a submitted command to complete. Returns false if the command failed.
+bool WaitForCommand(struct Port* port, uint32_t slot);
+// Enables interrupts on the port. The port's command engine must be running.
+void EnablePortInterrupts(struct Port* port);
+void AHCIInterruptHandler(obos::interrupt_frame* frame);
+
+// Fills the command table's PRDT with the physical pages of buff, merging physically contiguous pages.
+// If touch is set, each page is faulted in first, which can't be done in the interrupt handler.
+// Returns how many sectors the PRDT describes, which is less than nSectors if the PRDT filled up.
+size_t BuildPRDT(struct Port& portDescriptor, struct HBA_CMD_TBL* cmdTBL, obos::memory::PageMap* pageMap, byte* buff, size_t nSectors, bool write, bool touch, uint16_t* nEntries);
+// Points the PRDT of the command in 'slot' at the slot's bounce buffer.
+// Returns how many sectors fit in the bounce buffer, or zero if the slot doesn't have one.
+size_t BuildBouncePRDT(struct Port& portDescriptor, uint32_t slot, size_t nSectors, uint16_t* nEntries);
+// Sets up the FIS of the command in 'slot'.
+void SetupCommand(struct Port& portDescriptor, uint32_t slot, bool write, uint64_t lbaOffset, size_t nSectors, uint16_t nEntries);
+// Queues an asynchronous request on the port, and issues as much of it as there are free slots for.
+// The buffer's pages must be faulted in.
+bool SubmitAsyncRequest(struct Port* port, struct AsyncRequest* req);
+// Cancels a request if none of its commands were issued.
+bool CancelAsyncRequest(struct Port* port, obos::driverInterface::BlockRequest* request);
+// Completes the commands the port finished, for when interrupts are off or were lost.
+void PollPort(struct Port* port);
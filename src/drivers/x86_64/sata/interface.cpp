@@ -9,30 +9,17 @@
 #include <memory_manipulation.h>
 
 #include <driverInterface/struct.h>
+#include <driverInterface/blockRequest.h>
 
 #include <x86_64-utils/asm.h>
 
 #include <allocators/vmm/arch.h>
 
-#include <arch/x86_64/memory_manager/physical/allocate.h>
-
 #include <arch/x86_64/memory_manager/virtual/initialize.h>
 
-#include <vfs/devManip/memcpy.h>
-
 #include "structs.h"
 #include "command.h"
 
-namespace obos
-{
-	namespace memory
-	{
-		OBOS_EXPORT void* MapPhysicalAddress(PageMap* pageMap, uintptr_t phys, void* to, uintptr_t cpuFlags);
-		OBOS_EXPORT void UnmapAddress(PageMap* pageMap, void* _addr);
-		OBOS_EXPORT uintptr_t DecodeProtectionFlags(uintptr_t _flags);
-	}
-}
-
 using namespace obos;
 
 Port* GetPortDescriptorFromKernelDriveID(uint32_t id)
@@ -49,6 +36,195 @@ Port* GetPortDescriptorFromKernelDriveID(uint32_t id)
     return nullptr;
 }
 
+// The most bytes one PRDT entry can describe.
+#define MAX_PRD_SIZE 0x400000
+
+size_t BuildPRDT(Port& portDescriptor, HBA_CMD_TBL* cmdTBL, memory::PageMap* pageMap, byte* buff, size_t nSectors, bool write, bool touch, uint16_t* nEntries)
+{
+    const size_t sectorSize = portDescriptor.sectorSize;
+    const size_t maxBytes = nSectors * sectorSize;
+    size_t nBytes = 0;
+    size_t entry = 0;
+    uintptr_t lastEnd = 0;
+    while (nBytes < maxBytes)
+    {
+        volatile byte* virt = buff + nBytes;
+        size_t chunk = 4096 - ((uintptr_t)virt & 0xfff);
+        if (chunk > maxBytes - nBytes)
+            chunk = maxBytes - nBytes;
+        if (touch)
+            memory::TouchBufferForDMA((void*)virt, chunk, !write);
+        uintptr_t phys = memory::GetPhysicalAddress(pageMap, (uintptr_t)virt);
+        if (!phys)
+            break;
+        if (!g_generalHostControl->cap.s64a && ((phys + chunk - 1) >> 32))
+            break;
+        HBA_PRDT_ENTRY* prd = entry ? &cmdTBL->prdt_entry[entry - 1] : nullptr;
+        if (prd && lastEnd == phys && (prd->dbc + 1 + chunk) <= MAX_PRD_SIZE)
+            prd->dbc += chunk;
+        else
+        {
+            if (entry == AHCI_PRDT_ENTRIES)
+                break;
+            prd = &cmdTBL->prdt_entry[entry++];
+            prd->dba = phys & 0xffffffff;
+            prd->dbau = phys >> 32;
+            prd->dbc = chunk - 1;
+            // Completion is signaled by the D2H Register or Set Device Bits FIS, so an interrupt per PRD isn't needed.
+            prd->i = 0;
+        }
+        lastEnd = phys + chunk;
+        nBytes += chunk;
+    }
+    // Commands transfer whole sectors, so give back the partial sector at the end.
+    size_t excess = nBytes % sectorSize;
+    while (excess)
+    {
+        HBA_PRDT_ENTRY* prd = &cmdTBL->prdt_entry[entry - 1];
+        size_t size = prd->dbc + 1;
+        if (size <= excess)
+        {
+            entry--;
+            excess -= size;
+            nBytes -= size;
+            continue;
+        }
+        prd->dbc -= excess;
+        nBytes -= excess;
+        excess = 0;
+    }
+    *nEntries = entry;
+    return nBytes / sectorSize;
+}
+size_t BuildBouncePRDT(Port& portDescriptor, uint32_t slot, size_t nSectors, uint16_t* nEntries)
+{
+    const auto& commandSlot = portDescriptor.slots[slot];
+    size_t count = AHCI_BOUNCE_BUFFER_SIZE / portDescriptor.sectorSize;
+    if (!commandSlot.bounceBuffer || !count)
+        return 0;
+    if (count > nSectors)
+        count = nSectors;
+    HBA_PRDT_ENTRY* prd = &portDescriptor.cmdTables[slot]->prdt_entry[0];
+    prd->dba = commandSlot.bounceBufferPhys & 0xffffffff;
+    prd->dbau = commandSlot.bounceBufferPhys >> 32;
+    prd->dbc = count * portDescriptor.sectorSize - 1;
+    prd->i = 0;
+    *nEntries = 1;
+    return count;
+}
+void SetupCommand(Port& portDescriptor, uint32_t slot, bool write, uint64_t lbaOffset, size_t nSectors, uint16_t nEntries)
+{
+    HBA_CMD_HEADER* cmdHeader = (HBA_CMD_HEADER*)portDescriptor.clBase + slot;
+	cmdHeader->cfl = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
+	cmdHeader->w   = write;
+	cmdHeader->prdtl = nEntries;
+    cmdHeader->prdbc = 0;
+    FIS_REG_H2D* command = (FIS_REG_H2D*)&portDescriptor.cmdTables[slot]->cfis;
+    utils::memzero(command, sizeof(*command));
+    command->fis_type = FIS_TYPE_REG_H2D;
+    command->device = 0x40; // LBA mode.
+    command->c = 1;
+    if (portDescriptor.supportsNCQ)
+    {
+        // For the FPDMA commands, the sector count goes in the feature registers, and the tag goes in the count register.
+        command->command = write ? ATA_WRITE_FPDMA_QUEUED : ATA_READ_FPDMA_QUEUED;
+        command->featurel = (uint8_t)(nSectors & 0xff);
+        command->featureh = (uint8_t)((nSectors >> 8) & 0xff);
+        command->countl = (uint8_t)(slot << 3);
+    }
+    else
+    {
+        command->command = write ? ATA_WRITE_DMA_EXT : ATA_READ_DMA_EXT;
+        command->countl = (uint8_t)(nSectors & 0xff);
+        command->counth = (uint8_t)((nSectors >> 8) & 0xff);
+    }
+    command->lba0 = (uint8_t) (lbaOffset & 0xff);
+    command->lba1 = (uint8_t)((lbaOffset >>  8) & 0xff);
+    command->lba2 = (uint8_t)((lbaOffset >> 16) & 0xff);
+    command->lba3 = (uint8_t)((lbaOffset >> 24) & 0xff);
+    command->lba4 = (uint8_t)((lbaOffset >> 32) & 0xff);
+    command->lba5 = (uint8_t)((lbaOffset >> 40) & 0xff);
+}
+// Transfers nSectors sectors between the drive and buff.
+// The HBA reads or writes buff's pages directly. Parts of buff it can't reach, such as a buffer that isn't 2-byte aligned,
+// go through the slots' bounce buffers instead. The transfer is split into as many commands as the PRDTs need,
+// which are all issued before waiting on any of them.
+static bool Transfer(Port& portDescriptor, bool write, uint64_t lbaOffset, size_t nSectors, byte* buff)
+{
+    memory::PageMap* pageMap = memory::getCurrentPageMap();
+    // Our commands, in the order they were issued.
+    struct
+    {
+        uint32_t slot;
+        // Where to copy a read from the bounce buffer to, or nullptr if the command didn't use it.
+        byte* bounceTo;
+        size_t size;
+    } inFlight[32];
+    size_t head = 0, nInFlight = 0;
+    bool ret = true;
+    auto finishOldest = [&]()
+    {
+        auto& command = inFlight[head];
+        head = (head + 1) % 32;
+        nInFlight--;
+        if (!WaitForCommand(&portDescriptor, command.slot))
+            ret = false;
+        else if (command.bounceTo)
+            utils::memcpy(command.bounceTo, portDescriptor.slots[command.slot].bounceBuffer, command.size);
+        ReleaseCommandSlot(&portDescriptor, command.slot);
+    };
+    while (nSectors && ret)
+    {
+        uint32_t slot = 0;
+        // Don't block on a slot while holding others, as their completions would never be reaped.
+        while (!TryAcquireCommandSlot(&portDescriptor, &slot))
+        {
+            if (!nInFlight)
+            {
+                slot = AcquireCommandSlot(&portDescriptor);
+                break;
+            }
+            finishOldest();
+        }
+        uint16_t nEntries = 0;
+        size_t count = 0;
+        const size_t maxSectors = nSectors < 0xffff ? nSectors : 0xffff;
+        // PRDT entries need to be word-aligned.
+        bool bounce = (uintptr_t)buff & 1;
+        if (!bounce)
+        {
+            count = BuildPRDT(portDescriptor, portDescriptor.cmdTables[slot], pageMap, buff, maxSectors, write, true, &nEntries);
+            // The first page couldn't be given to the HBA, eg. it's above 4 GiB and the HBA only takes 32-bit addresses.
+            bounce = !count;
+        }
+        if (bounce)
+        {
+            count = BuildBouncePRDT(portDescriptor, slot, maxSectors, &nEntries);
+            if (count && write)
+                utils::memcpy(portDescriptor.slots[slot].bounceBuffer, buff, count * portDescriptor.sectorSize);
+        }
+        if (!count)
+        {
+            logger::warning("AHCI: %s: Could not build a PRDT for buffer 0x%p.\n", __func__, buff);
+            ReleaseCommandSlot(&portDescriptor, slot);
+            ret = false;
+            break;
+        }
+        SetupCommand(portDescriptor, slot, write, lbaOffset, count, nEntries);
+        SubmitCommand(&portDescriptor, slot, portDescriptor.supportsNCQ);
+        auto& command = inFlight[(head + nInFlight++) % 32];
+        command.slot = slot;
+        command.bounceTo = bounce && !write ? buff : nullptr;
+        command.size = count * portDescriptor.sectorSize;
+        nSectors -= count;
+        lbaOffset += count;
+        buff += count * portDescriptor.sectorSize;
+    }
+    while (nInFlight)
+        finishOldest();
+    return ret;
+}
+
 bool DriveReadSectors(
 	uint32_t driveId,
 	uint64_t lbaOffset,
@@ -61,98 +237,52 @@ bool DriveReadSectors(
     if (!_portDescriptor)
         return false;
     Port& portDescriptor = *_portDescriptor;
-    volatile HBA_PORT* pPort = portDescriptor.hbaPort;
     if ((lbaOffset + nSectorsToRead) > portDescriptor.nSectors)
     {
         if (oNSectorsRead)
             *oNSectorsRead = 0;
         return true;
     }
-    // Based on nSectorsToRead and portDescriptor.sectorSize, we might need to send multiple READ commands to get all our data.
+    size_t size = nSectorsToRead * portDescriptor.sectorSize;
     memory::VirtualAllocator vallocator{ nullptr };
-    size_t pagesToRead = (nSectorsToRead * portDescriptor.sectorSize) / 4096;
-	if (((nSectorsToRead * portDescriptor.sectorSize) % 4096) != 0)
-        pagesToRead++;
-    size_t blocksToRead = (pagesToRead / 1024) + ((pagesToRead % 1024) != 0);
-    uintptr_t *responsePhysicalAddresses = new uintptr_t[blocksToRead];
-    uintptr_t responsePhysicalAddressBase = memory::allocatePhysicalPage(pagesToRead);
-    for (size_t i = 0; i < blocksToRead; i++)
-        responsePhysicalAddresses[i] = responsePhysicalAddressBase + i * 1024;
-    StopCommandEngine(pPort);
-    size_t currentSectorCount = nSectorsToRead;
-    size_t currentPageCount = pagesToRead;
-    size_t currentLBAOffset = lbaOffset;
-	uint32_t cmdSlot = FindCMDSlot(pPort);
-    HBA_CMD_HEADER* cmdHeader = (HBA_CMD_HEADER*)portDescriptor.clBase + cmdSlot;
-	cmdHeader->cfl = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
-	cmdHeader->w   = 0; // Device to Host.
-	cmdHeader->prdtl = 1; // One PRDT entry
-    HBA_CMD_TBL* cmdTBL = 
-	    (HBA_CMD_TBL*)
-	    (
-	    	(byte*)portDescriptor.clBase +
-	    	 ((cmdHeader->ctba | ((uintptr_t)cmdHeader->ctbau << 32)) /* physical address of the HBA_CMD_TBL */ & 0xfff) // The offset of the HBA_CMD_TBL
-	    );
-    for (size_t i = 0; i < blocksToRead; i++)
+    byte* response = (byte*)vallocator.VirtualAlloc(nullptr, size, memory::PROT_NO_COW_ON_ALLOCATE);
+    if (!response)
+        return false;
+    if (!Transfer(portDescriptor, false, lbaOffset, nSectorsToRead, response))
     {
-	    uintptr_t responsePhys = responsePhysicalAddresses[i];
-	    // Setup the command slot.
-	    cmdTBL->prdt_entry[0].dba = responsePhys & 0xffffffff;
-	    if (g_generalHostControl->cap.s64a)
-	    	cmdTBL->prdt_entry[0].dbau = responsePhys >> 32;
-	    else
-	    	if (responsePhys >> 32)
-	    		logger::panic(nullptr, "AHCI: %s: responsePhys has its upper 32-bits set and cap.s64a is false.\n", __func__);
-	    cmdTBL->prdt_entry[0].dbc = currentPageCount * 4096 - 1;
-	    cmdTBL->prdt_entry[0].i = 1;
-	    FIS_REG_H2D* command = (FIS_REG_H2D*)&cmdTBL->cfis;
-	    utils::memzero(command, sizeof(*command));
-	    command->fis_type = FIS_TYPE_REG_H2D;
-	    command->command = ATA_READ_DMA_EXT;
-	    command->device = 0x40;
-	    command->c = 1;
-        uint16_t count = i == (blocksToRead - 1) ? currentSectorCount : 1024;
-	    command->countl = (uint8_t)(count & 0xff);
-	    command->counth = (uint8_t)((count >> 8) & 0xff);
-        command->lba0 = (uint8_t) (currentLBAOffset & 0xff);
-        command->lba1 = (uint8_t)((currentLBAOffset >>  8) & 0xff);
-        command->lba2 = (uint8_t)((currentLBAOffset >> 16) & 0xff);
-        command->lba3 = (uint8_t)((currentLBAOffset >> 24) & 0xff);
-        command->lba4 = (uint8_t)((currentLBAOffset >> 32) & 0xff);
-        command->lba5 = (uint8_t)((currentLBAOffset >> 48) & 0xff);
-	    // Wait on the port.
-	    // 0x88: ATA_DEV_BUSY | ATA_DEV_DRQ
-	    while ((pPort->tfd & 0x88))
-	    	pause();
-	    // Issue the command
-	    pPort->ci = (1 << cmdSlot);
-	    // Wait for the command.
-	    // TODO: Make this interrupt driven.
-	    StartCommandEngine(pPort);
-	    while ( (pPort->ci & (1 << cmdSlot)) && !(pPort->is & (0xFD800000)) /*An error in the IS.*/ );
-        if (currentSectorCount > (4096 / portDescriptor.sectorSize))
-            currentSectorCount -= (4096 / portDescriptor.sectorSize);
-        if (currentPageCount > 1024)
-            currentPageCount -= 1024;
-        currentLBAOffset += (nSectorsToRead - currentSectorCount);
+        vallocator.VirtualFree(response, size);
+        return false;
     }
     if (oNSectorsRead)
         *oNSectorsRead = nSectorsToRead;
     if (buff)
-    {
-        memory::PageMap* currentPageMap = memory::getCurrentPageMap();
-        byte* response = (byte*)memory::_Impl_FindUsableAddress(nullptr, pagesToRead);
-        size_t i = 0;
-        for (byte* addr = response; addr < (response + pagesToRead * 4096); addr += 4096, i++)
-            memory::MapPhysicalAddress(
-                currentPageMap,
-                responsePhysicalAddressBase + i * 4096,
-                addr,
-                memory::DecodeProtectionFlags(0)|1
-            );
         *buff = response;
+    else
+        vallocator.VirtualFree(response, size);
+    return true;
+}
+bool DriveReadSectorsInto(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void* buff,
+	size_t* oNSectorsRead
+	)
+{
+    Port* _portDescriptor = GetPortDescriptorFromKernelDriveID(driveId);
+    if (!_portDescriptor || !buff)
+        return false;
+    Port& portDescriptor = *_portDescriptor;
+    if ((lbaOffset + nSectorsToRead) > portDescriptor.nSectors)
+    {
+        if (oNSectorsRead)
+            *oNSectorsRead = 0;
+        return true;
     }
-    delete[] responsePhysicalAddresses;
+    if (!Transfer(portDescriptor, false, lbaOffset, nSectorsToRead, (byte*)buff))
+        return false;
+    if (oNSectorsRead)
+        *oNSectorsRead = nSectorsToRead;
     return true;
 }
 bool DriveWriteSectors(
@@ -164,107 +294,61 @@ bool DriveWriteSectors(
 	)
 {
     Port* _portDescriptor = GetPortDescriptorFromKernelDriveID(driveId);
-    if (!_portDescriptor)
+    if (!_portDescriptor || !buff)
         return false;
     Port& portDescriptor = *_portDescriptor;
-    volatile HBA_PORT* pPort = portDescriptor.hbaPort;
     if ((lbaOffset + nSectorsToWrite) > portDescriptor.nSectors)
     {
         if (oNSectorsWrote)
             *oNSectorsWrote = 0;
         return true;
     }
-    // Based on nSectorsToRead and portDescriptor.sectorSize, we might need to send multiple READ commands to get all our data.
-    memory::VirtualAllocator vallocator{ nullptr };
-    size_t pagesToWrite = (nSectorsToWrite * portDescriptor.sectorSize) / 4096;
-	if (((nSectorsToWrite * portDescriptor.sectorSize) % 4096) != 0)
-        pagesToWrite++;
-    size_t blocksToWrite = (pagesToWrite / 1024) + ((pagesToWrite % 1024) != 0);
-    uintptr_t *dataPhysicalAddresses = new uintptr_t[blocksToWrite];
-    uintptr_t dataPhysicalAddressBase = memory::allocatePhysicalPage(pagesToWrite);
-    for (size_t i = 0; i < blocksToWrite; i++)
-        dataPhysicalAddresses[i] = dataPhysicalAddressBase + i * 1024;
-    {
-        memory::PageMap* currentPageMap = memory::getCurrentPageMap();
-        byte* data = (byte*)memory::_Impl_FindUsableAddress(nullptr, pagesToWrite);
-        size_t i = 0;
-        for (byte* addr = data; addr < (data + pagesToWrite * 4096); addr += 4096, i++)
-            memory::MapPhysicalAddress(
-                currentPageMap,
-                dataPhysicalAddressBase + i * 4096,
-                addr,
-                memory::DecodeProtectionFlags(0)|1
-            );
-        // Should always exist on x86-64, so we're good using it without the check.
-        vfs::_VectorizedMemcpy64B(data, buff, (nSectorsToWrite * portDescriptor.sectorSize) / 64);
-        i = 0;
-        for (byte* addr = data; addr < (data + pagesToWrite * 4096); addr += 4096, i++)
-            memory::UnmapAddress(currentPageMap, addr);
-    }
-    StopCommandEngine(pPort);
-    size_t currentSectorCount = nSectorsToWrite;
-    size_t currentPageCount = pagesToWrite;
-    size_t currentLBAOffset = lbaOffset;
-	uint32_t cmdSlot = FindCMDSlot(pPort);
-    HBA_CMD_HEADER* cmdHeader = (HBA_CMD_HEADER*)portDescriptor.clBase + cmdSlot;
-	cmdHeader->cfl = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
-	cmdHeader->w   = 1; // Host to Device.
-	cmdHeader->prdtl = 1; // One PRDT entry
-    HBA_CMD_TBL* cmdTBL = 
-	    (HBA_CMD_TBL*)
-	    (
-	    	(byte*)portDescriptor.clBase +
-	    	 ((cmdHeader->ctba | ((uintptr_t)cmdHeader->ctbau << 32)) /* physical address of the HBA_CMD_TBL */ - portDescriptor.clBasePhys) // The offset of the HBA_CMD_TBL
-	    );
-    for (size_t i = 0; i < blocksToWrite; i++)
+    bool ret = Transfer(portDescriptor, true, lbaOffset, nSectorsToWrite, (byte*)buff);
+    if (ret && oNSectorsWrote)
+        *oNSectorsWrote = nSectorsToWrite;
+    return ret;
+}
+bool DriveSubmitRequest(driverInterface::BlockRequest* request)
+{
+    Port* portDescriptor = GetPortDescriptorFromKernelDriveID(request->driveId);
+    if (!portDescriptor)
+        return false;
+    // Commands can be issued from the interrupt handler, in any address space, so only kernel memory can be bounced.
+    const bool canBounce = (uintptr_t)request->buffer >= 0xffff800000000000;
+    // PRDT entries need to be word-aligned, so a buffer that isn't has to be bounced.
+    if (((uintptr_t)request->buffer & 1) && !canBounce)
+        return false;
+    const bool write = request->operation == driverInterface::BlockRequest::OPERATION_WRITE;
+    if (!request->nSectors || (request->lbaOffset + request->nSectors) > portDescriptor->nSectors)
     {
-	    uintptr_t dataPhys = dataPhysicalAddresses[i];
-	    // Setup the command slot.
-	    cmdTBL->prdt_entry[0].dba = dataPhys & 0xffffffff;
-	    if (g_generalHostControl->cap.s64a)
-	    	cmdTBL->prdt_entry[0].dbau = dataPhys >> 32;
-	    else
-	    	if (dataPhys >> 32)
-	    		logger::panic(nullptr, "AHCI: %s: dataPhys has its upper 32-bits set and cap.s64a is false.\n", __func__);
-	    cmdTBL->prdt_entry[0].dbc = currentPageCount * 4096 - 1;
-	    cmdTBL->prdt_entry[0].i = 1;
-	    FIS_REG_H2D* command = (FIS_REG_H2D*)&cmdTBL->cfis;
-	    utils::memzero(command, sizeof(*command));
-	    command->fis_type = FIS_TYPE_REG_H2D;
-	    command->command = ATA_WRITE_DMA_EXT;
-	    command->device = 0;
-	    command->c = 1;
-        uint16_t count = i == (blocksToWrite - 1) ? currentSectorCount : 1024;
-	    command->countl = (uint8_t)(count & 0xff);
-	    command->counth = (uint8_t)((count >> 8) & 0xff);
-        command->lba0 = (currentLBAOffset & 0xff);
-        command->lba1 = ((currentLBAOffset >> 8) & 0xff);
-        command->lba2 = ((currentLBAOffset >> 16) & 0xff);
-        command->lba3 = ((currentLBAOffset >> 24) & 0xff);
-        command->lba4 = ((currentLBAOffset >> 32) & 0xff);
-        command->lba5 = ((currentLBAOffset >> 48) & 0xff);
-	    // Wait on the port.
-	    // 0x88: ATA_DEV_BUSY | ATA_DEV_DRQ
-	    while ((pPort->tfd & 0x88))
-	    	pause();
-	    // Issue the command
-	    pPort->ci = (1 << cmdSlot);
-	    // Wait for the command.
-	    // TODO: Make this interrupt driven.
-	    StartCommandEngine(pPort);
-	    while ( (pPort->ci & (1 << cmdSlot)) && !(pPort->is & (0xFD800000)) /*An error in the IS.*/ );
-        if (currentSectorCount > (4096 / portDescriptor.sectorSize))
-            currentSectorCount -= (4096 / portDescriptor.sectorSize);
-        if (currentPageCount > 1024)
-            currentPageCount -= 1024;
-        currentLBAOffset += (nSectorsToWrite - currentSectorCount);
+        driverInterface::CompleteBlockRequest(request, driverInterface::BlockRequest::STATUS_SUCCESS, 0);
+        return true;
     }
-    if (oNSectorsWrote)
-        *oNSectorsWrote = nSectorsToWrite;
-    for (uintptr_t _phys = dataPhysicalAddressBase; _phys < (_phys + (pagesToWrite * 4096)); _phys += 4096)
-        memory::freePhysicalPage(_phys);
-    delete[] dataPhysicalAddresses;
-    return true;
+    // The commands can be issued from the interrupt handler, where the buffer's pages can't be faulted in, so do that now.
+    memory::TouchBufferForDMA(request->buffer, request->nSectors * portDescriptor->sectorSize, !write);
+    AsyncRequest* req = new AsyncRequest{};
+    req->request = request;
+    req->write = write;
+    req->pageMap = memory::getCurrentPageMap();
+    req->lba = request->lbaOffset;
+    req->buff = (byte*)request->buffer;
+    req->nSectorsLeft = request->nSectors;
+    req->canBounce = canBounce;
+    request->driverData = req;
+    return SubmitAsyncRequest(portDescriptor, req);
+}
+bool DriveCancelRequest(driverInterface::BlockRequest* request)
+{
+    Port* portDescriptor = GetPortDescriptorFromKernelDriveID(request->driveId);
+    if (!portDescriptor)
+        return false;
+    return CancelAsyncRequest(portDescriptor, request);
+}
+void DrivePoll(uint32_t driveId)
+{
+    Port* portDescriptor = GetPortDescriptorFromKernelDriveID(driveId);
+    if (portDescriptor)
+        PollPort(portDescriptor);
 }
 bool DriveQueryInfo(
 	uint32_t driveId,
@@ -24,6 +24,9 @@
 
 #include <x86_64-utils/asm.h>
 
+#include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/irq/irq.h>
+
 #include "structs.h"
 #include "command.h"
 
@@ -57,11 +60,21 @@ extern bool DriveWriteSectors(
 	char* buff,
 	size_t* oNSectorsWrote
 	);
+extern bool DriveReadSectorsInto(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void* buff,
+	size_t* oNSectorsRead
+	);
 extern bool DriveQueryInfo(
 	uint32_t driveId,
 	uint64_t *oNSectors,
 	uint64_t *oBytesPerSector
 	);
+extern bool DriveSubmitRequest(driverInterface::BlockRequest* request);
+extern bool DriveCancelRequest(driverInterface::BlockRequest* request);
+extern void DrivePoll(uint32_t driveId);
 
 driverInterface::driverHeader DEFINE_IN_SECTION g_driverHeader = {
 	.magicNumber = obos::driverInterface::OBOS_DRIVER_HEADER_MAGIC,
@@ -76,7 +89,11 @@ driverInterface::driverHeader DEFINE_IN_SECTION g_driverHeader = {
 				.ReadSectors = DriveReadSectors,
 				.WriteSectors = DriveWriteSectors,
 				.QueryDiskInfo = DriveQueryInfo,
-				.unused = {nullptr,nullptr,nullptr,nullptr,nullptr,nullptr,}
+				.ReadSectorsInto = DriveReadSectorsInto,
+				.SubmitRequest = DriveSubmitRequest,
+				.CancelRequest = DriveCancelRequest,
+				.PollDrive = DrivePoll,
+				.unused = {nullptr,nullptr,}
 			}
 		}
 	},
@@ -142,6 +159,39 @@ void hexdump(void* _buff, size_t nBytes, const size_t width = 31)
 	}
 }
 
+// Points the device's MSI at the current cpu's local APIC.
+static bool EnableMSI(uint8_t bus, uint8_t slot, uint8_t function, uint8_t vector)
+{
+	// Status bit 4: The device has a capabilities list.
+	if (!(driverInterface::pciReadWordRegister(bus, slot, function, PCI_GetRegisterOffset(1, 2)) & (1<<4)))
+		return false;
+	uint8_t capability = driverInterface::pciReadByteRegister(bus, slot, function, PCI_GetRegisterOffset(13, 0)) & ~0b11;
+	for (; capability; capability = driverInterface::pciReadByteRegister(bus, slot, function, capability + 1) & ~0b11)
+	{
+		if (driverInterface::pciReadByteRegister(bus, slot, function, capability) != 0x05 /* MSI */)
+			continue;
+		uint16_t messageControl = driverInterface::pciReadWordRegister(bus, slot, function, capability + 2);
+		uint32_t address = 0xFEE00000 | ((g_localAPICAddr->lapicID >> 24) << 12);
+		driverInterface::pciWriteDwordRegister(bus, slot, function, capability + 4, address);
+		if (messageControl & (1<<7) /* 64-bit capable */)
+		{
+			driverInterface::pciWriteDwordRegister(bus, slot, function, capability + 8, 0);
+			driverInterface::pciWriteWordRegister(bus, slot, function, capability + 12, vector);
+		}
+		else
+			driverInterface::pciWriteWordRegister(bus, slot, function, capability + 8, vector);
+		// Request one message, and enable MSI.
+		messageControl &= ~(0b111 << 4);
+		messageControl |= (1<<0);
+		driverInterface::pciWriteWordRegister(bus, slot, function, capability + 2, messageControl);
+		// Turn off INTx, so the interrupt isn't delivered twice.
+		uint16_t pciCommand = driverInterface::pciReadWordRegister(bus, slot, function, PCI_GetRegisterOffset(1, 0));
+		driverInterface::pciWriteWordRegister(bus, slot, function, PCI_GetRegisterOffset(1, 0), pciCommand | (1<<10));
+		return true;
+	}
+	return false;
+}
+
 void InitializeAHCI(uint32_t*, uint8_t bus, uint8_t slot, uint8_t function)
 {
 	// Map the HBA memory registers.
@@ -259,13 +309,29 @@ void InitializeAHCI(uint32_t*, uint8_t bus, uint8_t slot, uint8_t function)
 		for (uint8_t slot = 0; slot < 32; slot++)
 		{
 			HBA_CMD_HEADER* cmdHeader = (HBA_CMD_HEADER*)portDescriptor.clBase + slot;
-			uintptr_t ctba = clBase + sizeof(HBA_CMD_HEADER) * 32 + slot * sizeof(HBA_CMD_TBL);
+			// Each command table gets its own page, so it can hold a full PRDT.
+			uintptr_t ctba = memory::allocatePhysicalPage();
+			portDescriptor.cmdTables[slot] = (HBA_CMD_TBL*)memory::mapPageTable((uintptr_t*)ctba);
+			utils::memzero(portDescriptor.cmdTables[slot], sizeof(HBA_CMD_TBL));
 			cmdHeader->ctba = (uint32_t)ctba & 0xffffffff;
 			if (g_generalHostControl->cap.s64a)
 				cmdHeader->ctbau = ctba >> 32;
 			else
 				if (ctba >> 32)
 					logger::panic(nullptr, "AHCI: %s: ctba has its upper 32-bits set and cap.s64a is false.\n", __func__);
+			if (slot > g_generalHostControl->cap.nsc)
+				continue;
+			// Allocate the slot's bounce buffer now, so transfers never have to.
+			uintptr_t bounce = memory::allocatePhysicalPage(AHCI_BOUNCE_BUFFER_SIZE / 4096);
+			if (bounce && !g_generalHostControl->cap.s64a && ((bounce + AHCI_BOUNCE_BUFFER_SIZE - 1) >> 32))
+			{
+				memory::freePhysicalPage(bounce, AHCI_BOUNCE_BUFFER_SIZE / 4096);
+				bounce = 0;
+			}
+			if (!bounce)
+				continue;
+			portDescriptor.slots[slot].bounceBuffer = (byte*)memory::mapPageTable((uintptr_t*)bounce);
+			portDescriptor.slots[slot].bounceBufferPhys = bounce;
 		}
 		// Send IDENTIFIY ATA to find out information about the connected drives (eg: sector count, sector size)
 		uint32_t cmdSlot = FindCMDSlot(pPort);
@@ -278,12 +344,7 @@ void InitializeAHCI(uint32_t*, uint8_t bus, uint8_t slot, uint8_t function)
 		cmdHeader->cfl = sizeof(FIS_REG_H2D) / sizeof(uint32_t);
 		cmdHeader->w   = 0; // Device to Host.
 		cmdHeader->prdtl = 1; // One PRDT entry
-		HBA_CMD_TBL* cmdTBL = 
-		(HBA_CMD_TBL*)
-		(
-			(byte*)portDescriptor.clBase +
-			 ((cmdHeader->ctba | ((uintptr_t)cmdHeader->ctbau << 32)) /* physical address of the HBA_CMD_TBL */ - portDescriptor.clBasePhys) // The offset of the HBA_CMD_TBL
-		);
+		HBA_CMD_TBL* cmdTBL = portDescriptor.cmdTables[cmdSlot];
 		cmdTBL->prdt_entry[0].dba = responsePhys & 0xffffffff;
 		if (g_generalHostControl->cap.s64a)
 			cmdTBL->prdt_entry[0].dbau = responsePhys >> 32;
@@ -313,17 +374,37 @@ void InitializeAHCI(uint32_t*, uint8_t bus, uint8_t slot, uint8_t function)
 			portDescriptor.sectorSize = 512; // Assume one sector = 512 bytes.
 		size_t nSectors = *(uint64_t*)(response + (100 * 2));
 		portDescriptor.driveType = pPort->sig == SATA_SIG_ATA ? Port::DRIVE_TYPE_SATA : Port::DRIVE_TYPE_SATAPI;
+		// Word 76, bit 8: NCQ supported. Word 75, bits 0-4: The queue depth minus one.
+		uint16_t sataCapabilities = *(volatile uint16_t*)(response + (76 * 2));
+		uint8_t queueDepth = (*(volatile uint16_t*)(response + (75 * 2)) & 0x1f) + 1;
+		uint8_t nSlots = g_generalHostControl->cap.nsc + 1;
+		portDescriptor.supportsNCQ = g_generalHostControl->cap.sncq && (sataCapabilities & (1<<8));
+		if (portDescriptor.supportsNCQ && queueDepth < nSlots)
+			nSlots = queueDepth;
+		portDescriptor.slotMask = nSlots == 32 ? 0xffffffff : ((1u << nSlots) - 1);
 		vallocator.VirtualFree((void*)response, 4096);
 		// Register the drive with the kernel.
 		portDescriptor.kernelID = portDescriptor.driveType == Port::DRIVE_TYPE_SATA ? driverInterface::RegisterDevice(driverInterface::DeviceType::Drive) : 0xffffffff;
-		logger::info("AHCI: Found %s drive at port %d. Kernel drive ID: %d, sector count: 0x%016X, sector size 0x%08X.\n",
+		logger::info("AHCI: Found %s drive at port %d. Kernel drive ID: %d, sector count: 0x%016X, sector size 0x%08X, command slots: %d%s.\n",
 			portDescriptor.driveType == Port::DRIVE_TYPE_SATA ? "SATA" : "SATAPI",
 			port,
 			portDescriptor.kernelID,
 			nSectors,
-			portDescriptor.sectorSize);
+			portDescriptor.sectorSize,
+			nSlots,
+			portDescriptor.supportsNCQ ? ", NCQ" : "");
 		portDescriptor.nSectors = nSectors;
+		if (portDescriptor.driveType == Port::DRIVE_TYPE_SATA)
+			EnablePortInterrupts(&portDescriptor);
+	}
+	RegisterInterruptHandler(AHCI_IRQ_VECTOR, AHCIInterruptHandler);
+	if (!EnableMSI(bus, slot, function, AHCI_IRQ_VECTOR))
+	{
+		uint8_t irq = driverInterface::pciReadByteRegister(bus, slot, function, PCI_GetRegisterOffset(15, 0));
+		if (irq == 0xff || !MapIRQToVector(irq, AHCI_IRQ_VECTOR))
+			logger::warning("AHCI: Could not route the HBA's interrupt. Commands will be polled.\n");
 	}
+	g_generalHostControl->ghc.ie = true;
 }
 
 extern "C" void _start()
@@ -8,7 +8,19 @@
 
 #include <int.h>
 
-#include <multitasking/locks/mutex.h>
+#include <multitasking/locks/waitQueue.h>
+
+namespace obos
+{
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+	namespace memory
+	{
+		class PageMap;
+	}
+}
 
 #define	SATA_SIG_ATA	0x00000101	// SATA drive
 #define	SATA_SIG_ATAPI	0xEB140101	// SATAPI drive
@@ -18,6 +30,18 @@
 #define HBA_PORT_IPM_ACTIVE 1
 #define HBA_PORT_DET_PRESENT 3
 
+// Bits in PxIS that mean the HBA stopped processing commands.
+#define HBA_PxIS_ERROR_MASK 0xFD800000
+// PxIS bits for the FISes a command completion can send (D2H Register, PIO Setup, DMA Setup, Set Device Bits).
+#define HBA_PxIS_COMPLETION_MASK 0xF
+
+#define AHCI_IRQ_VECTOR 0x40
+
+// Enough PRDT entries for a command table to take up exactly one page.
+#define AHCI_PRDT_ENTRIES 248
+// The size of each command slot's bounce buffer, which is used for buffers the HBA can't transfer to directly.
+#define AHCI_BOUNCE_BUFFER_SIZE 0x2000
+
 struct HBA_PORT
 {
 	uint32_t clb;		// 0x00, command list base address, 1K-byte aligned
@@ -280,9 +304,33 @@ struct HBA_CMD_TBL
  
 	uint8_t rsv[48];
  
-	HBA_PRDT_ENTRY prdt_entry[4];
+	HBA_PRDT_ENTRY prdt_entry[AHCI_PRDT_ENTRIES];
 };
+static_assert(sizeof(HBA_CMD_TBL) == 4096, "struct HBA_CMD_TBL has an invalid size.");
 
+// The driver's state for a BlockRequest.
+struct AsyncRequest
+{
+	obos::driverInterface::BlockRequest* request = nullptr;
+	bool write = false;
+	// The address space the buffer is in.
+	obos::memory::PageMap* pageMap = nullptr;
+	// Where the next command starts.
+	uint64_t lba = 0;
+	byte* buff = nullptr;
+	// The sectors that still need a command.
+	size_t nSectorsLeft = 0;
+	size_t nSectorsDone = 0;
+	// The slots with one of this request's commands.
+	uint32_t slotsOwned = 0;
+	// Whether any of the request's commands were issued.
+	bool started = false;
+	bool failed = false;
+	// Whether the buffer can be copied through a bounce buffer, which needs it to be mapped in every address space.
+	bool canBounce = false;
+	// The port's pending queue, or the list of requests to free.
+	AsyncRequest* next = nullptr;
+};
 struct Port
 {
 	uint8_t id = 0;
@@ -290,6 +338,8 @@ struct Port
 	volatile void* clBase = nullptr;
 	volatile void* fisBase = nullptr;
 	uintptr_t clBasePhys = 0, fisBasePhys = 0;
+	// Each slot's command table, through the HHDM.
+	HBA_CMD_TBL* cmdTables[32];
 	uint32_t sectorSize = 0;
 	uint64_t nSectors = 0;
 	enum DriverType
@@ -298,14 +348,44 @@ struct Port
 		DRIVE_TYPE_SATA,
 		DRIVE_TYPE_SATAPI,
 	} driveType = DRIVE_TYPE_INVALID;
-	obos::locks::Mutex lock{ true };
 	uint32_t kernelID = 0xffffffff;
+	// Whether the drive and the HBA support native command queuing.
+	bool supportsNCQ = false;
+	// The slots that can be used on this port. For NCQ, this is limited by the drive's queue depth, as the slot is used as the tag.
+	uint32_t slotMask = 0;
+	// Slots owned by a thread.
+	uint32_t slotsInUse = 0;
+	// Slots issued to the HBA that haven't completed yet. Protected by issueLock.
+	uint32_t slotsIssued = 0;
+	bool issueLock = false;
+	// Threads waiting for a slot.
+	obos::locks::WaitQueue slotWaiters;
+	// Asynchronous requests waiting for a slot. Protected by issueLock.
+	AsyncRequest *pendingHead = nullptr, *pendingTail = nullptr;
+	// Finished requests, freed on the next submission, as they can't be freed in the interrupt handler.
+	AsyncRequest* reapList = nullptr;
+	struct CommandSlot
+	{
+		obos::locks::WaitQueue completion;
+		bool done;
+		bool failed;
+		// The asynchronous request the command is part of, or nullptr if a thread is waiting on it.
+		AsyncRequest* owner;
+		size_t nSectors;
+		// Physically contiguous, and mapped through the HHDM. This is nullptr if it couldn't be allocated.
+		byte* bounceBuffer;
+		uintptr_t bounceBufferPhys;
+		// Where to copy the bounce buffer to when an asynchronous read completes, or nullptr if the command didn't use it.
+		byte* bounceTo;
+	} slots[32];
 };
 
 enum
 {
 	ATA_READ_DMA_EXT    = 0x25,
 	ATA_WRITE_DMA_EXT   = 0x35,
+	ATA_READ_FPDMA_QUEUED  = 0x60,
+	ATA_WRITE_FPDMA_QUEUED = 0x61,
 	ATA_IDENTIFY_DEVICE = 0xEC,
 };
 
@@ -0,0 +1,183 @@
+/*
+	drivers/x86_64/virtioBlk/interface.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+
+#include <driverInterface/struct.h>
+#include <driverInterface/blockRequest.h>
+
+#include <allocators/vmm/vmm.h>
+
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+
+#include "structs.h"
+#include "virtqueue.h"
+
+using namespace obos;
+
+Device* GetDeviceFromKernelDriveID(uint32_t id)
+{
+	for (size_t i = 0; i < g_nDevices; i++)
+		if (g_devices[i].kernelID == id)
+			return &g_devices[i];
+	return nullptr;
+}
+
+// Transfers nSectors sectors between the drive and buff, on the current cpu's queue.
+// The device reads or writes buff's pages directly, and descriptors have no alignment requirement, so nothing is bounced.
+static bool Transfer(Device* dev, bool write, uint64_t lbaOffset, size_t nSectors, byte* buff)
+{
+	memory::TouchBufferForDMA(buff, nSectors * dev->sectorSize, !write);
+	Request req{};
+	req.write = write;
+	req.pageMap = memory::getCurrentPageMap();
+	req.lba = lbaOffset;
+	req.buff = buff;
+	req.nSectorsLeft = nSectors;
+	Queue* queue = GetQueue(dev);
+	SubmitRequest(queue, &req);
+	return WaitForRequest(queue, &req);
+}
+
+bool DriveReadSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void** buff,
+	size_t* oNSectorsRead
+	)
+{
+	Device* dev = GetDeviceFromKernelDriveID(driveId);
+	if (!dev)
+		return false;
+	if ((lbaOffset + nSectorsToRead) > dev->nSectors)
+	{
+		if (oNSectorsRead)
+			*oNSectorsRead = 0;
+		return true;
+	}
+	size_t size = nSectorsToRead * dev->sectorSize;
+	memory::VirtualAllocator vallocator{ nullptr };
+	byte* response = (byte*)vallocator.VirtualAlloc(nullptr, size, memory::PROT_NO_COW_ON_ALLOCATE);
+	if (!response)
+		return false;
+	if (!Transfer(dev, false, lbaOffset, nSectorsToRead, response))
+	{
+		vallocator.VirtualFree(response, size);
+		return false;
+	}
+	if (oNSectorsRead)
+		*oNSectorsRead = nSectorsToRead;
+	if (buff)
+		*buff = response;
+	else
+		vallocator.VirtualFree(response, size);
+	return true;
+}
+bool DriveReadSectorsInto(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void* buff,
+	size_t* oNSectorsRead
+	)
+{
+	Device* dev = GetDeviceFromKernelDriveID(driveId);
+	if (!dev || !buff)
+		return false;
+	if ((lbaOffset + nSectorsToRead) > dev->nSectors)
+	{
+		if (oNSectorsRead)
+			*oNSectorsRead = 0;
+		return true;
+	}
+	if (!Transfer(dev, false, lbaOffset, nSectorsToRead, (byte*)buff))
+		return false;
+	if (oNSectorsRead)
+		*oNSectorsRead = nSectorsToRead;
+	return true;
+}
+bool DriveWriteSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToWrite,
+	char* buff,
+	size_t* oNSectorsWrote
+	)
+{
+	Device* dev = GetDeviceFromKernelDriveID(driveId);
+	if (!dev || !buff || dev->readOnly)
+		return false;
+	if ((lbaOffset + nSectorsToWrite) > dev->nSectors)
+	{
+		if (oNSectorsWrote)
+			*oNSectorsWrote = 0;
+		return true;
+	}
+	bool ret = Transfer(dev, true, lbaOffset, nSectorsToWrite, (byte*)buff);
+	if (ret && oNSectorsWrote)
+		*oNSectorsWrote = nSectorsToWrite;
+	return ret;
+}
+bool DriveSubmitRequest(driverInterface::BlockRequest* request)
+{
+	Device* dev = GetDeviceFromKernelDriveID(request->driveId);
+	if (!dev)
+		return false;
+	const bool write = request->operation == driverInterface::BlockRequest::OPERATION_WRITE;
+	if (write && dev->readOnly)
+		return false;
+	if (!request->nSectors || (request->lbaOffset + request->nSectors) > dev->nSectors)
+	{
+		driverInterface::CompleteBlockRequest(request, driverInterface::BlockRequest::STATUS_SUCCESS, 0);
+		return true;
+	}
+	memory::TouchBufferForDMA(request->buffer, request->nSectors * dev->sectorSize, !write);
+	Request* req = new Request{};
+	req->blockRequest = request;
+	req->write = write;
+	req->pageMap = memory::getCurrentPageMap();
+	req->lba = request->lbaOffset;
+	req->buff = (byte*)request->buffer;
+	req->nSectorsLeft = request->nSectors;
+	request->driverData = req;
+	SubmitRequest(GetQueue(dev), req);
+	return true;
+}
+bool DriveCancelRequest(driverInterface::BlockRequest* request)
+{
+	Device* dev = GetDeviceFromKernelDriveID(request->driveId);
+	if (!dev)
+		return false;
+	// The request could've been submitted on any cpu's queue.
+	for (uint16_t i = 0; i < dev->nQueues; i++)
+		if (CancelRequest(dev->queues[i], request))
+			return true;
+	return false;
+}
+void DrivePoll(uint32_t driveId)
+{
+	Device* dev = GetDeviceFromKernelDriveID(driveId);
+	if (!dev)
+		return;
+	for (uint16_t i = 0; i < dev->nQueues; i++)
+		PollQueue(dev->queues[i]);
+}
+bool DriveQueryInfo(
+	uint32_t driveId,
+	uint64_t *oNSectors,
+	uint64_t *oBytesPerSector
+	)
+{
+	Device* dev = GetDeviceFromKernelDriveID(driveId);
+	if (!dev)
+		return false;
+	if (oNSectors)
+		*oNSectors = dev->nSectors;
+	if (oBytesPerSector)
+		*oBytesPerSector = dev->sectorSize;
+	return true;
+}
@@ -0,0 +1,333 @@
+/*
+	drivers/x86_64/virtioBlk/main.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <klog.h>
+
+#include <driverInterface/struct.h>
+#include <driverInterface/register.h>
+
+#include <multitasking/threadAPI/thrHandle.h>
+#include <multitasking/cpu_local.h>
+
+#include <driverInterface/x86_64/enumerate_pci.h>
+
+#include <x86_64-utils/asm.h>
+
+#include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/irq/irq.h>
+
+#include "structs.h"
+#include "transport.h"
+#include "virtqueue.h"
+
+using namespace obos;
+
+#ifdef __GNUC__
+#define DEFINE_IN_SECTION __attribute__((section(OBOS_DRIVER_HEADER_SECTION_NAME)))
+#else
+#define DEFINE_IN_SECTION
+#endif
+
+extern bool DriveReadSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void** buff,
+	size_t* oNSectorsRead
+	);
+extern bool DriveWriteSectors(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToWrite,
+	char* buff,
+	size_t* oNSectorsWrote
+	);
+extern bool DriveReadSectorsInto(
+	uint32_t driveId,
+	uint64_t lbaOffset,
+	size_t nSectorsToRead,
+	void* buff,
+	size_t* oNSectorsRead
+	);
+extern bool DriveQueryInfo(
+	uint32_t driveId,
+	uint64_t *oNSectors,
+	uint64_t *oBytesPerSector
+	);
+extern bool DriveSubmitRequest(driverInterface::BlockRequest* request);
+extern bool DriveCancelRequest(driverInterface::BlockRequest* request);
+extern void DrivePoll(uint32_t driveId);
+
+driverInterface::driverHeader DEFINE_IN_SECTION g_driverHeader = {
+	.magicNumber = obos::driverInterface::OBOS_DRIVER_HEADER_MAGIC,
+	.driverId = 6,
+	.driverType = obos::driverInterface::OBOS_SERVICE_TYPE_STORAGE_DEVICE,
+	.requests = driverInterface::driverHeader::REQUEST_SET_STACK_SIZE,
+	.stackSize = 0x8000,
+	.functionTable = {
+		.GetServiceType = []()->driverInterface::serviceType { return driverInterface::serviceType::OBOS_SERVICE_TYPE_STORAGE_DEVICE; },
+		.serviceSpecific = {
+			.storageDevice = {
+				.ReadSectors = DriveReadSectors,
+				.WriteSectors = DriveWriteSectors,
+				.QueryDiskInfo = DriveQueryInfo,
+				.ReadSectorsInto = DriveReadSectorsInto,
+				.SubmitRequest = DriveSubmitRequest,
+				.CancelRequest = DriveCancelRequest,
+				.PollDrive = DrivePoll,
+				.unused = {nullptr,nullptr,}
+			}
+		}
+	},
+	.howToIdentifyDevice = 0b1, // PCI
+	.pciInfo = {
+		// virtio-blk devices are SCSI storage controllers, so their vendor and device ids are checked in _start.
+		.classCode = 0x1, // Class code 0x01
+		.subclass = 1<<0, // Subclass: 0x00
+		.progIf = 1<<0 // Prog IF: 0x00
+	}
+};
+
+#ifndef __pie__
+#error Not compiling with -fPIE
+#endif
+
+Device g_devices[VIRTIO_MAX_DEVICES];
+size_t g_nDevices;
+static size_t s_nVectorsUsed;
+// The vector every device without MSI-X shares, or zero if none was allocated yet.
+static uint8_t s_intxVector;
+
+// Allocates an interrupt vector for a queue, or for the devices sharing INTx if 'queue' is nullptr. Returns zero if there are none left.
+static uint8_t allocateVector(Queue* queue)
+{
+	if (s_nVectorsUsed == VIRTIO_MAX_VECTORS)
+		return 0;
+	size_t i = s_nVectorsUsed++;
+	g_vectors[i].queue = queue;
+	g_vectors[i].used = true;
+	uint8_t vector = VIRTIO_IRQ_VECTOR_BASE + i;
+	RegisterInterruptHandler(vector, VirtioInterruptHandler);
+	return vector;
+}
+// Finds the device's MSI-X capability. Returns zero if it has none.
+static uint8_t findMSIX(Device* dev)
+{
+	// Status bit 4: The device has a capabilities list.
+	if (!(driverInterface::pciReadWordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(1, 2)) & (1<<4)))
+		return 0;
+	uint8_t capability = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(13, 0)) & ~0b11;
+	for (; capability; capability = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, capability + 1) & ~0b11)
+		if (driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, capability) == 0x11 /* MSI-X */)
+			return capability;
+	return 0;
+}
+// Enables MSI-X with every vector masked, and maps its table. Returns nullptr if the device can't use MSI-X.
+static volatile uint32_t* enableMSIX(Device* dev, uint8_t capability, uint16_t* nTableEntries)
+{
+	uint16_t messageControl = driverInterface::pciReadWordRegister(dev->bus, dev->slot, dev->function, capability + 2);
+	uint32_t table = driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, capability + 4);
+	*nTableEntries = (messageControl & 0x7ff) + 1;
+	volatile uint32_t* msixTable = (volatile uint32_t*)MapBar(dev, table & 0b111, table & ~0b111, *nTableEntries * 16);
+	if (!msixTable)
+		return nullptr;
+	// Enable MSI-X, with the function mask set until the table is filled in.
+	messageControl |= (1<<15)|(1<<14);
+	driverInterface::pciWriteWordRegister(dev->bus, dev->slot, dev->function, capability + 2, messageControl);
+	// Turn off INTx, so the interrupt isn't delivered twice.
+	uint16_t pciCommand = driverInterface::pciReadWordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(1, 0));
+	driverInterface::pciWriteWordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(1, 0), pciCommand | (1<<10));
+	dev->msix = true;
+	return msixTable;
+}
+static bool InitializeDevice(Device* dev)
+{
+	if (!InitializeTransport(dev))
+	{
+		logger::warning("virtio-blk: %02x:%02x.%x has neither the legacy nor the modern interface.\n", dev->bus, dev->slot, dev->function);
+		return false;
+	}
+	// Reset the device, and tell it we're a driver for it.
+	WriteDeviceStatus(dev, 0);
+	while (ReadDeviceStatus(dev))
+		pause();
+	WriteDeviceStatus(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+	WriteDeviceStatus(dev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+	uint8_t status = VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER;
+
+	const uint64_t deviceFeatures = ReadDeviceFeatures(dev);
+	const uint64_t supported =
+		(1ull << VIRTIO_BLK_F_SIZE_MAX) |
+		(1ull << VIRTIO_BLK_F_SEG_MAX) |
+		(1ull << VIRTIO_BLK_F_RO) |
+		(1ull << VIRTIO_BLK_F_BLK_SIZE) |
+		(1ull << VIRTIO_BLK_F_MQ) |
+		(dev->legacy ? 0 : (1ull << VIRTIO_F_VERSION_1));
+	dev->features = deviceFeatures & supported;
+	if (!dev->legacy && !(dev->features & (1ull << VIRTIO_F_VERSION_1)))
+		goto fail;
+	WriteDriverFeatures(dev, dev->features);
+	if (!dev->legacy)
+	{
+		// The device reads back FEATURES_OK if it can work with the features we took.
+		status |= VIRTIO_STATUS_FEATURES_OK;
+		WriteDeviceStatus(dev, status);
+		if (!(ReadDeviceStatus(dev) & VIRTIO_STATUS_FEATURES_OK))
+			goto fail;
+	}
+
+	{
+		// MSI-X has to be enabled before the legacy device configuration is read, as it moves it.
+		uint16_t nTableEntries = 0;
+		volatile uint32_t* msixTable = nullptr;
+		if (uint8_t capability = findMSIX(dev); capability && s_nVectorsUsed < VIRTIO_MAX_VECTORS)
+			msixTable = enableMSIX(dev, capability, &nTableEntries);
+
+		dev->nSectors = ReadDeviceConfig64(dev, VIRTIO_BLK_CONFIG_CAPACITY);
+		if (dev->features & (1ull << VIRTIO_BLK_F_BLK_SIZE))
+		{
+			uint32_t blkSize = ReadDeviceConfig32(dev, VIRTIO_BLK_CONFIG_BLK_SIZE);
+			if (blkSize >= 512 && blkSize <= 4096 && !(blkSize & (blkSize - 1)))
+				dev->sectorSize = blkSize;
+		}
+		// The capacity is always in 512-byte sectors.
+		dev->nSectors /= dev->sectorSize / VIRTIO_SECTOR_SIZE;
+		if (dev->features & (1ull << VIRTIO_BLK_F_SEG_MAX))
+		{
+			uint32_t segMax = ReadDeviceConfig32(dev, VIRTIO_BLK_CONFIG_SEG_MAX);
+			if (segMax && segMax < dev->maxSegments)
+				dev->maxSegments = segMax;
+		}
+		if (dev->features & (1ull << VIRTIO_BLK_F_SIZE_MAX))
+		{
+			uint32_t sizeMax = ReadDeviceConfig32(dev, VIRTIO_BLK_CONFIG_SIZE_MAX);
+			// A segment must hold at least a page, or a buffer's pages couldn't always be described.
+			if (sizeMax >= 4096 && sizeMax < dev->maxSegmentSize)
+				dev->maxSegmentSize = sizeMax & ~0xfff;
+		}
+		dev->readOnly = dev->features & (1ull << VIRTIO_BLK_F_RO);
+
+		// Use a queue per cpu, if the device has enough of them, and each can get its own vector.
+		size_t nQueues = 1;
+		if (dev->features & (1ull << VIRTIO_BLK_F_MQ))
+			nQueues = ReadDeviceConfig16(dev, VIRTIO_BLK_CONFIG_NUM_QUEUES);
+		const size_t nCpus = thread::g_nCPUs;
+		if (nQueues > nCpus)
+			nQueues = nCpus;
+		if (nQueues > VIRTIO_MAX_QUEUES)
+			nQueues = VIRTIO_MAX_QUEUES;
+		if (msixTable)
+		{
+			if (nQueues > VIRTIO_MAX_VECTORS - s_nVectorsUsed)
+				nQueues = VIRTIO_MAX_VECTORS - s_nVectorsUsed;
+			if (nQueues > nTableEntries)
+				nQueues = nTableEntries;
+		}
+		else
+			nQueues = 1;
+		if (!nQueues)
+			nQueues = 1;
+
+		for (uint16_t i = 0; i < nQueues; i++)
+		{
+			uint16_t size = QueryQueueSize(dev, i);
+			if (!size)
+				break;
+			// Legacy devices can't have their queues resized.
+			if (!dev->legacy && size > VIRTIO_MAX_QUEUE_SIZE)
+				size = VIRTIO_MAX_QUEUE_SIZE;
+			Queue* queue = CreateQueue(dev, i, size);
+			if (!queue)
+				break;
+			if (!SetupQueue(dev, queue, i))
+			{
+				// The queue is leaked, as the rings can't be taken back from a device that was given them.
+				logger::warning("virtio-blk: %02x:%02x.%x: Could not give queue %d an MSI-X vector.\n", dev->bus, dev->slot, dev->function, i);
+				break;
+			}
+			if (msixTable)
+			{
+				// Send the queue's interrupts to the cpu that submits to it.
+				queue->vector = allocateVector(queue);
+				volatile uint32_t* entry = msixTable + i * 4;
+				entry[0] = 0xFEE00000 | ((uint32_t)thread::g_cpuInfo[i % nCpus].arch_specific.lapicId << 12);
+				entry[1] = 0;
+				entry[2] = queue->vector;
+				entry[3] = 0; // Unmask the vector.
+			}
+			dev->queues[dev->nQueues++] = queue;
+		}
+		if (!dev->nQueues)
+			goto fail;
+		if (msixTable)
+		{
+			uint8_t capability = findMSIX(dev);
+			uint16_t messageControl = driverInterface::pciReadWordRegister(dev->bus, dev->slot, dev->function, capability + 2);
+			driverInterface::pciWriteWordRegister(dev->bus, dev->slot, dev->function, capability + 2, messageControl & ~(1<<14));
+		}
+		else
+		{
+			if (!s_intxVector)
+				s_intxVector = allocateVector(nullptr);
+			uint8_t irq = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(15, 0));
+			if (!s_intxVector || irq == 0xff || !MapIRQToVector(irq, s_intxVector))
+				logger::warning("virtio-blk: %02x:%02x.%x: Could not route the device's interrupt. Requests will be polled.\n", dev->bus, dev->slot, dev->function);
+		}
+	}
+
+	status |= VIRTIO_STATUS_DRIVER_OK;
+	WriteDeviceStatus(dev, status);
+	dev->kernelID = driverInterface::RegisterDevice(driverInterface::DeviceType::Drive);
+	logger::info("virtio-blk: Found %s device at %02x:%02x.%x. Kernel drive ID: %d, sector count: 0x%016X, sector size 0x%08X, queues: %d%s%s.\n",
+		dev->legacy ? "legacy" : "modern",
+		dev->bus, dev->slot, dev->function,
+		dev->kernelID,
+		dev->nSectors,
+		dev->sectorSize,
+		dev->nQueues,
+		dev->msix ? ", MSI-X" : "",
+		dev->readOnly ? ", read-only" : "");
+	return true;
+	fail:
+	WriteDeviceStatus(dev, status | VIRTIO_STATUS_FAILED);
+	logger::warning("virtio-blk: Could not initialize %02x:%02x.%x.\n", dev->bus, dev->slot, dev->function);
+	return false;
+}
+
+extern "C" void _start()
+{
+	uint32_t exitCode = 0;
+	for (uint16_t bus = 0; bus < 256; bus++)
+	{
+		driverInterface::enumerateBus((uint8_t)bus, [](void*, uint8_t slot, uint8_t function, uint8_t bus, uint8_t, uint8_t, uint8_t)->bool
+			{
+				if (g_nDevices == VIRTIO_MAX_DEVICES)
+					return true;
+				uint16_t vendorId = driverInterface::pciReadWordRegister(bus, slot, function, PCI_GetRegisterOffset(0, 0));
+				uint16_t deviceId = driverInterface::pciReadWordRegister(bus, slot, function, PCI_GetRegisterOffset(0, 2));
+				if (vendorId != VIRTIO_PCI_VENDOR_ID || (deviceId != VIRTIO_BLK_LEGACY_DEVICE_ID && deviceId != VIRTIO_BLK_MODERN_DEVICE_ID))
+					return true;
+				Device* dev = &g_devices[g_nDevices];
+				dev->bus = bus;
+				dev->slot = slot;
+				dev->function = function;
+				if (InitializeDevice(dev))
+					g_nDevices++;
+				else
+					*dev = Device{};
+				return true;
+			}, nullptr);
+	}
+	if (!g_nDevices)
+	{
+		logger::error("virtio-blk: No devices found.\n");
+		exitCode = 1;
+	}
+	g_driverHeader.driver_initialized = true;
+	while (!g_driverHeader.driver_finished_loading);
+	thread::ExitThread(exitCode);
+}
@@ -0,0 +1,209 @@
+/*
+	drivers/x86_64/virtioBlk/structs.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+#include <multitasking/locks/waitQueue.h>
+
+#define VIRTIO_PCI_VENDOR_ID 0x1AF4
+// The transitional device, which has the legacy interface, and sometimes the modern one.
+#define VIRTIO_BLK_LEGACY_DEVICE_ID 0x1001
+#define VIRTIO_BLK_MODERN_DEVICE_ID 0x1042
+
+// The first of the interrupt vectors used by the driver. Each queue with an MSI-X vector gets its own.
+#define VIRTIO_IRQ_VECTOR_BASE 0x50
+#define VIRTIO_MAX_VECTORS 16
+#define VIRTIO_MAX_DEVICES 8
+// The driver uses a queue per cpu on each device, up to this many.
+#define VIRTIO_MAX_QUEUES 16
+// The most descriptors in a queue. Modern devices can have their queues shrunk to this, legacy ones can't.
+#define VIRTIO_MAX_QUEUE_SIZE 256
+// The most data descriptors in a request, if the device doesn't limit it further.
+#define VIRTIO_MAX_SEGMENTS 126
+// The most bytes one descriptor describes, if the device doesn't limit it further.
+#define VIRTIO_MAX_SEGMENT_SIZE 0x400000
+// The unit of the sector field in requests, regardless of the device's block size.
+#define VIRTIO_SECTOR_SIZE 512
+
+enum
+{
+	VIRTIO_STATUS_ACKNOWLEDGE = 1,
+	VIRTIO_STATUS_DRIVER = 2,
+	VIRTIO_STATUS_DRIVER_OK = 4,
+	VIRTIO_STATUS_FEATURES_OK = 8,
+	VIRTIO_STATUS_FAILED = 128,
+};
+enum
+{
+	VIRTIO_BLK_F_SIZE_MAX = 1,
+	VIRTIO_BLK_F_SEG_MAX = 2,
+	VIRTIO_BLK_F_RO = 5,
+	VIRTIO_BLK_F_BLK_SIZE = 6,
+	VIRTIO_BLK_F_MQ = 12,
+	VIRTIO_F_VERSION_1 = 32,
+};
+// Offsets in the device-specific configuration.
+enum
+{
+	VIRTIO_BLK_CONFIG_CAPACITY = 0,
+	VIRTIO_BLK_CONFIG_SIZE_MAX = 8,
+	VIRTIO_BLK_CONFIG_SEG_MAX = 12,
+	VIRTIO_BLK_CONFIG_BLK_SIZE = 20,
+	VIRTIO_BLK_CONFIG_NUM_QUEUES = 34,
+};
+enum
+{
+	VIRTIO_BLK_T_IN = 0,
+	VIRTIO_BLK_T_OUT = 1,
+};
+enum
+{
+	VIRTIO_BLK_S_OK = 0,
+	VIRTIO_BLK_S_IOERR = 1,
+	VIRTIO_BLK_S_UNSUPP = 2,
+};
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_USED_F_NO_NOTIFY 1
+// Written to a vector register to not use MSI-X for that interrupt.
+#define VIRTIO_MSI_NO_VECTOR 0xffff
+
+struct VirtqDesc
+{
+	uint64_t addr;
+	uint32_t len;
+	uint16_t flags;
+	uint16_t next;
+};
+struct VirtqAvail
+{
+	uint16_t flags;
+	uint16_t idx;
+	uint16_t ring[];
+};
+struct VirtqUsedElem
+{
+	uint32_t id;
+	uint32_t len;
+};
+struct VirtqUsed
+{
+	uint16_t flags;
+	uint16_t idx;
+	VirtqUsedElem ring[];
+};
+// The parts of a request the device reads and writes, other than the data. One per descriptor, indexed by the request's first descriptor.
+struct CommandHeader
+{
+	uint32_t type;
+	uint32_t reserved;
+	uint64_t sector;
+	uint8_t status;
+	uint8_t padding[15];
+};
+static_assert(sizeof(CommandHeader) == 32, "struct CommandHeader has an invalid size.");
+
+namespace obos
+{
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+	namespace memory
+	{
+		class PageMap;
+	}
+}
+
+// A transfer, which is split into as many commands as the queue needs.
+struct Request
+{
+	// The request being done, or nullptr if a thread is waiting on 'completion'.
+	obos::driverInterface::BlockRequest* blockRequest = nullptr;
+	bool write = false;
+	// The address space the buffer is in.
+	obos::memory::PageMap* pageMap = nullptr;
+	// Where the next command starts, in the drive's sectors.
+	uint64_t lba = 0;
+	byte* buff = nullptr;
+	// The sectors that still need a command.
+	size_t nSectorsLeft = 0;
+	size_t nSectorsDone = 0;
+	// The commands in flight.
+	size_t nCommands = 0;
+	bool started = false;
+	bool failed = false;
+	// Set with 'completion' locked, when a synchronous transfer finishes.
+	bool done = false;
+	obos::locks::WaitQueue completion;
+	// The queue's pending list, or the list of requests to free.
+	Request* next = nullptr;
+};
+struct Queue
+{
+	struct Device* device = nullptr;
+	uint16_t index = 0;
+	uint16_t size = 0;
+	// Physically contiguous, and mapped through the HHDM.
+	volatile VirtqDesc* desc = nullptr;
+	volatile VirtqAvail* avail = nullptr;
+	volatile VirtqUsed* used = nullptr;
+	uintptr_t descPhys = 0, availPhys = 0, usedPhys = 0;
+	CommandHeader* headers = nullptr;
+	uintptr_t headersPhys = 0;
+	struct Command
+	{
+		// The request the command is part of.
+		Request* owner;
+		size_t nSectors;
+		uint16_t nDescriptors;
+	} *commands = nullptr;
+	// The free descriptors, linked through their 'next' field.
+	uint16_t freeHead = 0;
+	uint16_t nFree = 0;
+	// Our copy of avail->idx, and how far into the used ring we've read.
+	uint16_t availIdx = 0;
+	uint16_t lastUsed = 0;
+	// Where to write the queue's index to notify the device. Only used by modern devices.
+	volatile uint16_t* notify = nullptr;
+	// The interrupt vector of the queue, or zero if it shares the device's.
+	uint8_t vector = 0;
+	// Protects everything above, and the pending list.
+	bool lock = false;
+	Request *pendingHead = nullptr, *pendingTail = nullptr;
+	// Finished asynchronous requests, freed on the next submission, as they can't be freed in the interrupt handler.
+	Request* reapList = nullptr;
+};
+struct Device
+{
+	uint8_t bus = 0, slot = 0, function = 0;
+	bool legacy = false;
+	// The legacy interface's I/O ports.
+	uint16_t ioBase = 0;
+	// The modern interface's structures.
+	volatile byte* commonConfig = nullptr;
+	volatile byte* isr = nullptr;
+	volatile byte* deviceConfig = nullptr;
+	volatile byte* notifyBase = nullptr;
+	uint32_t notifyMultiplier = 0;
+	// Whether the queues' interrupts are delivered with MSI-X. Otherwise, all queues share the INTx line.
+	bool msix = false;
+	uint64_t features = 0;
+	uint32_t sectorSize = VIRTIO_SECTOR_SIZE;
+	uint64_t nSectors = 0;
+	uint32_t maxSegments = VIRTIO_MAX_SEGMENTS;
+	uint32_t maxSegmentSize = VIRTIO_MAX_SEGMENT_SIZE;
+	bool readOnly = false;
+	uint32_t kernelID = 0xffffffff;
+	uint16_t nQueues = 0;
+	Queue* queues[VIRTIO_MAX_QUEUES]{};
+};
+
+extern Device g_devices[VIRTIO_MAX_DEVICES];
+extern size_t g_nDevices;
@@ -0,0 +1,317 @@
+/*
+	drivers/x86_64/virtioBlk/transport.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <klog.h>
+
+#include <driverInterface/x86_64/enumerate_pci.h>
+
+#include <allocators/vmm/arch.h>
+
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+
+#include <x86_64-utils/asm.h>
+
+#include "structs.h"
+#include "transport.h"
+
+using namespace obos;
+
+namespace obos
+{
+	namespace memory
+	{
+		OBOS_EXPORT void* MapPhysicalAddress(PageMap* pageMap, uintptr_t phys, void* to, uintptr_t cpuFlags);
+	}
+}
+
+// The legacy interface's registers, as offsets from the I/O BAR.
+enum
+{
+	LEGACY_DEVICE_FEATURES = 0x00,
+	LEGACY_DRIVER_FEATURES = 0x04,
+	LEGACY_QUEUE_ADDRESS = 0x08,
+	LEGACY_QUEUE_SIZE = 0x0C,
+	LEGACY_QUEUE_SELECT = 0x0E,
+	LEGACY_QUEUE_NOTIFY = 0x10,
+	LEGACY_DEVICE_STATUS = 0x12,
+	LEGACY_ISR_STATUS = 0x13,
+	// Only there when MSI-X is enabled.
+	LEGACY_CONFIG_MSIX_VECTOR = 0x14,
+	LEGACY_QUEUE_MSIX_VECTOR = 0x16,
+};
+// The modern interface's common configuration.
+enum
+{
+	COMMON_DEVICE_FEATURE_SELECT = 0,
+	COMMON_DEVICE_FEATURE = 4,
+	COMMON_DRIVER_FEATURE_SELECT = 8,
+	COMMON_DRIVER_FEATURE = 12,
+	COMMON_CONFIG_MSIX_VECTOR = 16,
+	COMMON_NUM_QUEUES = 18,
+	COMMON_DEVICE_STATUS = 20,
+	COMMON_CONFIG_GENERATION = 21,
+	COMMON_QUEUE_SELECT = 22,
+	COMMON_QUEUE_SIZE = 24,
+	COMMON_QUEUE_MSIX_VECTOR = 26,
+	COMMON_QUEUE_ENABLE = 28,
+	COMMON_QUEUE_NOTIFY_OFF = 30,
+	COMMON_QUEUE_DESC = 32,
+	COMMON_QUEUE_DRIVER = 40,
+	COMMON_QUEUE_DEVICE = 48,
+};
+enum
+{
+	VIRTIO_PCI_CAP_COMMON_CFG = 1,
+	VIRTIO_PCI_CAP_NOTIFY_CFG = 2,
+	VIRTIO_PCI_CAP_ISR_CFG = 3,
+	VIRTIO_PCI_CAP_DEVICE_CFG = 4,
+};
+
+template<typename T>
+static T readRegister(volatile byte* base, size_t offset)
+{
+	return *(volatile T*)(base + offset);
+}
+template<typename T>
+static void writeRegister(volatile byte* base, size_t offset, T val)
+{
+	*(volatile T*)(base + offset) = val;
+}
+// 64-bit fields of the common configuration must be written as two 32-bit writes, the low half first (virtio 1.x, 4.1.3.1).
+static void writeRegister64(volatile byte* base, size_t offset, uint64_t val)
+{
+	writeRegister<uint32_t>(base, offset, (uint32_t)val);
+	writeRegister<uint32_t>(base, offset + 4, (uint32_t)(val >> 32));
+}
+// Returns the physical address a memory BAR points to, or zero if it's an I/O BAR.
+static uintptr_t getBarAddress(Device* dev, uint8_t bar)
+{
+	uint8_t reg = PCI_GetRegisterOffset(4 + bar, 0);
+	uint32_t low = driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, reg);
+	if (low & 1)
+		return 0;
+	uintptr_t phys = low & ~0xf;
+	if (((low >> 1) & 0b11) == 0b10 /* 64-bit */)
+		phys |= (uintptr_t)driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, reg + 4) << 32;
+	return phys;
+}
+volatile byte* MapBar(Device* dev, uint8_t bar, uint32_t offset, uint32_t length)
+{
+	uintptr_t phys = getBarAddress(dev, bar);
+	if (!phys || !length)
+		return nullptr;
+	phys += offset;
+	uintptr_t base = phys & ~(uintptr_t)0xfff;
+	size_t nPages = (((phys + length + 0xfff) & ~(uintptr_t)0xfff) - base) / 0x1000;
+	byte* virt = (byte*)memory::_Impl_FindUsableAddress(nullptr, nPages);
+	if (!virt)
+		return nullptr;
+	for (size_t i = 0; i < nPages; i++)
+	{
+		memory::MapPhysicalAddress(
+			memory::getCurrentPageMap(),
+			base + i * 0x1000,
+			virt + i * 0x1000,
+			(1<<0)|(1<<1)|(1<<4)|(((uintptr_t)1)<<63) /*PRESENT,WRITE,CACHE_DISABLE,EXECUTE_DISABLE*/
+			);
+	}
+	return virt + (phys & 0xfff);
+}
+static bool initializeModernTransport(Device* dev)
+{
+	// Status bit 4: The device has a capabilities list.
+	if (!(driverInterface::pciReadWordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(1, 2)) & (1<<4)))
+		return false;
+	uint8_t capability = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(13, 0)) & ~0b11;
+	for (; capability; capability = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, capability + 1) & ~0b11)
+	{
+		if (driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, capability) != 0x09 /* Vendor specific */)
+			continue;
+		uint8_t type = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, capability + 3);
+		uint8_t bar = driverInterface::pciReadByteRegister(dev->bus, dev->slot, dev->function, capability + 4);
+		uint32_t offset = driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, capability + 8);
+		uint32_t length = driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, capability + 12);
+		if (bar > 5)
+			continue;
+		// There can be more than one capability of each type; the first one that can be used is preferred.
+		switch (type)
+		{
+		case VIRTIO_PCI_CAP_COMMON_CFG:
+			if (!dev->commonConfig)
+				dev->commonConfig = MapBar(dev, bar, offset, length);
+			break;
+		case VIRTIO_PCI_CAP_NOTIFY_CFG:
+			if (!dev->notifyBase)
+			{
+				dev->notifyBase = MapBar(dev, bar, offset, length);
+				dev->notifyMultiplier = driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, capability + 16);
+			}
+			break;
+		case VIRTIO_PCI_CAP_ISR_CFG:
+			if (!dev->isr)
+				dev->isr = MapBar(dev, bar, offset, length);
+			break;
+		case VIRTIO_PCI_CAP_DEVICE_CFG:
+			if (!dev->deviceConfig)
+				dev->deviceConfig = MapBar(dev, bar, offset, length);
+			break;
+		default:
+			break;
+		}
+	}
+	return dev->commonConfig && dev->notifyBase && dev->isr && dev->deviceConfig;
+}
+bool InitializeTransport(Device* dev)
+{
+	uint16_t pciCommand = driverInterface::pciReadWordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(1, 0));
+	// DMA Bus mastering, memory space, and I/O space access are on.
+	pciCommand |= 7;
+	driverInterface::pciWriteWordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(1, 0), pciCommand);
+	if (initializeModernTransport(dev))
+	{
+		dev->legacy = false;
+		return true;
+	}
+	uint32_t bar0 = driverInterface::pciReadDwordRegister(dev->bus, dev->slot, dev->function, PCI_GetRegisterOffset(4, 0));
+	if (!(bar0 & 1))
+		return false;
+	dev->legacy = true;
+	dev->ioBase = bar0 & ~0b11;
+	return true;
+}
+
+uint8_t ReadDeviceStatus(Device* dev)
+{
+	if (dev->legacy)
+		return inb(dev->ioBase + LEGACY_DEVICE_STATUS);
+	return readRegister<uint8_t>(dev->commonConfig, COMMON_DEVICE_STATUS);
+}
+void WriteDeviceStatus(Device* dev, uint8_t status)
+{
+	if (dev->legacy)
+		outb(dev->ioBase + LEGACY_DEVICE_STATUS, status);
+	else
+		writeRegister<uint8_t>(dev->commonConfig, COMMON_DEVICE_STATUS, status);
+}
+uint64_t ReadDeviceFeatures(Device* dev)
+{
+	if (dev->legacy)
+		return ind(dev->ioBase + LEGACY_DEVICE_FEATURES);
+	writeRegister<uint32_t>(dev->commonConfig, COMMON_DEVICE_FEATURE_SELECT, 0);
+	uint64_t features = readRegister<uint32_t>(dev->commonConfig, COMMON_DEVICE_FEATURE);
+	writeRegister<uint32_t>(dev->commonConfig, COMMON_DEVICE_FEATURE_SELECT, 1);
+	features |= (uint64_t)readRegister<uint32_t>(dev->commonConfig, COMMON_DEVICE_FEATURE) << 32;
+	return features;
+}
+void WriteDriverFeatures(Device* dev, uint64_t features)
+{
+	if (dev->legacy)
+	{
+		outd(dev->ioBase + LEGACY_DRIVER_FEATURES, (uint32_t)features);
+		return;
+	}
+	writeRegister<uint32_t>(dev->commonConfig, COMMON_DRIVER_FEATURE_SELECT, 0);
+	writeRegister<uint32_t>(dev->commonConfig, COMMON_DRIVER_FEATURE, (uint32_t)features);
+	writeRegister<uint32_t>(dev->commonConfig, COMMON_DRIVER_FEATURE_SELECT, 1);
+	writeRegister<uint32_t>(dev->commonConfig, COMMON_DRIVER_FEATURE, (uint32_t)(features >> 32));
+}
+// The legacy device configuration moves when MSI-X is enabled, to make room for the vector registers.
+static uint16_t legacyConfigBase(Device* dev)
+{
+	return dev->ioBase + (dev->msix ? 0x18 : 0x14);
+}
+uint8_t ReadDeviceConfig8(Device* dev, size_t offset)
+{
+	if (dev->legacy)
+		return inb(legacyConfigBase(dev) + offset);
+	return readRegister<uint8_t>(dev->deviceConfig, offset);
+}
+uint16_t ReadDeviceConfig16(Device* dev, size_t offset)
+{
+	if (dev->legacy)
+		return inw(legacyConfigBase(dev) + offset);
+	return readRegister<uint16_t>(dev->deviceConfig, offset);
+}
+uint32_t ReadDeviceConfig32(Device* dev, size_t offset)
+{
+	if (dev->legacy)
+		return ind(legacyConfigBase(dev) + offset);
+	return readRegister<uint32_t>(dev->deviceConfig, offset);
+}
+uint64_t ReadDeviceConfig64(Device* dev, size_t offset)
+{
+	if (dev->legacy)
+		return ind(legacyConfigBase(dev) + offset) | ((uint64_t)ind(legacyConfigBase(dev) + offset + 4) << 32);
+	// The device can change the configuration between the two reads, which is caught by the generation changing.
+	uint8_t generation = 0;
+	uint64_t val = 0;
+	do
+	{
+		generation = readRegister<uint8_t>(dev->commonConfig, COMMON_CONFIG_GENERATION);
+		val = readRegister<uint32_t>(dev->deviceConfig, offset);
+		val |= (uint64_t)readRegister<uint32_t>(dev->deviceConfig, offset + 4) << 32;
+	} while (generation != readRegister<uint8_t>(dev->commonConfig, COMMON_CONFIG_GENERATION));
+	return val;
+}
+uint16_t QueryQueueSize(Device* dev, uint16_t index)
+{
+	if (dev->legacy)
+	{
+		outw(dev->ioBase + LEGACY_QUEUE_SELECT, index);
+		return inw(dev->ioBase + LEGACY_QUEUE_SIZE);
+	}
+	if (index >= readRegister<uint16_t>(dev->commonConfig, COMMON_NUM_QUEUES))
+		return 0;
+	writeRegister<uint16_t>(dev->commonConfig, COMMON_QUEUE_SELECT, index);
+	return readRegister<uint16_t>(dev->commonConfig, COMMON_QUEUE_SIZE);
+}
+bool SetupQueue(Device* dev, Queue* queue, uint16_t vector)
+{
+	if (dev->legacy)
+	{
+		outw(dev->ioBase + LEGACY_QUEUE_SELECT, queue->index);
+		if (dev->msix)
+		{
+			outw(dev->ioBase + LEGACY_QUEUE_MSIX_VECTOR, vector);
+			// The device reads back VIRTIO_MSI_NO_VECTOR if it couldn't allocate the vector.
+			if (inw(dev->ioBase + LEGACY_QUEUE_MSIX_VECTOR) != vector)
+				return false;
+		}
+		// The legacy interface takes the page number of the rings, which are laid out one after the other.
+		outd(dev->ioBase + LEGACY_QUEUE_ADDRESS, (uint32_t)(queue->descPhys >> 12));
+		return true;
+	}
+	volatile byte* common = dev->commonConfig;
+	writeRegister<uint16_t>(common, COMMON_QUEUE_SELECT, queue->index);
+	writeRegister<uint16_t>(common, COMMON_QUEUE_SIZE, queue->size);
+	if (dev->msix)
+	{
+		writeRegister<uint16_t>(common, COMMON_QUEUE_MSIX_VECTOR, vector);
+		if (readRegister<uint16_t>(common, COMMON_QUEUE_MSIX_VECTOR) != vector)
+			return false;
+	}
+	writeRegister64(common, COMMON_QUEUE_DESC, queue->descPhys);
+	writeRegister64(common, COMMON_QUEUE_DRIVER, queue->availPhys);
+	writeRegister64(common, COMMON_QUEUE_DEVICE, queue->usedPhys);
+	uint16_t notifyOffset = readRegister<uint16_t>(common, COMMON_QUEUE_NOTIFY_OFF);
+	queue->notify = (volatile uint16_t*)(dev->notifyBase + (size_t)notifyOffset * dev->notifyMultiplier);
+	writeRegister<uint16_t>(common, COMMON_QUEUE_ENABLE, 1);
+	return true;
+}
+void NotifyQueue(Queue* queue)
+{
+	if (queue->device->legacy)
+		outw(queue->device->ioBase + LEGACY_QUEUE_NOTIFY, queue->index);
+	else
+		*queue->notify = queue->index;
+}
+uint8_t ReadISR(Device* dev)
+{
+	if (dev->legacy)
+		return inb(dev->ioBase + LEGACY_ISR_STATUS);
+	return readRegister<uint8_t>(dev->isr, 0);
+}
@@ -0,0 +1,33 @@
+/*
+	drivers/x86_64/virtioBlk/transport.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+// Access to the device's registers, through either the legacy (I/O port) interface, or the modern (PCI capability) interface.
+
+// Maps part of a memory BAR, with caching disabled. Returns nullptr if the BAR isn't in memory space.
+volatile byte* MapBar(struct Device* dev, uint8_t bar, uint32_t offset, uint32_t length);
+// Finds the device's registers, and maps them. Returns false if the device has neither interface.
+bool InitializeTransport(struct Device* dev);
+uint8_t ReadDeviceStatus(struct Device* dev);
+void WriteDeviceStatus(struct Device* dev, uint8_t status);
+uint64_t ReadDeviceFeatures(struct Device* dev);
+void WriteDriverFeatures(struct Device* dev, uint64_t features);
+// Reads from the device-specific configuration.
+uint8_t ReadDeviceConfig8(struct Device* dev, size_t offset);
+uint16_t ReadDeviceConfig16(struct Device* dev, size_t offset);
+uint32_t ReadDeviceConfig32(struct Device* dev, size_t offset);
+uint64_t ReadDeviceConfig64(struct Device* dev, size_t offset);
+// Returns the most descriptors the queue can have, or zero if the queue doesn't exist.
+uint16_t QueryQueueSize(struct Device* dev, uint16_t index);
+// Gives the device the queue's rings, and enables it. For legacy devices, the queue's size must be what QueryQueueSize returned.
+// If 'vector' isn't VIRTIO_MSI_NO_VECTOR, the queue interrupts with that MSI-X table entry. Returns false if the device rejected it.
+bool SetupQueue(struct Device* dev, struct Queue* queue, uint16_t vector);
+void NotifyQueue(struct Queue* queue);
+// Reads and clears the interrupt status. Needed to deassert INTx.
+uint8_t ReadISR(struct Device* dev);
@@ -0,0 +1,417 @@
+/*
+	drivers/x86_64/virtioBlk/virtqueue.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <memory_manipulation.h>
+
+#include <driverInterface/blockRequest.h>
+
+#include <multitasking/cpu_local.h>
+
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+#include <arch/x86_64/memory_manager/physical/allocate.h>
+
+#include <allocators/vmm/arch.h>
+
+#include <x86_64-utils/asm.h>
+
+#include <arch/x86_64/interrupt.h>
+#include <arch/x86_64/irq/irq.h>
+
+#include "structs.h"
+#include "transport.h"
+#include "virtqueue.h"
+
+using namespace obos;
+
+// How long a thread sleeps on a request before polling the queue, in case the interrupt was lost.
+#define REQUEST_POLL_INTERVAL 10000000
+
+VectorEntry g_vectors[VIRTIO_MAX_VECTORS];
+
+static void lockQueue(Queue* queue)
+{
+	while (__atomic_exchange_n(&queue->lock, true, __ATOMIC_ACQUIRE))
+		pause();
+}
+static void unlockQueue(Queue* queue)
+{
+	__atomic_store_n(&queue->lock, false, __ATOMIC_RELEASE);
+}
+static bool canBlock()
+{
+	// Threads can't block with interrupts off (ex: in the page fault handler).
+	return getEflags() & x86_64_flags::RFLAGS_INTERRUPT_ENABLE;
+}
+
+Queue* CreateQueue(Device* dev, uint16_t index, uint16_t size)
+{
+	if (!size)
+		return nullptr;
+	// The legacy interface needs the rings in this layout, with the used ring on its own page. It works for the modern interface too.
+	const size_t availOffset = size * sizeof(VirtqDesc);
+	const size_t usedOffset = (availOffset + sizeof(VirtqAvail) + (size + 1) * sizeof(uint16_t) + 0xfff) & ~(size_t)0xfff;
+	const size_t ringsSize = (usedOffset + sizeof(VirtqUsed) + size * sizeof(VirtqUsedElem) + sizeof(uint16_t) + 0xfff) & ~(size_t)0xfff;
+	const size_t headersSize = (size * sizeof(CommandHeader) + 0xfff) & ~(size_t)0xfff;
+	uintptr_t rings = memory::allocatePhysicalPage(ringsSize / 0x1000);
+	if (!rings)
+		return nullptr;
+	uintptr_t headers = memory::allocatePhysicalPage(headersSize / 0x1000);
+	if (!headers)
+	{
+		memory::freePhysicalPage(rings, ringsSize / 0x1000);
+		return nullptr;
+	}
+	Queue* queue = new Queue{};
+	queue->device = dev;
+	queue->index = index;
+	queue->size = size;
+	byte* ringsVirt = (byte*)memory::mapPageTable((uintptr_t*)rings);
+	utils::memzero(ringsVirt, ringsSize);
+	queue->desc = (volatile VirtqDesc*)ringsVirt;
+	queue->avail = (volatile VirtqAvail*)(ringsVirt + availOffset);
+	queue->used = (volatile VirtqUsed*)(ringsVirt + usedOffset);
+	queue->descPhys = rings;
+	queue->availPhys = rings + availOffset;
+	queue->usedPhys = rings + usedOffset;
+	queue->headers = (CommandHeader*)memory::mapPageTable((uintptr_t*)headers);
+	utils::memzero(queue->headers, headersSize);
+	queue->headersPhys = headers;
+	queue->commands = new Queue::Command[size]{};
+	for (uint16_t i = 0; i < size; i++)
+		queue->desc[i].next = i + 1;
+	queue->freeHead = 0;
+	queue->nFree = size;
+	return queue;
+}
+Queue* GetQueue(Device* dev)
+{
+	// Each cpu has its own queue, whose interrupts go to that cpu, so submissions on different cpus don't contend.
+	return dev->queues[thread::GetCurrentCpuLocalPtr()->cpuId % dev->nQueues];
+}
+
+static uint16_t allocateDescriptor(Queue* queue)
+{
+	uint16_t desc = queue->freeHead;
+	queue->freeHead = queue->desc[desc].next;
+	queue->nFree--;
+	return desc;
+}
+static void freeChain(Queue* queue, uint16_t head, uint16_t nDescriptors)
+{
+	uint16_t last = head;
+	for (uint16_t i = 1; i < nDescriptors; i++)
+		last = queue->desc[last].next;
+	queue->desc[last].next = queue->freeHead;
+	queue->freeHead = head;
+	queue->nFree += nDescriptors;
+}
+static void removePending(Queue* queue, Request* req)
+{
+	Request* prev = nullptr;
+	for (Request* cur = queue->pendingHead; cur; prev = cur, cur = cur->next)
+	{
+		if (cur != req)
+			continue;
+		if (prev)
+			prev->next = cur->next;
+		else
+			queue->pendingHead = cur->next;
+		if (queue->pendingTail == cur)
+			queue->pendingTail = prev;
+		cur->next = nullptr;
+		return;
+	}
+}
+// Returns the size of the physically contiguous part of the request's buffer at 'offset', up to maxBytes.
+static size_t nextSegment(Queue* queue, Request* req, size_t offset, size_t maxBytes, uintptr_t* oPhys)
+{
+	if (maxBytes > queue->device->maxSegmentSize)
+		maxBytes = queue->device->maxSegmentSize;
+	uintptr_t start = 0;
+	size_t len = 0;
+	while (len < maxBytes)
+	{
+		uintptr_t virt = (uintptr_t)req->buff + offset + len;
+		size_t chunk = 0x1000 - (virt & 0xfff);
+		if (chunk > maxBytes - len)
+			chunk = maxBytes - len;
+		uintptr_t phys = memory::GetPhysicalAddress(req->pageMap, virt);
+		if (!phys || (len && phys != start + len))
+			break;
+		if (!len)
+			start = phys;
+		len += chunk;
+	}
+	*oPhys = start;
+	return len;
+}
+// Puts 'finished' on the list of requests to complete.
+static void finishRequest(Request* req, Request*& finished)
+{
+	req->next = finished;
+	finished = req;
+}
+// Issues commands for the pending requests while there are free descriptors. Expects the queue to be locked, with interrupts off.
+static void dispatch(Queue* queue, Request*& finished)
+{
+	Device* dev = queue->device;
+	const size_t sectorSize = dev->sectorSize;
+	bool issued = false;
+	while (Request* req = queue->pendingHead)
+	{
+		// A command needs a descriptor for its header and its status, and at least one for its data.
+		if (queue->nFree < 3)
+			break;
+		size_t maxSegments = queue->nFree - 2;
+		if (maxSegments > dev->maxSegments)
+			maxSegments = dev->maxSegments;
+		// Find how much of the buffer fits in one command.
+		const size_t maxBytes = req->nSectorsLeft * sectorSize;
+		size_t nBytes = 0;
+		for (size_t i = 0; i < maxSegments && nBytes < maxBytes; i++)
+		{
+			uintptr_t phys = 0;
+			size_t len = nextSegment(queue, req, nBytes, maxBytes - nBytes, &phys);
+			if (!len)
+				break;
+			nBytes += len;
+		}
+		// Commands transfer whole sectors.
+		nBytes -= nBytes % sectorSize;
+		if (!nBytes)
+		{
+			// The buffer was unmapped.
+			removePending(queue, req);
+			req->failed = true;
+			req->nSectorsLeft = 0;
+			if (!req->nCommands)
+				finishRequest(req, finished);
+			continue;
+		}
+		const size_t count = nBytes / sectorSize;
+		uint16_t head = allocateDescriptor(queue);
+		CommandHeader* header = &queue->headers[head];
+		header->type = req->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+		header->reserved = 0;
+		header->sector = req->lba * (sectorSize / VIRTIO_SECTOR_SIZE);
+		header->status = 0xff;
+		const uintptr_t headerPhys = queue->headersPhys + head * sizeof(CommandHeader);
+		queue->desc[head].addr = headerPhys;
+		queue->desc[head].len = 16;
+		queue->desc[head].flags = VIRTQ_DESC_F_NEXT;
+		uint16_t prev = head;
+		uint16_t nDescriptors = 1;
+		for (size_t done = 0; done < nBytes; nDescriptors++)
+		{
+			uintptr_t phys = 0;
+			size_t len = nextSegment(queue, req, done, nBytes - done, &phys);
+			uint16_t desc = allocateDescriptor(queue);
+			queue->desc[desc].addr = phys;
+			queue->desc[desc].len = len;
+			// The device writes to the buffer for reads.
+			queue->desc[desc].flags = VIRTQ_DESC_F_NEXT | (req->write ? 0 : VIRTQ_DESC_F_WRITE);
+			queue->desc[prev].next = desc;
+			prev = desc;
+			done += len;
+		}
+		uint16_t statusDesc = allocateDescriptor(queue);
+		queue->desc[statusDesc].addr = headerPhys + __builtin_offsetof(CommandHeader, status);
+		queue->desc[statusDesc].len = 1;
+		queue->desc[statusDesc].flags = VIRTQ_DESC_F_WRITE;
+		queue->desc[prev].next = statusDesc;
+		nDescriptors++;
+		Queue::Command& command = queue->commands[head];
+		command.owner = req;
+		command.nSectors = count;
+		command.nDescriptors = nDescriptors;
+		queue->avail->ring[queue->availIdx % queue->size] = head;
+		queue->availIdx++;
+		issued = true;
+		req->nCommands++;
+		req->started = true;
+		req->lba += count;
+		req->buff += nBytes;
+		req->nSectorsLeft -= count;
+		if (!req->nSectorsLeft)
+			removePending(queue, req);
+	}
+	if (!issued)
+		return;
+	// The device can't see the new index before the ring entries.
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	queue->avail->idx = queue->availIdx;
+	// Nor can we read the used ring's flags before it sees the new index.
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (!(queue->used->flags & VIRTQ_USED_F_NO_NOTIFY))
+		NotifyQueue(queue);
+}
+// Frees the descriptors of every command the device finished. Expects the queue to be locked, with interrupts off.
+// Requests that finished are put in 'finished', to be completed once the queue is unlocked.
+static void completeCommands(Queue* queue, Request*& finished)
+{
+	uint16_t usedIdx = __atomic_load_n(&queue->used->idx, __ATOMIC_ACQUIRE);
+	while (queue->lastUsed != usedIdx)
+	{
+		uint16_t head = (uint16_t)queue->used->ring[queue->lastUsed % queue->size].id;
+		queue->lastUsed++;
+		Queue::Command& command = queue->commands[head];
+		Request* req = command.owner;
+		bool succeeded = queue->headers[head].status == VIRTIO_BLK_S_OK;
+		freeChain(queue, head, command.nDescriptors);
+		command.owner = nullptr;
+		if (!req)
+			continue;
+		req->nCommands--;
+		if (!succeeded)
+		{
+			// Don't issue the rest of a failed request.
+			if (!req->failed && req->nSectorsLeft)
+				removePending(queue, req);
+			req->failed = true;
+			req->nSectorsLeft = 0;
+		}
+		else
+			req->nSectorsDone += command.nSectors;
+		if (!req->nCommands && !req->nSectorsLeft)
+			finishRequest(req, finished);
+	}
+}
+static bool setDone(thread::Thread*, void* udata)
+{
+	((Request*)udata)->done = true;
+	return true;
+}
+// Completes the requests in 'finished'. Must be called with the queue unlocked, as completion callbacks can submit more requests.
+static void finishRequests(Queue* queue, Request* finished)
+{
+	while (finished)
+	{
+		Request* next = finished->next;
+		if (driverInterface::BlockRequest* request = finished->blockRequest)
+		{
+			bool failed = finished->failed;
+			size_t nSectorsDone = finished->nSectorsDone;
+			finished->next = __atomic_load_n(&queue->reapList, __ATOMIC_RELAXED);
+			while (!__atomic_compare_exchange_n(&queue->reapList, &finished->next, finished, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+				;
+			driverInterface::CompleteBlockRequest(request, failed ? driverInterface::BlockRequest::STATUS_FAILED : driverInterface::BlockRequest::STATUS_SUCCESS, failed ? 0 : nSectorsDone);
+		}
+		else
+			// The waiter can return as soon as it sees done, so it's set with the wait queue locked.
+			finished->completion.WakeOne(setDone, finished);
+		finished = next;
+	}
+}
+// Frees the asynchronous requests that finished. This can't be called in the interrupt handler.
+static void reapRequests(Queue* queue)
+{
+	Request* list = __atomic_exchange_n(&queue->reapList, nullptr, __ATOMIC_ACQUIRE);
+	while (list)
+	{
+		Request* next = list->next;
+		delete list;
+		list = next;
+	}
+}
+void PollQueue(Queue* queue)
+{
+	Request* finished = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockQueue(queue);
+	completeCommands(queue, finished);
+	dispatch(queue, finished);
+	unlockQueue(queue);
+	finishRequests(queue, finished);
+	restorePreviousInterruptStatus(flags);
+}
+void SubmitRequest(Queue* queue, Request* req)
+{
+	if (canBlock())
+		reapRequests(queue);
+	req->next = nullptr;
+	Request* finished = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockQueue(queue);
+	if (queue->pendingTail)
+		queue->pendingTail->next = req;
+	else
+		queue->pendingHead = req;
+	queue->pendingTail = req;
+	dispatch(queue, finished);
+	unlockQueue(queue);
+	finishRequests(queue, finished);
+	restorePreviousInterruptStatus(flags);
+}
+bool CancelRequest(Queue* queue, driverInterface::BlockRequest* request)
+{
+	// Look for the request in the pending list instead of using driverData, as it could've already been freed.
+	Request* req = nullptr;
+	uintptr_t flags = saveFlagsAndCLI();
+	lockQueue(queue);
+	for (Request* cur = queue->pendingHead; cur; cur = cur->next)
+	{
+		if (cur->blockRequest != request)
+			continue;
+		if (!cur->started)
+		{
+			removePending(queue, cur);
+			req = cur;
+		}
+		break;
+	}
+	unlockQueue(queue);
+	restorePreviousInterruptStatus(flags);
+	if (!req)
+		return false;
+	request->driverData = nullptr;
+	delete req;
+	driverInterface::CompleteBlockRequest(request, driverInterface::BlockRequest::STATUS_CANCELLED, 0);
+	return true;
+}
+static bool requestDone(void* udata)
+{
+	return ((Request*)udata)->done;
+}
+bool WaitForRequest(Queue* queue, Request* req)
+{
+	while (!__atomic_load_n(&req->done, __ATOMIC_ACQUIRE))
+	{
+		if (canBlock())
+		{
+			if (req->completion.WaitFor(requestDone, req, REQUEST_POLL_INTERVAL))
+				break;
+		}
+		else
+			pause();
+		PollQueue(queue);
+	}
+	// done is set before the completion is unlocked. Wait for that, as the request is freed as soon as we return.
+	req->completion.WakeAll();
+	return !req->failed;
+}
+void VirtioInterruptHandler(interrupt_frame* frame)
+{
+	size_t vector = frame->intNumber - VIRTIO_IRQ_VECTOR_BASE;
+	if (vector < VIRTIO_MAX_VECTORS && g_vectors[vector].used)
+	{
+		if (g_vectors[vector].queue)
+			PollQueue(g_vectors[vector].queue);
+		else
+		{
+			// The INTx line can be shared, so check every device using it. Reading the ISR deasserts the line.
+			for (size_t i = 0; i < g_nDevices; i++)
+			{
+				Device* dev = &g_devices[i];
+				if (dev->msix || !dev->nQueues || !(ReadISR(dev) & 1))
+					continue;
+				for (uint16_t q = 0; q < dev->nQueues; q++)
+					PollQueue(dev->queues[q]);
+			}
+		}
+	}
+	SendEOI();
+}
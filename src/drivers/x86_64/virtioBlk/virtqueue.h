@@ -0,0 +1,42 @@
+/*
+	drivers/x86_64/virtioBlk/virtqueue.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+namespace obos
+{
+	struct interrupt_frame;
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+}
+
+// What an interrupt vector used by the driver completes.
+struct VectorEntry
+{
+	// The queue the vector belongs to, or nullptr if it's a shared INTx line, where every device not using MSI-X is checked.
+	struct Queue* queue;
+	bool used;
+};
+extern VectorEntry g_vectors[];
+
+// Allocates the queue's rings, and puts every descriptor in its free list. The rings still need to be given to the device.
+struct Queue* CreateQueue(struct Device* dev, uint16_t index, uint16_t size);
+// Returns the queue the current cpu submits to.
+struct Queue* GetQueue(struct Device* dev);
+// Queues a request, and issues as much of it as there are free descriptors for.
+// The buffer's pages must be faulted in, as the rest of the request can be issued from the interrupt handler.
+void SubmitRequest(struct Queue* queue, struct Request* req);
+// Cancels an asynchronous request if it's pending on the queue, and none of its commands were issued.
+bool CancelRequest(struct Queue* queue, obos::driverInterface::BlockRequest* request);
+// Waits for a request submitted without a BlockRequest. Returns false if the transfer failed.
+bool WaitForRequest(struct Queue* queue, struct Request* req);
+// Completes the commands the device finished, for when interrupts are off or were lost.
+void PollQueue(struct Queue* queue);
+void VirtioInterruptHandler(obos::interrupt_frame* frame);
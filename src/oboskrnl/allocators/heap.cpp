@@ -0,0 +1,221 @@
+/*
+	oboskrnl/allocators/heap.cpp
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <klog.h>
+#include <atomic.h>
+#include <memory_manipulation.h>
+
+#include <new>
+
+#include <allocators/liballoc.h>
+#include <allocators/slab.h>
+
+#include <allocators/vmm/vmm.h>
+#include <allocators/vmm/arch.h>
+
+#include <multitasking/locks/mutex.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+#endif
+
+#define LARGE_ALLOCATION_MAGIC 0x1A46E0A1
+
+// Allocations bigger than SLAB_MAX_GENERIC_SIZE get their own pages from the vmm, with this header at the start of the first page.
+struct largeAllocation
+{
+	alignas(0x10) uint32_t magic;
+	size_t size;
+	size_t nPages;
+};
+
+obos::memory::VirtualAllocator g_kernelHeapVirtualAllocator{ nullptr };
+
+static size_t s_nLargeAllocations;
+static size_t s_largeBytesInUse;
+static size_t s_largeBytesMapped;
+
+static largeAllocation* getLargeAllocation(void* ptr)
+{
+	if (((uintptr_t)ptr & (obos::memory::VirtualAllocator::GetPageSize() - 1)) != sizeof(largeAllocation))
+		return nullptr;
+	largeAllocation* header = (largeAllocation*)ptr - 1;
+	if (header->magic != LARGE_ALLOCATION_MAGIC)
+		return nullptr;
+	return header;
+}
+static void* allocateLarge(size_t amount)
+{
+	if (!obos::g_slabAllocatorInitialized)
+		obos::SlabInitialize(); // This initializes g_kernelHeapVmmLock.
+	const size_t pageSize = obos::memory::VirtualAllocator::GetPageSize();
+	size_t nPages = (amount + sizeof(largeAllocation) + pageSize - 1) / pageSize;
+	obos::g_kernelHeapVmmLock.Lock();
+	largeAllocation* header = (largeAllocation*)g_kernelHeapVirtualAllocator.VirtualAlloc(nullptr, nPages * pageSize, 0);
+	obos::g_kernelHeapVmmLock.Unlock();
+	if (!header)
+		return nullptr;
+	header->magic = LARGE_ALLOCATION_MAGIC;
+	header->size = amount;
+	header->nPages = nPages;
+	__atomic_add_fetch(&s_nLargeAllocations, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&s_largeBytesInUse, amount, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&s_largeBytesMapped, nPages * pageSize, __ATOMIC_RELAXED);
+	return header + 1;
+}
+static void freeLarge(largeAllocation* header)
+{
+	const size_t pageSize = obos::memory::VirtualAllocator::GetPageSize();
+	size_t nPages = header->nPages;
+	__atomic_sub_fetch(&s_nLargeAllocations, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&s_largeBytesInUse, header->size, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&s_largeBytesMapped, nPages * pageSize, __ATOMIC_RELAXED);
+	header->magic = 0;
+	obos::g_kernelHeapVmmLock.Lock();
+	g_kernelHeapVirtualAllocator.VirtualFree(header, nPages * pageSize);
+	obos::g_kernelHeapVmmLock.Unlock();
+}
+
+extern "C" {
+	// Memory returned by kmalloc is always zeroed.
+	void* kmalloc(size_t amount)
+	{
+		if (!amount)
+			return nullptr;
+		if (amount <= SLAB_MAX_GENERIC_SIZE)
+			return obos::SlabAllocateGeneric(amount);
+		return allocateLarge(amount);
+	}
+	void* kcalloc(size_t nobj, size_t szObj)
+	{
+		if (szObj && nobj > SIZE_MAX / szObj)
+			return nullptr;
+		return kmalloc(nobj * szObj);
+	}
+	void* krealloc(void* ptr, size_t newSize)
+	{
+		if (!newSize)
+			return nullptr;
+		if (!ptr)
+			return kmalloc(newSize);
+		size_t oldSize = 0;
+		if (obos::SlabOwnsAddress(ptr))
+			oldSize = obos::SlabGetObjectSize(ptr);
+		else if (largeAllocation* header = getLargeAllocation(ptr))
+		{
+			const size_t pageSize = obos::memory::VirtualAllocator::GetPageSize();
+			if ((newSize + sizeof(largeAllocation)) <= header->nPages * pageSize)
+			{
+				// The block still fits in its pages.
+				if (newSize < header->size)
+					obos::utils::memzero((byte*)ptr + newSize, header->size - newSize);
+				__atomic_add_fetch(&s_largeBytesInUse, newSize - header->size, __ATOMIC_RELAXED);
+				header->size = newSize;
+				return ptr;
+			}
+			oldSize = header->size;
+		}
+		else
+			return nullptr;
+		if (newSize <= oldSize)
+			return ptr;
+		void* newBlock = kmalloc(newSize);
+		if (!newBlock)
+			return nullptr;
+		obos::utils::memcpy(newBlock, ptr, oldSize);
+		kfree(ptr);
+		return newBlock;
+	}
+	void kfree(void* ptr)
+	{
+		if (!ptr)
+			return;
+		if (obos::SlabOwnsAddress(ptr))
+		{
+			obos::SlabFreeGeneric(ptr);
+			return;
+		}
+		if (largeAllocation* header = getLargeAllocation(ptr))
+			freeLarge(header);
+	}
+}
+
+namespace obos
+{
+	bool CanAllocateMemory()
+	{
+#if defined(__x86_64__) || defined(_WIN64)
+		return obos::memory::g_initialized;
+#endif
+	}
+	void GetHeapStatistics(HeapStatistics* stats)
+	{
+		if (!stats)
+			return;
+		utils::memzero(stats, sizeof(*stats));
+		size_t bytesMapped = __atomic_load_n(&s_largeBytesMapped, __ATOMIC_RELAXED);
+		stats->nLargeAllocations = __atomic_load_n(&s_nLargeAllocations, __ATOMIC_RELAXED);
+		stats->largeBytesInUse = __atomic_load_n(&s_largeBytesInUse, __ATOMIC_RELAXED);
+		stats->bytesInUse = stats->largeBytesInUse;
+		for (size_t i = 0; i < SlabGetCacheCount() && i < HEAP_MAX_SIZE_CLASSES; i++)
+		{
+			SlabCacheStatistics cacheStats{};
+			if (!SlabGetStatistics(i, &cacheStats))
+				continue;
+			HeapSizeClassStatistics& sizeClass = stats->sizeClasses[stats->nSizeClasses++];
+			utils::memcpy(sizeClass.name, cacheStats.name, utils::strlen(cacheStats.name) < sizeof(sizeClass.name) ? utils::strlen(cacheStats.name) : sizeof(sizeClass.name) - 1);
+			sizeClass.objectSize = cacheStats.objectSize;
+			sizeClass.nObjectsInUse = cacheStats.nObjectsInUse;
+			sizeClass.nCachedObjects = cacheStats.nCachedObjects;
+			sizeClass.nSlabs = cacheStats.nSlabs;
+			sizeClass.nAllocations = cacheStats.nAllocations;
+			sizeClass.nFrees = cacheStats.nFrees;
+			stats->bytesInUse += cacheStats.nObjectsInUse * cacheStats.objectSize;
+			bytesMapped += cacheStats.nSlabs * SLAB_SIZE;
+		}
+		stats->bytesMapped = bytesMapped;
+		stats->fragmentation = bytesMapped && bytesMapped > stats->bytesInUse ? (uint8_t)((bytesMapped - stats->bytesInUse) * 100 / bytesMapped) : 0;
+	}
+}
+
+[[nodiscard]] void* operator new(size_t count) noexcept
+{
+	return kmalloc(count);
+}
+[[nodiscard]] void* operator new[](size_t count) noexcept
+{
+	return kmalloc(count);
+}
+void operator delete(void* block) noexcept
+{
+	kfree(block);
+}
+void operator delete[](void* block) noexcept
+{
+	kfree(block);
+}
+void operator delete(void* block, size_t)
+{
+	kfree(block);
+}
+void operator delete[](void* block, size_t)
+{
+	kfree(block);
+}
+
+[[nodiscard]] void* operator new(size_t, void* ptr) noexcept
+{
+	return ptr;
+}
+[[nodiscard]] void* operator new[](size_t, void* ptr) noexcept
+{
+	return ptr;
+}
+void operator delete(void*, void*) noexcept
+{}
+void operator delete[](void*, void*) noexcept
+{}
@@ -21,8 +21,40 @@ OBOS_EXPORT void kfree(void* ptr);
 
 #ifdef __cplusplus
 }
+#define HEAP_MAX_SIZE_CLASSES 32
 namespace obos
 {
 	bool CanAllocateMemory();
+
+	struct HeapSizeClassStatistics
+	{
+		char name[24];
+		size_t objectSize;
+		size_t nObjectsInUse;
+		// Free objects held in the per-cpu caches.
+		size_t nCachedObjects;
+		size_t nSlabs;
+		uint64_t nAllocations;
+		uint64_t nFrees;
+	};
+	struct HeapStatistics
+	{
+		// Bytes allocated and not freed yet, with small allocations rounded up to their size class.
+		size_t bytesInUse;
+		// Bytes the heap got from the vmm.
+		size_t bytesMapped;
+		// From 0-100, the percentage of bytesMapped that isn't in use.
+		uint8_t fragmentation;
+		// Allocations bigger than the biggest size class.
+		size_t nLargeAllocations;
+		size_t largeBytesInUse;
+		size_t nSizeClasses;
+		HeapSizeClassStatistics sizeClasses[HEAP_MAX_SIZE_CLASSES];
+	};
+	/// <summary>
+	/// Gets statistics about the kernel heap.
+	/// </summary>
+	/// <param name="stats">[out] The statistics.</param>
+	OBOS_EXPORT void GetHeapStatistics(HeapStatistics* stats);
 }
 #endif
@@ -5,69 +5,98 @@
 */
 
 #include <int.h>
+#include <atomic.h>
+#include <memory_manipulation.h>
 #include <new>
 
 #include <allocators/vmm/vmm.h>
 #include <allocators/slab.h>
+#include <allocators/liballoc.h>
 
 #include <multitasking/thread.h>
+#include <multitasking/scheduler.h>
+#include <multitasking/cpu_local.h>
 #include <multitasking/process/process.h>
 #include <multitasking/locks/mutex.h>
 #include <vfs/vfsNode.h>
 #include <driverInterface/struct.h>
 #include <driverInterface/input_device.h>
 
-#define DEFAULT_OBJECT_COUNT 32
-extern obos::memory::VirtualAllocator g_liballocVirtualAllocator;
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+// The start of the range the kernel's virtual allocator allocates in.
+#define SLAB_REGION_BASE 0xffffffff00000000
+#define SLAB_REGION_SIZE 0x100000000
+#endif
+
+#define SLAB_MAGIC 0x51AB0BB5
+// Objects start at this offset in their slab, after the slab's header.
+#define SLAB_OBJECTS_OFFSET 0x40
+#define SLAB_MAGAZINE_SIZE 16
+// How many empty slabs a cache keeps around before giving them back to the vmm.
+#define SLAB_MAX_EMPTY_SLABS 1
+#define N_TYPED_CACHES 9
+#define N_GENERIC_CACHES 18
+#define N_CACHES (N_TYPED_CACHES + N_GENERIC_CACHES)
+
+extern obos::memory::VirtualAllocator g_kernelHeapVirtualAllocator;
 
 namespace obos
 {
-	locks::Mutex g_slabAllocatorLock;
 	bool g_slabAllocatorInitialized;
-	struct FreeListNode
-	{
-		alignas(0x10) struct FreeList* parent;
-		alignas(0x10) FreeListNode *next, *prev;
-		void Remove(FreeListNode*& head, FreeListNode*& tail, size_t &nNodes)
-		{
-			if (next)
-				next->prev = prev;
-			if (prev)
-				prev->next = next;
-			if (head == this)
-				head = next;
-			if (tail == this)
-				tail = prev;
-			nNodes--;
-		}
-		void PushBack(FreeListNode*& head, FreeListNode*& tail, size_t& nNodes)
-		{
-			if (tail)
-				tail->next = this;
-			if(!head)
-				head = this;
-			prev = tail;
-			tail = this;
-			nNodes++;
-		}
-		void PushFront(FreeListNode*& head, FreeListNode*& tail, size_t& nNodes)
+	struct Slab
+	{
+		uint32_t magic;
+		struct SlabCache* cache;
+		Slab *next, *prev;
+		// The free objects in this slab. The first bytes of each free object point to the next one.
+		void* freeList;
+		size_t nFree;
+	};
+	static_assert(sizeof(Slab) <= SLAB_OBJECTS_OFFSET, "Slab header is too big.");
+	struct SlabList
+	{
+		Slab* head;
+		size_t nSlabs;
+		void Append(Slab* slab)
 		{
+			slab->prev = nullptr;
+			slab->next = head;
 			if (head)
-				head->prev = this;
-			if (!tail)
-				tail = this;
-			next = head;
-			head = this;
-			nNodes++;
+				head->prev = slab;
+			head = slab;
+			nSlabs++;
+		}
+		void Remove(Slab* slab)
+		{
+			if (slab->next)
+				slab->next->prev = slab->prev;
+			if (slab->prev)
+				slab->prev->next = slab->next;
+			if (head == slab)
+				head = slab->next;
+			slab->next = slab->prev = nullptr;
+			nSlabs--;
 		}
 	};
-	struct FreeList
+	// Free objects cached by a cpu, so it doesn't need to take the cache's lock on most allocations and frees.
+	struct SlabMagazine
 	{
-		ObjectTypes type;
-		FreeListNode *fhead, *ftail;
-		size_t nFNodes;
-		FreeListNode *ahead, *atail;
-		size_t nANodes;
+		void* objects[SLAB_MAGAZINE_SIZE];
+		size_t nObjects;
+		uint64_t nAllocations, nFrees;
+	};
+	struct SlabCache
+	{
+		const char* name;
+		size_t objectSize;
+		size_t nObjectsPerSlab;
+		SlabList partial, full, empty;
+		bool lock;
+		// How many objects were taken out of this cache's slabs, including the ones held by magazines.
+		size_t nObjectsAllocated;
+		// Allocations and frees that didn't go through a magazine.
+		uint64_t nAllocations, nFrees;
 	};
 	constexpr size_t g_objectTypesToSize[] = {
 		sizeof(thread::Thread),
@@ -80,90 +109,405 @@ namespace obos
 		sizeof(driverInterface::InputDevice),
 		sizeof(driverInterface::driverIdentity),
 	};
-	static void ExpandFreeList(FreeList* list, size_t nObjects, size_t szObject, size_t alignment = 0)
+	// Powers of two, with a class halfway between each of them so at most a third of an object is wasted.
+	static constexpr size_t s_genericSizes[N_GENERIC_CACHES] = {
+		16, 32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096, 6144, SLAB_MAX_GENERIC_SIZE,
+	};
+	static const char* s_cacheNames[N_CACHES] = {
+		"Thread", "Process", "Mutex", "MountPoint", "DirectoryEntry", "PartitionEntry", "DriveEntry", "InputDevice", "DriverIdentity",
+		"generic-16", "generic-32", "generic-48", "generic-64", "generic-96", "generic-128", "generic-192", "generic-256", "generic-384",
+		"generic-512", "generic-768", "generic-1024", "generic-1536", "generic-2048", "generic-3072", "generic-4096", "generic-6144", "generic-8192",
+	};
+	static SlabCache s_caches[N_CACHES];
+	// s_magazines[cpuId * N_CACHES + cacheIndex]. This is allocated once the scheduler is initialized.
+	static SlabMagazine* s_magazines;
+	static bool s_magazinesAllocating;
+	// Bit n is set if the n-th SLAB_SIZE block of the kernel's address space is a slab.
+	static uint64_t s_slabBitmap[SLAB_REGION_SIZE / SLAB_SIZE / 64];
+	// The vmm isn't thread-safe, so this serializes the kernel heap's calls to it.
+	locks::Mutex g_kernelHeapVmmLock;
+
+	static void lockCache(SlabCache* cache)
 	{
-		size_t realSzObject = szObject + sizeof(FreeListNode);
-		if (alignment)
-			realSzObject += (realSzObject % alignment);
-		void* newBlock = g_liballocVirtualAllocator.VirtualAlloc(nullptr, nObjects * realSzObject, 0);
-		for (size_t i = 0; i < nObjects; i++)
-		{
-			FreeListNode* currentNode = (FreeListNode*)((byte*)newBlock + i * realSzObject);
-			new (currentNode) FreeListNode{};
-			currentNode->parent = list;
-			currentNode->PushBack(list->fhead, list->ftail, list->nFNodes);
-		}
+		while (!atomic_cmpxchg(&cache->lock, false, true))
+			pause();
 	}
-	FreeList g_freeLists[9];
+	static void unlockCache(SlabCache* cache)
+	{
+		atomic_clear(&cache->lock);
+	}
+	static void markSlab(uintptr_t addr, bool isSlab)
+	{
+		size_t index = (addr - SLAB_REGION_BASE) / SLAB_SIZE;
+		if (isSlab)
+			__atomic_fetch_or(&s_slabBitmap[index / 64], (uint64_t)1 << (index % 64), __ATOMIC_SEQ_CST);
+		else
+			__atomic_fetch_and(&s_slabBitmap[index / 64], ~((uint64_t)1 << (index % 64)), __ATOMIC_SEQ_CST);
+	}
+	static Slab* getSlab(const void* obj)
+	{
+		uintptr_t addr = (uintptr_t)obj;
+		if (addr < SLAB_REGION_BASE)
+			return nullptr;
+		size_t index = (addr - SLAB_REGION_BASE) / SLAB_SIZE;
+		if (!(__atomic_load_n(&s_slabBitmap[index / 64], __ATOMIC_SEQ_CST) & ((uint64_t)1 << (index % 64))))
+			return nullptr;
+		Slab* slab = (Slab*)(addr & ~((uintptr_t)SLAB_SIZE - 1));
+		if (slab->magic != SLAB_MAGIC || (addr - (uintptr_t)slab) < SLAB_OBJECTS_OFFSET)
+			return nullptr;
+		return slab;
+	}
+
 	void SlabInitialize()
 	{
-		new (&g_slabAllocatorLock) locks::Mutex{};
-		for (size_t i = 0; i < sizeof(g_freeLists) / sizeof(g_freeLists[0]); i++)
+		new (&g_kernelHeapVmmLock) locks::Mutex{};
+		for (size_t i = 0; i < N_CACHES; i++)
 		{
-			ExpandFreeList(g_freeLists + i, DEFAULT_OBJECT_COUNT, g_objectTypesToSize[i], i == 0 ? 0x10 : 0);
-			g_freeLists[i].type = (ObjectTypes)(i+1);
+			SlabCache* cache = &s_caches[i];
+			cache->name = s_cacheNames[i];
+			if (i < N_TYPED_CACHES)
+				cache->objectSize = (g_objectTypesToSize[i] + 0xf) & ~0xf;
+			else
+				cache->objectSize = s_genericSizes[i - N_TYPED_CACHES];
+			cache->nObjectsPerSlab = (SLAB_SIZE - SLAB_OBJECTS_OFFSET) / cache->objectSize;
 		}
 		g_slabAllocatorInitialized = true;
 	}
-	void* ImplSlabAllocate(ObjectTypes _type, size_t nObjects)
+	static void allocateMagazines()
 	{
-		if (!g_slabAllocatorInitialized)
-			SlabInitialize();
-		uint32_t type = (uint32_t)_type - 1;
-		if (_type == ObjectTypes::Invalid || type > 8)
+		if (!atomic_cmpxchg(&s_magazinesAllocating, false, true))
+			return;
+		g_kernelHeapVmmLock.Lock();
+		size_t size = thread::g_nCPUs * N_CACHES * sizeof(SlabMagazine);
+		SlabMagazine* magazines = (SlabMagazine*)g_kernelHeapVirtualAllocator.VirtualAlloc(nullptr, size, memory::PROT_NO_COW_ON_ALLOCATE);
+		g_kernelHeapVmmLock.Unlock();
+		if (!magazines)
+		{
+			atomic_clear(&s_magazinesAllocating);
+			return;
+		}
+		utils::memzero(magazines, size);
+		__atomic_store_n(&s_magazines, magazines, __ATOMIC_SEQ_CST);
+	}
+	// Interrupts must be disabled.
+	static SlabMagazine* getMagazine(SlabCache* cache)
+	{
+		SlabMagazine* magazines = __atomic_load_n(&s_magazines, __ATOMIC_SEQ_CST);
+		if (!magazines)
+			return nullptr;
+		thread::cpu_local* cpu = thread::GetCurrentCpuLocalPtr();
+		if (!cpu)
+			return nullptr;
+		return &magazines[cpu->cpuId * N_CACHES + (cache - s_caches)];
+	}
+
+	static Slab* allocateSlab(SlabCache* cache)
+	{
+		// Allocate twice as much as needed, then free everything outside of the aligned slab.
+		g_kernelHeapVmmLock.Lock();
+		uintptr_t block = (uintptr_t)g_kernelHeapVirtualAllocator.VirtualAlloc(nullptr, SLAB_SIZE * 2, 0);
+		if (!block)
+		{
+			g_kernelHeapVmmLock.Unlock();
 			return nullptr;
-		const size_t sz = g_objectTypesToSize[type];
-		FreeList* const list = &g_freeLists[type];
-		if (!list->fhead)
-			ExpandFreeList(list, DEFAULT_OBJECT_COUNT, sz);
-		if (list->nFNodes < nObjects)
-			ExpandFreeList(list, nObjects, sz);
-		auto node = list->ftail;
-		void* ret = node + 1;
-		for (size_t i = 0; i < nObjects; i++)
-		{
-			node->Remove(list->fhead, list->ftail, list->nFNodes);
-			node->PushBack(list->ahead, list->atail, list->nANodes);
 		}
-		return ret;
+		uintptr_t base = (block + SLAB_SIZE - 1) & ~((uintptr_t)SLAB_SIZE - 1);
+		if (base != block)
+			g_kernelHeapVirtualAllocator.VirtualFree((void*)block, base - block);
+		if (base + SLAB_SIZE != block + SLAB_SIZE * 2)
+			g_kernelHeapVirtualAllocator.VirtualFree((void*)(base + SLAB_SIZE), (block + SLAB_SIZE * 2) - (base + SLAB_SIZE));
+		g_kernelHeapVmmLock.Unlock();
+		Slab* slab = (Slab*)base;
+		slab->magic = SLAB_MAGIC;
+		slab->cache = cache;
+		slab->next = slab->prev = nullptr;
+		slab->freeList = nullptr;
+		slab->nFree = cache->nObjectsPerSlab;
+		for (size_t i = cache->nObjectsPerSlab; i > 0; i--)
+		{
+			void* obj = (byte*)base + SLAB_OBJECTS_OFFSET + (i - 1) * cache->objectSize;
+			*(void**)obj = slab->freeList;
+			slab->freeList = obj;
+		}
+		markSlab(base, true);
+		return slab;
 	}
-	static bool HasNode(FreeList* list, void* obj)
+	// Gives the memory of slabs back to the vmm. The slabs are linked through 'next'.
+	static size_t releaseSlabs(Slab* slabs)
 	{
-		for (auto node = list->ahead; node;)
+		size_t nFreed = 0;
+		while (slabs)
+		{
+			Slab* next = slabs->next;
+			markSlab((uintptr_t)slabs, false);
+			slabs->magic = 0;
+			g_kernelHeapVmmLock.Lock();
+			g_kernelHeapVirtualAllocator.VirtualFree(slabs, SLAB_SIZE);
+			g_kernelHeapVmmLock.Unlock();
+			nFreed += SLAB_SIZE;
+			slabs = next;
+		}
+		return nFreed;
+	}
+	// The cache must be locked.
+	static void* takeObject(SlabCache* cache)
+	{
+		Slab* slab = cache->partial.head;
+		if (!slab)
+			slab = cache->empty.head;
+		if (!slab)
+			return nullptr;
+		bool wasEmpty = slab->nFree == cache->nObjectsPerSlab;
+		void* obj = slab->freeList;
+		slab->freeList = *(void**)obj;
+		slab->nFree--;
+		if (wasEmpty)
+		{
+			cache->empty.Remove(slab);
+			if (slab->nFree)
+				cache->partial.Append(slab);
+			else
+				cache->full.Append(slab);
+		}
+		else if (!slab->nFree)
+		{
+			cache->partial.Remove(slab);
+			cache->full.Append(slab);
+		}
+		cache->nObjectsAllocated++;
+		return obj;
+	}
+	// The cache must be locked. If there are too many empty slabs, one gets put in 'release'.
+	static void returnObject(SlabCache* cache, void* obj, Slab*& release)
+	{
+		Slab* slab = (Slab*)((uintptr_t)obj & ~((uintptr_t)SLAB_SIZE - 1));
+		bool wasFull = !slab->nFree;
+		*(void**)obj = slab->freeList;
+		slab->freeList = obj;
+		slab->nFree++;
+		cache->nObjectsAllocated--;
+		if (slab->nFree == cache->nObjectsPerSlab)
+		{
+			(wasFull ? cache->full : cache->partial).Remove(slab);
+			cache->empty.Append(slab);
+		}
+		else if (wasFull)
 		{
-			if (node == obj)
-				return true;
+			cache->full.Remove(slab);
+			cache->partial.Append(slab);
+		}
+		if (cache->empty.nSlabs > SLAB_MAX_EMPTY_SLABS)
+		{
+			Slab* victim = cache->empty.head;
+			cache->empty.Remove(victim);
+			victim->next = release;
+			release = victim;
+		}
+	}
 
-			node = node->next;
+	static void* cacheAllocate(SlabCache* cache)
+	{
+		if (!s_magazines && thread::g_initialized && thread::g_cpuInfo)
+			allocateMagazines();
+		void* ret = nullptr;
+		while (!ret)
+		{
+			uintptr_t flags = saveFlagsAndCLI();
+			SlabMagazine* magazine = getMagazine(cache);
+			if (magazine && magazine->nObjects)
+				ret = magazine->objects[--magazine->nObjects];
+			else
+			{
+				lockCache(cache);
+				ret = takeObject(cache);
+				// Refill the magazine while the lock is held.
+				while (ret && magazine && magazine->nObjects < SLAB_MAGAZINE_SIZE / 2)
+				{
+					void* obj = takeObject(cache);
+					if (!obj)
+						break;
+					magazine->objects[magazine->nObjects++] = obj;
+				}
+				if (ret && !magazine)
+					cache->nAllocations++;
+				unlockCache(cache);
+			}
+			if (ret && magazine)
+				magazine->nAllocations++;
+			restorePreviousInterruptStatus(flags);
+			if (ret)
+				break;
+			Slab* slab = allocateSlab(cache);
+			if (!slab)
+				return nullptr;
+			flags = saveFlagsAndCLI();
+			lockCache(cache);
+			cache->empty.Append(slab);
+			unlockCache(cache);
+			restorePreviousInterruptStatus(flags);
 		}
-		return true;
+		utils::memzero(ret, cache->objectSize);
+		return ret;
 	}
-	bool SlabHasObject(ObjectTypes _type, void* obj)
+	static void cacheFree(SlabCache* cache, void* obj)
+	{
+		Slab* release = nullptr;
+		uintptr_t flags = saveFlagsAndCLI();
+		SlabMagazine* magazine = getMagazine(cache);
+		if (magazine)
+		{
+			if (magazine->nObjects == SLAB_MAGAZINE_SIZE)
+			{
+				lockCache(cache);
+				while (magazine->nObjects > SLAB_MAGAZINE_SIZE / 2)
+					returnObject(cache, magazine->objects[--magazine->nObjects], release);
+				unlockCache(cache);
+			}
+			magazine->objects[magazine->nObjects++] = obj;
+			magazine->nFrees++;
+		}
+		else
+		{
+			lockCache(cache);
+			returnObject(cache, obj, release);
+			cache->nFrees++;
+			unlockCache(cache);
+		}
+		restorePreviousInterruptStatus(flags);
+		releaseSlabs(release);
+	}
+
+	static SlabCache* typeToCache(ObjectTypes _type)
 	{
 		uint32_t type = (uint32_t)_type - 1;
-		if (_type == ObjectTypes::Invalid || type > 8)
+		if (_type == ObjectTypes::Invalid || type >= N_TYPED_CACHES)
+			return nullptr;
+		if (!g_slabAllocatorInitialized)
+			SlabInitialize();
+		return &s_caches[type];
+	}
+	void* ImplSlabAllocate(ObjectTypes type, size_t nObjects)
+	{
+		SlabCache* cache = typeToCache(type);
+		if (!cache)
+			return nullptr;
+		// Arrays can't be split across slabs, so they go through kmalloc. Leave space for the array cookie.
+		if (nObjects != 1)
+			return kcalloc(nObjects + 1, cache->objectSize);
+		return cacheAllocate(cache);
+	}
+	void ImplSlabFree(ObjectTypes type, void* obj, size_t nObjects)
+	{
+		SlabCache* cache = typeToCache(type);
+		if (!cache || !obj)
+			return;
+		if (nObjects != 1)
+		{
+			kfree(obj);
+			return;
+		}
+		Slab* slab = getSlab(obj);
+		if (!slab || slab->cache != cache)
+			return;
+		cacheFree(cache, obj);
+	}
+	bool SlabHasObject(ObjectTypes type, void* obj)
+	{
+		SlabCache* cache = typeToCache(type);
+		if (!cache)
+			return false;
+		Slab* slab = getSlab(obj);
+		if (!slab || slab->cache != cache)
 			return false;
-		return HasNode(&g_freeLists[type], obj);
+		size_t offset = (uintptr_t)obj - (uintptr_t)slab - SLAB_OBJECTS_OFFSET;
+		return !(offset % cache->objectSize) && (offset / cache->objectSize) < cache->nObjectsPerSlab;
 	}
-	void ImplSlabFree(ObjectTypes _type, void* obj, size_t nObjects)
+	void* SlabAllocateGeneric(size_t size)
 	{
+		if (size > SLAB_MAX_GENERIC_SIZE)
+			return nullptr;
 		if (!g_slabAllocatorInitialized)
+			SlabInitialize();
+		size_t i = 0;
+		while (s_genericSizes[i] < size)
+			i++;
+		return cacheAllocate(&s_caches[N_TYPED_CACHES + i]);
+	}
+	void SlabFreeGeneric(void* obj)
+	{
+		Slab* slab = getSlab(obj);
+		if (!slab)
 			return;
-		uint32_t type = (uint32_t)_type - 1;
-		if (_type == ObjectTypes::Invalid || type > 8)
-			return;
-		obj = (void*)((uintptr_t)obj - sizeof(FreeListNode));
-		const size_t sz = g_objectTypesToSize[type];
-		FreeList* const list = &g_freeLists[type];
-		for (size_t i = 0; i < nObjects; i++)
-			if (!HasNode(list, (FreeListNode*)( (byte*)obj + i * (sz + sizeof(FreeListNode)) ) ) )
-				return;
-		for (size_t i = 0; i < nObjects; i++)
+		cacheFree(slab->cache, obj);
+	}
+	bool SlabOwnsAddress(const void* addr)
+	{
+		return getSlab(addr) != nullptr;
+	}
+	size_t SlabGetObjectSize(const void* obj)
+	{
+		Slab* slab = getSlab(obj);
+		return slab ? slab->cache->objectSize : 0;
+	}
+	size_t SlabReclaim()
+	{
+		if (!g_slabAllocatorInitialized)
+			return 0;
+		size_t nFreed = 0;
+		for (size_t i = 0; i < N_CACHES; i++)
 		{
-			FreeListNode* node = (FreeListNode*)((byte*)obj + i * (sz + sizeof(FreeListNode)));
-			node->Remove(list->ahead, list->atail, list->nANodes);
-			node->PushBack(list->fhead, list->ftail, list->nFNodes);
-			utils::memzero(node + 1, sz);
+			SlabCache* cache = &s_caches[i];
+			Slab* release = nullptr;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache(cache);
+			// Flush this cpu's magazine first, so its objects don't keep slabs alive.
+			SlabMagazine* magazine = getMagazine(cache);
+			while (magazine && magazine->nObjects)
+				returnObject(cache, magazine->objects[--magazine->nObjects], release);
+			while (Slab* slab = cache->empty.head)
+			{
+				cache->empty.Remove(slab);
+				slab->next = release;
+				release = slab;
+			}
+			unlockCache(cache);
+			restorePreviousInterruptStatus(flags);
+			nFreed += releaseSlabs(release);
 		}
+		return nFreed;
+	}
+	size_t SlabGetCacheCount()
+	{
+		return N_CACHES;
+	}
+	bool SlabGetStatistics(size_t index, SlabCacheStatistics* stats)
+	{
+		if (index >= N_CACHES || !stats)
+			return false;
+		if (!g_slabAllocatorInitialized)
+			SlabInitialize();
+		SlabCache* cache = &s_caches[index];
+		stats->name = cache->name;
+		stats->objectSize = cache->objectSize;
+		uintptr_t flags = saveFlagsAndCLI();
+		lockCache(cache);
+		stats->nSlabs = cache->partial.nSlabs + cache->full.nSlabs + cache->empty.nSlabs;
+		stats->nEmptySlabs = cache->empty.nSlabs;
+		size_t nObjectsAllocated = cache->nObjectsAllocated;
+		stats->nAllocations = cache->nAllocations;
+		stats->nFrees = cache->nFrees;
+		unlockCache(cache);
+		restorePreviousInterruptStatus(flags);
+		stats->nCachedObjects = 0;
+		SlabMagazine* magazines = __atomic_load_n(&s_magazines, __ATOMIC_SEQ_CST);
+		for (size_t cpu = 0; magazines && cpu < thread::g_nCPUs; cpu++)
+		{
+			SlabMagazine* magazine = &magazines[cpu * N_CACHES + index];
+			stats->nCachedObjects += __atomic_load_n(&magazine->nObjects, __ATOMIC_RELAXED);
+			stats->nAllocations += __atomic_load_n(&magazine->nAllocations, __ATOMIC_RELAXED);
+			stats->nFrees += __atomic_load_n(&magazine->nFrees, __ATOMIC_RELAXED);
+		}
+		stats->nObjectsInUse = nObjectsAllocated > stats->nCachedObjects ? nObjectsAllocated - stats->nCachedObjects : 0;
+		return true;
 	}
-}
\ No newline at end of file
+}
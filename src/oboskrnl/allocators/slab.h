@@ -9,9 +9,20 @@
 #include <int.h>
 #include <new>
 
+// Slabs are aligned to their size, so the slab an object is in can be found from the object's address.
+#define SLAB_SIZE 0x10000
+// The biggest allocation the generic slab caches can satisfy.
+#define SLAB_MAX_GENERIC_SIZE 8192
+
 namespace obos
 {
+	namespace locks
+	{
+		class Mutex;
+	}
 	extern bool g_slabAllocatorInitialized;
+	// Serializes the kernel heap's calls into the (non thread-safe) VMM.
+	extern locks::Mutex g_kernelHeapVmmLock;
 	enum class ObjectTypes
 	{
 		Invalid,
@@ -49,6 +60,59 @@ namespace obos
 	/// <param name="obj">The object to check.</param>
 	/// <returns>Whether the object exists (true) or not (false).</returns>
 	bool SlabHasObject(ObjectTypes type, void* obj);
+	/// <summary>
+	/// Allocates an object from the generic slab caches.
+	/// </summary>
+	/// <param name="size">The size of the object. This is rounded up to the next size class.</param>
+	/// <returns>The object, or nullptr if size is bigger than SLAB_MAX_GENERIC_SIZE or there's no memory left.</returns>
+	void* SlabAllocateGeneric(size_t size);
+	/// <summary>
+	/// Frees an object allocated by SlabAllocateGeneric.
+	/// </summary>
+	/// <param name="obj">The object to free.</param>
+	void SlabFreeGeneric(void* obj);
+	/// <summary>
+	/// Checks if an address is inside of a slab.
+	/// </summary>
+	/// <param name="addr">The address to check.</param>
+	/// <returns>Whether the address is in a slab (true) or not (false).</returns>
+	bool SlabOwnsAddress(const void* addr);
+	/// <summary>
+	/// Gets the size of an object allocated with the slab allocator.
+	/// </summary>
+	/// <param name="obj">The object.</param>
+	/// <returns>The size of the object, or zero if it wasn't allocated with the slab allocator.</returns>
+	size_t SlabGetObjectSize(const void* obj);
+	/// <summary>
+	/// Gives the memory of every empty slab back to the vmm.
+	/// </summary>
+	/// <returns>How many bytes were freed.</returns>
+	size_t SlabReclaim();
+
+	struct SlabCacheStatistics
+	{
+		const char* name;
+		size_t objectSize;
+		size_t nSlabs;
+		size_t nEmptySlabs;
+		// Doesn't include the free objects held by the per-cpu magazines.
+		size_t nObjectsInUse;
+		size_t nCachedObjects;
+		uint64_t nAllocations;
+		uint64_t nFrees;
+	};
+	/// <summary>
+	/// Gets the amount of slab caches.
+	/// </summary>
+	/// <returns>The amount of slab caches.</returns>
+	size_t SlabGetCacheCount();
+	/// <summary>
+	/// Gets the statistics of a slab cache.
+	/// </summary>
+	/// <param name="cache">The index of the cache. This must be less than SlabGetCacheCount().</param>
+	/// <param name="stats">[out] The statistics.</param>
+	/// <returns>false if the cache doesn't exist, otherwise true.</returns>
+	bool SlabGetStatistics(size_t cache, SlabCacheStatistics* stats);
 
 	// Template madness!
 
@@ -42,10 +42,6 @@ namespace obos
 		// Returns true when the page fault was handled properly and addr was successfully mapped, otherwise false.
 		extern bool mapFilePFHandler(uintptr_t addr, memory::PageMap* pageMap, uintptr_t errorCode);
 	}
-	namespace thread
-	{
-		extern locks::Mutex g_coreGlobalSchedulerLock;
-	}
 	bool g_halt, g_unMask;
 	static size_t s_kModeExceptions = 0;
 	static constexpr const size_t kmodeExceptionsLimit = 3;
@@ -189,6 +189,12 @@ namespace obos
 				return thread->tid;
 			return 0;
 		}
+		static void resumeThr(thread::Thread* _thread)
+		{
+			_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+			// The scheduler moves paused threads off the run queues, so put it back.
+			thread::ReadyThread(_thread);
+		}
 		static void step(thread::Thread* _thread, interrupt_frame* frame)
 		{
 			_thread->status |= thread::THREAD_STATUS_SINGLE_STEPPING;
@@ -201,7 +207,8 @@ namespace obos
 		}
 		static void _continue(thread::Thread* _thread, interrupt_frame* frame)
 		{
-			_thread->status &= ~(thread::THREAD_STATUS_PAUSED | thread::THREAD_STATUS_SINGLE_STEPPING);
+			_thread->status &= ~thread::THREAD_STATUS_SINGLE_STEPPING;
+			resumeThr(_thread);
 			_thread->context.frame.rflags.setBit((uintptr_t)1 << 8);
 			if (_thread == getCurrentThread())
 				frame->rflags.setBit((uintptr_t)1 << 8);
@@ -232,10 +239,19 @@ namespace obos
 					currentThread = currentThread->next_run;
 				}
 				};
-			scanThreadList(thread::g_priorityLists[0]);
-			scanThreadList(thread::g_priorityLists[1]);
-			scanThreadList(thread::g_priorityLists[2]);
-			scanThreadList(thread::g_priorityLists[3]);
+			for (size_t i = 0; i < thread::g_nCPUs && !stop; i++)
+			{
+				// Running threads aren't in any list.
+				thread::Thread* running = (thread::Thread*)thread::g_cpuInfo[i].currentThread;
+				if (running && running != thread::g_cpuInfo[i].idleThread)
+				{
+					thread::Thread::ThreadList list{ running, running, 1 };
+					scanThreadList(list);
+				}
+				for (size_t j = 0; j < 4; j++)
+					scanThreadList(thread::g_cpuInfo[i].priorityLists[j]);
+				scanThreadList(thread::g_cpuInfo[i].blockedList);
+			}
 		}
 		// Returns nullptr if there is no thread with that tid.
 		static thread::Thread* getThreadFromTid(uint32_t tid)
@@ -344,7 +360,7 @@ namespace obos
 						_response = setupRegisterResponse(getCurrentThread() == _thread ? frame : &_thread->context.frame);
 						_responseLen = utils::strlen(_response);
 						shouldFree = true;
-						_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+						resumeThr(_thread);
 						break;
 					}
 					case 'G':
@@ -394,17 +410,17 @@ namespace obos
 						SET_REGISTER32(data, _thread->context.frame.rflags);
 						SET_REGISTER32(data, _thread->context.frame.cs);
 						SET_REGISTER32(data, _thread->context.frame.ds);
-						_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+						resumeThr(_thread);
 						break;
 					}
 					case 'c':
-						_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+						resumeThr(_thread);
 						if (_thread == getCurrentThread())
 							status = HandlePacketStatus::CONTINUE_PROGRAM;
 						_continue(_thread, frame);
 						break;
 					case 's':
-						_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+						resumeThr(_thread);
 						step(_thread, frame);
 						if (_thread == getCurrentThread())
 							status = HandlePacketStatus::CONTINUE_PROGRAM;
@@ -578,13 +594,13 @@ namespace obos
 									switch (par->action)
 									{
 									case 'c':
-										_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+										resumeThr(_thread);
 										if (_thread == getCurrentThread())
 											par->status = HandlePacketStatus::CONTINUE_PROGRAM;
 										_continue(_thread, par->frame);
 										break;
 									case 's':
-										_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+										resumeThr(_thread);
 										step(_thread, par->frame);
 										if (_thread == getCurrentThread())
 											par->status = HandlePacketStatus::CONTINUE_PROGRAM;
@@ -613,7 +629,7 @@ namespace obos
 				case 's':
 				{
 					thread::Thread* _thread = const_cast<thread::Thread*>(getCurrentThread());
-					_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+					resumeThr(_thread);
 					status = HandlePacketStatus::CONTINUE_PROGRAM;
 					step(_thread, frame);
 					break;
@@ -621,7 +637,7 @@ namespace obos
 				case 'c':
 				{
 					thread::Thread* _thread = const_cast<thread::Thread*>(getCurrentThread());
-					_thread->status &= ~thread::THREAD_STATUS_PAUSED;
+					resumeThr(_thread);
 					status = HandlePacketStatus::CONTINUE_PROGRAM;
 					_continue(_thread, frame);
 					break;
@@ -703,10 +719,19 @@ namespace obos
 								currentThread = currentThread->next_run;
 							}
 							};
-						scanThreadList(thread::g_priorityLists[0]);
-						scanThreadList(thread::g_priorityLists[1]);
-						scanThreadList(thread::g_priorityLists[2]);
-						scanThreadList(thread::g_priorityLists[3]);
+						for (size_t i = 0; i < thread::g_nCPUs; i++)
+						{
+							// Running threads aren't in any list.
+							thread::Thread* running = (thread::Thread*)thread::g_cpuInfo[i].currentThread;
+							if (running && running != thread::g_cpuInfo[i].idleThread)
+							{
+								thread::Thread::ThreadList list{ running, running, 1 };
+								scanThreadList(list);
+							}
+							for (size_t j = 0; j < 4; j++)
+								scanThreadList(thread::g_cpuInfo[i].priorityLists[j]);
+							scanThreadList(thread::g_cpuInfo[i].blockedList);
+						}
 						_response[_responseLen - 1] = 'T'; // Replace the trailing comma with a 'T'.
 					}
 					else if (utils::strcmp(command, "ThreadExtraInfo"))
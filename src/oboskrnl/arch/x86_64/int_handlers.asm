@@ -228,7 +228,7 @@ syscall_instruction_handler:
 	mov r10, rsp
 	; $RSP = GetCurrentCpuLocalPtr()->currentThread->context.syscallStackBottom + 0x4000
 	mov r9, [gs:0x10]
-	mov r9, [r9+0x370]
+	mov r9, [r9+0x3d0]
 	add r9, 0x4000
 	mov rsp, r9
 	sub rsp, 8
@@ -250,7 +250,7 @@ syscall_instruction_handler:
 
 .check_kmode:
 	mov r10, [gs:0x10]
-	mov r9, [r10+0x130]
+	mov r9, [r10+0x190]
 	cmp r9, 0x10
 	jne .call
 	; A kernel-mode thread can't syscall with the "syscall" instruction.
@@ -28,12 +28,14 @@ namespace obos
 		RegisterInterruptHandler(isr, IntermediateTimerIntHandler);
 		g_currentTimerHandler = handler;
 		divisor = (TimerDivisor)((int)divisor & 0b1101);
-		if (timerConfig != 0 && timerConfig != TIMER_CONFIG_PERIODIC)
+		if (timerConfig != TIMER_CONFIG_ONE_SHOT && timerConfig != TIMER_CONFIG_PERIODIC && timerConfig != TIMER_CONFIG_TSC_DEADLINE)
 			timerConfig = TIMER_CONFIG_PERIODIC;
 		g_localAPICAddr->divideConfig = divisor;
 		g_localAPICAddr->lvtTimer = isr | timerConfig;
 		MaskTimer(mask);
-		g_localAPICAddr->initialCount = initialCount;
+		// The initial count is ignored in TSC-deadline mode, the deadline is set with the IA32_TSC_DEADLINE msr instead.
+		if (timerConfig != TIMER_CONFIG_TSC_DEADLINE)
+			g_localAPICAddr->initialCount = initialCount;
 		restorePreviousInterruptStatus(savedFlags);
 	}
 	void MaskTimer(bool mask)
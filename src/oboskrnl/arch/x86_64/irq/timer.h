@@ -14,6 +14,7 @@ namespace obos
 	{
 		TIMER_CONFIG_ONE_SHOT,
 		TIMER_CONFIG_PERIODIC = 0x20000,
+		TIMER_CONFIG_TSC_DEADLINE = 0x40000,
 	};
 	enum TimerDivisor
 	{
@@ -9,24 +9,51 @@
 #include <int.h>
 #include <export.h>
 
+// The biggest block the physical memory manager keeps track of is (1 << PMM_MAX_ORDER) pages.
+#define PMM_MAX_ORDER 10
+
 namespace obos
 {
 	namespace memory
 	{
+		struct PhysicalMemoryStatistics
+		{
+			// All the pages given to the physical memory manager.
+			size_t totalPages;
+			// Includes cachedPages.
+			size_t freePages;
+			size_t usedPages;
+			// Free pages held in the per-cpu page caches.
+			size_t cachedPages;
+			// How many free blocks of (1 << order) pages there are, indexed by order.
+			size_t freeBlocks[PMM_MAX_ORDER + 1];
+			// The size of the largest free block, in pages.
+			size_t largestFreeBlock;
+			// From 0-100, the percentage of free pages that aren't in a block of (1 << PMM_MAX_ORDER) pages.
+			uint8_t fragmentation;
+		};
+
 		void InitializePhysicalMemoryManager();
 	
 		/// <summary>
-		/// Allocates a physical page.
+		/// Allocates physically contiguous pages.
 		/// </summary>
-		/// <returns>The address of the page. Make sure to map this page before using it.</returns>
+		/// <param name="nPages">The amount of pages to allocate.</param>
+		/// <returns>The address of the first page, or zero if there isn't enough memory. Make sure to map this page before using it.</returns>
 		OBOS_EXPORT uintptr_t allocatePhysicalPage(size_t nPages = 1);
 		/// <summary>
 		/// Marks a physical page as freed.
 		/// </summary>
 		/// <param name="addr">The address of the page to free</param>
+		/// <param name="nPages">The amount of pages to free. This doesn't need to be the same amount that was allocated.</param>
 		/// <returns>true on success, otherwise false.</returns>
 		OBOS_EXPORT bool freePhysicalPage(uintptr_t addr, size_t nPages = 1);
 		/// <summary>
+		/// Gets statistics about the physical memory manager.
+		/// </summary>
+		/// <param name="stats">[out] The statistics.</param>
+		OBOS_EXPORT void GetPhysicalMemoryStatistics(PhysicalMemoryStatistics* stats);
+		/// <summary>
 		/// Queries whether a page is in the HHDM or not.
 		/// </summary>
 		/// <param name="addr">The address of the page to check.</param>
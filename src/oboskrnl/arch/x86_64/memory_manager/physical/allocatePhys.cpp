@@ -8,6 +8,7 @@
 
 #include <int.h>
 #include <klog.h>
+#include <error.h>
 #include <atomic.h>
 #include <memory_manipulation.h>
 
@@ -17,10 +18,17 @@
 
 #include <arch/x86_64/memory_manager/virtual/initialize.h>
 
+#include <multitasking/scheduler.h>
+#include <multitasking/cpu_local.h>
+
 #include <multitasking/locks/mutex.h>
 
 #include <new>
 
+#define PAGE_CACHE_SIZE (sizeof(thread::cpu_local_arch::pageCache) / sizeof(uintptr_t))
+// How many pages get moved between a cpu's page cache and the free lists at once.
+#define PAGE_CACHE_BATCH (PAGE_CACHE_SIZE / 2)
+
 namespace obos
 {
 	static volatile limine_memmap_request mmap_request = {
@@ -31,42 +39,244 @@ namespace obos
 	namespace memory
 	{
 		uintptr_t hhdm_base, hhdm_end;
+		// A free block of pages, stored in the block's first page.
 		struct MemoryNode
 		{
-			MemoryNode *next, *prev;
-			size_t nPages;
+			// Physical addresses.
+			uintptr_t next, prev;
 		};
-		MemoryNode *g_memoryHead, *g_memoryTail;
-		size_t g_nMemoryNodes;
+		// The free lists, indexed by the order of the blocks in them.
+		static uintptr_t s_freeLists[PMM_MAX_ORDER + 1];
+		static size_t s_nFreeBlocks[PMM_MAX_ORDER + 1];
+		// Bit n of s_freeBitmaps[order] is set if the block of (1 << order) pages starting at page (n << order) is free.
+		static uint64_t* s_freeBitmaps[PMM_MAX_ORDER + 1];
+		// One more than the highest page number the bitmaps cover.
+		static size_t s_nPages;
+		static size_t s_totalPages;
+		// Doesn't include the pages in the per-cpu page caches.
+		static size_t s_freePages;
 		locks::Mutex g_pmmLock;
 
+		static MemoryNode* getNode(size_t page)
+		{
+			return (MemoryNode*)mapPageTable((uintptr_t*)(page << 12));
+		}
+		static bool testFree(size_t page, uint8_t order)
+		{
+			size_t bit = page >> order;
+			return s_freeBitmaps[order][bit / 64] & ((uint64_t)1 << (bit % 64));
+		}
+		static void setFree(size_t page, uint8_t order, bool free)
+		{
+			size_t bit = page >> order;
+			if (free)
+				s_freeBitmaps[order][bit / 64] |= ((uint64_t)1 << (bit % 64));
+			else
+				s_freeBitmaps[order][bit / 64] &= ~((uint64_t)1 << (bit % 64));
+		}
+		static void pushBlock(size_t page, uint8_t order)
+		{
+			MemoryNode* node = getNode(page);
+			node->prev = 0;
+			node->next = s_freeLists[order];
+			if (s_freeLists[order])
+				getNode(s_freeLists[order] >> 12)->prev = page << 12;
+			s_freeLists[order] = page << 12;
+			s_nFreeBlocks[order]++;
+			setFree(page, order, true);
+		}
+		static void removeBlock(size_t page, uint8_t order)
+		{
+			MemoryNode* node = getNode(page);
+			if (node->next)
+				getNode(node->next >> 12)->prev = node->prev;
+			if (node->prev)
+				getNode(node->prev >> 12)->next = node->next;
+			else
+				s_freeLists[order] = node->next;
+			s_nFreeBlocks[order]--;
+			setFree(page, order, false);
+		}
+		// Frees a block, merging it with its buddy for as long as the buddy is free.
+		static void freeBlock(size_t page, uint8_t order)
+		{
+			while (order < PMM_MAX_ORDER)
+			{
+				size_t buddy = page ^ ((size_t)1 << order);
+				if (buddy >= s_nPages || !testFree(buddy, order))
+					break;
+				removeBlock(buddy, order);
+				page &= ~((size_t)1 << order);
+				order++;
+			}
+			pushBlock(page, order);
+		}
+		// Frees a range of pages by splitting it into the biggest aligned blocks possible.
+		static void freeRange(size_t page, size_t nPages)
+		{
+			s_freePages += nPages;
+			while (nPages)
+			{
+				uint8_t order = 0;
+				while (order < PMM_MAX_ORDER && !(page & ((size_t)1 << order)) && ((size_t)2 << order) <= nPages)
+					order++;
+				freeBlock(page, order);
+				page += (size_t)1 << order;
+				nPages -= (size_t)1 << order;
+			}
+		}
+		static bool pageIsFree(size_t page)
+		{
+			for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++)
+				if (testFree(page, order))
+					return true;
+			return false;
+		}
+		// Returns the first page of a free block of (1 << order) pages, or SIZE_MAX if there isn't one.
+		static size_t allocBlock(uint8_t order)
+		{
+			uint8_t current = order;
+			while (current <= PMM_MAX_ORDER && !s_freeLists[current])
+				current++;
+			if (current > PMM_MAX_ORDER)
+				return SIZE_MAX;
+			size_t page = s_freeLists[current] >> 12;
+			removeBlock(page, current);
+			// Split the block until it's the right size, giving back the upper halves.
+			while (current > order)
+			{
+				current--;
+				pushBlock(page + ((size_t)1 << current), current);
+			}
+			return page;
+		}
+		// Allocations bigger than the biggest block need a run of free blocks of the biggest order.
+		static size_t allocRun(size_t nBlocks)
+		{
+			const size_t blockSize = (size_t)1 << PMM_MAX_ORDER;
+			for (uintptr_t block = s_freeLists[PMM_MAX_ORDER]; block; block = getNode(block >> 12)->next)
+			{
+				size_t page = block >> 12;
+				size_t i = 1;
+				for (; i < nBlocks; i++)
+				{
+					size_t next = page + i * blockSize;
+					if (next >= s_nPages || !testFree(next, PMM_MAX_ORDER))
+						break;
+				}
+				if (i != nBlocks)
+					continue;
+				for (i = 0; i < nBlocks; i++)
+					removeBlock(page + i * blockSize, PMM_MAX_ORDER);
+				return page;
+			}
+			return SIZE_MAX;
+		}
+		static size_t allocPages(size_t nPages)
+		{
+			uint8_t order = 0;
+			while (order <= PMM_MAX_ORDER && ((size_t)1 << order) < nPages)
+				order++;
+			size_t page = 0, allocated = 0;
+			if (order <= PMM_MAX_ORDER)
+			{
+				page = allocBlock(order);
+				allocated = (size_t)1 << order;
+			}
+			else
+			{
+				size_t nBlocks = (nPages + ((size_t)1 << PMM_MAX_ORDER) - 1) >> PMM_MAX_ORDER;
+				page = allocRun(nBlocks);
+				allocated = nBlocks << PMM_MAX_ORDER;
+			}
+			if (page == SIZE_MAX)
+				return SIZE_MAX;
+			s_freePages -= allocated;
+			if (allocated > nPages)
+				freeRange(page + nPages, allocated - nPages);
+			return page;
+		}
+		// Returns the current cpu if its page cache can be used. Interrupts must be disabled.
+		static thread::cpu_local* getPageCacheCpu()
+		{
+			if (!thread::g_initialized)
+				return nullptr;
+			thread::cpu_local* cpu = thread::GetCurrentCpuLocalPtr();
+			return (cpu && cpu->initialized) ? cpu : nullptr;
+		}
+		// Moves pages from a cpu's page cache back to the free lists. g_pmmLock must be held.
+		static void drainPageCache(thread::cpu_local* cpu, size_t nPages)
+		{
+			auto& arch = cpu->arch_specific;
+			for (size_t i = 0; i < nPages && arch.nCachedPages; i++)
+				freeRange(arch.pageCache[--arch.nCachedPages] >> 12, 1);
+		}
+
 #pragma GCC push_options
 #pragma GCC optimize("O1")
+		static bool isRAM(uint64_t type)
+		{
+			return type == LIMINE_MEMMAP_USABLE ||
+				type == LIMINE_MEMMAP_BOOTLOADER_RECLAIMABLE ||
+				type == LIMINE_MEMMAP_ACPI_RECLAIMABLE ||
+				type == LIMINE_MEMMAP_KERNEL_AND_MODULES;
+		}
 		void InitializePhysicalMemoryManager()
 		{
 			new (&g_pmmLock) locks::Mutex{ false };
 			hhdm_base = hhdm_offset.response->offset;
+			// Memory that isn't usable yet can still be freed later (ex: bootloader reclaimable memory), so the bitmaps cover that too.
+			for (size_t i = 0; i < mmap_request.response->entry_count; i++)
+			{
+				auto entry = mmap_request.response->entries[i];
+				if (!isRAM(entry->type))
+					continue;
+				size_t end = (entry->base + entry->length) >> 12;
+				if (end > s_nPages)
+					s_nPages = end;
+			}
+			size_t bitmapSize = 0;
+			for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++)
+				bitmapSize += ((s_nPages >> order) / 64 + 1) * sizeof(uint64_t);
+			size_t bitmapPages = (bitmapSize + 0xfff) / 0x1000;
+			// Put the bitmaps at the start of the first usable entry that can fit them.
+			uintptr_t bitmapBase = 0;
+			for (size_t i = 0; i < mmap_request.response->entry_count && !bitmapBase; i++)
+			{
+				auto entry = mmap_request.response->entries[i];
+				if (entry->type != LIMINE_MEMMAP_USABLE)
+					continue;
+				uintptr_t base = (entry->base + 0xfff) & ~0xfff;
+				if (base < 0x1000)
+					base = 0x1000;
+				uintptr_t end = (entry->base + entry->length) & ~0xfff;
+				if (end > base && (end - base) / 0x1000 >= bitmapPages)
+					bitmapBase = base;
+			}
+			if (!bitmapBase)
+				logger::panic(nullptr, "Not enough physical memory for the physical memory manager's bitmaps.\n");
+			uint64_t* bitmap = (uint64_t*)mapPageTable((uintptr_t*)bitmapBase);
+			utils::memzero(bitmap, bitmapPages * 0x1000);
+			for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++)
+			{
+				s_freeBitmaps[order] = bitmap;
+				bitmap += (s_nPages >> order) / 64 + 1;
+			}
 			for (size_t i = 0; i < mmap_request.response->entry_count; i++)
 			{
-				if (mmap_request.response->entries[i]->type != LIMINE_MEMMAP_USABLE)
+				auto entry = mmap_request.response->entries[i];
+				if (entry->type != LIMINE_MEMMAP_USABLE)
 					continue;
-				uintptr_t base = mmap_request.response->entries[i]->base;
+				uintptr_t base = (entry->base + 0xfff) & ~0xfff;
 				if (base < 0x1000)
 					base = 0x1000;
-				if (base & 0xfff)
-					base = (base + 0xfff) & 0xfff;
-				size_t size = mmap_request.response->entries[i]->length & ~0xfff;
-				g_nMemoryNodes++;
-				MemoryNode* newNode = (MemoryNode*)mapPageTable((uintptr_t*)base);
-				MemoryNode* newNodePhys = (MemoryNode*)base;
-				if (g_memoryTail)
-					((MemoryNode*)mapPageTable((uintptr_t*)g_memoryTail))->next = newNodePhys;
-				if(!g_memoryHead)
-					g_memoryHead = newNodePhys;
-				newNode->prev = g_memoryTail;
-				newNode->next = nullptr;
-				newNode->nPages = size / 0x1000;
-				g_memoryTail = newNodePhys;
+				if (base == bitmapBase)
+					base += bitmapPages * 0x1000;
+				uintptr_t end = (entry->base + entry->length) & ~0xfff;
+				if (end <= base)
+					continue;
+				s_totalPages += (end - base) / 0x1000;
+				freeRange(base >> 12, (end - base) / 0x1000);
 			}
 			auto& lastMMAPEntry = 
 				mmap_request.response->entries[mmap_request.response->entry_count - 1]
@@ -77,58 +287,109 @@ namespace obos
 
 		uintptr_t allocatePhysicalPage(size_t nPages)
 		{
-			if (!g_nMemoryNodes)
-				logger::panic(nullptr, "No more available physical memory left.\n");
-			g_pmmLock.Lock();
+			if (!nPages)
+				return 0;
 			uintptr_t flags = saveFlagsAndCLI();
-			MemoryNode* node = (MemoryNode*)mapPageTable((uintptr_t*)g_memoryHead);
-			MemoryNode* nodePhys = g_memoryHead;
-			uintptr_t ret = (uintptr_t)g_memoryHead;
-			while (node->nPages < nPages)
-			{
-				node = node->next;
-				if (!node)
-					return 0; // Not enough physical memory to satisfy request of nPages.
-				nodePhys = node;
-				node = (MemoryNode*)mapPageTable((uintptr_t*)node);
-			}
-			node->nPages -= nPages;
-			if (!node->nPages)
-			{
-				// This node has no free pages after this allocation, so it should be removed.
-				MemoryNode *next = node->next, *prev = node->prev;
-				if (next)
-					((MemoryNode*)mapPageTable((uintptr_t*)next))->prev = prev;
-				if (prev)
-					((MemoryNode*)mapPageTable((uintptr_t*)prev))->next = next;
-				if (g_memoryHead == nodePhys)
-					g_memoryHead = next;
-				if (g_memoryTail == nodePhys)
-					g_memoryTail = prev;
-				node->next = nullptr;
-				node->prev = nullptr;
-			}
-			ret = ret + node->nPages * 4096;
-			restorePreviousInterruptStatus(flags);
+			thread::cpu_local* cpu = getPageCacheCpu();
+			if (cpu && nPages == 1)
+			{
+				auto& arch = cpu->arch_specific;
+				if (!arch.nCachedPages)
+				{
+					g_pmmLock.Lock();
+					while (arch.nCachedPages < PAGE_CACHE_BATCH)
+					{
+						size_t page = allocPages(1);
+						if (page == SIZE_MAX)
+							break;
+						arch.pageCache[arch.nCachedPages++] = page << 12;
+					}
+					g_pmmLock.Unlock();
+				}
+				if (arch.nCachedPages)
+				{
+					uintptr_t ret = arch.pageCache[--arch.nCachedPages];
+					restorePreviousInterruptStatus(flags);
+					return ret;
+				}
+			}
+			g_pmmLock.Lock();
+			size_t page = allocPages(nPages);
+			if (page == SIZE_MAX && cpu && cpu->arch_specific.nCachedPages)
+			{
+				// Give this cpu's cached pages back so they can be merged, then try again.
+				drainPageCache(cpu, PAGE_CACHE_SIZE);
+				page = allocPages(nPages);
+			}
 			g_pmmLock.Unlock();
-			return ret;
+			restorePreviousInterruptStatus(flags);
+			return page == SIZE_MAX ? 0 : page << 12;
 		}
 		bool freePhysicalPage(uintptr_t addr, size_t nPages)
 		{
+			size_t page = addr >> 12;
+			if ((addr & 0xfff) || page + nPages > s_nPages)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			if (!nPages)
+				return true;
+			uintptr_t flags = saveFlagsAndCLI();
+			thread::cpu_local* cpu = getPageCacheCpu();
+			if (cpu && nPages == 1)
+			{
+				auto& arch = cpu->arch_specific;
+				if (arch.nCachedPages == PAGE_CACHE_SIZE)
+				{
+					g_pmmLock.Lock();
+					drainPageCache(cpu, PAGE_CACHE_BATCH);
+					g_pmmLock.Unlock();
+				}
+				arch.pageCache[arch.nCachedPages++] = addr;
+				restorePreviousInterruptStatus(flags);
+				return true;
+			}
 			g_pmmLock.Lock();
-			MemoryNode* node = (MemoryNode*)mapPageTable((uintptr_t*)addr);
-			MemoryNode* nodePhys = (MemoryNode*)addr;
-			if (g_memoryTail)
-				((MemoryNode*)mapPageTable((uintptr_t*)g_memoryTail))->next = nodePhys;
-			if(!g_memoryHead)
-				g_memoryHead = nodePhys;
-			node->prev = g_memoryTail;
-			g_memoryTail = nodePhys;
-			node->nPages = nPages;
-			g_nMemoryNodes++;
+			bool doubleFree = false;
+			for (size_t i = 0; i < nPages && !doubleFree; i++)
+				doubleFree = pageIsFree(page + i);
+			if (!doubleFree)
+				freeRange(page, nPages);
 			g_pmmLock.Unlock();
+			restorePreviousInterruptStatus(flags);
+			if (doubleFree)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
 			return true;
 		}
+		void GetPhysicalMemoryStatistics(PhysicalMemoryStatistics* stats)
+		{
+			if (!stats)
+				return;
+			uintptr_t flags = saveFlagsAndCLI();
+			g_pmmLock.Lock();
+			size_t freePages = s_freePages;
+			stats->totalPages = s_totalPages;
+			stats->largestFreeBlock = 0;
+			for (uint8_t order = 0; order <= PMM_MAX_ORDER; order++)
+			{
+				stats->freeBlocks[order] = s_nFreeBlocks[order];
+				if (s_nFreeBlocks[order])
+					stats->largestFreeBlock = (size_t)1 << order;
+			}
+			g_pmmLock.Unlock();
+			restorePreviousInterruptStatus(flags);
+			stats->cachedPages = 0;
+			for (size_t i = 0; thread::g_cpuInfo && i < thread::g_nCPUs; i++)
+				stats->cachedPages += __atomic_load_n(&thread::g_cpuInfo[i].arch_specific.nCachedPages, __ATOMIC_RELAXED);
+			stats->freePages = freePages + stats->cachedPages;
+			// Pages that weren't given to the pmm at boot (ex: bootloader reclaimable memory) can still be freed into it.
+			stats->usedPages = stats->totalPages > stats->freePages ? stats->totalPages - stats->freePages : 0;
+			stats->fragmentation = freePages ? (uint8_t)(100 - ((stats->freeBlocks[PMM_MAX_ORDER] << PMM_MAX_ORDER) * 100 / freePages)) : 0;
+		}
 		bool PageInHHDM(uintptr_t addr)
 		{
 			return (addr >= hhdm_base) && (addr < hhdm_end);
@@ -15,6 +15,10 @@
 #include <allocators/vmm/vmm.h>
 #include <allocators/vmm/arch.h>
 
+#include <multitasking/cpu_local.h>
+
+#include <vfs/fileManip/pageCache.h>
+
 #include <x86_64-utils/asm.h>
 
 namespace obos
@@ -165,20 +169,62 @@ namespace obos
 			}
 			*status = VFREE_SUCCESS;
 			uintptr_t base = (uintptr_t)_base & (~0xfff);
+			// Kernel memory is shared by every process, so its file mappings are never the current process'.
+			const bool kernelAddress = base >= 0xffff800000000000;
+			if (!proc && !kernelAddress && thread::GetCurrentCpuLocalPtr() && thread::GetCurrentCpuLocalPtr()->currentThread)
+				proc = (process::Process*)thread::GetCurrentCpuLocalPtr()->currentThread->owner;
+			const bool hasMappings = kernelAddress || proc;
+			// Nothing is freed or released with the file mappings locked, as that can free kernel memory, which comes back here.
+			// The regions are unlinked, and the pages of the page cache are collected and released in batches.
+			process::procContextInfo::virtuallyMappedRegionNode* removed = nullptr;
+			constexpr size_t releaseBatch = 32;
+			uintptr_t toRelease[releaseBatch];
+			size_t nToRelease = 0;
 			uintptr_t eflags = saveFlagsAndCLI();
+			// Page faults on mapped files must not map pages in while they're being freed.
+			if (hasMappings)
+			{
+				LockFileMappings(proc, base);
+				RemoveFileMappings(proc, base, nPages, removed);
+			}
 			for (uintptr_t addr = base; addr != (base + nPages * 4096); addr += 4096)
 			{
 				uintptr_t _pageMapPhys = (uintptr_t)pageMap->getL2PageMapEntryAt(addr) & g_physAddrMask;
 				uintptr_t* _pageMap = mapPageTable(reinterpret_cast<uintptr_t*>(_pageMapPhys));
 				uintptr_t entry = _pageMap[PageMap::addressToIndex(addr, 0)];
-				if (!(entry & ((uintptr_t)1 << 9)) && !(entry & ((uintptr_t)1 << 10)))
+				if ((entry & 1) && (entry & ((uintptr_t)1 << 11)))
+					toRelease[nToRelease++] = entry & g_physAddrMask; // The page is shared through the page cache.
+				else if (!(entry & ((uintptr_t)1 << 9)) && !(entry & ((uintptr_t)1 << 10)))
 					freePhysicalPage(entry & g_physAddrMask);
 				_pageMap = mapPageTable(reinterpret_cast<uintptr_t*>(_pageMapPhys));
 				_pageMap[PageMap::addressToIndex(addr, 0)] = 0;
 				freePagingStructures(_pageMap, _pageMapPhys, pageMap, addr);
 				invlpg(addr);
+				if (nToRelease == releaseBatch)
+				{
+					// The pages released so far are unmapped, so faults can't map them back in while the mappings are unlocked.
+					if (hasMappings)
+						UnlockFileMappings(proc, base);
+					restorePreviousInterruptStatus(eflags);
+					for (size_t i = 0; i < nToRelease; i++)
+						vfs::PageCacheReleasePage(toRelease[i]);
+					nToRelease = 0;
+					eflags = saveFlagsAndCLI();
+					if (hasMappings)
+						LockFileMappings(proc, base);
+				}
 			}
+			if (hasMappings)
+				UnlockFileMappings(proc, base);
 			restorePreviousInterruptStatus(eflags);
+			for (size_t i = 0; i < nToRelease; i++)
+				vfs::PageCacheReleasePage(toRelease[i]);
+			while (removed)
+			{
+				auto next = removed->next;
+				delete removed;
+				removed = next;
+			}
 			*status = VFREE_SUCCESS;
 			return;
 		}
@@ -213,6 +259,10 @@ namespace obos
 				uintptr_t newEntry = 0;
 				if (entry & ((uintptr_t)1 << 9))
 					newEntry = 1 | (_flags << 52) | ((uintptr_t)1 << 9) | ((uintptr_t)1 << 63);
+				else if ((entry & 1) && (entry & ((uintptr_t)1 << 11)))
+					newEntry = (entry & g_physAddrMask) | DecodeProtectionFlags(_flags | PROT_READ_ONLY) | 1 | ((uintptr_t)1 << 11); // Pages of the page cache are shared, so they stay read-only.
+				else if (!(entry & 1) && (entry & ((uintptr_t)1 << 10)))
+					newEntry = ((uintptr_t)1 << 10) | (_flags << 52); // The page of the mapped file isn't committed yet.
 				else
 					newEntry = (entry & g_physAddrMask) | DecodeProtectionFlags(_flags) | 1;
 				_pageMap = allocatePagingStructures(addr, pageMap, DecodeProtectionFlags(_flags) | 1);
@@ -110,6 +110,35 @@ namespace obos
 			restorePreviousInterruptStatus(flags);
 			return ret;
 		}
+		uintptr_t GetPhysicalAddress(PageMap* pageMap, uintptr_t virt)
+		{
+			uintptr_t entry = (uintptr_t)pageMap->getL3PageMapEntryAt(virt);
+			if (!(entry & 1))
+				return 0;
+			if (entry & (1<<7)) // 1 GiB page.
+				return (entry & g_physAddrMask & ~(uintptr_t)0x3FFFFFFF) + (virt & 0x3FFFFFFF);
+			entry = (uintptr_t)pageMap->getL2PageMapEntryAt(virt);
+			if (!(entry & 1))
+				return 0;
+			if (entry & (1<<7)) // 2 MiB page.
+				return (entry & g_physAddrMask & ~(uintptr_t)0x1FFFFF) + (virt & 0x1FFFFF);
+			entry = (uintptr_t)pageMap->getL1PageMapEntryAt(virt);
+			if (!(entry & 1))
+				return 0;
+			return (entry & g_physAddrMask) + (virt & 0xfff);
+		}
+		void TouchBufferForDMA(void* buff, size_t size, bool deviceWrites)
+		{
+			const uintptr_t end = (uintptr_t)buff + size;
+			for (uintptr_t addr = (uintptr_t)buff; addr < end; addr = (addr & ~(uintptr_t)0xfff) + 4096)
+			{
+				volatile byte* virt = (volatile byte*)addr;
+				if (deviceWrites)
+					*virt = *virt;
+				else
+					(void)*virt;
+			}
+		}
 
 		void* MapPhysicalAddress(PageMap* pageMap, uintptr_t phys, void* to, uintptr_t cpuFlags);
 		size_t GetPhysicalAddressBits()
@@ -39,6 +39,12 @@ namespace obos
 
 		OBOS_EXPORT PageMap* getCurrentPageMap();
 
+		// Returns the physical address 'virt' is mapped to in pageMap, or zero if it isn't mapped.
+		OBOS_EXPORT uintptr_t GetPhysicalAddress(PageMap* pageMap, uintptr_t virt);
+		// Faults in the pages of a buffer in the current address space before a device accesses them, as that can't be done from an interrupt handler.
+		// If the device is going to write to the buffer, the pages are written to as well, which breaks copy-on-write.
+		OBOS_EXPORT void TouchBufferForDMA(void* buff, size_t size, bool deviceWrites);
+
 		OBOS_EXPORT size_t GetPhysicalAddressBits();
 		OBOS_EXPORT size_t GetVirtualAddressBits();
 
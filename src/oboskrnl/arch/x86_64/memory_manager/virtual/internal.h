@@ -37,6 +37,18 @@ namespace obos
 			uintptr_t* indices // must be an array of at least 4 entries (anything over is ignored).
 		);
 
+		// Memory mapped files. Bit 11 of a committed page's pte is set if the page belongs to the page cache, and so must be released instead of freed.
+
+		// Locks the mapped regions that addr can be in: the kernel's for addresses in the kernel's half, otherwise proc's.
+		// proc can be nullptr for addresses in the kernel's half.
+		void LockFileMappings(process::Process* proc, uintptr_t addr);
+		void UnlockFileMappings(process::Process* proc, uintptr_t addr);
+		// Unlinks the mapped regions that are entirely inside of the range, and puts them on 'removed'.
+		// Expects the file mappings to be locked. The regions must be deleted after the mappings are unlocked.
+		void RemoveFileMappings(process::Process* proc, uintptr_t base, size_t nPages, process::procContextInfo::virtuallyMappedRegionNode*& removed);
+		// Releases the page cache pages that the process maps, and frees its mapped regions. Called when the process' context is freed.
+		void FreeFileMappings(process::procContextInfo* info);
+
 		void* MapPhysicalAddress(PageMap* pageMap, uintptr_t phys, void* to, uintptr_t cpuFlags);
 		void* MapEntry(PageMap* pageMap, uintptr_t entry, void* to);
 		void UnmapAddress(PageMap* pageMap, void* _addr);
@@ -5,6 +5,9 @@
 */
 
 #include <int.h>
+#include <atomic.h>
+
+#include <x86_64-utils/asm.h>
 
 #include <arch/x86_64/memory_manager/virtual/internal.h>
 
@@ -16,25 +19,102 @@
 
 #include <vfs/vfsNode.h>
 
+#include <vfs/fileManip/pageCache.h>
+
+// How many pages around a faulting page of a mapped file are mapped in if they're already cached. Must be a power of two.
+#define MAPFILE_FAULT_AROUND_PAGES 16
+
 namespace obos
 {
 	namespace memory
 	{
+		using mappedRegion = process::procContextInfo::virtuallyMappedRegionNode;
+
+		// The regions mapped in the kernel's half of the address space. Every process shares that half, so they aren't tracked per process.
+		static mappedRegion* s_kernelRegions;
+		static bool s_kernelRegionsLock;
+
+		static bool isKernelAddress(uintptr_t addr)
+		{
+			return addr >= 0xffff800000000000;
+		}
+		static mappedRegion*& regionList(process::Process* proc, uintptr_t addr)
+		{
+			return isKernelAddress(addr) ? s_kernelRegions : proc->context.memoryMappedFiles;
+		}
+		void LockFileMappings(process::Process* proc, uintptr_t addr)
+		{
+			bool* lock = isKernelAddress(addr) ? &s_kernelRegionsLock : &proc->context.memoryMappedFilesLock;
+			while (!atomic_cmpxchg(lock, false, true))
+				pause();
+		}
+		void UnlockFileMappings(process::Process* proc, uintptr_t addr)
+		{
+			atomic_clear(isKernelAddress(addr) ? &s_kernelRegionsLock : &proc->context.memoryMappedFilesLock);
+		}
+		// Expects the file mappings to be locked.
+		static mappedRegion* findRegion(process::Process* proc, uintptr_t addr)
+		{
+			for (mappedRegion* region = regionList(proc, addr); region; region = region->next)
+			{
+				uintptr_t base = (uintptr_t)region->base;
+				if (addr >= base && addr < base + ((region->size + 0xfff) & ~0xfff))
+					return region;
+			}
+			return nullptr;
+		}
+		void RemoveFileMappings(process::Process* proc, uintptr_t base, size_t nPages, mappedRegion*& removed)
+		{
+			const uintptr_t end = base + nPages * 4096;
+			mappedRegion** link = &regionList(proc, base);
+			while (*link)
+			{
+				mappedRegion* region = *link;
+				uintptr_t regionBase = (uintptr_t)region->base;
+				uintptr_t regionEnd = regionBase + ((region->size + 0xfff) & ~0xfff);
+				if (regionBase >= base && regionEnd <= end)
+				{
+					*link = region->next;
+					region->next = removed;
+					removed = region;
+					continue;
+				}
+				link = &region->next;
+			}
+		}
+		void FreeFileMappings(process::procContextInfo* info)
+		{
+			PageMap* pageMap = (PageMap*)info->cr3;
+			for (mappedRegion* region = info->memoryMappedFiles; region; )
+			{
+				mappedRegion* next = region->next;
+				uintptr_t base = (uintptr_t)region->base;
+				for (uintptr_t addr = base; region->isDirent && addr < base + region->size; addr += 4096)
+				{
+					uintptr_t entry = (uintptr_t)pageMap->getL1PageMapEntryAt(addr);
+					if ((entry & 1) && (entry & ((uintptr_t)1 << 11)))
+						vfs::PageCacheReleasePage(entry & g_physAddrMask);
+				}
+				delete region;
+				region = next;
+			}
+			info->memoryMappedFiles = nullptr;
+		}
+
 		void* _Impl_ProcMapFileNodeToAddress(
 			process::Process* proc,
 			void* _base,
 			size_t size,
 			uintptr_t protFlags,
-			[[maybe_unused]] vfs::DirectoryEntry* entry,
-			[[maybe_unused]] uintptr_t off,
+			vfs::DirectoryEntry* entry,
+			uintptr_t off,
 			uint32_t* status)
 		{
 			// Don't actually map anything until a page fault happens on these pages.
 			// Set bit 10 which is avaliable for the kernel to use to indicate to PagesAllocated() and other functions that the page is uncommitted.
-			// On page-fault, the page is mapped with the correct protection flags and is loaded into memory.
+			// On page-fault, the page is mapped with the correct protection flags from the page cache, which shares it with every other mapping of the file.
 			// If the file is written to through a file handle (unimplemented as of February 10th, 2024), the region should be updated accordingly.
 			
-			// TODO: Look for (committed) memory mapped regions of the same directory entry, offset, and size and use some sort of shared memory.
 			// TODO: When file writing is implemented, allow this to write 
 			if (!_Impl_IsValidAddress(_base))
 			{
@@ -46,10 +126,16 @@ namespace obos
 				*status = MAPFILESTATUS_UNIMPLEMENTED;
 				return nullptr;
 			}
+			// The pages of the page cache are page-aligned in the file.
+			if (off % 4096)
+			{
+				*status = MAPFILESTATUS_INVALID_PARAMETER;
+				return nullptr;
+			}
 			auto [pageMap, isUserProcess] = GetPageMapFromProcess(proc);
 			if (!proc)
 				proc = thread::GetCurrentCpuLocalPtr() ? (process::Process*)thread::GetCurrentCpuLocalPtr()->currentThread->owner : nullptr;
-			if (!proc)
+			if (!proc && !isKernelAddress((uintptr_t)_base))
 			{
 				*status = MAPFILESTATUS_INVALID_PARAMETER;
 				return nullptr;
@@ -65,46 +151,99 @@ namespace obos
 				*status = MAPFILESTATUS_BASE_ADDRESS_USED;
 				return nullptr;
 			}
+			mappedRegion* region = new mappedRegion{ _base, entry, off, size, true, nullptr };
 			uintptr_t base = (uintptr_t)_base;
-			size_t sz = size;
-			for (uintptr_t addr = base, offset = 0; addr < (base + nPages * 4096); addr += 4096, sz -= 4096, offset += 4096)
+			uintptr_t flags = saveFlagsAndCLI();
+			LockFileMappings(proc, base);
+			region->next = regionList(proc, base);
+			regionList(proc, base) = region;
+			for (uintptr_t addr = base; addr < (base + nPages * 4096); addr += 4096)
 			{
-				proc->context.memoryMappedFiles.emplace_at((void*)addr, { _base, (void*)addr, entry, offset, sz, true });
 				uintptr_t* pageTable = allocatePagingStructures(addr, pageMap, 1);
 				pageTable[PageMap::addressToIndex(addr, 0)] = ((uintptr_t)1<<10) | (protFlags << 52);
 			}
+			UnlockFileMappings(proc, base);
+			restorePreviousInterruptStatus(flags);
 			return _base;
 		}
+		// Maps the pages around a faulting page that are already in the page cache, so sequential accesses to a mapped file don't fault on every page.
+		// Expects the file mappings to be locked.
+		static void faultAround(PageMap* pageMap, const mappedRegion* region, uintptr_t addr)
+		{
+			vfs::DirectoryEntry* dirent = (vfs::DirectoryEntry*)region->dirent;
+			const uintptr_t base = (uintptr_t)region->base;
+			const uintptr_t end = base + ((region->size + 0xfff) & ~0xfff);
+			uintptr_t start = addr & ~((uintptr_t)MAPFILE_FAULT_AROUND_PAGES * 4096 - 1);
+			if (start < base)
+				start = base;
+			for (uintptr_t page = start; page < start + MAPFILE_FAULT_AROUND_PAGES * 4096 && page < end; page += 4096)
+			{
+				if (page == addr)
+					continue;
+				uintptr_t entry = (uintptr_t)pageMap->getL1PageMapEntryAt(page);
+				if ((entry & 1) || !(entry & ((uintptr_t)1 << 10)))
+					continue;
+				uintptr_t phys = vfs::PageCacheFindPage(dirent, region->off + (page - base));
+				if (!phys)
+					continue;
+				uintptr_t flags = DecodeProtectionFlags((entry >> 52) | PROT_READ_ONLY) | 1;
+				MapEntry(pageMap, phys | flags | ((uintptr_t)1 << 11), (void*)page);
+			}
+		}
 		bool mapFilePFHandler(uintptr_t addr, memory::PageMap* pageMap, uintptr_t errorCode)
 		{
 			process::Process* proc = (process::Process*)thread::GetCurrentCpuLocalPtr()->currentThread->owner;
-			if (!proc->context.memoryMappedFiles.contains((void*)addr))
+			uintptr_t eflags = saveFlagsAndCLI();
+			LockFileMappings(proc, addr);
+			mappedRegion* region = findRegion(proc, addr);
+			mappedRegion node{};
+			if (region)
+				node = *region;
+			UnlockFileMappings(proc, addr);
+			restorePreviousInterruptStatus(eflags);
+			if (!region)
 				return false;
 			uintptr_t l1Entry = (uintptr_t)pageMap->getL1PageMapEntryAt(addr);
 			uintptr_t protFlags = l1Entry >> 52;
 			uintptr_t flags = DecodeProtectionFlags(protFlags) | 1;
 			if (errorCode & ((uintptr_t)1 << 4) /* execution fault */ && !(protFlags & PROT_CAN_EXECUTE) /* and the protection flags don't say we can execute... */)
 				return false; // Fail.
-			if (errorCode & ((uintptr_t)1 << 1) /* write fault */ && (protFlags & PROT_READ_ONLY) /* and the protection flags say that this is a RO page... */)
-				return false; // Fail.
-			if (errorCode & ((uintptr_t)1 << 2) /* write fault */ && (protFlags & PROT_USER_MODE_ACCESS) /* and the protection flags say that this is a RO page... */)
+			if (errorCode & ((uintptr_t)1 << 1) /* write fault */)
+				return false; // Fail, as mapped files are read-only.
+			if (errorCode & ((uintptr_t)1 << 2) /* user mode fault */ && !(protFlags & PROT_USER_MODE_ACCESS) /* and the protection flags say that this is a kernel page... */)
 				return false; // Fail.
 			// A valid operation was done on this page, map it in.
-			auto& node = proc->context.memoryMappedFiles.at((void*)addr);
+			const uintptr_t off = node.off + (addr - (uintptr_t)node.base);
 			if (node.isDirent)
 			{
 				vfs::DirectoryEntry* dirent = (vfs::DirectoryEntry*)node.dirent;
-				if (dirent->fileAttrib & driverInterface::FILE_ATTRIBUTES_READ_ONLY && errorCode & ((uintptr_t)1 << 1))
+				// The page is shared with every other mapping of the file, so it's always mapped read-only.
+				uintptr_t page = vfs::PageCacheGetPage(dirent, off);
+				if (!page)
 					return false;
-				auto &ftable = dirent->mountPoint->filesystemDriver->functionTable.serviceSpecific.filesystem;
-				uint64_t driveId = dirent->mountPoint->partition ? dirent->mountPoint->partition->drive->driveId : 0;
-				uint8_t drivePartitionId = dirent->mountPoint->partition ? dirent->mountPoint->partition->partitionId : 0;
-				[[maybe_unused]] uint32_t status = 0;
-				uintptr_t page = allocatePhysicalPage();
-				l1Entry = page | flags;
-				char* fileData = (char*)MapPhysicalAddress(pageMap, page, _Impl_FindUsableAddress(nullptr, 1), 3);
-				ftable.ReadFile(driveId, drivePartitionId, dirent->path, node.off & ~0xfff, dirent->filesize < 4096 ? dirent->filesize : 4096, (char*)fileData);
-				UnmapAddress(pageMap, fileData);
+				flags = DecodeProtectionFlags(protFlags | PROT_READ_ONLY) | 1;
+				l1Entry = page | flags | ((uintptr_t)1 << 11);
+				// The region could've been unmapped while the page was being read, or another thread could've faulted on the same page.
+				bool mapped = false, handled = false;
+				eflags = saveFlagsAndCLI();
+				LockFileMappings(proc, addr);
+				if (findRegion(proc, addr) == region)
+				{
+					uintptr_t current = (uintptr_t)pageMap->getL1PageMapEntryAt(addr);
+					if (current & 1)
+						handled = true;
+					else if (current & ((uintptr_t)1 << 10))
+					{
+						MapEntry(pageMap, l1Entry, (void*)(addr & ~0xfff));
+						faultAround(pageMap, region, addr);
+						mapped = handled = true;
+					}
+				}
+				UnlockFileMappings(proc, addr);
+				restorePreviousInterruptStatus(eflags);
+				if (!mapped)
+					vfs::PageCacheReleasePage(page);
+				return handled;
 			}
 			else
 			{
@@ -118,7 +257,7 @@ namespace obos
 				l1Entry = page | flags;
 				size_t sectorSize = 0;
 				ftable.QueryDiskInfo(driveId, nullptr, &sectorSize);
-				size_t lbaOffset = node.off / sectorSize;
+				size_t lbaOffset = off / sectorSize;
 				void* buff = nullptr;
 				ftable.ReadSectors(driveId, part->lbaOffset + lbaOffset, 4096/sectorSize, &buff, nullptr);
 				_Impl_ProcVirtualFree(nullptr, buff, 1, &status);
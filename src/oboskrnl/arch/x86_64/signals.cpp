@@ -10,6 +10,7 @@
 
 #include <multitasking/thread.h>
 #include <multitasking/cpu_local.h>
+#include <multitasking/scheduler.h>
 
 #include <multitasking/process/process.h>
 #include <multitasking/process/signals.h>
@@ -31,12 +32,11 @@ namespace obos
         {
             on->flags |= thread::THREAD_FLAGS_IN_SIGNAL;
             bool isRunning = on->status & thread::THREAD_STATUS_RUNNING;
-            __uint128_t affinity = on->affinity;
             on->status = thread::THREAD_STATUS_CAN_RUN | thread::THREAD_STATUS_PAUSED;
             if (isRunning)
             {
-                // Find the cpu the thread is running on.
-                uint32_t cpuId = bsf(affinity);
+                // A thread only runs on the cpu that owns its run queue.
+                uint32_t cpuId = on->cpu->cpuId;
                 // Call the scheduler on the cpu.
                 SendIPI(DestinationShorthand::None, DeliveryMode::Fixed, 0x30, cpuId);
             }
@@ -47,6 +47,7 @@ namespace obos
             *returnAddress = previousRip;
             clearAC();
             on->status = thread::THREAD_STATUS_CAN_RUN;
+            thread::ReadyThread(on);
         }
 
         bool CallSignal(thread::Thread* on, signals sig)
@@ -131,6 +131,7 @@ namespace obos
 			vallocator.VirtualAlloc((void*)temp_stacks_base, g_nCPUs * 16384, memory::PROT_NO_COW_ON_ALLOCATE);
 			for (size_t i = 0; i < g_nCPUs; i++)
 			{
+				g_cpuInfo[i].arch_specific.lapicId = g_lapicIDs[i];
 				if (g_lapicIDs[i] == g_localAPICAddr->lapicID)
 				{
 					g_cpuInfo[i].temp_stack.addr = (void*)temp_stacks_base;
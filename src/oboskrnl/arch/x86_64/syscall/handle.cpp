@@ -34,11 +34,11 @@ namespace obos
 				!objectAddress)
 				return 0xffffffffffffffff;
 			process::Process* proc = (process::Process*)_proc;
-			locks::SafeMutex lock_guard{ &proc->context.handleTableLock };
-			lock_guard.Lock();
+			proc->context.handleTableLock.LockExclusive();
 			auto &handleTable = proc->context.handleTable;
 			user_handle handleValue = proc->context.nextHandleValue++;
 			handleTable.emplace_at(handleValue, { objectAddress, type });
+			proc->context.handleTableLock.UnlockExclusive();
 			return handleValue;
 		}
 		void* ProcessReleaseHandle(void* _proc, user_handle handle)
@@ -49,9 +49,10 @@ namespace obos
 				return nullptr;
 			void* ret = ProcessGetHandleObject(_proc, handle);
 			process::Process* proc = (process::Process*)_proc;
-			locks::SafeMutex lock_guard{ &proc->context.handleTableLock };
+			proc->context.handleTableLock.LockExclusive();
 			auto& handleTable = proc->context.handleTable;
 			handleTable.remove(handle);
+			proc->context.handleTableLock.UnlockExclusive();
 			return ret;
 		}
 		bool ProcessVerifyHandle(void* _proc, user_handle handle, ProcessHandleType type)
@@ -60,12 +61,12 @@ namespace obos
 				_proc = thread::GetCurrentCpuLocalPtr()->currentThread->owner;
 			process::Process* proc = (process::Process*)_proc;
 			auto& handleTable = proc->context.handleTable;
-			if (type == ProcessHandleType::INVALID)
-				return handleTable.contains(handle);
-			bool has = handleTable.contains(handle);
-			if (!has)
-				return false;
-			return handleTable.at(handle).second == type;
+			proc->context.handleTableLock.LockShared();
+			bool ret = handleTable.contains(handle);
+			if (ret && type != ProcessHandleType::INVALID)
+				ret = handleTable.at(handle).second == type;
+			proc->context.handleTableLock.UnlockShared();
+			return ret;
 		}
 		void* ProcessGetHandleObject(void* _proc, user_handle handle)
 		{
@@ -75,7 +76,10 @@ namespace obos
 				return nullptr;
 			process::Process* proc = (process::Process*)_proc;
 			auto& handleTable = proc->context.handleTable;
-			return handleTable.at(handle).first;
+			proc->context.handleTableLock.LockShared();
+			void* ret = handleTable.at(handle).first;
+			proc->context.handleTableLock.UnlockShared();
+			return ret;
 		}
 		ProcessHandleType ProcessGetHandleType(void* _proc, user_handle handle)
 		{
@@ -85,7 +89,10 @@ namespace obos
 				return ProcessHandleType::INVALID;
 			process::Process* proc = (process::Process*)_proc;
 			auto& handleTable = proc->context.handleTable;
-			return handleTable.at(handle).second;
+			proc->context.handleTableLock.LockShared();
+			ProcessHandleType ret = handleTable.at(handle).second;
+			proc->context.handleTableLock.UnlockShared();
+			return ret;
 		}
 
 		bool SyscallInvalidateHandle(uint64_t, user_handle* _handle)
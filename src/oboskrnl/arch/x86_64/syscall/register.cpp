@@ -125,7 +125,7 @@ namespace obos
 			RegisterSyscall(23, (uintptr_t)ThreadSyscallHandler);
 			RegisterSyscall(24, (uintptr_t)SyscallInvalidateHandle);
 			for (uint16_t currentSyscall = 25; currentSyscall < 38; RegisterSyscall(currentSyscall++, (uintptr_t)ConsoleSyscallHandler));
-			for (uint16_t currentSyscall = 39; currentSyscall < 45; RegisterSyscall(currentSyscall++, (uintptr_t)VMMSyscallHandler));
+			for (uint16_t currentSyscall = 39; currentSyscall < 46; RegisterSyscall(currentSyscall++, (uintptr_t)VMMSyscallHandler));
 			for (uint16_t currentSyscall = 46; currentSyscall < 55; RegisterSyscall(currentSyscall++, (uintptr_t)DriveSyscallHandler));
 			for (uint16_t currentSyscall = 55; currentSyscall < 57; RegisterSyscall(currentSyscall++, (uintptr_t)ErrorSyscallHandler));
 			RegisterSyscall(57, (uintptr_t)LoadModuleSyscallHandler);
@@ -134,6 +134,7 @@ namespace obos
 			for (uint16_t currentSyscall = 61; currentSyscall < 69; RegisterSyscall(currentSyscall++, (uintptr_t)DirectorySyscallHandler));
 			RegisterSyscall(69, (uintptr_t)wrgsfsbase);
 			RegisterSyscall(70, (uintptr_t)rdgsfsbase);
+			for (uint16_t currentSyscall = 71; currentSyscall < 73; RegisterSyscall(currentSyscall++, (uintptr_t)FileHandleSyscallHandler));
 		}
 		void RegisterSyscall(uint16_t n, uintptr_t func)
 		{
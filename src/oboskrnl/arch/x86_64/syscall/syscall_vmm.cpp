@@ -114,6 +114,19 @@ namespace obos
 				}
 				return (uintptr_t)SyscallVirtualMemcpy(pars->hnd, pars->dest, pars->src, pars->size);
 			}
+			case 45:
+			{
+				struct _par
+				{
+					alignas(0x10) HeapStatistics* stats;
+				} *pars = (_par*)args;
+				if (!canAccessUserMemory(pars, sizeof(*pars), false))
+				{
+					SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+					return UINTPTR_MAX;
+				}
+				return SyscallGetHeapStatistics(pars->stats);
+			}
 			default:
 				break;
 			}
@@ -242,5 +255,18 @@ namespace obos
 			memory::VirtualAllocator* valloc = (memory::VirtualAllocator*)ProcessGetHandleObject(nullptr, hnd);
 			return valloc->Memcpy(remoteDest, localSrc, size);
 		}
+		bool SyscallGetHeapStatistics(HeapStatistics* stats)
+		{
+			if (!canAccessUserMemory(stats, sizeof(*stats), true))
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			HeapStatistics* _stats = new HeapStatistics;
+			GetHeapStatistics(_stats);
+			utils::memcpy(stats, _stats, sizeof(*stats));
+			delete _stats;
+			return true;
+		}
 	}
 }
\ No newline at end of file
@@ -172,6 +172,71 @@ namespace obos
 				return SyscallFileSeekTo(pars->hnd, pars->count, pars->from);
 			}
 			// Syscall 22 is handled in basic getter syscalls, as it has the same return value and parameters overall.
+			case 71:
+			{
+				struct _par
+				{
+					alignas(0x10) user_handle hnd;
+					alignas(0x10) char* data;
+					alignas(0x10) size_t nToRead;
+					alignas(0x10) vfs::uoff_t offset;
+				} *pars = (_par*)args;
+				if (!canAccessUserMemory(pars, sizeof * pars, false))
+				{
+					SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+					return false;
+				}
+				if (!canAccessUserMemory(pars->data, pars->nToRead, true))
+				{
+					SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+					return false;
+				}
+				return SyscallFileReadAt(pars->hnd, pars->data, pars->nToRead, pars->offset);
+			}
+			case 72:
+			{
+				struct _par
+				{
+					alignas(0x10) user_handle hnd;
+					alignas(0x10) const vfs::FileHandle::ReadVector* vectors;
+					alignas(0x10) size_t nVectors;
+					alignas(0x10) vfs::uoff_t offset;
+				} *pars = (_par*)args;
+				if (!canAccessUserMemory(pars, sizeof * pars, false))
+				{
+					SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+					return false;
+				}
+				const size_t nVectors = pars->nVectors;
+				if (!nVectors)
+					return SyscallFileReadVectoredAt(pars->hnd, nullptr, 0, pars->offset);
+				if (nVectors > SIZE_MAX / sizeof(vfs::FileHandle::ReadVector) ||
+					!canAccessUserMemory(pars->vectors, nVectors * sizeof(vfs::FileHandle::ReadVector), false))
+				{
+					SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+					return false;
+				}
+				// Copy the vectors, so the process can't change them after they were checked.
+				vfs::FileHandle::ReadVector* vectors = new vfs::FileHandle::ReadVector[nVectors];
+				if (!vectors)
+				{
+					SetLastError(OBOS_ERROR_NO_FREE_REGION);
+					return false;
+				}
+				utils::memcpy(vectors, pars->vectors, nVectors * sizeof(vfs::FileHandle::ReadVector));
+				for (size_t i = 0; i < nVectors; i++)
+				{
+					if (vectors[i].data && !canAccessUserMemory(vectors[i].data, vectors[i].nToRead, true))
+					{
+						delete[] vectors;
+						SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+						return false;
+					}
+				}
+				bool ret = SyscallFileReadVectoredAt(pars->hnd, vectors, nVectors, pars->offset);
+				delete[] vectors;
+				return ret;
+			}
 			}
 			return 0;
 		}
@@ -202,6 +267,27 @@ namespace obos
 			return handle->Read(data, nToRead, peek);
 		}
 
+		bool SyscallFileReadAt(user_handle hnd, char* data, size_t nToRead, vfs::uoff_t offset)
+		{
+			if (!ProcessVerifyHandle(nullptr, hnd, ProcessHandleType::FILE_HANDLE))
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			vfs::FileHandle* handle = (vfs::FileHandle*)ProcessGetHandleObject(nullptr, hnd);
+			return handle->ReadAt(data, nToRead, offset);
+		}
+		bool SyscallFileReadVectoredAt(user_handle hnd, const vfs::FileHandle::ReadVector* vectors, size_t nVectors, vfs::uoff_t offset)
+		{
+			if (!ProcessVerifyHandle(nullptr, hnd, ProcessHandleType::FILE_HANDLE))
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			vfs::FileHandle* handle = (vfs::FileHandle*)ProcessGetHandleObject(nullptr, hnd);
+			return handle->ReadVectoredAt(vectors, nVectors, offset);
+		}
+
 		bool SyscallFileEof(user_handle hnd)
 		{
 			if (!ProcessVerifyHandle(nullptr, hnd, ProcessHandleType::FILE_HANDLE))
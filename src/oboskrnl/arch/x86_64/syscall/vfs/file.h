@@ -10,6 +10,10 @@
 
 #include <arch/x86_64/syscall/handle.h>
 
+#include <vfs/off_t.h>
+
+#include <vfs/fileManip/fileHandle.h>
+
 namespace obos
 {
 	namespace syscalls
@@ -98,5 +102,28 @@ namespace obos
 		/// </summary>
 		/// <returns>Whether the file could be closed (true) or not (false). If it fails, use GetLastError for an error code.</returns>
 		bool SyscallFileClose(user_handle hnd);
+
+		/// <summary>
+		/// Syscall Number: 71<para></para>
+		/// Reads "nToRead" bytes at "offset" into "data", without using or changing the handle's stream position.
+		/// If the range passes EOF, the function fails with OBOS_ERROR_VFS_READ_ABORTED.
+		/// </summary>
+		/// <param name="hnd">The file handle.</param>
+		/// <param name="data">The buffer to read into.</param>
+		/// <param name="nToRead">The count of bytes to read.</param>
+		/// <param name="offset">The offset in the file to read at.</param>
+		/// <returns>Whether the file could be read (true) or not (false). If it fails, use GetLastError for an error code.</returns>
+		bool SyscallFileReadAt(user_handle hnd, char* data, size_t nToRead, vfs::uoff_t offset);
+		/// <summary>
+		/// Syscall Number: 72<para></para>
+		/// Fills several buffers, one after another, from the bytes starting at "offset", without using or changing the handle's stream position.
+		/// The range is read from the filesystem driver in window-sized requests, rather than one per buffer. Buffers that are nullptr skip their bytes.
+		/// </summary>
+		/// <param name="hnd">The file handle.</param>
+		/// <param name="vectors">The buffers to read into. See vfs/fileManip/fileHandle.h for the layout of an element.</param>
+		/// <param name="nVectors">The count of elements in "vectors".</param>
+		/// <param name="offset">The offset in the file of the first buffer.</param>
+		/// <returns>Whether the file could be read (true) or not (false). If it fails, use GetLastError for an error code.</returns>
+		bool SyscallFileReadVectoredAt(user_handle hnd, const vfs::FileHandle::ReadVector* vectors, size_t nVectors, vfs::uoff_t offset);
 	}
 }
\ No newline at end of file
@@ -12,6 +12,8 @@
 
 #include <multitasking/process/process.h>
 
+#include <allocators/liballoc.h>
+
 namespace obos
 {
 	namespace syscalls
@@ -70,5 +72,13 @@ namespace obos
 		/// <param name="size">The size of the buffer.</param>
 		/// <returns>remoteDest on success, or nullptr.</returns>
 		void* SyscallVirtualMemcpy(user_handle hnd, void* remoteDest, const void* localSrc, size_t size);
+
+		/// <summary>
+		/// Syscall Number: 45<para></para>
+		/// Gets statistics about the kernel heap.
+		/// </summary>
+		/// <param name="stats">[out] The statistics.</param>
+		/// <returns>false on failure, otherwise true. If this function fails, use GetLastError for extra error information.</returns>
+		bool SyscallGetHeapStatistics(HeapStatistics* stats);
 	}
 }
\ No newline at end of file
@@ -98,6 +98,7 @@ namespace obos
 						return nullptr;
 					};
 				driverInterface::obosDriverSymbol* symbol = nullptr;
+				driverInterface::g_driverInterfacesLock.LockShared();
 				for (auto iter = driverInterface::g_driverInterfaces.begin(); iter; iter++)
 				{
 					if (!(iter))
@@ -107,6 +108,7 @@ namespace obos
 					if ((symbol = searchDriver(*(*iter).value)))
 						break;
 				}
+				driverInterface::g_driverInterfacesLock.UnlockShared();
 				if (!symbol)
 					return;
 				str = symbol->name;
@@ -43,7 +43,7 @@ namespace obos
 
 #define LITERAL(str) (char*)(str), sizeof((str))
 
-extern obos::memory::VirtualAllocator g_liballocVirtualAllocator;
+extern obos::memory::VirtualAllocator g_kernelHeapVirtualAllocator;
 
 namespace obos
 {
@@ -76,9 +76,9 @@ namespace obos
 		process::g_processes.tail = process::g_processes.head = kernelProc;
 		kernelProc->pid = process::g_processes.size++;
 
-		// Reconstruct the liballoc's allocator with the kernel process, to avoid future problems with liballoc in user mode.
-		g_liballocVirtualAllocator.~VirtualAllocator();
-		new (&g_liballocVirtualAllocator) memory::VirtualAllocator{ kernelProc };
+		// Reconstruct the kernel heap's allocator with the kernel process, to avoid future problems with the heap in user mode.
+		g_kernelHeapVirtualAllocator.~VirtualAllocator();
+		new (&g_kernelHeapVirtualAllocator) memory::VirtualAllocator{ kernelProc };
 
 		kBootThread.OpenThread(thread::GetTID());
 
@@ -257,23 +257,15 @@ namespace obos
 			true
 		);
 		thread::Thread* _initProgramMainThread = (thread::Thread*)initProgramMainThread.GetUnderlyingObject();
-		_initProgramMainThread->blockCallback.callback = [](thread::Thread*, void* udata)
-			{
-				thread::ThreadHandle* kBootThread = (thread::ThreadHandle*)udata;
-				if (kBootThread->GetThreadStatus() == thread::THREAD_STATUS_DEAD)
-				{
-					kBootThread->CloseHandle();
-					return true;
-				}
-				return false;
-			};
-		_initProgramMainThread->blockCallback.userdata = &kBootThread;
-		_initProgramMainThread->status = thread::THREAD_STATUS_CAN_RUN | thread::THREAD_STATUS_BLOCKED;
+		// Don't let the init program run until this thread has exited.
+		((thread::Thread*)kBootThread.GetUnderlyingObject())->exitWaiters.BlockThread(_initProgramMainThread);
+		initProgramMainThread.ResumeThread();
 		initProgramMainThread.CloseHandle();
 		memory::VirtualAllocator{ nullptr }.VirtualFree(initProgramContents, handle.GetFileSize());
 		handle.Close();
 
 		logger::log("%s: Done early-kernel boot process!\n", __func__);
+		kBootThread.CloseHandle();
 		thread::ExitThread(0);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,191 @@
+/*
+	driverInterface/blockRequest.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <memory_manipulation.h>
+
+#include <driverInterface/struct.h>
+#include <driverInterface/blockRequest.h>
+
+#include <allocators/vmm/vmm.h>
+
+#include <vfs/devManip/bufferCache.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#include <arch/x86_64/interrupt.h>
+#endif
+
+// How long a waiter sleeps before polling the drive, in case the driver's interrupt was lost.
+#define BLOCK_REQUEST_POLL_INTERVAL 10000000
+
+namespace obos
+{
+	namespace driverInterface
+	{
+		static bool canBlock()
+		{
+#if defined(__x86_64__) || defined(_WIN64)
+			return getEflags() & x86_64_flags::RFLAGS_INTERRUPT_ENABLE;
+#else
+			return true;
+#endif
+		}
+		// Does the request with the driver's synchronous callbacks, for drivers that can't take requests.
+		static bool doRequestSynchronously(driverIdentity* driver, BlockRequest* request)
+		{
+			auto& ftable = driver->functionTable.serviceSpecific.storageDevice;
+			size_t nTransferred = 0;
+			bool succeeded = false;
+			if (request->operation == BlockRequest::OPERATION_WRITE)
+				succeeded = ftable.WriteSectors(request->driveId, request->lbaOffset, request->nSectors, (char*)request->buffer, &nTransferred);
+			else if (ftable.ReadSectorsInto)
+				succeeded = ftable.ReadSectorsInto(request->driveId, request->lbaOffset, request->nSectors, request->buffer, &nTransferred);
+			else
+			{
+				uint64_t sectorSize = 0;
+				void* data = nullptr;
+				succeeded = ftable.QueryDiskInfo(request->driveId, nullptr, &sectorSize) &&
+					ftable.ReadSectors(request->driveId, request->lbaOffset, request->nSectors, &data, &nTransferred);
+				if (succeeded && data)
+				{
+					utils::memcpy(request->buffer, data, nTransferred * sectorSize);
+					memory::VirtualAllocator{ nullptr }.VirtualFree(data, nTransferred * sectorSize);
+				}
+			}
+			CompleteBlockRequest(request, succeeded ? BlockRequest::STATUS_SUCCESS : BlockRequest::STATUS_FAILED, succeeded ? nTransferred : 0);
+			return true;
+		}
+		bool SubmitBlockRequest(driverIdentity* driver, BlockRequest* request)
+		{
+			if (!driver || !request || !request->buffer || request->operation > BlockRequest::OPERATION_WRITE)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			if (driver->_serviceType != OBOS_SERVICE_TYPE_STORAGE_DEVICE && driver->_serviceType != OBOS_SERVICE_TYPE_VIRTUAL_STORAGE_DEVICE)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			request->status = BlockRequest::STATUS_PENDING;
+			request->nSectorsTransferred = 0;
+			request->driverData = nullptr;
+			auto& ftable = driver->functionTable.serviceSpecific.storageDevice;
+			if (!ftable.SubmitRequest)
+				return doRequestSynchronously(driver, request);
+			SetLastError(OBOS_SUCCESS);
+			if (!ftable.SubmitRequest(request))
+			{
+				if (GetLastError() == OBOS_SUCCESS)
+					SetLastError(OBOS_ERROR_VFS_DRIVER_FAILURE);
+				return false;
+			}
+			return true;
+		}
+		bool CancelBlockRequest(driverIdentity* driver, BlockRequest* request)
+		{
+			if (!driver || !request)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			if (request->status != BlockRequest::STATUS_PENDING)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			auto& ftable = driver->functionTable.serviceSpecific.storageDevice;
+			if (!ftable.CancelRequest)
+			{
+				SetLastError(OBOS_ERROR_UNIMPLEMENTED_FEATURE);
+				return false;
+			}
+			return ftable.CancelRequest(request);
+		}
+		static bool requestCompleted(void* udata)
+		{
+			return ((BlockRequest*)udata)->status != BlockRequest::STATUS_PENDING;
+		}
+		bool WaitForBlockRequest(driverIdentity* driver, BlockRequest* request, uint64_t timeout)
+		{
+			if (!driver || !request || request->onCompletion)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			auto& ftable = driver->functionTable.serviceSpecific.storageDevice;
+			uint64_t waited = 0;
+			while (!requestCompleted(request))
+			{
+				if (timeout && waited >= timeout)
+				{
+					SetLastError(OBOS_ERROR_TIMEOUT);
+					return false;
+				}
+				uint64_t slice = BLOCK_REQUEST_POLL_INTERVAL;
+				if (timeout && timeout - waited < slice)
+					slice = timeout - waited;
+				if (canBlock())
+				{
+					if (request->event.WaitFor(requestCompleted, request, slice))
+						break;
+					waited += slice;
+				}
+				if (ftable.PollDrive)
+					ftable.PollDrive(request->driveId);
+				if (!canBlock())
+					pause();
+			}
+			// The status is set before the driver unlocks the event. Wait for it to do that, as the request could be freed as soon as we return.
+			request->event.WakeAll();
+			switch (request->status)
+			{
+			case BlockRequest::STATUS_SUCCESS:
+				return true;
+			case BlockRequest::STATUS_CANCELLED:
+				SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+				return false;
+			default:
+				SetLastError(request->operation == BlockRequest::OPERATION_WRITE ? OBOS_ERROR_VFS_WRITE_ABORTED : OBOS_ERROR_VFS_READ_ABORTED);
+				return false;
+			}
+		}
+		struct completion
+		{
+			BlockRequest* request;
+			BlockRequest::Status status;
+		};
+		static bool setStatus(thread::Thread*, void* udata)
+		{
+			completion* c = (completion*)udata;
+			c->request->status = c->status;
+			return true;
+		}
+		void CompleteBlockRequest(BlockRequest* request, BlockRequest::Status status, size_t nSectorsTransferred)
+		{
+			if (!request)
+				return;
+			// This has to happen before the request is handed back, as it could be freed right after.
+			if (request->cacheWrite)
+			{
+				request->cacheWrite = false;
+				vfs::BufferCacheEndWrite(request->driveId, request->lbaOffset, request->nSectors);
+			}
+			request->nSectorsTransferred = nSectorsTransferred;
+			if (request->onCompletion)
+			{
+				request->status = status;
+				request->onCompletion(request);
+				return;
+			}
+			// The status has to be set with the event locked, or the waiter could see it and free the request before we wake it.
+			completion c{ request, status };
+			request->event.WakeOne(setStatus, &c);
+		}
+	}
+}
@@ -0,0 +1,92 @@
+/*
+	driverInterface/blockRequest.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+#include <multitasking/locks/waitQueue.h>
+
+namespace obos
+{
+	namespace driverInterface
+	{
+		struct driverIdentity;
+		// An asynchronous read or write of a storage device's sectors.
+		struct BlockRequest
+		{
+			enum Operation
+			{
+				OPERATION_READ,
+				OPERATION_WRITE,
+			};
+			enum Status
+			{
+				STATUS_PENDING,
+				STATUS_SUCCESS,
+				STATUS_FAILED,
+				STATUS_CANCELLED,
+			};
+			// These are filled in by the submitter.
+
+			uint32_t driveId = 0;
+			Operation operation = OPERATION_READ;
+			uint64_t lbaOffset = 0;
+			size_t nSectors = 0;
+			// Must be at least 2-byte aligned. This can be user memory, as long as the request is submitted in that process' context.
+			void* buffer = nullptr;
+			// Optional. Called once the request finishes, which could be in an interrupt handler, so it mustn't block.
+			// If this is set, the request can't be waited on, and belongs to the callback once it's called.
+			void(*onCompletion)(BlockRequest* request) = nullptr;
+			void* userdata = nullptr;
+
+			// These are filled in by the driver.
+
+			volatile Status status = STATUS_PENDING;
+			size_t nSectorsTransferred = 0;
+			// Only one thread can wait on the request.
+			locks::WaitQueue event;
+			// For the driver's use.
+			void* driverData = nullptr;
+			// Set on writes that went around the buffer cache, which has to hear when they complete. See vfs::BufferCacheEndWrite.
+			bool cacheWrite = false;
+			// For the use of whoever currently owns the request (ex: an I/O queue).
+			BlockRequest *next = nullptr, *prev = nullptr;
+		};
+
+		/// <summary>
+		/// Submits a request to a storage driver.<para></para>
+		/// If the driver doesn't support asynchronous requests, the request is done synchronously before this returns.
+		/// </summary>
+		/// <param name="driver">The storage driver.</param>
+		/// <param name="request">The request. This must stay valid until it completes.</param>
+		/// <returns>Whether the request was submitted. If this returns false, the request won't complete; use GetLastError.</returns>
+		OBOS_EXPORT bool SubmitBlockRequest(driverIdentity* driver, BlockRequest* request);
+		/// <summary>
+		/// Cancels a request that the drive hasn't started yet. The request completes with STATUS_CANCELLED.
+		/// </summary>
+		/// <param name="driver">The storage driver the request was submitted to.</param>
+		/// <param name="request">The request.</param>
+		/// <returns>Whether the request was cancelled. If this returns false, the request will still complete; use GetLastError.</returns>
+		OBOS_EXPORT bool CancelBlockRequest(driverIdentity* driver, BlockRequest* request);
+		/// <summary>
+		/// Waits for a request to complete.
+		/// </summary>
+		/// <param name="driver">The storage driver the request was submitted to.</param>
+		/// <param name="request">The request.</param>
+		/// <param name="timeout">How many nanoseconds to wait for, or zero to wait forever.</param>
+		/// <returns>Whether the request completed successfully. If it didn't, use GetLastError.</returns>
+		OBOS_EXPORT bool WaitForBlockRequest(driverIdentity* driver, BlockRequest* request, uint64_t timeout = 0);
+		/// <summary>
+		/// Called by storage drivers to finish a request. This can be called from an interrupt handler.
+		/// </summary>
+		/// <param name="request">The request.</param>
+		/// <param name="status">The request's final status.</param>
+		/// <param name="nSectorsTransferred">How many sectors were transferred.</param>
+		OBOS_EXPORT void CompleteBlockRequest(BlockRequest* request, BlockRequest::Status status, size_t nSectorsTransferred);
+	}
+}
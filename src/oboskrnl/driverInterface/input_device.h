@@ -15,6 +15,8 @@
 
 #include <allocators/slab.h>
 
+#include <multitasking/locks/waitQueue.h>
+
 namespace obos
 {
 	namespace driverInterface
@@ -26,6 +28,8 @@ namespace obos
 			uint32_t id = 0;
 			vfs::HandleList fileHandlesReferencing;
 			InputDevice *next = nullptr, *prev = nullptr;
+			// Woken when the driver writes to data.
+			locks::WaitQueue dataAvailable;
 
 			void* operator new(size_t)
 			{
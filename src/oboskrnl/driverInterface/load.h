@@ -12,11 +12,17 @@
 
 #include <multitasking/threadAPI/thrHandle.h>
 
+#include <multitasking/locks/rwLock.h>
+
 namespace obos
 {
 	namespace driverInterface
 	{
 		extern utils::Hashmap<uint32_t, struct driverIdentity*> g_driverInterfaces;
+		// Protects g_driverInterfaces. Lookups only need to lock it shared.
+		extern locks::RwLock g_driverInterfacesLock;
+		// Returns the identity of a loaded driver, or nullptr if the driver isn't loaded.
+		struct driverIdentity* GetDriverInterface(uint32_t driverId);
 		void ScanAndLoadModules(const char* root);
 		// Returns the driver header, this header must be in an offset from file to file+size.
 		struct driverHeader* CheckModule(const byte* file, size_t size);
@@ -20,6 +20,8 @@
 #include <multitasking/cpu_local.h>
 
 #include <vfs/devManip/driveHandle.h>
+#include <vfs/devManip/bufferCache.h>
+#include <vfs/devManip/ioScheduler.h>
 
 namespace obos
 {
@@ -82,6 +84,10 @@ namespace obos
             if (g_drives.tail == drive)
                 g_drives.tail = drive->prev;
             g_drives.nDrives--;
+            // Let the requests that are queued finish before the driver goes away.
+            vfs::IoQueueDestroy(drive);
+            // The id could be given to another drive, so don't leave this drive's blocks in the cache.
+            vfs::BufferCacheInvalidateDrive(id);
             // Close any open handles, partition handles for this driver will also be closed.
             for (auto handleNode = drive->handlesReferencing.head; handleNode;)
             {
@@ -151,6 +157,8 @@ namespace obos
             if (g_inputDevices.tail == device)
                 g_inputDevices.tail = device->prev;
             g_drives.nDrives--;
+            // The id could be given to another drive, so don't leave this drive's blocks in the cache.
+            vfs::BufferCacheInvalidateDrive(id);
             // Close any open file handles.
             for (auto handleNode = device->fileHandlesReferencing.head; handleNode;)
             {
@@ -196,6 +204,7 @@ namespace obos
             if (!device)
                 return false;
             device->data.push_back(exChar);
+            device->dataAvailable.WakeAll();
             return true;
         }
         void* GetUserInputDevice(uint32_t id)
@@ -22,6 +22,7 @@ namespace obos
 {
 	namespace driverInterface
 	{
+		struct BlockRequest;
 		enum { OBOS_DRIVER_HEADER_MAGIC = 0x5902E288 };
 		enum serviceType
 		{
@@ -134,8 +135,20 @@ namespace obos
 						size_t nToSkip,
 						size_t nToRead,
 						char* buff);
+					/// <summary>
+					/// Optional. Creates an iterator over the files directly in a directory, which is used with FileIteratorNext and FileIteratorClose.<para></para>
+					/// The paths returned are still relative to the partition's root. If this is nullptr, every file is iterated over when the partition is mounted.
+					/// </summary>
+					/// <param name="driveId">The drive id the directory is located on.</param>
+					/// <param name="partitionIdOnDrive">The partition id on the drive the directory is located on.</param>
+					/// <param name="path">The directory's path, or an empty string for the root directory.</param>
+					/// <param name="oIter">The variable to store the iterator in.</param>
+					bool(*DirectoryIteratorCreate)(
+						uint32_t driveId, uint32_t partitionIdOnDrive,
+						const char* path,
+						uintptr_t* oIter);
 					// TODO: Make a write file callback.
-					void* unused[maxCallbacks - 5]; // Add padding
+					void* unused[maxCallbacks - 6]; // Add padding
 				} filesystem;
 				struct
 				{
@@ -163,7 +176,25 @@ namespace obos
 						uint64_t *oNSectors,
 						uint64_t *oBytesPerSector
 						);
-					void* unused[maxCallbacks - 3]; // Add padding
+					// Optional.
+					// Reads directly into buff, which can be any buffer mapped in the current address space, including user memory.
+					// If lbaOffset + nSectorsToRead > the drive's sector count, this function shall return true and set *oNSectorsRead to zero.
+					bool(*ReadSectorsInto)(
+						uint32_t driveId,
+						uint64_t lbaOffset,
+						size_t nSectorsToRead,
+						void* buff,
+						size_t* oNSectorsRead
+						);
+					// Optional. If this is nullptr, requests are done synchronously with the callbacks above.
+					// Starts a request, and returns without waiting for it. The driver calls CompleteBlockRequest when the request finishes.
+					// If this returns false, the request must not be completed.
+					bool(*SubmitRequest)(struct BlockRequest* request);
+					// Optional. Cancels a request the drive hasn't started, and completes it with STATUS_CANCELLED.
+					bool(*CancelRequest)(struct BlockRequest* request);
+					// Optional. Completes any requests the drive finished, for when interrupts are off or were lost.
+					void(*PollDrive)(uint32_t driveId);
+					void* unused[maxCallbacks - 7]; // Add padding
 				} storageDevice;
 				struct
 				{
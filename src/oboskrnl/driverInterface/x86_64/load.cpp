@@ -573,6 +573,16 @@ namespace obos
 			return true;
 		}
 		utils::Hashmap<uint32_t, driverIdentity*> g_driverInterfaces;
+		locks::RwLock g_driverInterfacesLock;
+		driverIdentity* GetDriverInterface(uint32_t driverId)
+		{
+			driverIdentity* ret = nullptr;
+			g_driverInterfacesLock.LockShared();
+			if (g_driverInterfaces.contains(driverId))
+				ret = g_driverInterfaces.at(driverId);
+			g_driverInterfacesLock.UnlockShared();
+			return ret;
+		}
 		driverHeader* CheckModule(const byte* file, size_t size)
 		{
 			return (driverHeader*)_CheckModuleImpl(file, size, nullptr);
@@ -601,7 +611,7 @@ namespace obos
 			identity->functionTable = header->functionTable;
 			identity->header = new driverHeader{ *header };
 			// We emplace it after the driver finishes initialization.
-			if (g_driverInterfaces.contains(identity->driverId))
+			if (GetDriverInterface(identity->driverId))
 			{
 				SetLastError(OBOS_ERROR_ALREADY_EXISTS);
 				return false;
@@ -664,7 +674,9 @@ namespace obos
 			else
 				header->driver_initialized = true;
 			while (!header->driver_initialized);
+			g_driverInterfacesLock.LockExclusive();
 			g_driverInterfaces.emplace_at(header->driverId, identity);
+			g_driverInterfacesLock.UnlockExclusive();
 			header->driver_finished_loading = true;
 			return true;
 		}
@@ -163,7 +163,7 @@ namespace obos
 			for(auto iter = driversToLoad.begin(); iter; iter++)
 			{
 				auto driver = (*iter).key;
-				if (g_driverInterfaces.contains(driver->header->driverId))
+				if (GetDriverInterface(driver->header->driverId))
 					continue;
 				logger::debug("%s: Loading driver %s\n", __func__, driver->fullPath.data());
 				vfs::FileHandle file;
@@ -255,7 +255,7 @@ namespace obos
 			uacpi_namespace_for_each_node_depth_first(uacpi_namespace_root(), ACPIIteratorCallback, userdata);
 			for (auto& driver : driversToLoad)
 			{
-				if (g_driverInterfaces.contains(driver->header->driverId))
+				if (GetDriverInterface(driver->header->driverId))
 					continue;
 				logger::debug("%s: Loading driver %s\n", __func__, driver->fullPath.data());
 				vfs::FileHandle file;
@@ -327,7 +327,7 @@ namespace obos
 			}
 			if (mbrDrives.length())
 			{
-				if (g_driverInterfaces.contains(2))
+				if (GetDriverInterface(2))
 					goto next;
 				vfs::FileHandle mbrDriver;
 				if (!mbrDriver.Open("0:/mbrDriver"))
@@ -345,7 +345,7 @@ namespace obos
 			next:
 			if (gptDrives.length())
 			{
-				if (g_driverInterfaces.contains(3))
+				if (GetDriverInterface(3))
 					goto done;
 				vfs::FileHandle gptDriver;
 				if (!gptDriver.Open("0:/gptDriver"))
@@ -361,11 +361,7 @@ namespace obos
 				delete[] fdata;
 			}
 		done:
-			driverIdentity *gptDriver = nullptr, *mbrDriver = nullptr;
-			if (&g_driverInterfaces.at(2))
-				mbrDriver = g_driverInterfaces.at(2);
-			if (&g_driverInterfaces.at(3))
-				gptDriver = g_driverInterfaces.at(3);
+			driverIdentity *mbrDriver = GetDriverInterface(2), *gptDriver = GetDriverInterface(3);
 			auto iterateDrivesAndRegisterPartitions = [](utils::Vector<uint32_t>& drives, driverIdentity* driver)
 				{
 					for (auto& driveId : drives)
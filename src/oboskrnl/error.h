@@ -58,7 +58,7 @@ namespace obos
 		/// </summary>
 		OBOS_ERROR_MUTEX_LOCKED,
 		/// <summary>
-		/// The scheduler woke up the thread during a blocking operation when g_timerTicks > thread->wakeUpTime.
+		/// The scheduler woke up the thread during a blocking operation when the timeout passed.
 		/// </summary>
 		OBOS_ERROR_TIMEOUT,
 		/// <summary>
@@ -28,7 +28,6 @@ namespace obos
 	namespace thread
 	{
 		void switchToThreadImpl(taskSwitchInfo* info, struct Thread* thread);
-		bool callBlockCallbackOnThread(taskSwitchInfo* info, bool(*callback)(void* thread, void* userdata), void* par1, void* par2);
 		void setupThreadContext(taskSwitchInfo* info, void* stackInfo, uintptr_t entry, uintptr_t userdata, size_t stackSize, memory::VirtualAllocator* vallocator, void* asProc);
 		void freeThreadStackInfo(void* stackInfo, memory::VirtualAllocator* vallocator);
 		void setupTimerInterrupt();
@@ -37,6 +36,13 @@ namespace obos
 		OBOS_EXPORT void startTimer(uintptr_t);
 		
 		OBOS_EXPORT void callScheduler(bool allCores);
+		// Sends the cpu an interrupt that calls the scheduler.
+		void callSchedulerOnCpu(uint32_t cpuId);
+
+		// Returns the time since the clock was calibrated in nanoseconds. This never goes backwards, and is the same on all cpus.
+		OBOS_EXPORT uint64_t GetMonotonicTime();
+		// Sets the current cpu's timer to call the scheduler once GetMonotonicTime() >= deadline. If deadline is UINT64_MAX, the timer is turned off.
+		void armSchedulerTimer(uint64_t deadline);
 
 		void* getCurrentCpuLocalPtr();
 		// For any kernel/driver developers, this does nothing but send the other cores to a trampoline.
@@ -27,9 +27,25 @@ namespace obos
 			cpu_local_arch arch_specific{};
 			bool isBSP = false;
 			Thread* idleThread = nullptr;
+			// This cpu's run queues, indexed by the log2 of the thread's priority. These only hold runnable threads.
+			Thread::ThreadList priorityLists[4]{};
+			// Threads owned by this cpu that are blocked or paused.
+			Thread::ThreadList blockedList{};
+			// Bit n is set when priorityLists[n] isn't empty.
+			uint8_t runQueueBitmap = 0;
+			// Bit n is set when priorityLists[n] has used all its turns in the current round.
+			uint8_t exhaustedBitmap = 0;
+			// Protects priorityLists and blockedList. Other cpus take this when adding, removing, or stealing threads.
+			bool runQueueLock = false;
+			// How many threads are in priorityLists.
+			size_t nThreads = 0;
+			// Timers armed on this cpu, fired by the scheduler.
+			TimerWheel timerWheel{};
+			// When the scheduler timer is set to go off, or UINT64_MAX if it is off.
+			uint64_t timerDeadline = UINT64_MAX;
 		};
-		extern cpu_local* g_cpuInfo;
-		extern size_t g_nCPUs;
+		extern OBOS_EXPORT cpu_local* g_cpuInfo;
+		extern OBOS_EXPORT size_t g_nCPUs;
 		OBOS_EXPORT cpu_local* GetCurrentCpuLocalPtr();
 	}
 }
\ No newline at end of file
@@ -14,78 +14,120 @@
 
 #include <multitasking/locks/mutex.h>
 
-#include <allocators/liballoc.h>
-
-extern obos::locks::Mutex g_allocatorMutex;
-
-#ifdef __INTELLISENSE__
-template<class type>
-bool __atomic_compare_exchange_n(type* ptr, type* expected, type desired, bool weak, int success_memorder, int failure_memorder);
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
 #endif
 
+#include <allocators/liballoc.h>
+
 namespace obos
 {
-	namespace thread
-	{
-		extern locks::Mutex g_coreGlobalSchedulerLock;
-	}
 	namespace locks
 	{
+		// How many times Lock checks the mutex before sleeping, while the owner is running.
+		static constexpr size_t s_maxSpins = 1000;
+		static bool ownerIsRunning(thread::Thread* owner)
+		{
+			return owner && (owner->status & thread::THREAD_STATUS_RUNNING) && owner->cpu != thread::GetCurrentCpuLocalPtr();
+		}
 		bool Mutex::Lock(uint64_t timeout, bool block)
 		{
-			if (!block && Locked())
+			const bool useScheduler = m_canUseMultitasking && thread::g_initialized;
+			thread::Thread* currentThread = useScheduler ? (thread::Thread*)thread::GetCurrentCpuLocalPtr()->currentThread : nullptr;
+			uint64_t wakeupTime = thread::GetMonotonicTime() + timeout * 1000000;
+			if (timeout == 0)
+				wakeupTime = 0xffffffffffffffff /* UINT64_MAX */;
+			if (atomic_cmpxchg(&m_locked, false, true))
+				goto acquired;
+			if (!block)
 			{
-				if (this != &thread::g_coreGlobalSchedulerLock)
-					SetLastError(OBOS_ERROR_MUTEX_LOCKED);
+				SetLastError(OBOS_ERROR_MUTEX_LOCKED);
 				return false;
 			}
-			// Compare m_locked with zero, and if it is zero, then set it to true and return true, otherwise return false and keep m_locked intact.
-			uint64_t wakeupTime = thread::g_timerTicks + timeout;
-			if (timeout == 0)
-				wakeupTime = 0xffffffffffffffff /* UINT64_MAX */;
-			const bool expected = false;
-			if (m_locked)
+			atomic_inc(m_stats.nContended);
+			// The owner will probably unlock the mutex soon if it is running, so spin for a bit before sleeping.
+			// Don't spin if there are threads sleeping, as they get the mutex first.
+			for (size_t i = 0; i < s_maxSpins && !m_wake; i++)
 			{
-				if (m_canUseMultitasking && thread::g_initialized)
+				if (useScheduler && (m_waiters.GetWaiterCount() || !ownerIsRunning(m_ownerThread)))
+					break;
+				if (!atomic_test(&m_locked) && atomic_cmpxchg(&m_locked, false, true))
 				{
-					thread::Thread* currentThread = (thread::Thread*)thread::GetCurrentCpuLocalPtr()->currentThread;
-					currentThread->blockCallback.callback = [](thread::Thread* thr, void* udata)->bool
-					{
-						Mutex* _this = (Mutex*)udata;
-						return _this->m_locked || _this->m_wake || thread::g_timerTicks < thr->wakeUpTime;
-					};
-					currentThread->blockCallback.userdata = this;
-					currentThread->wakeUpTime = wakeupTime;
-					currentThread->status = thread::THREAD_STATUS_CAN_RUN | thread::THREAD_STATUS_BLOCKED;
-					thread::callScheduler(false);
-				}
-				else
-				{
-					while (m_locked && !m_wake && thread::g_timerTicks < wakeupTime);
+					atomic_inc(m_stats.nSpinAcquisitions);
+					goto acquired;
 				}
+#if defined(__x86_64__) || defined(_WIN64)
+				pause();
+#endif
 			}
-			while ((__atomic_compare_exchange_n(&m_locked, (bool*)&expected, true, false, 0, 0) || m_wake) || thread::g_timerTicks >= wakeupTime);
-			if (thread::g_timerTicks >= wakeupTime)
+			while (true)
 			{
-				SetLastError(OBOS_ERROR_TIMEOUT);
-				return false;
+				if (m_wake)
+				{
+					SetLastError(OBOS_ERROR_MUTEX_LOCKED);
+					return false;
+				}
+				uint64_t now = thread::GetMonotonicTime();
+				if (now >= wakeupTime)
+				{
+					SetLastError(OBOS_ERROR_TIMEOUT);
+					return false;
+				}
+				if (!useScheduler)
+				{
+					if (atomic_cmpxchg(&m_locked, false, true))
+						goto acquired;
+#if defined(__x86_64__) || defined(_WIN64)
+					pause();
+#endif
+					continue;
+				}
+				atomic_inc(m_stats.nSleeps);
+				// Unlock either gives the mutex to this thread (m_ownerThread is set), or unlocks it if nobody is waiting.
+				if (!m_waiters.WaitFor([](void* udata)->bool
+					{
+						Mutex* _this = (Mutex*)udata;
+						if (_this->m_ownerThread == thread::GetCurrentCpuLocalPtr()->currentThread)
+							return true;
+						return _this->m_wake || atomic_cmpxchg(&_this->m_locked, false, true);
+					}, this, timeout ? wakeupTime - now : 0))
+					return false;
+				if (m_ownerThread == currentThread || !m_wake)
+					goto acquired;
 			}
-			if (thread::g_initialized && m_canUseMultitasking)
-				m_ownerThread = (thread::Thread*)thread::GetCurrentCpuLocalPtr()->currentThread;
+			acquired:
+			if (useScheduler)
+				m_ownerThread = currentThread;
+			atomic_inc(m_stats.nAcquisitions);
 			return true;
 		}
 		bool Mutex::Unlock()
 		{
-			if (thread::g_initialized && m_canUseMultitasking)
+			if (!(thread::g_initialized && m_canUseMultitasking))
 			{
-				if (thread::GetCurrentCpuLocalPtr()->currentThread != m_ownerThread)
-				{
-					SetLastError(OBOS_ERROR_ACCESS_DENIED);
-					return false;
-				}
+				m_ownerThread = nullptr;
+				atomic_clear(&m_locked);
+				return true;
 			}
-			atomic_clear(&m_locked);
-			m_ownerThread = nullptr;
+			if (thread::GetCurrentCpuLocalPtr()->currentThread != m_ownerThread)
+			{
+				SetLastError(OBOS_ERROR_ACCESS_DENIED);
+				return false;
+			}
+			// Give the mutex to the thread that has waited the longest, so it can't be taken by a thread that just got here.
+			m_waiters.WakeOne([](thread::Thread* thr, void* udata)->bool
+				{
+					Mutex* _this = (Mutex*)udata;
+					if (!thr)
+					{
+						_this->m_ownerThread = nullptr;
+						atomic_clear(&_this->m_locked);
+						return false;
+					}
+					_this->m_ownerThread = thr;
+					atomic_inc(_this->m_stats.nHandoffs);
+					return true;
+				}, this);
 			return true;
 		}
 		bool Mutex::Locked() const
@@ -95,7 +137,8 @@ namespace obos
 		Mutex::~Mutex()
 		{
 			atomic_set(&m_wake);
-			thread::callScheduler(false);
+			if (thread::g_initialized)
+				m_waiters.WakeAll();
 			m_ownerThread = nullptr;
 			atomic_clear(&m_locked);
 		}
@@ -11,6 +11,8 @@
 
 #include <allocators/slab.h>
 
+#include <multitasking/locks/waitQueue.h>
+
 namespace obos
 {
 #ifndef MULTIASKING_THREAD_H_INCLUDED
@@ -30,7 +32,7 @@ namespace obos
 			/// <summary>
 			/// Locks the mutex.
 			/// </summary>
-			/// <param name="timeout">How long to block for, only effective if blockWithScheduler == true.</param>
+			/// <param name="timeout">How many milliseconds to block for, or zero to block forever.</param>
 			/// <param name="block">Whether to block if the lock is locked, or to abort.</param>
 			/// <returns>Whether the mutex could be locked, otherwise false. If the function returned false, use GetLastError.</returns>
 			OBOS_EXPORT bool Lock(uint64_t timeout = 0, bool block = true);
@@ -51,6 +53,25 @@ namespace obos
 			OBOS_EXPORT void CanUseMultitasking(bool val) { m_canUseMultitasking = val; };
 			OBOS_EXPORT bool CanUseMultitasking() const { return m_canUseMultitasking; };
 
+			struct Statistics
+			{
+				// How many times the mutex was locked.
+				uint64_t nAcquisitions;
+				// How many times Lock found the mutex locked.
+				uint64_t nContended;
+				// How many contended locks got the mutex while spinning.
+				uint64_t nSpinAcquisitions;
+				// How many times a thread slept waiting for the mutex.
+				uint64_t nSleeps;
+				// How many times Unlock gave the mutex to a waiting thread.
+				uint64_t nHandoffs;
+			};
+			/// <summary>
+			/// Gets the mutex's contention counters.
+			/// </summary>
+			/// <returns>The counters.</returns>
+			OBOS_EXPORT const Statistics& GetStatistics() const { return m_stats; }
+
 			OBOS_EXPORT ~Mutex();
 
 			[[nodiscard]] void* operator new(size_t )
@@ -74,11 +95,14 @@ namespace obos
 			void operator delete(void*, void*) noexcept {}
 			void operator delete[](void*, void*) noexcept {}
 		private:
-			bool m_wake;
-			bool m_locked;
+			bool m_wake = false;
+			bool m_locked = false;
 			bool m_canUseMultitasking = true;
 			bool m_initialized;
 			thread::Thread* m_ownerThread;
+			// The threads blocked in Lock, in the order they get the mutex.
+			WaitQueue m_waiters;
+			Statistics m_stats{};
 		};
 
 		struct SafeMutex final
@@ -0,0 +1,134 @@
+/*
+	multitasking/locks/rwLock.cpp
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <atomic.h>
+
+#include <multitasking/scheduler.h>
+
+#include <multitasking/locks/rwLock.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#endif
+
+#define RWLOCK_WRITER ((uint64_t)1 << 63)
+
+namespace obos
+{
+	namespace locks
+	{
+		static void spin()
+		{
+#if defined(__x86_64__) || defined(_WIN64)
+			pause();
+#endif
+		}
+		bool RwLock::tryLockShared(void* udata)
+		{
+			RwLock* _this = (RwLock*)udata;
+			uint64_t state = __atomic_load_n(&_this->m_state, __ATOMIC_SEQ_CST);
+			while (!(state & RWLOCK_WRITER) && !__atomic_load_n(&_this->m_writersWaiting, __ATOMIC_SEQ_CST))
+				if (__atomic_compare_exchange_n(&_this->m_state, &state, state + 1, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST))
+					return true;
+			return false;
+		}
+		bool RwLock::tryLockExclusive(void* udata)
+		{
+			RwLock* _this = (RwLock*)udata;
+			uint64_t expected = 0;
+			return __atomic_compare_exchange_n(&_this->m_state, &expected, RWLOCK_WRITER, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+		}
+
+		bool RwLock::LockShared(bool block)
+		{
+			if (!tryLockShared(this))
+			{
+				if (!block)
+				{
+					SetLastError(OBOS_ERROR_MUTEX_LOCKED);
+					return false;
+				}
+				atomic_inc(m_stats.nContended);
+				if (thread::g_initialized)
+				{
+					atomic_inc(m_stats.nSleeps);
+					m_waiters.WaitFor(tryLockShared, this);
+				}
+				else
+				{
+					while (!tryLockShared(this))
+						spin();
+				}
+			}
+			atomic_inc(m_stats.nSharedAcquisitions);
+			return true;
+		}
+		bool RwLock::UnlockShared()
+		{
+			uint64_t state = __atomic_load_n(&m_state, __ATOMIC_SEQ_CST);
+			if ((state & RWLOCK_WRITER) || !state)
+			{
+				SetLastError(OBOS_ERROR_ACCESS_DENIED);
+				return false;
+			}
+			// Only a writer can be waiting on readers, so the waiters only need to be woken when the last reader leaves.
+			if (__atomic_sub_fetch(&m_state, 1, __ATOMIC_SEQ_CST) == 0 && thread::g_initialized)
+				m_waiters.WakeAll();
+			return true;
+		}
+		bool RwLock::LockExclusive(bool block)
+		{
+			if (!tryLockExclusive(this))
+			{
+				if (!block)
+				{
+					SetLastError(OBOS_ERROR_MUTEX_LOCKED);
+					return false;
+				}
+				atomic_inc(m_stats.nContended);
+				// Keep new readers out until this thread gets the lock.
+				__atomic_add_fetch(&m_writersWaiting, 1, __ATOMIC_SEQ_CST);
+				if (thread::g_initialized)
+				{
+					atomic_inc(m_stats.nSleeps);
+					m_waiters.WaitFor(tryLockExclusive, this);
+				}
+				else
+				{
+					while (!tryLockExclusive(this))
+						spin();
+				}
+				__atomic_sub_fetch(&m_writersWaiting, 1, __ATOMIC_SEQ_CST);
+			}
+			atomic_inc(m_stats.nExclusiveAcquisitions);
+			return true;
+		}
+		bool RwLock::UnlockExclusive()
+		{
+			if (!LockedExclusive())
+			{
+				SetLastError(OBOS_ERROR_ACCESS_DENIED);
+				return false;
+			}
+			__atomic_store_n(&m_state, 0, __ATOMIC_SEQ_CST);
+			// Readers and writers can both be waiting on a writer.
+			if (thread::g_initialized)
+				m_waiters.WakeAll();
+			return true;
+		}
+
+		size_t RwLock::GetReaderCount() const
+		{
+			return __atomic_load_n(&m_state, __ATOMIC_SEQ_CST) & ~RWLOCK_WRITER;
+		}
+		bool RwLock::LockedExclusive() const
+		{
+			return __atomic_load_n(&m_state, __ATOMIC_SEQ_CST) & RWLOCK_WRITER;
+		}
+	}
+}
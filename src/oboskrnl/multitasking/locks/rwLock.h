@@ -0,0 +1,83 @@
+/*
+	multitasking/locks/rwLock.h
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+#include <multitasking/locks/waitQueue.h>
+
+namespace obos
+{
+	namespace locks
+	{
+		// A lock that can be held by many readers, or one writer. Waiting writers keep new readers out, so they can't be starved.
+		// This lock isn't recursive.
+		class RwLock final
+		{
+		public:
+			OBOS_EXPORT RwLock() = default;
+
+			/// <summary>
+			/// Locks the lock for reading.
+			/// </summary>
+			/// <param name="block">Whether to block if a writer has the lock, or is waiting for it, or to abort.</param>
+			/// <returns>Whether the lock could be locked, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool LockShared(bool block = true);
+			/// <summary>
+			/// Unlocks the lock after LockShared.
+			/// </summary>
+			/// <returns>Whether the lock could be unlocked, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool UnlockShared();
+			/// <summary>
+			/// Locks the lock for writing.
+			/// </summary>
+			/// <param name="block">Whether to block if the lock is held, or to abort.</param>
+			/// <returns>Whether the lock could be locked, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool LockExclusive(bool block = true);
+			/// <summary>
+			/// Unlocks the lock after LockExclusive.
+			/// </summary>
+			/// <returns>Whether the lock could be unlocked, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool UnlockExclusive();
+
+			/// <summary>
+			/// Returns how many readers have the lock.
+			/// </summary>
+			/// <returns>The number of readers.</returns>
+			OBOS_EXPORT size_t GetReaderCount() const;
+			/// <summary>
+			/// Returns whether a writer has the lock.
+			/// </summary>
+			/// <returns>Whether a writer has the lock.</returns>
+			OBOS_EXPORT bool LockedExclusive() const;
+
+			struct Statistics
+			{
+				uint64_t nSharedAcquisitions;
+				uint64_t nExclusiveAcquisitions;
+				// How many times a lock call found the lock unavailable.
+				uint64_t nContended;
+				// How many times a thread slept waiting for the lock.
+				uint64_t nSleeps;
+			};
+			/// <summary>
+			/// Gets the lock's contention counters.
+			/// </summary>
+			/// <returns>The counters.</returns>
+			OBOS_EXPORT const Statistics& GetStatistics() const { return m_stats; }
+		private:
+			static bool tryLockShared(void* _this);
+			static bool tryLockExclusive(void* _this);
+			// Bit 63 is set while a writer has the lock, and the rest of the bits count the readers.
+			uint64_t m_state = 0;
+			uint64_t m_writersWaiting = 0;
+			WaitQueue m_waiters;
+			Statistics m_stats{};
+		};
+	}
+}
@@ -0,0 +1,201 @@
+/*
+	multitasking/locks/waitQueue.cpp
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <atomic.h>
+
+#include <multitasking/scheduler.h>
+#include <multitasking/cpu_local.h>
+#include <multitasking/timerWheel.h>
+#include <multitasking/arch.h>
+
+#include <multitasking/locks/waitQueue.h>
+
+namespace obos
+{
+	namespace locks
+	{
+		void WaitQueue::lock()
+		{
+			while (!atomic_cmpxchg(&m_lock, false, true));
+		}
+		void WaitQueue::unlock()
+		{
+			atomic_clear(&m_lock);
+		}
+		void WaitQueue::append(thread::Thread* thr)
+		{
+			thr->next_wait = nullptr;
+			thr->prev_wait = m_tail;
+			if (m_tail)
+				m_tail->next_wait = thr;
+			if (!m_head)
+				m_head = thr;
+			m_tail = thr;
+			m_nWaiters++;
+			thr->inWaitQueue = true;
+		}
+		void WaitQueue::remove(thread::Thread* thr)
+		{
+			if (thr->prev_wait)
+				thr->prev_wait->next_wait = thr->next_wait;
+			if (thr->next_wait)
+				thr->next_wait->prev_wait = thr->prev_wait;
+			if (m_head == thr)
+				m_head = thr->next_wait;
+			if (m_tail == thr)
+				m_tail = thr->prev_wait;
+			m_nWaiters--;
+			thr->next_wait = thr->prev_wait = nullptr;
+			thr->inWaitQueue = false;
+		}
+		void WaitQueue::wake(thread::Thread* thr)
+		{
+			remove(thr);
+			thr->waitWoken = true;
+			thread::UnblockThread(thr);
+		}
+		void WaitQueue::timeoutCallback(thread::TimerEntry*, void* udata)
+		{
+			thread::Thread* thr = (thread::Thread*)udata;
+			WaitQueue* queue = (WaitQueue*)thr->waitQueue;
+			if (!queue)
+				return;
+			queue->lock();
+			if (thr->waitQueue == queue)
+			{
+				// Even if the thread isn't in the queue right now, it will see this before it blocks again.
+				thr->waitTimedOut = true;
+				if (thr->inWaitQueue)
+				{
+					queue->remove(thr);
+					thread::UnblockThread(thr);
+				}
+			}
+			queue->unlock();
+		}
+
+		bool WaitQueue::Wait(uint64_t timeout)
+		{
+			return WaitFor(nullptr, nullptr, timeout);
+		}
+		bool WaitQueue::WaitFor(bool(*condition)(void* userdata), void* userdata, uint64_t timeout)
+		{
+			thread::Thread* currentThread = (thread::Thread*)thread::GetCurrentCpuLocalPtr()->currentThread;
+			uintptr_t val = thread::stopTimer();
+			currentThread->waitQueue = this;
+			currentThread->waitTimedOut = false;
+			currentThread->waitWoken = false;
+			if (timeout)
+			{
+				currentThread->waitTimer.callback = timeoutCallback;
+				currentThread->waitTimer.userdata = currentThread;
+				thread::AddTimer(&currentThread->waitTimer, timeout);
+			}
+			bool ret = false;
+			while (true)
+			{
+				lock();
+				// If the thread is still in the queue, the scheduler ran it for some other reason, so block again.
+				if (!currentThread->inWaitQueue)
+				{
+					// Only a wake counts; the timeout also takes the thread out of the queue.
+					if (condition ? condition(userdata) : currentThread->waitWoken)
+					{
+						ret = true;
+						unlock();
+						break;
+					}
+					if (currentThread->waitTimedOut)
+					{
+						unlock();
+						break;
+					}
+					append(currentThread);
+				}
+				// The thread is marked as blocked before the queue is unlocked, so a wake can't happen before the block.
+				thread::BlockThread(currentThread);
+				unlock();
+				thread::startTimer(val);
+				thread::callScheduler(false);
+				val = thread::stopTimer();
+			}
+			if (timeout)
+				thread::CancelTimer(&currentThread->waitTimer);
+			currentThread->waitQueue = nullptr;
+			thread::startTimer(val);
+			if (!ret)
+				SetLastError(OBOS_ERROR_TIMEOUT);
+			return ret;
+		}
+		bool WaitQueue::BlockThread(thread::Thread* thr)
+		{
+			if (!thr || thr == thread::GetCurrentCpuLocalPtr()->currentThread)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			if (thr->status & thread::THREAD_STATUS_DEAD)
+			{
+				SetLastError(OBOS_ERROR_THREAD_DIED);
+				return false;
+			}
+			uintptr_t val = thread::stopTimer();
+			lock();
+			if (thr->inWaitQueue)
+			{
+				unlock();
+				thread::startTimer(val);
+				SetLastError(OBOS_ERROR_ALREADY_EXISTS);
+				return false;
+			}
+			append(thr);
+			thread::BlockThread(thr);
+			unlock();
+			thread::startTimer(val);
+			return true;
+		}
+
+		bool WaitQueue::WakeOne()
+		{
+			uintptr_t val = thread::stopTimer();
+			lock();
+			thread::Thread* thr = m_head;
+			if (thr)
+				wake(thr);
+			unlock();
+			thread::startTimer(val);
+			return thr != nullptr;
+		}
+		bool WaitQueue::WakeOne(bool(*handoff)(thread::Thread* thr, void* userdata), void* userdata)
+		{
+			uintptr_t val = thread::stopTimer();
+			lock();
+			thread::Thread* thr = m_head;
+			bool ret = handoff(thr, userdata) && thr;
+			if (ret)
+				wake(thr);
+			unlock();
+			thread::startTimer(val);
+			return ret;
+		}
+		size_t WaitQueue::WakeAll()
+		{
+			uintptr_t val = thread::stopTimer();
+			lock();
+			size_t nWoken = 0;
+			while (thread::Thread* thr = m_head)
+			{
+				wake(thr);
+				nWoken++;
+			}
+			unlock();
+			thread::startTimer(val);
+			return nWoken;
+		}
+	}
+}
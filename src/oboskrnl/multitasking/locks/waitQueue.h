@@ -0,0 +1,93 @@
+/*
+	multitasking/locks/waitQueue.h
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+namespace obos
+{
+#ifndef MULTIASKING_THREAD_H_INCLUDED
+	namespace thread
+	{
+		struct Thread;
+	}
+#endif
+	namespace thread
+	{
+		struct TimerEntry;
+	}
+	namespace locks
+	{
+		// A list of threads blocked until an event happens. Waiting threads are not looked at by the scheduler until they are woken.
+		class WaitQueue final
+		{
+		public:
+			OBOS_EXPORT WaitQueue() = default;
+
+			/// <summary>
+			/// Blocks the current thread until it is woken.
+			/// </summary>
+			/// <param name="timeout">How many nanoseconds to wait for, or zero to wait forever.</param>
+			/// <returns>Whether the thread was woken before the timeout, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool Wait(uint64_t timeout = 0);
+			/// <summary>
+			/// Blocks the current thread until condition returns true.
+			/// The condition is checked with the queue locked, so setting the condition then calling WakeOne or WakeAll can't be missed.
+			/// </summary>
+			/// <param name="condition">The condition to wait for.</param>
+			/// <param name="userdata">The parameter to pass to condition.</param>
+			/// <param name="timeout">How many nanoseconds to wait for, or zero to wait forever.</param>
+			/// <returns>Whether the condition became true before the timeout, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool WaitFor(bool(*condition)(void* userdata), void* userdata, uint64_t timeout = 0);
+			/// <summary>
+			/// Blocks a thread that isn't the current thread until it is woken.
+			/// </summary>
+			/// <param name="thr">The thread to block.</param>
+			/// <returns>Whether the function succeeded or not. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool BlockThread(thread::Thread* thr);
+
+			/// <summary>
+			/// Wakes the thread that has waited the longest.
+			/// </summary>
+			/// <returns>Whether a thread was woken.</returns>
+			OBOS_EXPORT bool WakeOne();
+			/// <summary>
+			/// Calls handoff with the queue locked, and the thread that has waited the longest, or nullptr if the queue is empty.
+			/// The thread is only woken if handoff returns true. This lets a lock be given to the next waiter before anyone else can take it.
+			/// </summary>
+			/// <param name="handoff">The callback.</param>
+			/// <param name="userdata">The parameter to pass to handoff.</param>
+			/// <returns>Whether a thread was woken.</returns>
+			OBOS_EXPORT bool WakeOne(bool(*handoff)(thread::Thread* thr, void* userdata), void* userdata);
+			/// <summary>
+			/// Wakes every thread in the queue.
+			/// </summary>
+			/// <returns>How many threads were woken.</returns>
+			OBOS_EXPORT size_t WakeAll();
+
+			/// <summary>
+			/// Returns how many threads are waiting.
+			/// </summary>
+			/// <returns>The number of threads in the queue.</returns>
+			OBOS_EXPORT size_t GetWaiterCount() const { return m_nWaiters; }
+
+			OBOS_EXPORT ~WaitQueue() { WakeAll(); }
+		private:
+			static void timeoutCallback(thread::TimerEntry* entry, void* udata);
+			void lock();
+			void unlock();
+			void append(thread::Thread* thr);
+			void remove(thread::Thread* thr);
+			void wake(thread::Thread* thr);
+			thread::Thread* m_head = nullptr;
+			thread::Thread* m_tail = nullptr;
+			size_t m_nWaiters = 0;
+			bool m_lock = false;
+		};
+	}
+}
@@ -86,15 +86,8 @@ namespace obos
 				thr->exitCode = 0;
 				thr->status = thread::THREAD_STATUS_DEAD;
 				thr->flags = 0;
-				if (thr->prev_run)
-					thr->prev_run->next_run = thr->next_run;
-				if (thr->next_run)
-					thr->next_run->prev_run = thr->prev_run;
-				if (thr->priorityList->head == thr)
-					thr->priorityList->head = thr->next_run;
-				if (thr->priorityList->tail == thr)
-					thr->priorityList->tail = thr->prev_run;
-				thr->priorityList->size--;
+				thread::RemoveThreadFromRunQueue(thr);
+				thr->exitWaiters.WakeAll();
 				if (!thr->references)
 				{
 					if (thr->prev_list)
@@ -14,6 +14,7 @@
 #include <multitasking/threadAPI/thrHandle.h>
 
 #include <arch/x86_64/memory_manager/virtual/initialize.h>
+#include <arch/x86_64/memory_manager/virtual/internal.h>
 #include <arch/x86_64/memory_manager/physical/allocate.h>
 
 #include <memory_manipulation.h>
@@ -51,6 +52,7 @@ namespace obos
 		void freeProcessContext(procContextInfo* info)
 		{
 			//memory::freePhysicalPage((uintptr_t)info->cr3);
+			memory::FreeFileMappings(info);
 			for (auto iter = info->handleTable.begin(); iter; iter++)
 			{
 				auto &hnd_val = *(*iter).value;
@@ -10,7 +10,7 @@
 
 #include <utils/hashmap.h>
 
-#include <multitasking/locks/mutex.h>
+#include <multitasking/locks/rwLock.h>
 
 namespace obos
 {
@@ -19,28 +19,26 @@ namespace obos
 		struct procContextInfo
 		{
 			void* cr3;
-			// Controls ownership of 'handleTable' and 'nextHandleValue'.
-			locks::Mutex handleTableLock;
+			// Controls ownership of 'handleTable' and 'nextHandleValue'. Lookups only need to lock it shared.
+			locks::RwLock handleTableLock;
 			utils::Hashmap<syscalls::user_handle, syscalls::handle> handleTable;
 			syscalls::user_handle nextHandleValue;
 			struct virtuallyMappedRegionNode
 			{
 				void* base;
-				void* addr;
 				void* dirent;
+				// The offset in the file of base, and the size of the region in bytes.
 				size_t off, size;
 				// Whether dirent is a DirectoryEntry* (true) or a PartitionEntry* (false).
 				// The former option is used for memory mapped files.
 				// The latter option is used for swap space.
 				bool isDirent;
+				virtuallyMappedRegionNode* next;
 			};
-			static bool vmapEquals(void* const &_left, void* const &_right)
-			{
-				uintptr_t left  = (uintptr_t)_left,
-					      right = (uintptr_t)_right;
-				return (left & ~0xfff) == (right & ~0xfff);
-			}
-			utils::Hashmap<void*, virtuallyMappedRegionNode, vmapEquals> memoryMappedFiles;
+			// One node for each mapped region, newest first.
+			virtuallyMappedRegionNode* memoryMappedFiles = nullptr;
+			// A spinlock that protects 'memoryMappedFiles' and the page table entries of the regions.
+			bool memoryMappedFilesLock = false;
 		};
 	}
 }
\ No newline at end of file
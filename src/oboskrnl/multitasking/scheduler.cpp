@@ -14,8 +14,7 @@
 #include <multitasking/thread.h>
 #include <multitasking/arch.h>
 #include <multitasking/cpu_local.h>
-
-#include <multitasking/locks/mutex.h>
+#include <multitasking/timerWheel.h>
 
 #include <memory_manipulation.h>
 
@@ -28,11 +27,8 @@ namespace obos
 	extern void kmain_common(byte* initrdDriverData, size_t initrdDriverSize);
 	namespace thread
 	{
-		Thread::ThreadList g_priorityLists[4];
 		uint64_t g_schedulerFrequency = 1000;
-		uint64_t g_timerTicks = 0;
 		__uint128_t g_defaultAffinity = 0;
-		locks::Mutex g_coreGlobalSchedulerLock;
 
 		bool g_initialized = false;
 
@@ -43,252 +39,343 @@ namespace obos
 #else
 #define DEFINE_IN_SECTION
 #endif
-		static bool DEFINE_IN_SECTION checkThreadAffinity(const Thread* thr)
+		static bool DEFINE_IN_SECTION checkThreadAffinity(const Thread* thr, uint32_t cpuId)
 		{
-			return (thr->affinity >> GetCurrentCpuLocalPtr()->cpuId) & 1;
+			return (thr->affinity >> cpuId) & 1;
 		}
-		static bool DEFINE_IN_SECTION ThreadCanRun(const Thread* thr)
+		static void DEFINE_IN_SECTION lockRunQueue(cpu_local* cpu)
 		{
-			return (thr->status == THREAD_STATUS_CAN_RUN) &&
-				checkThreadAffinity(thr) &&
-				(thr->timeSliceIndex < thr->priority);
+			while (!atomic_cmpxchg(&cpu->runQueueLock, false, true));
 		}
-		static Thread* DEFINE_IN_SECTION findRunnableThreadInList(Thread::ThreadList& list)
+		static void DEFINE_IN_SECTION unlockRunQueue(cpu_local* cpu)
 		{
-			Thread* currentThread = list.tail;
-			//volatile Thread* currentRunningThread = getCPULocal()->currentThread;
-			Thread* ret = nullptr;
-
-			while (currentThread)
-			{
-				bool clearTimeSliceIndex = currentThread->status & THREAD_STATUS_CLEAR_TIME_SLICE_INDEX;
-
-				if (currentThread->timeSliceIndex >= currentThread->priority)
-					currentThread->status |= THREAD_STATUS_CLEAR_TIME_SLICE_INDEX;
-
-				if (ThreadCanRun(currentThread))
-				{
-					if (!ret)
-						ret = currentThread;
-					else
-						if (currentThread->lastTimePreempted < ret->lastTimePreempted)
-							ret = currentThread;
-				}
-
-				if (clearTimeSliceIndex)
-				{
-					currentThread->status &= ~THREAD_STATUS_CLEAR_TIME_SLICE_INDEX;
-					currentThread->timeSliceIndex = 0;
-				}
-				
-				currentThread = currentThread->prev_run;
-			}
-
-			return ret;
+			atomic_clear(&cpu->runQueueLock);
 		}
-		static Thread::ThreadList& DEFINE_IN_SECTION findThreadPriorityList()
+		static void DEFINE_IN_SECTION listAppend(Thread::ThreadList* list, Thread* thr)
 		{
-			Thread::ThreadList* list = nullptr;
-			int i;
-			for (i = 3; i > -1; i--)
-			{
-				constexpr thrPriority priorityTable[4] = {
-					THREAD_PRIORITY_IDLE,
-					THREAD_PRIORITY_LOW,
-					THREAD_PRIORITY_NORMAL,
-					THREAD_PRIORITY_HIGH,
-				};
-				thrPriority priority = priorityTable[i];
-				list = &g_priorityLists[i];
-				if (list->size > 0)
-				{
-					if (g_priorityLists[i].iterations < (int)priority)
-						break;
-				}
-			}
-			if (g_priorityLists[0].iterations >= (int)THREAD_PRIORITY_IDLE)
+			thr->next_run = nullptr;
+			thr->prev_run = list->tail;
+			if (list->tail)
+				list->tail->next_run = thr;
+			if (!list->head)
+				list->head = thr;
+			list->tail = thr;
+			list->size++;
+			thr->priorityList = list;
+		}
+		static void DEFINE_IN_SECTION listRemove(Thread::ThreadList* list, Thread* thr)
+		{
+			if (thr->prev_run)
+				thr->prev_run->next_run = thr->next_run;
+			if (thr->next_run)
+				thr->next_run->prev_run = thr->prev_run;
+			if (list->head == thr)
+				list->head = thr->next_run;
+			if (list->tail == thr)
+				list->tail = thr->prev_run;
+			list->size--;
+			thr->next_run = thr->prev_run = nullptr;
+			thr->priorityList = nullptr;
+		}
+		// The following functions must be called with cpu's run queue lock held.
+		// A thread is in exactly one of: one of its cpu's run queues (runnable), its cpu's blocked list (blocked or paused), or no list (running, or dead).
+		static void DEFINE_IN_SECTION enqueueThread(Thread* thr, cpu_local* cpu)
+		{
+			int i = __builtin_ctz(thr->priority);
+			listAppend(&cpu->priorityLists[i], thr);
+			cpu->runQueueBitmap |= (1 << i);
+			thr->cpu = cpu;
+			cpu->nThreads++;
+		}
+		static void DEFINE_IN_SECTION parkThread(Thread* thr, cpu_local* cpu)
+		{
+			listAppend(&cpu->blockedList, thr);
+			thr->cpu = cpu;
+		}
+		static void DEFINE_IN_SECTION unlinkThread(Thread* thr)
+		{
+			cpu_local* cpu = thr->cpu;
+			Thread::ThreadList* list = thr->priorityList;
+			listRemove(list, thr);
+			if (list == &cpu->blockedList)
+				return;
+			cpu->nThreads--;
+			if (!list->size)
+				cpu->runQueueBitmap &= ~(1 << (list - cpu->priorityLists));
+		}
+		// Picks which run queue the next thread comes from. Each non-empty queue gets as many turns per round as its priority.
+		static Thread::ThreadList* DEFINE_IN_SECTION pickPriorityList(cpu_local* cpu)
+		{
+			uint8_t candidates = cpu->runQueueBitmap & ~cpu->exhaustedBitmap;
+			if (!candidates)
 			{
+				// Start a new round.
 				for (int j = 0; j < 4; j++)
-				{
-					while (atomic_test(&g_priorityLists[j].lock));
-					atomic_set(&g_priorityLists[j].lock);
-					g_priorityLists[j].iterations = 0;
-					atomic_clear(&g_priorityLists[j].lock);
-				}
-				return findThreadPriorityList();
+					cpu->priorityLists[j].iterations = 0;
+				cpu->exhaustedBitmap = 0;
+				candidates = cpu->runQueueBitmap;
 			}
-			while (atomic_test(&g_priorityLists[i].lock));
-			atomic_set(&g_priorityLists[i].lock);
-			g_priorityLists[i].iterations++;
-			atomic_clear(&g_priorityLists[i].lock);
-			return *list;
+			if (!candidates)
+				return nullptr;
+			int i = 31 - __builtin_clz(candidates);
+			Thread::ThreadList* list = &cpu->priorityLists[i];
+			if (++list->iterations >= ((size_t)1 << i))
+				cpu->exhaustedBitmap |= (1 << i);
+			return list;
 		}
-		static void DEFINE_IN_SECTION callBlockCallbacksOnList(Thread::ThreadList& list)
+		// Returns the thread that has waited longest in the chosen run queue, or nullptr if the cpu has no runnable threads.
+		static Thread* DEFINE_IN_SECTION dequeueRunnableThread(cpu_local* cpu)
 		{
-			Thread* thread = list.head;
-			while(thread)
+			while (Thread::ThreadList* list = pickPriorityList(cpu))
 			{
-				if (thread->status & THREAD_STATUS_BLOCKED)
-				{
-					while (thread->flags & THREAD_FLAGS_CALLING_BLOCK_CALLBACK);
-					OBOS_ASSERTP(!(thread->status & THREAD_STATUS_RUNNING), "Thread (tid %d) is both blocked and running (status 0x%04X)!\n","", thread->tid, thread->status);
-					thread->flags |= THREAD_FLAGS_CALLING_BLOCK_CALLBACK;
-					bool ret = callBlockCallbackOnThread(&thread->context, (bool(*)(void*,void*))thread->blockCallback.callback, thread, thread->blockCallback.userdata);
-					thread->flags &= ~THREAD_FLAGS_CALLING_BLOCK_CALLBACK;
-					if (ret)
-						thread->status &= ~THREAD_STATUS_BLOCKED;
-				}
-
-				thread = thread->next_run;
+				Thread* thr = list->head;
+				unlinkThread(thr);
+				if (thr->status == THREAD_STATUS_CAN_RUN)
+					return thr;
+				// The thread was paused, blocked, or killed while waiting in the run queue.
+				if (!(thr->status & THREAD_STATUS_DEAD))
+					parkThread(thr, cpu);
 			}
+			return nullptr;
 		}
-		/*static */size_t DEFINE_IN_SECTION getCpusInScheduler()
+		// Tries to take a runnable thread from another cpu's run queues, and moves it to thief.
+		// The caller must hold thief's run queue lock.
+		static Thread* DEFINE_IN_SECTION stealThread(cpu_local* thief)
 		{
-			size_t nCpusInScheduler = 0;
 			for (size_t i = 0; i < g_nCPUs; i++)
-				nCpusInScheduler += g_cpuInfo[i].schedulerLock;
-			return nCpusInScheduler;
+			{
+				cpu_local* victim = &g_cpuInfo[i];
+				if (victim == thief || !victim->nThreads)
+					continue;
+				// Don't wait on a cpu that is busy with its run queues, try the next one.
+				if (!atomic_cmpxchg(&victim->runQueueLock, false, true))
+					continue;
+				Thread* ret = nullptr;
+				for (int j = 3; j > -1 && !ret; j--)
+				{
+					if (!(victim->runQueueBitmap & (1 << j)))
+						continue;
+					// The run queues are in FIFO order, so the first match has waited the longest.
+					for (Thread* thr = victim->priorityLists[j].head; thr && !ret; thr = thr->next_run)
+						if (thr->status == THREAD_STATUS_CAN_RUN && checkThreadAffinity(thr, thief->cpuId))
+							ret = thr;
+				}
+				if (ret)
+					unlinkThread(ret);
+				unlockRunQueue(victim);
+				if (!ret)
+					continue;
+				ret->cpu = thief;
+				return ret;
+			}
+			return nullptr;
 		}
 		void DEFINE_IN_SECTION schedule()
 		{
-			if(getCPULocal()->cpuId == 0)
-				g_timerTicks++;
-			volatile Thread* currentThread = getCPULocal()->currentThread;
-			if (getCPULocal()->schedulerLock)
+			cpu_local* cpu = getCPULocal();
+			volatile Thread* currentThread = cpu->currentThread;
+			if (cpu->schedulerLock)
 				return;
 
-			//lock:
-			//if (!g_coreGlobalSchedulerLock.Lock(0, false))
-			//{
-			//	if (!getCpusInScheduler())
-			//	{
-			//		g_coreGlobalSchedulerLock.Unlock();
-			//		goto lock;
-			//	}
-			//	auto switchToIdleTask = [&]() {
-			//		currentThread->lastTimePreempted = g_timerTicks;
-			//		currentThread->status |= THREAD_STATUS_CAN_RUN;
-			//		currentThread->status &= ~THREAD_STATUS_RUNNING;
-			//		currentThread->affinity = currentThread->ogAffinity;
-			//		Thread* newThread = getCPULocal()->idleThread;
-			//		newThread->status = (newThread->status & ~THREAD_STATUS_CAN_RUN) | THREAD_STATUS_RUNNING;
-			//		getCPULocal()->currentThread = newThread;
-			//		switchToThreadImpl(&newThread->context, newThread);
-			//		return;
-			//		};
-			//	if (currentThread)
-			//		if (ThreadCanRun((thread::Thread*)currentThread))
-			//			return;
-			//		else
-			//			switchToIdleTask();
-			//	else {}
-			//	return;
-			//}
-			//
-			atomic_set((bool*)&getCPULocal()->schedulerLock);
+			atomic_set((bool*)&cpu->schedulerLock);
 
-			if (currentThread)
-			{
-				if (currentThread == getCPULocal()->idleThread && currentThread->status & THREAD_STATUS_BLOCKED)
-				{
-					// Wait for the idle thread to be unblocked, then continue running.
-					while (!currentThread->blockCallback.callback((Thread*)currentThread, currentThread->blockCallback.userdata));
-					currentThread->status &= ~THREAD_STATUS_BLOCKED;
-					atomic_clear((bool*)&getCPULocal()->schedulerLock);
-					return;
-				}
-			}
+			// Timer callbacks can wake threads on this cpu, so this is done before the run queues are locked.
+			ProcessTimers(cpu);
 
-			////OBOS_ASSERTP(getCpusInScheduler() < 2, "");
-			if (getCpusInScheduler() != 1)
-			{
-				atomic_clear((bool*)&getCPULocal()->schedulerLock);
-				auto switchToIdleTask = [&]() {
-					currentThread->lastTimePreempted = g_timerTicks;
-					currentThread->status |= THREAD_STATUS_CAN_RUN;
-					currentThread->status &= ~THREAD_STATUS_RUNNING;
-					currentThread->affinity = currentThread->ogAffinity;
-					Thread* newThread = getCPULocal()->idleThread;
-					newThread->status = (newThread->status & ~THREAD_STATUS_CAN_RUN) | THREAD_STATUS_RUNNING;
-					getCPULocal()->currentThread = newThread;
-					switchToThreadImpl(&newThread->context, newThread);
-					return;
-					};
-				if (currentThread)
-					if (ThreadCanRun((thread::Thread*)currentThread))
-						return;
-					else
-						switchToIdleTask();
-				else {}
-				return;
-			}
+			// Each cpu only schedules the threads in its own run queues, so the cpus don't need to wait for each other here.
+			lockRunQueue(cpu);
 
 			if (currentThread)
 			{
-				currentThread->lastTimePreempted = g_timerTicks;
-				if (!(currentThread->status & THREAD_STATUS_DEAD))
-					currentThread->status |= THREAD_STATUS_CAN_RUN;
-				currentThread->status &= ~THREAD_STATUS_RUNNING;
-				currentThread->affinity = currentThread->ogAffinity;
+				Thread* thr = (Thread*)currentThread;
+				thr->lastTimePreempted = GetMonotonicTime();
+				thr->status &= ~THREAD_STATUS_RUNNING;
+				if (!(thr->status & THREAD_STATUS_DEAD))
+					thr->status |= THREAD_STATUS_CAN_RUN;
+				// Put the thread back at the end of its run queue, or aside if it blocked itself.
+				if (thr != cpu->idleThread && !(thr->status & THREAD_STATUS_DEAD) && !thr->priorityList)
+				{
+					if (thr->status == THREAD_STATUS_CAN_RUN)
+						enqueueThread(thr, cpu);
+					else
+						parkThread(thr, cpu);
+				}
 			}
 
-			callBlockCallbacksOnList(g_priorityLists[3]);
-			callBlockCallbacksOnList(g_priorityLists[2]);
-			callBlockCallbacksOnList(g_priorityLists[1]);
-			callBlockCallbacksOnList(g_priorityLists[0]);
-
-			Thread::ThreadList* list = &findThreadPriorityList();
-			Thread* newThread = nullptr;
-			int foundHighPriority = 0;
-		find:
-			if (!list)
-				list = &findThreadPriorityList();
-			if (!list)
-			{
-				newThread = getCPULocal()->idleThread;
-				goto found;
-			}
-			newThread = findRunnableThreadInList(*list);
-			found:
+			Thread* newThread = dequeueRunnableThread(cpu);
 			if (!newThread)
-			{
-				foundHighPriority += list == &g_priorityLists[3];
-				list = list->prevThreadList;
-				if(foundHighPriority < 2)
-					goto find;
-			}
-			if (foundHighPriority == 2)
-				newThread = getCPULocal()->idleThread;
+				// This cpu ran out of work, so take some from a cpu that has more than it can run.
+				newThread = stealThread(cpu);
+			if (!newThread)
+				newThread = cpu->idleThread;
 			OBOS_ASSERTP(!(newThread->status & THREAD_STATUS_BLOCKED), "Thread (tid %d) is both blocked and is trying to be run! Status 0x%04X\n", "", newThread->tid, newThread->status);
 			OBOS_ASSERTP(!(newThread->status & THREAD_STATUS_PAUSED), "Thread (tid %d) is both paused and is trying to be run! Status 0x%04X\n", "", newThread->tid, newThread->status);
-			if (newThread != currentThread)
-				if ((newThread->status & THREAD_STATUS_RUNNING))
-					goto find;
 			OBOS_ASSERTP(!inSchedulerFunction(newThread), "Thread (tid %d) was preempted while in the scheduler!\n", "", newThread->tid);
+			// Set the timer for the end of the time slice or the next timer, whichever is first.
+			// When the cpu is idle, only timers and interrupts wake it up.
+			uint64_t deadline = NextTimerExpiry(cpu);
+			if (newThread != cpu->idleThread)
+			{
+				uint64_t sliceEnd = GetMonotonicTime() + 1000000000 / g_schedulerFrequency;
+				if (sliceEnd < deadline)
+					deadline = sliceEnd;
+			}
+			SetSchedulerTimer(cpu, deadline);
 			if (newThread == currentThread)
 			{
-				currentThread->affinity = ((__uint128_t)1 << getCPULocal()->cpuId);
 				currentThread->status = (currentThread->status & ~THREAD_STATUS_CAN_RUN) | THREAD_STATUS_RUNNING;
-				//g_coreGlobalSchedulerLock.Unlock();
-				atomic_clear((bool*)&getCPULocal()->schedulerLock);
+				unlockRunQueue(cpu);
+				atomic_clear((bool*)&cpu->schedulerLock);
 				return;
 			}
-			if (!newThread)
-				newThread = getCPULocal()->idleThread;
-			newThread->affinity = ((uint64_t)1 << getCPULocal()->cpuId);
-			getCPULocal()->currentThread = newThread;
+			cpu->currentThread = newThread;
 			newThread->timeSliceIndex = newThread->timeSliceIndex + 1;
 			newThread->status = (newThread->status & ~THREAD_STATUS_CAN_RUN) | THREAD_STATUS_RUNNING;
-			//g_coreGlobalSchedulerLock.Unlock();
-			atomic_clear((bool*)&getCPULocal()->schedulerLock);
+			unlockRunQueue(cpu);
+			atomic_clear((bool*)&cpu->schedulerLock);
 			switchToThreadImpl((taskSwitchInfo*)&newThread->context, newThread);
 		}
 #pragma GCC pop_options
 
+		void SetSchedulerTimer(cpu_local* cpu, uint64_t deadline)
+		{
+			cpu->timerDeadline = deadline;
+			armSchedulerTimer(deadline);
+		}
+		// Makes sure a cpu picks up thr soon after it was put in cpu's run queue.
+		// Idle cpus don't get timer interrupts, so they have to be sent one.
+		static void kickCpuForThread(Thread* thr, cpu_local* cpu)
+		{
+			if (!g_initialized)
+				return;
+			if (cpu->currentThread != cpu->idleThread)
+			{
+				// The cpu is busy, so wake an idle cpu that can steal the thread instead.
+				cpu = nullptr;
+				for (size_t i = 0; i < g_nCPUs && !cpu; i++)
+					if (g_cpuInfo[i].currentThread == g_cpuInfo[i].idleThread && checkThreadAffinity(thr, g_cpuInfo[i].cpuId))
+						cpu = &g_cpuInfo[i];
+				if (!cpu)
+					return;
+			}
+			// The idle thread calls the scheduler after every interrupt, so the current cpu doesn't need one.
+			if (cpu != getCPULocal())
+				callSchedulerOnCpu(cpu->cpuId);
+		}
+		void LockRunQueue(cpu_local* cpu)
+		{
+			lockRunQueue(cpu);
+		}
+		void UnlockRunQueue(cpu_local* cpu)
+		{
+			unlockRunQueue(cpu);
+		}
+		Thread::ThreadList* GetPriorityList(cpu_local* cpu, uint32_t priority)
+		{
+			if (!priority || (priority & (priority - 1)) || __builtin_ctz(priority) > 3)
+				return nullptr;
+			return &cpu->priorityLists[__builtin_ctz(priority)];
+		}
+		cpu_local* FindCpuForThread(__uint128_t affinity)
+		{
+			cpu_local* ret = nullptr;
+			for (size_t i = 0; i < g_nCPUs; i++)
+			{
+				if (!((affinity >> g_cpuInfo[i].cpuId) & 1))
+					continue;
+				if (!ret || g_cpuInfo[i].nThreads < ret->nThreads)
+					ret = &g_cpuInfo[i];
+			}
+			return ret;
+		}
+		// Locks the run queues of the cpu that owns thr, making sure another cpu didn't steal it before the lock was taken.
+		static cpu_local* lockThreadCpu(Thread* thr)
+		{
+			while (true)
+			{
+				cpu_local* cpu = thr->cpu;
+				lockRunQueue(cpu);
+				if (thr->cpu == cpu)
+					return cpu;
+				unlockRunQueue(cpu);
+			}
+		}
+		void AppendThreadToRunQueue(Thread* thr, cpu_local* cpu)
+		{
+			uintptr_t val = stopTimer();
+			lockRunQueue(cpu);
+			enqueueThread(thr, cpu);
+			unlockRunQueue(cpu);
+			kickCpuForThread(thr, cpu);
+			startTimer(val);
+		}
+		void RemoveThreadFromRunQueue(Thread* thr)
+		{
+			uintptr_t val = stopTimer();
+			cpu_local* cpu = lockThreadCpu(thr);
+			if (thr->priorityList)
+				unlinkThread(thr);
+			unlockRunQueue(cpu);
+			startTimer(val);
+		}
+		void ChangeThreadPriority(Thread* thr, uint32_t priority)
+		{
+			uintptr_t val = stopTimer();
+			cpu_local* cpu = lockThreadCpu(thr);
+			// Blocked and running threads pick up the new priority the next time they're put in a run queue.
+			bool inRunQueue = thr->priorityList && thr->priorityList != &cpu->blockedList;
+			if (inRunQueue)
+				unlinkThread(thr);
+			thr->priority = priority;
+			if (inRunQueue)
+				enqueueThread(thr, cpu);
+			unlockRunQueue(cpu);
+			startTimer(val);
+		}
+		// Must be called with cpu's run queue lock held.
+		static bool readyThread(Thread* thr, cpu_local* cpu)
+		{
+			if (thr->priorityList == &cpu->blockedList && thr->status == THREAD_STATUS_CAN_RUN)
+			{
+				unlinkThread(thr);
+				enqueueThread(thr, cpu);
+				return true;
+			}
+			return false;
+		}
+		void ReadyThread(Thread* thr)
+		{
+			uintptr_t val = stopTimer();
+			cpu_local* cpu = lockThreadCpu(thr);
+			bool readied = readyThread(thr, cpu);
+			unlockRunQueue(cpu);
+			if (readied)
+				kickCpuForThread(thr, cpu);
+			startTimer(val);
+		}
+		void BlockThread(Thread* thr)
+		{
+			uintptr_t val = stopTimer();
+			cpu_local* cpu = lockThreadCpu(thr);
+			// If the thread is in a run queue, the scheduler moves it to the blocked list when it gets to it.
+			thr->status |= THREAD_STATUS_BLOCKED;
+			unlockRunQueue(cpu);
+			startTimer(val);
+		}
+		void UnblockThread(Thread* thr)
+		{
+			uintptr_t val = stopTimer();
+			cpu_local* cpu = lockThreadCpu(thr);
+			thr->status &= ~THREAD_STATUS_BLOCKED;
+			bool readied = readyThread(thr, cpu);
+			unlockRunQueue(cpu);
+			if (readied)
+				kickCpuForThread(thr, cpu);
+			startTimer(val);
+		}
+
 		void InitializeScheduler()
 		{
-			new (&g_coreGlobalSchedulerLock) locks::Mutex{ false };
-		
 			memory::VirtualAllocator valloc{ nullptr };
 
 			if (!StartCPUs())
@@ -299,7 +386,6 @@ namespace obos
 			kernelMainThread->tid = g_nextTid++;
 			kernelMainThread->status = THREAD_STATUS_RUNNING;
 			kernelMainThread->priority = THREAD_PRIORITY_NORMAL;
-			kernelMainThread->priorityList = g_priorityLists + 2;
 			kernelMainThread->threadList = new Thread::ThreadList;
 			
 			setupThreadContext(&kernelMainThread->context, &kernelMainThread->stackInfo, (uintptr_t)kmain_common, 0, 0x10000, &valloc, nullptr);
@@ -308,29 +394,18 @@ namespace obos
 			kernelMainThread->threadList->tail = kernelMainThread;
 			kernelMainThread->threadList->size = 1;
 
-			g_priorityLists[2].head = g_priorityLists[2].tail = kernelMainThread;
-			g_priorityLists[2].size++;
-			
-			g_priorityLists[3].prevThreadList = g_priorityLists + 2;
-			g_priorityLists[2].prevThreadList = g_priorityLists + 1;
-			g_priorityLists[1].prevThreadList = g_priorityLists + 0;
-			g_priorityLists[0].prevThreadList = g_priorityLists + 3;
-
-			g_priorityLists[3].nextThreadList = g_priorityLists + 0;
-			g_priorityLists[2].nextThreadList = g_priorityLists + 3;
-			g_priorityLists[1].nextThreadList = g_priorityLists + 2;
-			g_priorityLists[0].nextThreadList = g_priorityLists + 1;
-			
 			for (size_t i = 0; i < g_nCPUs; i++)
 				g_defaultAffinity |= (uint64_t)1 << g_cpuInfo[i].cpuId;
 			kernelMainThread->affinity = kernelMainThread->ogAffinity = /*g_defaultAffinity*/1;
 
+			// The kernel main thread starts running right away, so it isn't put in a run queue.
+			kernelMainThread->cpu = getCPULocal();
+
 			for (size_t i = 0; i < g_nCPUs; i++)
 			{
 				auto &idleThread = g_cpuInfo[i].idleThread;
 				idleThread = new Thread{};
 				idleThread->tid = g_nextTid++;
-				idleThread->priorityList = g_priorityLists + 0;
 				idleThread->status = THREAD_STATUS_CAN_RUN;
 				idleThread->priority = THREAD_PRIORITY_IDLE;
 				idleThread->affinity = idleThread->ogAffinity = (uint64_t)1 << g_cpuInfo[i].cpuId;
@@ -342,14 +417,8 @@ namespace obos
 				idleThread->prev_list = threadListProc->tail;
 				threadListProc->tail = idleThread;
 				threadListProc->size++;
-				auto &priorityList = g_priorityLists[0];
-				if (priorityList.tail)
-					priorityList.tail->next_list = idleThread;
-				if(!priorityList.head)
-					priorityList.head = idleThread;
-				idleThread->next_run = priorityList.tail;
-				priorityList.tail = idleThread;
-				priorityList.size++;
+				// The idle thread is never put in a run queue, the scheduler falls back to it when there is nothing else to run.
+				idleThread->cpu = &g_cpuInfo[i];
 				setupThreadContext(&idleThread->context, &idleThread->stackInfo, (uintptr_t)idleTask, 0, 0x2000, &valloc, nullptr);
 			}
 
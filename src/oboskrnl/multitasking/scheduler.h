@@ -13,11 +13,36 @@ namespace obos
 {
 	namespace thread
 	{
-		extern Thread::ThreadList g_priorityLists[4];
+		struct cpu_local;
 		extern bool g_initialized;
+		// How many time slices there are in a second.
 		extern OBOS_EXPORT uint64_t g_schedulerFrequency;
-		extern OBOS_EXPORT uint64_t g_timerTicks;
 		extern uint32_t g_nextTid;
 		void InitializeScheduler();
+
+		// Sets the timer of cpu, which must be the current cpu, to go off at deadline.
+		void SetSchedulerTimer(cpu_local* cpu, uint64_t deadline);
+
+		// Locks and unlocks a cpu's run queues. These do not disable interrupts.
+		void LockRunQueue(cpu_local* cpu);
+		void UnlockRunQueue(cpu_local* cpu);
+		// Returns the run queue on 'cpu' for the priority, or nullptr if the priority is invalid.
+		Thread::ThreadList* GetPriorityList(cpu_local* cpu, uint32_t priority);
+		// Finds the least loaded cpu that the affinity allows.
+		cpu_local* FindCpuForThread(__uint128_t affinity);
+		// Appends the thread to cpu's run queue for thr->priority.
+		void AppendThreadToRunQueue(Thread* thr, cpu_local* cpu);
+		// Removes the thread from whatever run queue or blocked list it is in.
+		void RemoveThreadFromRunQueue(Thread* thr);
+		// Changes the thread's priority, moving it to the matching run queue if it is in one.
+		void ChangeThreadPriority(Thread* thr, uint32_t priority);
+		// Moves a thread that is no longer blocked or paused from its cpu's blocked list back into its run queue.
+		// Call this after clearing THREAD_STATUS_BLOCKED or THREAD_STATUS_PAUSED from another thread.
+		OBOS_EXPORT void ReadyThread(Thread* thr);
+		// Sets THREAD_STATUS_BLOCKED on the thread. The thread stops running the next time it is scheduled.
+		// Use a locks::WaitQueue instead of calling this directly, so that something can wake the thread.
+		OBOS_EXPORT void BlockThread(Thread* thr);
+		// Clears THREAD_STATUS_BLOCKED on the thread, and puts it back in its cpu's run queue if it can run.
+		OBOS_EXPORT void UnblockThread(Thread* thr);
 	}
 }
\ No newline at end of file
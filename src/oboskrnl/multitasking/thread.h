@@ -13,6 +13,9 @@
 
 #define MULTIASKING_THREAD_H_INCLUDED
 
+#include <multitasking/timerWheel.h>
+#include <multitasking/locks/waitQueue.h>
+
 #if defined(_GNUC_)
 #define OBOS_ALIGN(n) __attribute__((aligned(n))
 #else
@@ -23,6 +26,7 @@ namespace obos
 {
 	namespace thread
 	{
+		struct cpu_local;
 		enum thrStatus
 		{
 			THREAD_STATUS_DEAD = 0x01,
@@ -36,7 +40,6 @@ namespace obos
 		{
 			THREAD_FLAGS_IN_SIGNAL = 0x01,
 			THREAD_FLAGS_SINGLE_STEPPING = 0x02,
-			THREAD_FLAGS_CALLING_BLOCK_CALLBACK = 0x04,
 			THREAD_FLAGS_IS_EXITING_PROCESS = 0x08,
 		};
 		enum thrPriority
@@ -64,14 +67,8 @@ namespace obos
 			uint32_t timeSliceIndex;
 			uint32_t exitCode;
 			uint64_t lastTimePreempted;
-			uint64_t wakeUpTime;
 			uint32_t lastError;
 			uint32_t references;
-			struct
-			{
-				bool(*callback)(Thread* _this, void* userData);
-				void* userdata;
-			} blockCallback;
 			struct StackInfo
 			{
 				void* addr;
@@ -83,7 +80,16 @@ namespace obos
 			Thread* next_list; // The next in the process thread list.
 			Thread* prev_list;  // The previous in the process thread list.
 			ThreadList* priorityList; // A pointer to the priority list.
+			cpu_local* cpu; // The cpu that owns the run queue the thread is in.
 			ThreadList* threadList; // A pointer to the process' thread list.
+			Thread* next_wait; // The next in the wait queue the thread is blocked on.
+			Thread* prev_wait; // The previous in the wait queue the thread is blocked on.
+			bool inWaitQueue; // Whether the thread is in a wait queue.
+			bool waitTimedOut;
+			bool waitWoken; // Set when WakeOne or WakeAll takes the thread out of a wait queue.
+			void* waitQueue; // The locks::WaitQueue the thread is waiting on in WaitFor.
+			TimerEntry waitTimer; // Wakes the thread when a wait times out.
+			locks::WaitQueue exitWaiters; // Woken when the thread dies.
 			taskSwitchInfo context;
 			// If a bit is set, the cpu corresponding to that bit number can run the thread.
 			// This limits the kernel to 128 cores.
@@ -111,5 +117,12 @@ namespace obos
 				void operator delete(void*, void*) noexcept {}
 			void operator delete[](void*, void*) noexcept {}
 		} OBOS_ALIGN(4);
+#if defined(__x86_64__) || defined(_WIN64)
+		// The context switch and syscall code (taskSwitchImpl.asm and int_handlers.asm) use these offsets directly.
+		static_assert(offsetof(Thread, context) == 0xf0, "Thread::context moved, update the assembly that uses it.");
+		static_assert(offsetof(Thread, context.syscallStackBottom) == 0x3d0, "Thread::context.syscallStackBottom moved, update int_handlers.asm.");
+		static_assert(offsetof(Thread, context.fsbase) == 0x3d8, "Thread::context.fsbase moved, update taskSwitchImpl.asm.");
+		static_assert(offsetof(Thread, context.gsbase) == 0x3e0, "Thread::context.gsbase moved, update taskSwitchImpl.asm.");
+#endif
 	};
 }
\ No newline at end of file
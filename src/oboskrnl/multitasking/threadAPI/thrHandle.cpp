@@ -37,20 +37,32 @@ namespace obos
 			}
 			return nullptr;
 		}
+		static void* lookForThread(uint32_t tid)
+		{
+			void* obj = nullptr;
+			for (size_t i = 0; i < g_nCPUs && !obj; i++)
+			{
+				uintptr_t val = stopTimer();
+				LockRunQueue(&g_cpuInfo[i]);
+				// Running threads aren't in any list.
+				if (g_cpuInfo[i].currentThread && g_cpuInfo[i].currentThread->tid == tid)
+					obj = (void*)g_cpuInfo[i].currentThread;
+				for (size_t j = 0; j < 4 && !obj; j++)
+					obj = lookForThreadInList(g_cpuInfo[i].priorityLists[j], tid);
+				if (!obj)
+					obj = lookForThreadInList(g_cpuInfo[i].blockedList, tid);
+				UnlockRunQueue(&g_cpuInfo[i]);
+				startTimer(val);
+			}
+			return obj;
+		}
 		ThreadHandle::ThreadHandle() 
 			: m_obj{ nullptr }
 		{}
 		
 		bool ThreadHandle::OpenThread(uint32_t tid)
 		{
-			void* obj = nullptr;
-			obj = lookForThreadInList(g_priorityLists[0], tid);
-			if(!obj)
-				obj = lookForThreadInList(g_priorityLists[1], tid);
-			if (!obj)
-				obj = lookForThreadInList(g_priorityLists[2], tid);
-			if (!obj)
-				obj = lookForThreadInList(g_priorityLists[3], tid);
+			void* obj = lookForThread(tid);
 			if (!obj)
 			{
 				SetLastError(OBOS_ERROR_NO_SUCH_OBJECT);
@@ -77,16 +89,12 @@ namespace obos
 			}
 			if (!affinity)
 				affinity = thread::g_defaultAffinity;
-			constexpr static Thread::ThreadList* priorityListTable[] = {
-				g_priorityLists + 0, g_priorityLists + 1,
-				g_priorityLists + 2, g_priorityLists + 3,
-			};
-			if ((size_t)__builtin_ctz(priority) >= (sizeof(priorityListTable) / sizeof(priorityListTable[0])))
+			cpu_local* cpu = FindCpuForThread(affinity);
+			if (!cpu || !GetPriorityList(cpu, priority))
 			{
 				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
 				return false;
 			}
-			Thread::ThreadList* const priorityList = priorityListTable[__builtin_ctz(priority)];
 
 			process::Process* tproc = _process ? (process::Process*)_process : (process::Process*)getCPULocal()->currentThread->owner;
 
@@ -99,7 +107,6 @@ namespace obos
 			thread->priority = priority;
 			thread->exitCode = 0;
 			thread->lastError = 0;
-			thread->priorityList = priorityList;
 			thread->owner = tproc;
 			thread->threadList = &tproc->threads;
 			thread->affinity = 
@@ -109,13 +116,7 @@ namespace obos
 			thread->references++;
 			uintptr_t val = stopTimer();
 
-			if(priorityList->tail)
-				priorityList->tail->next_run = thread;
-			if (!priorityList->head)
-				priorityList->head = thread;
-			thread->prev_run = priorityList->tail;
-			priorityList->tail = thread;
-			priorityList->size++;
+			AppendThreadToRunQueue(thread, cpu);
 			
 			if(thread->threadList->tail)
 				thread->threadList->tail->next_list = thread;
@@ -164,6 +165,7 @@ namespace obos
 			}
 
 			obj->status &= ~THREAD_STATUS_PAUSED;
+			ReadyThread(obj);
 
 			return true;
 		}
@@ -183,54 +185,14 @@ namespace obos
 			if (obj->priority == priority)
 				return true;
 
-			Thread::ThreadList* newPriorityList = nullptr;
-			switch (priority)
+			if (!GetPriorityList(obj->cpu, priority))
 			{
-			case THREAD_PRIORITY_IDLE:
-				newPriorityList = g_priorityLists + 0;
-				break;
-			case THREAD_PRIORITY_LOW:
-				newPriorityList = g_priorityLists + 1;
-				break;
-			case THREAD_PRIORITY_NORMAL:
-				newPriorityList = g_priorityLists + 2;
-				break;
-			case THREAD_PRIORITY_HIGH:
-				newPriorityList = g_priorityLists + 3;
-				break;
-			default:
 				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
 				return false;
-				break;
 			}
-			Thread::ThreadList* oldPriorityList = obj->priorityList;
 
-			uintptr_t val = stopTimer();
-
-			if (obj->prev_run)
-				obj->prev_run->next_run = obj->next_run;
-			if (obj->next_run)
-				obj->next_run->prev_run = obj->prev_run;
-			if (oldPriorityList->head == obj)
-				oldPriorityList->head = obj->next_run;
-			if (oldPriorityList->tail == obj)
-				oldPriorityList->tail = obj->prev_run;
-			oldPriorityList->size--;
-
-			if (newPriorityList->tail)
-			{
-				newPriorityList->tail->next_run = obj;
-				obj->prev_run = newPriorityList->tail;
-			}
-			if (!newPriorityList->head)
-				newPriorityList->head = obj;
-			newPriorityList->tail = obj;
-			newPriorityList->size++;
-
-			obj->priorityList = newPriorityList;
-			obj->priority = priority;
-
-			startTimer(val);
+			// The thread stays on the same cpu, it only moves to that cpu's run queue for the new priority.
+			ChangeThreadPriority(obj, priority);
 
 			return true;
 		}
@@ -260,22 +222,29 @@ namespace obos
 				callScheduler(true);
 			freeThreadStackInfo(&obj->stackInfo, &((process::Process*)obj->owner)->vallocator);
 
-			uint32_t val = stopTimer();
-			
-			if (obj->prev_run)
-				obj->prev_run->next_run = obj->next_run;
-			if (obj->next_run)
-				obj->next_run->prev_run = obj->prev_run;
-			if (obj->priorityList->head == obj)
-				obj->priorityList->head = obj->next_run;
-			if (obj->priorityList->tail == obj)
-				obj->priorityList->tail = obj->prev_run;
-			obj->priorityList->size--;
-
-			startTimer(val);
+			RemoveThreadFromRunQueue(obj);
+			obj->exitWaiters.WakeAll();
 
 			return true;
 		}
+		bool ThreadHandle::WaitForThreadExit(uint64_t timeout)
+		{
+			if (!m_obj)
+			{
+				SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+				return false;
+			}
+			Thread* obj = GET_THREAD;
+			if (obj == getCPULocal()->currentThread)
+			{
+				SetLastError(OBOS_ERROR_ACCESS_DENIED);
+				return false;
+			}
+			return obj->exitWaiters.WaitFor([](void* udata)->bool
+				{
+					return ((Thread*)udata)->status & THREAD_STATUS_DEAD;
+				}, obj, timeout * 1000000);
+		}
 		uint32_t ThreadHandle::GetThreadStatus()
 		{
 			if (!m_obj)
@@ -358,15 +327,8 @@ namespace obos
 			currentThread->exitCode = exitCode;
 			currentThread->status = THREAD_STATUS_DEAD;
 			currentThread->flags = 0;
-			if (currentThread->prev_run)
-				currentThread->prev_run->next_run = currentThread->next_run;
-			if (currentThread->next_run)
-				currentThread->next_run->prev_run = currentThread->prev_run;
-			if (currentThread->priorityList->head == currentThread)
-				currentThread->priorityList->head = currentThread->next_run;
-			if (currentThread->priorityList->tail == currentThread)
-				currentThread->priorityList->tail = currentThread->prev_run;
-			currentThread->priorityList->size--;
+			RemoveThreadFromRunQueue((Thread*)currentThread);
+			((Thread*)currentThread)->exitWaiters.WakeAll();
 			if(!currentThread->references)
 			{
 				if (currentThread->prev_list)
@@ -67,6 +67,12 @@ namespace obos
 			/// <param name="exitCode">The exit code to exit with.</param>
 			/// <returns>Whether the function succeeded or not.</returns>
 			OBOS_EXPORT bool TerminateThread(uint32_t exitCode);
+			/// <summary>
+			/// Blocks the current thread until the thread exits.
+			/// </summary>
+			/// <param name="timeout">How many milliseconds to wait for, or zero to wait forever.</param>
+			/// <returns>Whether the thread exited before the timeout, otherwise false. If the function returned false, use GetLastError.</returns>
+			OBOS_EXPORT bool WaitForThreadExit(uint64_t timeout = 0);
 
 			/// <summary>
 			/// Gets the thread status.
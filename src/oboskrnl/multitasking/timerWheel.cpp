@@ -0,0 +1,180 @@
+/*
+	oboskrnl/multitasking/timerWheel.cpp
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <atomic.h>
+
+#include <multitasking/timerWheel.h>
+#include <multitasking/scheduler.h>
+#include <multitasking/cpu_local.h>
+#include <multitasking/arch.h>
+
+namespace obos
+{
+	namespace thread
+	{
+		static void lockWheel(TimerWheel* wheel)
+		{
+			while (!atomic_cmpxchg(&wheel->lock, false, true));
+		}
+		static void unlockWheel(TimerWheel* wheel)
+		{
+			atomic_clear(&wheel->lock);
+		}
+		static size_t slotIndex(uint64_t time)
+		{
+			return (time >> TIMER_WHEEL_SLOT_SHIFT) % TIMER_WHEEL_SLOTS;
+		}
+		static void unlinkTimer(TimerWheel* wheel, TimerEntry* entry)
+		{
+			size_t i = slotIndex(entry->expiresAt);
+			if (entry->prev)
+				entry->prev->next = entry->next;
+			if (entry->next)
+				entry->next->prev = entry->prev;
+			if (wheel->slots[i] == entry)
+				wheel->slots[i] = entry->next;
+			if (!wheel->slots[i])
+				wheel->occupied[i / 64] &= ~(1ull << (i % 64));
+			entry->next = entry->prev = nullptr;
+			entry->cpu = nullptr;
+		}
+		// Returns the first slot with timers at or after 'from', wrapping around the wheel, or TIMER_WHEEL_SLOTS if the wheel is empty.
+		static size_t nextOccupiedSlot(TimerWheel* wheel, size_t from)
+		{
+			constexpr size_t nWords = TIMER_WHEEL_SLOTS / 64;
+			// The first word is looked at twice, the second time for the slots before 'from'.
+			for (size_t i = 0; i <= nWords; i++)
+			{
+				size_t word = (from / 64 + i) % nWords;
+				uint64_t bits = wheel->occupied[word];
+				if (!i)
+					bits &= ~0ull << (from % 64);
+				if (bits)
+					return word * 64 + __builtin_ctzll(bits);
+			}
+			return TIMER_WHEEL_SLOTS;
+		}
+
+		// Walks the occupied slots from the current one. The first slot with a timer due in this revolution of the wheel has the earliest timer.
+		// Timers more than a revolution away are only found if no slot has one due in this revolution.
+		static void findNextExpiry(TimerWheel* wheel)
+		{
+			wheel->nextExpiry = UINT64_MAX;
+			const size_t start = wheel->lastSlot % TIMER_WHEEL_SLOTS;
+			size_t offset = 0;
+			while (offset < TIMER_WHEEL_SLOTS)
+			{
+				size_t i = nextOccupiedSlot(wheel, (start + offset) % TIMER_WHEEL_SLOTS);
+				if (i == TIMER_WHEEL_SLOTS)
+					break;
+				size_t found = (i + TIMER_WHEEL_SLOTS - start) % TIMER_WHEEL_SLOTS;
+				// The search wrapped around past the current slot.
+				if (found < offset)
+					break;
+				offset = found;
+				const uint64_t windowEnd = (wheel->lastSlot + offset + 1) << TIMER_WHEEL_SLOT_SHIFT;
+				for (TimerEntry* entry = wheel->slots[i]; entry; entry = entry->next)
+					if (entry->expiresAt < wheel->nextExpiry)
+						wheel->nextExpiry = entry->expiresAt;
+				if (wheel->nextExpiry < windowEnd)
+					return;
+				offset++;
+			}
+		}
+
+		void AddTimer(TimerEntry* entry, uint64_t ns)
+		{
+			uintptr_t val = stopTimer();
+			cpu_local* cpu = GetCurrentCpuLocalPtr();
+			TimerWheel* wheel = &cpu->timerWheel;
+			lockWheel(wheel);
+			entry->expiresAt = GetMonotonicTime() + ns;
+			entry->firing = false;
+			entry->cpu = cpu;
+			size_t i = slotIndex(entry->expiresAt);
+			entry->prev = nullptr;
+			entry->next = wheel->slots[i];
+			if (entry->next)
+				entry->next->prev = entry;
+			wheel->slots[i] = entry;
+			wheel->occupied[i / 64] |= (1ull << (i % 64));
+			if (entry->expiresAt < wheel->nextExpiry)
+				wheel->nextExpiry = entry->expiresAt;
+			unlockWheel(wheel);
+			// The cpu's timer might be set to go off after this timer expires, or not at all.
+			if (entry->expiresAt < cpu->timerDeadline)
+				SetSchedulerTimer(cpu, entry->expiresAt);
+			startTimer(val);
+		}
+		bool CancelTimer(TimerEntry* entry)
+		{
+			uintptr_t val = stopTimer();
+			bool ret = false;
+			while (cpu_local* cpu = entry->cpu)
+			{
+				lockWheel(&cpu->timerWheel);
+				if (entry->cpu == cpu)
+				{
+					unlinkTimer(&cpu->timerWheel, entry);
+					ret = true;
+				}
+				unlockWheel(&cpu->timerWheel);
+			}
+			startTimer(val);
+			// Don't let the caller free the entry while its callback is running on another cpu.
+			while (atomic_test(&entry->firing));
+			return ret;
+		}
+		void ProcessTimers(cpu_local* cpu)
+		{
+			TimerWheel* wheel = &cpu->timerWheel;
+			uint64_t now = GetMonotonicTime();
+			if (wheel->nextExpiry > now)
+				return;
+			lockWheel(wheel);
+			// The expired timers are moved to this list, so the callbacks can run without the wheel locked.
+			TimerEntry* expired = nullptr;
+			uint64_t nowSlot = now >> TIMER_WHEEL_SLOT_SHIFT;
+			// The last slot processed is looked at again, as it can have timers that expired since then.
+			uint64_t nSlots = nowSlot - wheel->lastSlot + 1;
+			if (nSlots > TIMER_WHEEL_SLOTS)
+				nSlots = TIMER_WHEEL_SLOTS;
+			for (uint64_t slot = nowSlot - nSlots + 1; slot <= nowSlot; slot++)
+			{
+				TimerEntry* entry = wheel->slots[slot % TIMER_WHEEL_SLOTS];
+				while (entry)
+				{
+					TimerEntry* next = entry->next;
+					// Timers more than a revolution away share the slot, and stay for a later pass.
+					if (entry->expiresAt <= now)
+					{
+						unlinkTimer(wheel, entry);
+						entry->firing = true;
+						entry->next = expired;
+						expired = entry;
+					}
+					entry = next;
+				}
+			}
+			wheel->lastSlot = nowSlot;
+			findNextExpiry(wheel);
+			unlockWheel(wheel);
+			while (expired)
+			{
+				TimerEntry* next = expired->next;
+				expired->next = nullptr;
+				expired->callback(expired, expired->userdata);
+				atomic_clear(&expired->firing);
+				expired = next;
+			}
+		}
+		uint64_t NextTimerExpiry(cpu_local* cpu)
+		{
+			return cpu->timerWheel.nextExpiry;
+		}
+	}
+}
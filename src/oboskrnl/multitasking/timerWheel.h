@@ -0,0 +1,63 @@
+/*
+	oboskrnl/multitasking/timerWheel.h
+
+	Copyright (c) 2023-2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+namespace obos
+{
+	namespace thread
+	{
+		struct cpu_local;
+		struct TimerEntry
+		{
+			// The monotonic time, in nanoseconds, at which the callback is called.
+			uint64_t expiresAt;
+			// Called from the scheduler on the cpu that owns the timer, with interrupts disabled.
+			void(*callback)(TimerEntry* entry, void* userdata);
+			void* userdata;
+			TimerEntry* next;
+			TimerEntry* prev;
+			// The cpu whose wheel has the timer, or nullptr if the timer isn't pending.
+			cpu_local* cpu;
+			bool firing;
+		};
+		constexpr size_t TIMER_WHEEL_SLOTS = 256;
+		// Each slot covers 2^20 ns, about a millisecond.
+		constexpr uint8_t TIMER_WHEEL_SLOT_SHIFT = 20;
+		struct TimerWheel
+		{
+			// Timers are put in the slot for (expiresAt >> TIMER_WHEEL_SLOT_SHIFT) % TIMER_WHEEL_SLOTS.
+			TimerEntry* slots[TIMER_WHEEL_SLOTS];
+			// Bit n is set while slots[n] has timers.
+			uint64_t occupied[TIMER_WHEEL_SLOTS / 64];
+			// The last slot time the wheel was processed for.
+			uint64_t lastSlot;
+			// The earliest expiry in the wheel, or UINT64_MAX if it is empty. This can be earlier than the real earliest expiry if a timer was cancelled.
+			uint64_t nextExpiry = UINT64_MAX;
+			bool lock;
+		};
+
+		/// <summary>
+		/// Arms a timer on the current cpu.
+		/// </summary>
+		/// <param name="entry">The timer. This must stay valid until the timer fires or is cancelled.</param>
+		/// <param name="ns">How many nanoseconds until the timer fires.</param>
+		OBOS_EXPORT void AddTimer(TimerEntry* entry, uint64_t ns);
+		/// <summary>
+		/// Cancels a timer. If the timer's callback is running, this waits for it to return.
+		/// </summary>
+		/// <param name="entry">The timer.</param>
+		/// <returns>Whether the timer was cancelled before it fired.</returns>
+		OBOS_EXPORT bool CancelTimer(TimerEntry* entry);
+		// Fires the timers on cpu that expired. Called by the scheduler.
+		void ProcessTimers(cpu_local* cpu);
+		// Returns when the next timer on cpu expires, or UINT64_MAX if there are no timers.
+		uint64_t NextTimerExpiry(cpu_local* cpu);
+	}
+}
@@ -45,6 +45,11 @@ namespace obos
 			} __attribute__((packed));
 			gdtptr gdtPtr;
 			uintptr_t mapPageTableBase;
+			// The cpu's local APIC id, which device interrupts are sent to.
+			uint8_t lapicId;
+			// Free physical pages owned by this cpu, so single page allocations don't need to take the pmm lock.
+			uintptr_t pageCache[64];
+			size_t nCachedPages;
 		};
 	}
 }
\ No newline at end of file
@@ -5,6 +5,7 @@
 [BITS 64]
 
 global calibrateTimer
+global calibrateTSC
 extern _ZN4obos15g_localAPICAddrE
 extern _ZN4obos10g_HPETAddrE
 ; extern _ZN4obos24RegisterInterruptHandlerEhPFvPNS_15interrupt_frameEE
@@ -60,6 +61,44 @@ calibrateTimer:
 	popfq
 
 .finish:
+	pop r14
+	pop r15
+	pop rbx
+	leave
+	ret
+
+; Returns how many times the TSC increments in 1/rdi seconds.
+calibrateTSC:
+	push rbp
+	mov rbp, rsp
+	push rbx
+	push r15
+	push r14
+	pushfq
+	cli
+
+	mov r14, [_ZN4obos10g_HPETAddrE]
+
+	call _ZN4obos6thread13configureHPETEm
+	mov r15, rax ; comparatorValue
+
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	mov rbx, rax
+
+	add r14, 0xf0 ; mainCounterValue
+.loop:
+	mov r11, [r14]
+	cmp r11, r15
+	jb .loop
+
+	rdtsc
+	shl rdx, 32
+	or rax, rdx
+	sub rax, rbx
+
+	popfq
 	pop r14
 	pop r15
 	pop rbx
@@ -6,6 +6,7 @@
 
 #include <int.h>
 #include <klog.h>
+#include <atomic.h>
 #include <memory_manipulation.h>
 #include <utils/hashmap.h>
 
@@ -27,6 +28,7 @@
 #define getCPULocal() GetCurrentCpuLocalPtr()
 
 extern "C" uint64_t calibrateTimer(uint64_t femtoseconds);
+extern "C" uint64_t calibrateTSC(uint64_t freq);
 extern "C" void _fxsave(byte(*context)[512]);
 extern "C" void _callScheduler();
 
@@ -35,6 +37,7 @@ extern "C" char _sched_text_end;
 
 namespace obos
 {
+	extern uint8_t g_lapicIDs[256];
 	namespace thread
 	{
 		extern void schedule();
@@ -70,10 +73,95 @@ namespace obos
 			return ret;
 		}
 
+		// The clock is the TSC if it is invariant, otherwise the HPET's main counter.
+		// Clock ticks are converted to nanoseconds with (ticks * s_clockMult) >> 32.
+		static uint64_t s_clockBase;
+		static uint64_t s_clockMult;
+		static uint64_t s_tscFrequency;
+		// Nanoseconds are converted to TSC ticks with (ns * s_nsToTscMult) >> 24.
+		static uint64_t s_nsToTscMult;
+		static bool s_useTSCDeadline;
+		// How many APIC timer ticks there are in a millisecond with a divisor of one.
+		static uint64_t s_apicTicksPerMs;
+		static bool s_clockInitialized;
+		static bool s_clockLock;
+		static uint64_t readClock()
+		{
+			return s_tscFrequency ? rdtsc() : g_HPETAddr->mainCounterValue;
+		}
+		static void initializeClock()
+		{
+			uint32_t eax = 0, ebx = 0, ecx = 0, edx = 0;
+			__cpuid__(0x80000000, 0, &eax, &ebx, &ecx, &edx);
+			bool invariantTSC = false;
+			if (eax >= 0x80000007)
+			{
+				__cpuid__(0x80000007, 0, &eax, &ebx, &ecx, &edx);
+				invariantTSC = edx & (1 << 8);
+			}
+			uint64_t freq = g_hpetFrequency;
+			if (invariantTSC)
+			{
+				// Count the TSC ticks in 10ms, using the HPET as a reference.
+				s_tscFrequency = calibrateTSC(100) * 100;
+				freq = s_tscFrequency;
+				s_nsToTscMult = (s_tscFrequency << 24) / 1000000000;
+				__cpuid__(0x1, 0, &eax, &ebx, &ecx, &edx);
+				s_useTSCDeadline = ecx & (1 << 24);
+			}
+			s_clockMult = (1000000000ULL << 32) / freq;
+			s_clockBase = readClock();
+			s_apicTicksPerMs = FindCounterValueFromFrequency(1000);
+			logger::debug("%s: Using the %s as the clock source at %d Hz. The scheduler timer uses %s mode.\n", __func__,
+				s_tscFrequency ? "TSC" : "HPET",
+				freq,
+				s_useTSCDeadline ? "TSC-deadline" : "one-shot");
+			s_clockInitialized = true;
+		}
+		uint64_t GetMonotonicTime()
+		{
+			if (!s_clockInitialized)
+				return 0;
+			return (uint64_t)(((__uint128_t)(readClock() - s_clockBase) * s_clockMult) >> 32);
+		}
+		void armSchedulerTimer(uint64_t deadline)
+		{
+			if (s_useTSCDeadline)
+			{
+				// Writing zero disarms the timer.
+				uint64_t tscDeadline = 0;
+				if (deadline != UINT64_MAX)
+					tscDeadline = s_clockBase + (uint64_t)(((__uint128_t)deadline * s_nsToTscMult) >> 24);
+				wrmsr(0x6E0 /*IA32_TSC_DEADLINE*/, tscDeadline);
+				return;
+			}
+			if (deadline == UINT64_MAX)
+			{
+				g_localAPICAddr->initialCount = 0;
+				return;
+			}
+			uint64_t now = GetMonotonicTime();
+			// If the deadline passed, fire as soon as possible. An initial count of zero would stop the timer.
+			uint64_t ns = deadline > now ? deadline - now : 0;
+			// Anything longer than a second fires early, and the scheduler sets the timer again.
+			if (ns > 1000000000)
+				ns = 1000000000;
+			uint64_t count = ns * s_apicTicksPerMs / 1000000;
+			if (count > 0xffffffff)
+				count = 0xffffffff;
+			if (!count)
+				count = 1;
+			g_localAPICAddr->initialCount = count;
+		}
+
 		void scheduler_bootstrap(interrupt_frame* frame)
 		{
 			if (!g_initialized)
+			{
+				// Keep the timer going until the scheduler can take over.
+				SetSchedulerTimer(getCPULocal(), GetMonotonicTime() + 1000000000 / g_schedulerFrequency);
 				return;
+			}
 			volatile Thread* currentThread = getCPULocal()->currentThread;
 			if (!getCPULocal()->schedulerLock && currentThread)
 			{
@@ -89,9 +177,15 @@ namespace obos
 
 		void setupTimerInterrupt()
 		{
-			uint64_t counter = FindCounterValueFromFrequency(g_schedulerFrequency);
-			ConfigureAPICTimer(scheduler_bootstrap, 0x20, counter, TIMER_CONFIG_PERIODIC, TIMER_DIVISOR_ONE);
+			// The APs get here before the BSP, so whichever cpu is first calibrates the clock.
+			while (!atomic_cmpxchg(&s_clockLock, false, true));
+			if (!s_clockInitialized)
+				initializeClock();
+			atomic_clear(&s_clockLock);
+			// There is no periodic tick, the scheduler sets the timer for whenever it next needs to run.
+			ConfigureAPICTimer(scheduler_bootstrap, 0x20, 0, s_useTSCDeadline ? TIMER_CONFIG_TSC_DEADLINE : TIMER_CONFIG_ONE_SHOT, TIMER_DIVISOR_ONE);
 			RegisterInterruptHandler(0x30, scheduler_bootstrap);
+			SetSchedulerTimer(getCPULocal(), GetMonotonicTime() + 1000000000 / g_schedulerFrequency);
 		}
 		uintptr_t stopTimer()
 		{
@@ -113,6 +207,10 @@ namespace obos
 			else
 				asm volatile("int $0x30");
 		}
+		void callSchedulerOnCpu(uint32_t cpuId)
+		{
+			SendIPI(DestinationShorthand::None, DeliveryMode::Default, 0x30, g_lapicIDs[cpuId]);
+		}
 	
 		bool inSchedulerFunction(struct Thread* thr)
 		{
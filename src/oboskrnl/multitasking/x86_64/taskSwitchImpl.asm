@@ -34,7 +34,6 @@ extern _ZN4obos7SendEOIEv
 extern _ZN4obos5rdmsrEj
 
 global _ZN4obos6thread18switchToThreadImplEPNS0_14taskSwitchInfoEPNS0_6ThreadE
-global _ZN4obos6thread25callBlockCallbackOnThreadEPNS0_14taskSwitchInfoEPFbPvS3_ES3_S3_
 global idleTask
 global _callScheduler
 
@@ -55,8 +54,8 @@ _ZN4obos6thread18switchToThreadImplEPNS0_14taskSwitchInfoEPNS0_6ThreadE:
 	cli
 
 	; FSBase
-	mov eax, [rsi+0x378]
-	mov edx, [rsi+0x37c]
+	mov eax, [rsi+0x3d8]
+	mov edx, [rsi+0x3dc]
 	mov ecx, 0xC0000100
 	wrmsr
 
@@ -65,8 +64,8 @@ _ZN4obos6thread18switchToThreadImplEPNS0_14taskSwitchInfoEPNS0_6ThreadE:
 	cmp qword [rdi+0x120], 0x8
 	jne .not_kernel_mode
 	; GSBase
-	mov eax, [rsi+0x380]
-	mov edx, [rsi+0x384]
+	mov eax, [rsi+0x3e0]
+	mov edx, [rsi+0x3e4]
 	mov ecx, 0xC0000101
 	wrmsr
 .not_kernel_mode:
@@ -97,33 +96,6 @@ _ZN4obos6thread18switchToThreadImplEPNS0_14taskSwitchInfoEPNS0_6ThreadE:
 	fxrstor [rsp+0x30]
 
 	iretq
-_ZN4obos6thread25callBlockCallbackOnThreadEPNS0_14taskSwitchInfoEPFbPvS3_ES3_S3_:
-	push rbp
-	mov rbp, rsp
-	
-; rsp = context->tssStackBottom + 0x4000
-	mov rsp, [rdi+8]
-	add rsp, 0x4000
-	
-	mov r10, cr3
-	
-	mov rax, [rdi]
-	mov cr3, rax
-	
-	push r10
-
-	mov r8, rsi
-
-	mov rdi, rdx
-	mov rsi, rcx
-	call r8
-
-	pop r11
-	mov cr3, r11
-
-	mov rsp, rbp
-	pop rbp
-	ret
 extern _ZN4obos6thread8scheduleEv
 _callScheduler:
 	push rbp
@@ -151,4 +123,6 @@ _ZN4obos6thread21getCurrentCpuLocalPtrEv:
 idleTask:
 	sti
 	hlt
- 	jmp idleTask
\ No newline at end of file
+; There is no timer tick while the cpu is idle, so whatever woke the cpu up might have made a thread runnable.
+	int 0x30
+	jmp idleTask
\ No newline at end of file
@@ -0,0 +1,539 @@
+/*
+	oboskrnl/vfs/devManip/bufferCache.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <atomic.h>
+#include <memory_manipulation.h>
+
+#include <vfs/devManip/bufferCache.h>
+#include <vfs/devManip/ioScheduler.h>
+
+#include <vfs/vfsNode.h>
+
+#include <driverInterface/struct.h>
+
+#include <allocators/vmm/vmm.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#include <arch/x86_64/memory_manager/physical/allocate.h>
+#endif
+
+#define BUFFER_CACHE_BUCKETS 1024
+// The cache takes at most 1/BUFFER_CACHE_MEMORY_SHIFT of physical memory.
+#define BUFFER_CACHE_MEMORY_SHIFT 3
+// Memory is considered under pressure when less than 1/BUFFER_CACHE_PRESSURE_SHIFT of it is free.
+#define BUFFER_CACHE_PRESSURE_SHIFT 4
+// Writes are tracked in runs of this many sectors, whatever the drive's sector size is.
+#define BUFFER_CACHE_WRITE_GRANULE 8
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct BufferCacheEntry
+		{
+			uint32_t driveId;
+			// The block's index on the drive, in blocks.
+			uint64_t block;
+			byte* data;
+			size_t size;
+			// How many of the block's sectors are valid. Only the last block of a drive can have less than a full block.
+			size_t nSectors;
+			// Set on every hit, and cleared when the clock hand passes over the block.
+			bool referenced;
+			BufferCacheEntry* hashNext;
+			// The clock's ring.
+			BufferCacheEntry *next, *prev;
+		};
+		static BufferCacheEntry* s_buckets[BUFFER_CACHE_BUCKETS];
+		static BufferCacheEntry* s_hand;
+		static size_t s_nEntries;
+		static size_t s_bytesCached;
+		static size_t s_maxBytesCached;
+		static bool s_lock;
+		static uint64_t s_nHits, s_nMisses, s_nEvictions;
+		// Indexed like s_buckets, by write granule instead of by block.
+		// A read miss only fills the cache if no write to its sectors was in flight, or finished, while it read them.
+		static size_t s_writesInFlight[BUFFER_CACHE_BUCKETS];
+		static uint64_t s_writeGenerations[BUFFER_CACHE_BUCKETS];
+
+		static void lockCache()
+		{
+			while (!atomic_cmpxchg(&s_lock, false, true))
+				pause();
+		}
+		static void unlockCache()
+		{
+			atomic_clear(&s_lock);
+		}
+		static size_t hashBlock(uint32_t driveId, uint64_t block)
+		{
+			uint64_t key = block ^ ((uint64_t)driveId << 48);
+			key *= 0x9E3779B97F4A7C15;
+			return (key >> 32) % BUFFER_CACHE_BUCKETS;
+		}
+		static size_t sectorsPerBlock(size_t sectorSize)
+		{
+			return sectorSize < BUFFER_CACHE_BLOCK_SIZE ? BUFFER_CACHE_BLOCK_SIZE / sectorSize : 1;
+		}
+		static size_t getMaxBytesCached()
+		{
+			if (s_maxBytesCached)
+				return s_maxBytesCached;
+			memory::PhysicalMemoryStatistics stats{};
+			memory::GetPhysicalMemoryStatistics(&stats);
+			s_maxBytesCached = (stats.totalPages << 12) >> BUFFER_CACHE_MEMORY_SHIFT;
+			if (!s_maxBytesCached)
+				s_maxBytesCached = BUFFER_CACHE_BLOCK_SIZE * BUFFER_CACHE_MAX_MISS_BLOCKS;
+			return s_maxBytesCached;
+		}
+		static bool memoryUnderPressure()
+		{
+			memory::PhysicalMemoryStatistics stats{};
+			memory::GetPhysicalMemoryStatistics(&stats);
+			return stats.freePages < (stats.totalPages >> BUFFER_CACHE_PRESSURE_SHIFT);
+		}
+
+		// These functions expect the cache to be locked.
+
+		static BufferCacheEntry* lookup(uint32_t driveId, uint64_t block)
+		{
+			for (BufferCacheEntry* entry = s_buckets[hashBlock(driveId, block)]; entry; entry = entry->hashNext)
+				if (entry->driveId == driveId && entry->block == block)
+					return entry;
+			return nullptr;
+		}
+		static void insert(BufferCacheEntry* entry)
+		{
+			size_t bucket = hashBlock(entry->driveId, entry->block);
+			entry->hashNext = s_buckets[bucket];
+			s_buckets[bucket] = entry;
+			// New blocks go right behind the hand, so they get a full trip around the clock.
+			if (!s_hand)
+			{
+				entry->next = entry->prev = entry;
+				s_hand = entry;
+			}
+			else
+			{
+				entry->next = s_hand;
+				entry->prev = s_hand->prev;
+				s_hand->prev->next = entry;
+				s_hand->prev = entry;
+			}
+			s_nEntries++;
+			s_bytesCached += entry->size;
+		}
+		// Calls callback with the index of every write bucket the range touches. A bucket can be passed more than once.
+		template<typename F>
+		static void forEachWriteBucket(uint32_t driveId, uint64_t lba, size_t nSectors, F callback)
+		{
+			if (!nSectors)
+				return;
+			const uint64_t first = lba / BUFFER_CACHE_WRITE_GRANULE;
+			const uint64_t last = (lba + nSectors - 1) / BUFFER_CACHE_WRITE_GRANULE;
+			if (last - first >= BUFFER_CACHE_BUCKETS)
+			{
+				for (size_t i = 0; i < BUFFER_CACHE_BUCKETS; i++)
+					callback(i);
+				return;
+			}
+			for (uint64_t granule = first; granule <= last; granule++)
+				callback(hashBlock(driveId, granule));
+		}
+		static void beginWrite(uint32_t driveId, uint64_t lba, size_t nSectors)
+		{
+			forEachWriteBucket(driveId, lba, nSectors, [](size_t i) { s_writesInFlight[i]++; });
+		}
+		static void endWrite(uint32_t driveId, uint64_t lba, size_t nSectors)
+		{
+			forEachWriteBucket(driveId, lba, nSectors, [](size_t i) { s_writesInFlight[i]--; s_writeGenerations[i]++; });
+		}
+		// The state of the writes to a range of sectors, taken before the range is read from the drive.
+		struct WriteSnapshot
+		{
+			uint64_t lba;
+			size_t nSectors;
+			uint64_t generation;
+		};
+		static WriteSnapshot takeWriteSnapshot(uint32_t driveId, uint64_t lba, size_t nSectors)
+		{
+			WriteSnapshot snapshot{ lba, nSectors, 0 };
+			forEachWriteBucket(driveId, lba, nSectors, [&](size_t i) { snapshot.generation += s_writeGenerations[i]; });
+			return snapshot;
+		}
+		// Whether what was read after the snapshot was taken could be older than what's on the drive.
+		static bool writtenSince(uint32_t driveId, const WriteSnapshot& snapshot)
+		{
+			uint64_t generation = 0;
+			bool inFlight = false;
+			forEachWriteBucket(driveId, snapshot.lba, snapshot.nSectors, [&](size_t i) {
+				generation += s_writeGenerations[i];
+				inFlight = inFlight || s_writesInFlight[i];
+			});
+			return inFlight || generation != snapshot.generation;
+		}
+		static void remove(BufferCacheEntry* entry)
+		{
+			BufferCacheEntry** link = &s_buckets[hashBlock(entry->driveId, entry->block)];
+			while (*link != entry)
+				link = &(*link)->hashNext;
+			*link = entry->hashNext;
+			if (entry->next == entry)
+				s_hand = nullptr;
+			else
+			{
+				entry->prev->next = entry->next;
+				entry->next->prev = entry->prev;
+				if (s_hand == entry)
+					s_hand = entry->next;
+			}
+			s_nEntries--;
+			s_bytesCached -= entry->size;
+		}
+		// Runs the clock hand until nBytes were evicted, or the cache is empty.
+		// The evicted blocks are put in 'evicted' so they can be freed once the cache is unlocked.
+		static size_t evict(size_t nBytes, BufferCacheEntry*& evicted)
+		{
+			size_t nFreed = 0;
+			while (s_hand && nFreed < nBytes)
+			{
+				BufferCacheEntry* entry = s_hand;
+				if (entry->referenced)
+				{
+					entry->referenced = false;
+					s_hand = entry->next;
+					continue;
+				}
+				remove(entry);
+				nFreed += entry->size;
+				entry->hashNext = evicted;
+				evicted = entry;
+				s_nEvictions++;
+			}
+			return nFreed;
+		}
+
+		static void freeEntries(BufferCacheEntry* list)
+		{
+			while (list)
+			{
+				BufferCacheEntry* next = list->hashNext;
+				delete[] list->data;
+				delete list;
+				list = next;
+			}
+		}
+		// Adds the blocks read by a cache miss to the cache, unless the sectors were written while they were read.
+		static void fill(uint32_t driveId, size_t sectorSize, uint64_t firstBlock, const byte* data, size_t nSectors, const WriteSnapshot& snapshot)
+		{
+			const size_t spb = sectorsPerBlock(sectorSize);
+			const size_t blockSize = spb * sectorSize;
+			const size_t nBlocks = nSectors / spb + ((nSectors % spb) != 0);
+			BufferCacheEntry* evicted = nullptr;
+			size_t maxBytes = getMaxBytesCached();
+			bool pressure = memoryUnderPressure();
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			size_t nBytes = nBlocks * blockSize;
+			if (pressure)
+				evict(s_bytesCached / 4 + nBytes, evicted);
+			else if (s_bytesCached + nBytes > maxBytes)
+				evict(s_bytesCached + nBytes - maxBytes, evicted);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(evicted);
+			if (pressure)
+				return;
+			for (size_t i = 0; i < nBlocks; i++)
+			{
+				BufferCacheEntry* entry = new BufferCacheEntry{};
+				entry->driveId = driveId;
+				entry->block = firstBlock + i;
+				entry->size = blockSize;
+				entry->nSectors = (nSectors - i * spb) < spb ? (nSectors - i * spb) : spb;
+				entry->data = new byte[blockSize];
+				utils::memcpy(entry->data, data + i * blockSize, entry->nSectors * sectorSize);
+				flags = saveFlagsAndCLI();
+				lockCache();
+				if (writtenSince(driveId, snapshot))
+				{
+					unlockCache();
+					restorePreviousInterruptStatus(flags);
+					entry->hashNext = nullptr;
+					freeEntries(entry);
+					break;
+				}
+				// Another thread could've cached this block while we were reading it.
+				BufferCacheEntry* old = lookup(driveId, entry->block);
+				if (old)
+					remove(old);
+				insert(entry);
+				unlockCache();
+				restorePreviousInterruptStatus(flags);
+				if (old)
+				{
+					old->hashNext = nullptr;
+					freeEntries(old);
+				}
+			}
+		}
+
+		bool BufferCacheRead(DriveEntry* drive, size_t sectorSize, size_t driveSectors, uint64_t lba, size_t nSectors, void* buff, size_t* nSectorsRead)
+		{
+			if (!drive || !sectorSize || !buff)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			const uint32_t driveId = drive->driveId;
+			const size_t spb = sectorsPerBlock(sectorSize);
+			byte* out = (byte*)buff;
+			uint64_t current = lba;
+			const uint64_t end = lba + nSectors;
+			while (current < end)
+			{
+				uint64_t block = current / spb;
+				size_t offset = current % spb;
+				size_t nToCopy = (spb - offset) < (end - current) ? (spb - offset) : (end - current);
+				uintptr_t flags = saveFlagsAndCLI();
+				lockCache();
+				BufferCacheEntry* entry = lookup(driveId, block);
+				if (entry && entry->nSectors >= offset + nToCopy)
+				{
+					utils::memcpy(out, entry->data + offset * sectorSize, nToCopy * sectorSize);
+					entry->referenced = true;
+					s_nHits++;
+					unlockCache();
+					restorePreviousInterruptStatus(flags);
+					current += nToCopy;
+					out += nToCopy * sectorSize;
+					continue;
+				}
+				// Read every block up to the next cached one in one go.
+				// If the run starts on a block boundary, the drive reads straight into the caller's buffer.
+				const bool canReadDirect = !offset;
+				const uint64_t lastBlock = (end - 1) / spb;
+				const size_t maxBlocks = canReadDirect ? BUFFER_CACHE_MAX_DIRECT_BLOCKS : BUFFER_CACHE_MAX_MISS_BLOCKS;
+				size_t nBlocks = 1;
+				while (block + nBlocks <= lastBlock && nBlocks < maxBlocks && !lookup(driveId, block + nBlocks))
+					nBlocks++;
+				s_nMisses += nBlocks;
+				const WriteSnapshot snapshot = takeWriteSnapshot(driveId, block * spb, nBlocks * spb);
+				unlockCache();
+				restorePreviousInterruptStatus(flags);
+				const uint64_t readLba = block * spb;
+				if (readLba >= driveSectors)
+					break;
+				size_t nToRead = nBlocks * spb;
+				if (readLba + nToRead > driveSectors)
+					nToRead = driveSectors - readLba;
+				// Leave a partial block at the end of the request for the next iteration, so the rest can be read directly.
+				if (canReadDirect && readLba + nToRead > end && nBlocks > 1)
+				{
+					nBlocks--;
+					nToRead = nBlocks * spb;
+				}
+				const bool direct = canReadDirect && readLba + nToRead <= end;
+				byte* data = direct ? out : new byte[nToRead * sectorSize];
+				size_t nRead = 0;
+				bool succeeded = IoQueueTransfer(drive, false, readLba, nToRead, data, &nRead);
+				auto freeData = [&]()
+				{
+					if (!direct)
+						delete[] data;
+				};
+				if (!succeeded)
+				{
+					freeData();
+					SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+					return false;
+				}
+				if (!nRead)
+				{
+					freeData();
+					break;
+				}
+				uint64_t readEnd = readLba + nRead;
+				if (readEnd > end)
+					readEnd = end;
+				if (readEnd > current)
+				{
+					if (!direct)
+						utils::memcpy(out, data + (current - readLba) * sectorSize, (readEnd - current) * sectorSize);
+					out += (readEnd - current) * sectorSize;
+					current = readEnd;
+				}
+				// Big reads are streamed past the cache, so they don't push out the blocks that are actually hot.
+				if (nBlocks <= BUFFER_CACHE_MAX_MISS_BLOCKS)
+					fill(driveId, sectorSize, block, data, nRead, snapshot);
+				freeData();
+				if (nRead < nToRead)
+					break;
+			}
+			if (nSectorsRead)
+				*nSectorsRead = current - lba;
+			return true;
+		}
+		bool BufferCacheWrite(DriveEntry* drive, size_t sectorSize, uint64_t lba, size_t nSectors, const void* buff, size_t* nSectorsWritten)
+		{
+			if (!drive || !sectorSize || !buff)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			const uint32_t driveId = drive->driveId;
+			size_t nWritten = 0;
+			BufferCacheBeginWrite(driveId, lba, nSectors);
+			if (!IoQueueTransfer(drive, true, lba, nSectors, (void*)buff, &nWritten))
+			{
+				// Part of the write could've made it to the drive, so don't trust what's cached.
+				BufferCacheInvalidateDrive(driveId);
+				BufferCacheEndWrite(driveId, lba, nSectors);
+				SetLastError(OBOS_ERROR_VFS_WRITE_ABORTED);
+				return false;
+			}
+			// Update the blocks that are cached, instead of dropping them.
+			const size_t spb = sectorsPerBlock(sectorSize);
+			const byte* in = (const byte*)buff;
+			const uint64_t end = lba + nWritten;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			for (uint64_t current = lba; current < end; )
+			{
+				uint64_t block = current / spb;
+				size_t offset = current % spb;
+				size_t nToCopy = (spb - offset) < (end - current) ? (spb - offset) : (end - current);
+				BufferCacheEntry* entry = lookup(driveId, block);
+				if (entry)
+				{
+					size_t nValid = offset < entry->nSectors ? entry->nSectors - offset : 0;
+					utils::memcpy(entry->data + offset * sectorSize, in, (nToCopy < nValid ? nToCopy : nValid) * sectorSize);
+				}
+				current += nToCopy;
+				in += nToCopy * sectorSize;
+			}
+			endWrite(driveId, lba, nSectors);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			if (nSectorsWritten)
+				*nSectorsWritten = nWritten;
+			return true;
+		}
+		void BufferCacheBeginWrite(uint32_t driveId, uint64_t lba, size_t nSectors)
+		{
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			beginWrite(driveId, lba, nSectors);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+		}
+		void BufferCacheEndWrite(uint32_t driveId, uint64_t lba, size_t nSectors)
+		{
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			endWrite(driveId, lba, nSectors);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+		}
+		void BufferCacheInvalidateDrive(uint32_t driveId)
+		{
+			BufferCacheEntry* evicted = nullptr;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			for (size_t i = 0; i < BUFFER_CACHE_BUCKETS; i++)
+			{
+				for (BufferCacheEntry* entry = s_buckets[i]; entry; )
+				{
+					BufferCacheEntry* next = entry->hashNext;
+					if (entry->driveId == driveId)
+					{
+						remove(entry);
+						entry->hashNext = evicted;
+						evicted = entry;
+					}
+					entry = next;
+				}
+			}
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(evicted);
+		}
+		void BufferCacheInvalidateRange(uint32_t driveId, size_t sectorSize, uint64_t lba, size_t nSectors)
+		{
+			if (!sectorSize || !nSectors)
+				return;
+			const size_t spb = sectorsPerBlock(sectorSize);
+			const uint64_t lastBlock = (lba + nSectors - 1) / spb;
+			BufferCacheEntry* evicted = nullptr;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			const uint64_t firstBlock = lba / spb;
+			if (lastBlock - firstBlock >= s_nEntries)
+			{
+				// The range is bigger than the cache, so it's cheaper to look at every cached block.
+				for (size_t i = 0; i < BUFFER_CACHE_BUCKETS; i++)
+				{
+					for (BufferCacheEntry* entry = s_buckets[i]; entry; )
+					{
+						BufferCacheEntry* next = entry->hashNext;
+						if (entry->driveId == driveId && entry->block >= firstBlock && entry->block <= lastBlock)
+						{
+							remove(entry);
+							entry->hashNext = evicted;
+							evicted = entry;
+						}
+						entry = next;
+					}
+				}
+			}
+			else
+			{
+				for (uint64_t block = firstBlock; block <= lastBlock; block++)
+				{
+					BufferCacheEntry* entry = lookup(driveId, block);
+					if (!entry)
+						continue;
+					remove(entry);
+					entry->hashNext = evicted;
+					evicted = entry;
+				}
+			}
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(evicted);
+		}
+		size_t BufferCacheShrink(size_t nBytes)
+		{
+			BufferCacheEntry* evicted = nullptr;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			size_t nFreed = evict(nBytes, evicted);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(evicted);
+			return nFreed;
+		}
+		void GetBufferCacheStatistics(BufferCacheStatistics* stats)
+		{
+			if (!stats)
+				return;
+			size_t maxBytes = getMaxBytesCached();
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			stats->nHits = s_nHits;
+			stats->nMisses = s_nMisses;
+			stats->nEvictions = s_nEvictions;
+			stats->nCachedBlocks = s_nEntries;
+			stats->bytesCached = s_bytesCached;
+			stats->maxBytesCached = maxBytes;
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+		}
+	}
+}
@@ -0,0 +1,104 @@
+/*
+	oboskrnl/vfs/devManip/bufferCache.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+// The size of a block in the buffer cache, if the drive's sector size allows it.
+#define BUFFER_CACHE_BLOCK_SIZE 4096
+// The most blocks a cache miss reads from the drive at once, if it can't read into the caller's buffer.
+// Reads of more blocks than this aren't cached.
+#define BUFFER_CACHE_MAX_MISS_BLOCKS 16
+// The most blocks a cache miss reads from the drive at once, if it reads into the caller's buffer.
+#define BUFFER_CACHE_MAX_DIRECT_BLOCKS 256
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct DriveEntry;
+		struct BufferCacheStatistics
+		{
+			// Reads of a block that was in the cache.
+			size_t nHits;
+			// Reads of a block that had to go to the drive.
+			size_t nMisses;
+			// Blocks dropped to make room for others, or because of memory pressure.
+			size_t nEvictions;
+			size_t nCachedBlocks;
+			size_t bytesCached;
+			// The cache starts evicting blocks once bytesCached reaches this.
+			size_t maxBytesCached;
+		};
+
+		/// <summary>
+		/// Reads sectors from a drive through the buffer cache.
+		/// </summary>
+		/// <param name="drive">The drive to read from.</param>
+		/// <param name="sectorSize">The drive's sector size.</param>
+		/// <param name="driveSectors">The drive's sector count.</param>
+		/// <param name="lba">The first sector to read, relative to the start of the drive.</param>
+		/// <param name="nSectors">The amount of sectors to read.</param>
+		/// <param name="buff">[out] The buffer to read into.</param>
+		/// <param name="nSectorsRead">[out,opt] The amount of sectors read.</param>
+		/// <returns>false if the driver failed the read, otherwise true.</returns>
+		bool BufferCacheRead(DriveEntry* drive, size_t sectorSize, size_t driveSectors, uint64_t lba, size_t nSectors, void* buff, size_t* nSectorsRead);
+		/// <summary>
+		/// Writes sectors to a drive, and updates any cached blocks the write touches.<para></para>
+		/// The cache is write-through, so this returns once the driver finishes the write.
+		/// </summary>
+		/// <param name="drive">The drive to write to.</param>
+		/// <param name="sectorSize">The drive's sector size.</param>
+		/// <param name="lba">The first sector to write, relative to the start of the drive.</param>
+		/// <param name="nSectors">The amount of sectors to write.</param>
+		/// <param name="buff">The data to write.</param>
+		/// <param name="nSectorsWritten">[out,opt] The amount of sectors written.</param>
+		/// <returns>false if the driver failed the write, otherwise true.</returns>
+		bool BufferCacheWrite(DriveEntry* drive, size_t sectorSize, uint64_t lba, size_t nSectors, const void* buff, size_t* nSectorsWritten);
+		/// <summary>
+		/// Marks a write that goes around the buffer cache as in flight, so cache misses that read the sectors meanwhile don't cache what they read.<para></para>
+		/// This must be matched by a call to BufferCacheEndWrite with the same range once the write completes.
+		/// </summary>
+		/// <param name="driveId">The drive's id.</param>
+		/// <param name="lba">The first sector written, relative to the start of the drive.</param>
+		/// <param name="nSectors">The amount of sectors written.</param>
+		void BufferCacheBeginWrite(uint32_t driveId, uint64_t lba, size_t nSectors);
+		/// <summary>
+		/// Ends a write started with BufferCacheBeginWrite. Cache misses that read the sectors while it was in flight aren't cached.<para></para>
+		/// This doesn't block or free memory, so it can be called when the write completes in an interrupt handler.
+		/// </summary>
+		/// <param name="driveId">The drive's id.</param>
+		/// <param name="lba">The first sector written, relative to the start of the drive.</param>
+		/// <param name="nSectors">The amount of sectors written.</param>
+		void BufferCacheEndWrite(uint32_t driveId, uint64_t lba, size_t nSectors);
+		/// <summary>
+		/// Drops every cached block of a drive.
+		/// </summary>
+		/// <param name="driveId">The drive's id.</param>
+		void BufferCacheInvalidateDrive(uint32_t driveId);
+		/// <summary>
+		/// Drops the cached blocks that overlap a range of sectors.
+		/// </summary>
+		/// <param name="driveId">The drive's id.</param>
+		/// <param name="sectorSize">The drive's sector size.</param>
+		/// <param name="lba">The first sector of the range, relative to the start of the drive.</param>
+		/// <param name="nSectors">The amount of sectors in the range.</param>
+		void BufferCacheInvalidateRange(uint32_t driveId, size_t sectorSize, uint64_t lba, size_t nSectors);
+		/// <summary>
+		/// Evicts blocks from the buffer cache.
+		/// </summary>
+		/// <param name="nBytes">The amount of bytes to try to free.</param>
+		/// <returns>The amount of bytes freed.</returns>
+		OBOS_EXPORT size_t BufferCacheShrink(size_t nBytes);
+		/// <summary>
+		/// Gets the buffer cache's counters.
+		/// </summary>
+		/// <param name="stats">[out] The statistics.</param>
+		OBOS_EXPORT void GetBufferCacheStatistics(BufferCacheStatistics* stats);
+	}
+}
@@ -9,11 +9,12 @@
 #include <memory_manipulation.h>
 
 #include <vfs/devManip/driveHandle.h>
-#include <vfs/devManip/memcpy.h>
+#include <vfs/devManip/bufferCache.h>
 
 #include <vfs/vfsNode.h>
 
 #include <driverInterface/struct.h>
+#include <driverInterface/blockRequest.h>
 
 #include <allocators/vmm/vmm.h>
 
@@ -160,18 +161,12 @@ namespace obos
                 }
             }
             // Attempt the read...
-            void* buff = nullptr;
             size_t nSectorsRead = 0;
-            if (!ftable.ReadSectors(driveId, lbaOffset, nSectorsToRead, &buff, &nSectorsRead))
+            if (!BufferCacheRead((DriveEntry*)m_driveNode, sizeofSector, nSectors, lbaOffset, nSectorsToRead, obuff, &nSectorsRead))
             {
                 SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
                 return false;
             }
-            if (_VectorizedMemcpy64B)
-                _VectorizedMemcpy64B(obuff, buff, (nSectorsRead * sizeofSector) / 64);
-            else
-                utils::memcpy(obuff, buff, nSectorsRead * sizeofSector);
-            memory::VirtualAllocator{nullptr}.VirtualFree(buff, nSectorsRead * sizeofSector);
             if (_nSectorsRead)
                 *_nSectorsRead = nSectorsRead;
             return true;
@@ -226,7 +221,7 @@ namespace obos
             }
             // Attempt the write...
             size_t nSectorsWrote = 0;
-            if (!ftable.WriteSectors(driveId, lbaOffset, nSectorsToWrite, (char*)buff, &nSectorsWrote))
+            if (!BufferCacheWrite((DriveEntry*)m_driveNode, sizeofSector, lbaOffset, nSectorsToWrite, buff, &nSectorsWrote))
             {
                 SetLastError(OBOS_ERROR_VFS_WRITE_ABORTED);
                 return false;
@@ -235,6 +230,110 @@ namespace obos
                 *_nSectorsWritten = nSectorsWrote;
             return true;
         }
+        // Makes lbaOffset relative to the drive, and checks the range is in the drive, and the partition if there is one.
+        static bool translateRange(void* node, void* driveNode, uoff_t& lbaOffset, size_t nSectorsToAccess, size_t* sectorSize)
+        {
+            DriveEntry* drive = (DriveEntry*)driveNode;
+            auto& ftable = drive->storageDriver->functionTable.serviceSpecific.storageDevice;
+            size_t nSectors = 0;
+            if (!ftable.QueryDiskInfo(drive->driveId, &nSectors, sectorSize))
+                return false;
+            if (node != driveNode)
+            {
+                PartitionEntry* part = (PartitionEntry*)node;
+                if (lbaOffset + nSectorsToAccess > part->sizeSectors)
+                    return false;
+                lbaOffset += part->lbaOffset;
+            }
+            return lbaOffset + nSectorsToAccess <= nSectors;
+        }
+        bool DriveHandle::ReadSectorsAsync(driverInterface::BlockRequest* request, void* buff, uoff_t lbaOffset, size_t nSectorsToRead) const
+        {
+            if (!m_node || m_flags & FLAGS_CLOSED)
+            {
+                SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+                return false;
+            }
+            if (!request || !buff || !nSectorsToRead)
+            {
+                SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+                return false;
+            }
+            size_t sizeofSector = 0;
+            if (!translateRange(m_node, m_driveNode, lbaOffset, nSectorsToRead, &sizeofSector))
+            {
+                SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+                return false;
+            }
+            // The buffer cache is write-through, so the drive always has the newest data, and reads can skip it.
+            DriveEntry* drive = (DriveEntry*)m_driveNode;
+            request->driveId = drive->driveId;
+            request->operation = driverInterface::BlockRequest::OPERATION_READ;
+            request->lbaOffset = lbaOffset;
+            request->nSectors = nSectorsToRead;
+            request->buffer = buff;
+            return driverInterface::SubmitBlockRequest(drive->storageDriver, request);
+        }
+        bool DriveHandle::WriteSectorsAsync(driverInterface::BlockRequest* request, const void* buff, uoff_t lbaOffset, size_t nSectorsToWrite)
+        {
+            if (!m_node || m_flags & FLAGS_CLOSED)
+            {
+                SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+                return false;
+            }
+            if (!request || !buff || !nSectorsToWrite)
+            {
+                SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+                return false;
+            }
+            if (!(m_flags & FLAGS_CAN_WRITE))
+            {
+                SetLastError(OBOS_ERROR_VFS_READ_ONLY);
+                return false;
+            }
+            size_t sizeofSector = 0;
+            if (!translateRange(m_node, m_driveNode, lbaOffset, nSectorsToWrite, &sizeofSector))
+            {
+                SetLastError(OBOS_ERROR_VFS_WRITE_ABORTED);
+                return false;
+            }
+            DriveEntry* drive = (DriveEntry*)m_driveNode;
+            // The cached copies of these sectors are about to be stale.
+            // Until the write completes, cache misses that read them won't be cached either; CompleteBlockRequest ends the write.
+            BufferCacheBeginWrite(drive->driveId, lbaOffset, nSectorsToWrite);
+            BufferCacheInvalidateRange(drive->driveId, sizeofSector, lbaOffset, nSectorsToWrite);
+            request->driveId = drive->driveId;
+            request->operation = driverInterface::BlockRequest::OPERATION_WRITE;
+            request->lbaOffset = lbaOffset;
+            request->nSectors = nSectorsToWrite;
+            request->buffer = (void*)buff;
+            request->cacheWrite = true;
+            if (!driverInterface::SubmitBlockRequest(drive->storageDriver, request))
+            {
+                request->cacheWrite = false;
+                BufferCacheEndWrite(drive->driveId, lbaOffset, nSectorsToWrite);
+                return false;
+            }
+            return true;
+        }
+        bool DriveHandle::WaitForRequest(driverInterface::BlockRequest* request, uint64_t timeout) const
+        {
+            if (!m_node || m_flags & FLAGS_CLOSED)
+            {
+                SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+                return false;
+            }
+            return driverInterface::WaitForBlockRequest(((DriveEntry*)m_driveNode)->storageDriver, request, timeout);
+        }
+        bool DriveHandle::CancelRequest(driverInterface::BlockRequest* request) const
+        {
+            if (!m_node || m_flags & FLAGS_CLOSED)
+            {
+                SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+                return false;
+            }
+            return driverInterface::CancelBlockRequest(((DriveEntry*)m_driveNode)->storageDriver, request);
+        }
         uint32_t DriveHandle::GetDriveId() const
         {
             if (!m_node || m_flags & FLAGS_CLOSED)
@@ -13,6 +13,10 @@
 
 namespace obos
 {
+    namespace driverInterface
+    {
+        struct BlockRequest;
+    }
     namespace vfs
     {
         class DriveHandle
@@ -42,6 +46,15 @@ namespace obos
             OBOS_EXPORT bool ReadSectors(void* buff, size_t* nSectorsRead, uoff_t lbaOffset, size_t nSectors) const;
             OBOS_EXPORT bool WriteSectors(const void* buff, size_t* nSectorsWritten, uoff_t lbaOffset, size_t nSectors);
 
+            // Starts a read or write without waiting for it. The request's onCompletion and userdata fields should be set by the caller beforehand.
+            // The request, and the buffer, must stay valid until the request completes.
+            // If one of these returns false, the request won't complete.
+            OBOS_EXPORT bool ReadSectorsAsync(driverInterface::BlockRequest* request, void* buff, uoff_t lbaOffset, size_t nSectors) const;
+            OBOS_EXPORT bool WriteSectorsAsync(driverInterface::BlockRequest* request, const void* buff, uoff_t lbaOffset, size_t nSectors);
+            // Waits for a request started with ReadSectorsAsync or WriteSectorsAsync. The timeout is in nanoseconds, or zero to wait forever.
+            OBOS_EXPORT bool WaitForRequest(driverInterface::BlockRequest* request, uint64_t timeout = 0) const;
+            OBOS_EXPORT bool CancelRequest(driverInterface::BlockRequest* request) const;
+
             OBOS_EXPORT uint32_t GetDriveId() const;
             OBOS_EXPORT uint32_t GetPartitionId() const;
 
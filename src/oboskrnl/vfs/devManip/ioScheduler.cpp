@@ -0,0 +1,606 @@
+/*
+	oboskrnl/vfs/devManip/ioScheduler.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <atomic.h>
+#include <memory_manipulation.h>
+
+#include <vfs/devManip/ioScheduler.h>
+
+#include <vfs/vfsNode.h>
+
+#include <driverInterface/struct.h>
+#include <driverInterface/blockRequest.h>
+
+#include <multitasking/arch.h>
+#include <multitasking/cpu_local.h>
+#include <multitasking/thread.h>
+#include <multitasking/threadAPI/thrHandle.h>
+#include <multitasking/locks/waitQueue.h>
+
+#include <allocators/vmm/vmm.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#include <arch/x86_64/interrupt.h>
+#endif
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct IoQueueEntry
+		{
+			driverInterface::BlockRequest* request;
+			uint64_t submitTime;
+			uint64_t deadline;
+			// The queue's list, sorted by lba.
+			IoQueueEntry *sortNext, *sortPrev;
+			// The queue's list, in the order the requests were submitted.
+			IoQueueEntry *fifoNext, *fifoPrev;
+			// The next request in the same transfer.
+			IoQueueEntry* batchNext;
+			// Set while the request overlaps an earlier request that hasn't completed, so it can't be sent yet.
+			bool blocked;
+		};
+		struct IoTransfer
+		{
+			// The request sent to the driver.
+			driverInterface::BlockRequest request;
+			struct IoQueue* queue;
+			IoQueueEntry* entries;
+			// Set if the requests' buffers couldn't be used directly.
+			byte* bounce;
+			size_t bounceSize;
+			IoTransfer* next;
+			// The queue's list of transfers the driver hasn't finished.
+			IoTransfer* inFlightNext;
+		};
+		struct IoQueue
+		{
+			DriveEntry* drive;
+			size_t sectorSize;
+			IoQueueEntry *sortHead, *sortTail;
+			IoQueueEntry *fifoHead, *fifoTail;
+			// Transfers the driver finished, which the queue's thread hasn't completed yet.
+			IoTransfer* done;
+			IoTransfer* inFlight;
+			size_t nPending, nInFlight;
+			// Pending requests that are held back by an earlier request.
+			size_t nBlocked;
+			size_t plugCount;
+			// Where the elevator is.
+			uint64_t lastLba;
+			bool dying;
+			bool lock;
+			// The queue's thread waits on this.
+			locks::WaitQueue event;
+			thread::ThreadHandle thread;
+			IoQueueStatistics stats;
+		};
+
+		static void lockQueue(IoQueue* queue)
+		{
+			while (!atomic_cmpxchg(&queue->lock, false, true))
+				pause();
+		}
+		static void unlockQueue(IoQueue* queue)
+		{
+			atomic_clear(&queue->lock);
+		}
+		static bool canBlock()
+		{
+#if defined(__x86_64__) || defined(_WIN64)
+			return getEflags() & x86_64_flags::RFLAGS_INTERRUPT_ENABLE;
+#else
+			return true;
+#endif
+		}
+		static bool isKernelAddress(const void* addr)
+		{
+#if defined(__x86_64__) || defined(_WIN64)
+			return (uintptr_t)addr >= 0xffff800000000000;
+#else
+			return true;
+#endif
+		}
+
+		// These functions expect the queue to be locked.
+
+		static void insertEntry(IoQueue* queue, IoQueueEntry* entry)
+		{
+			const uint64_t lba = entry->request->lbaOffset;
+			// Requests usually come in ascending order, so look from the back.
+			IoQueueEntry* after = queue->sortTail;
+			while (after && after->request->lbaOffset > lba)
+				after = after->sortPrev;
+			entry->sortPrev = after;
+			entry->sortNext = after ? after->sortNext : queue->sortHead;
+			if (entry->sortNext)
+				entry->sortNext->sortPrev = entry;
+			else
+				queue->sortTail = entry;
+			if (after)
+				after->sortNext = entry;
+			else
+				queue->sortHead = entry;
+
+			entry->fifoNext = nullptr;
+			entry->fifoPrev = queue->fifoTail;
+			if (queue->fifoTail)
+				queue->fifoTail->fifoNext = entry;
+			else
+				queue->fifoHead = entry;
+			queue->fifoTail = entry;
+			queue->nPending++;
+		}
+		static void removeEntry(IoQueue* queue, IoQueueEntry* entry)
+		{
+			if (entry->sortPrev)
+				entry->sortPrev->sortNext = entry->sortNext;
+			else
+				queue->sortHead = entry->sortNext;
+			if (entry->sortNext)
+				entry->sortNext->sortPrev = entry->sortPrev;
+			else
+				queue->sortTail = entry->sortPrev;
+			if (entry->fifoPrev)
+				entry->fifoPrev->fifoNext = entry->fifoNext;
+			else
+				queue->fifoHead = entry->fifoNext;
+			if (entry->fifoNext)
+				entry->fifoNext->fifoPrev = entry->fifoPrev;
+			else
+				queue->fifoTail = entry->fifoPrev;
+			entry->batchNext = nullptr;
+			queue->nPending--;
+		}
+		// Whether the requests touch the same sectors, and reordering them could change what's read or written.
+		static bool conflicts(const driverInterface::BlockRequest* a, const driverInterface::BlockRequest* b)
+		{
+			if (a->operation == driverInterface::BlockRequest::OPERATION_READ && b->operation == driverInterface::BlockRequest::OPERATION_READ)
+				return false;
+			return a->lbaOffset < b->lbaOffset + b->nSectors && b->lbaOffset < a->lbaOffset + a->nSectors;
+		}
+		// Whether the request conflicts with a request submitted before it that hasn't completed.
+		static bool isBlocked(IoQueue* queue, IoQueueEntry* entry)
+		{
+			for (IoQueueEntry* cur = entry->fifoPrev; cur; cur = cur->fifoPrev)
+				if (conflicts(cur->request, entry->request))
+					return true;
+			for (IoTransfer* transfer = queue->inFlight; transfer; transfer = transfer->inFlightNext)
+				for (IoQueueEntry* cur = transfer->entries; cur; cur = cur->batchNext)
+					if (conflicts(cur->request, entry->request))
+						return true;
+			return false;
+		}
+		// Lets the requests go that were held back by requests that have completed since.
+		static void unblockEntries(IoQueue* queue)
+		{
+			for (IoQueueEntry* entry = queue->fifoHead; entry && queue->nBlocked; entry = entry->fifoNext)
+			{
+				if (entry->blocked && !isBlocked(queue, entry))
+				{
+					entry->blocked = false;
+					queue->nBlocked--;
+				}
+			}
+		}
+		// Takes the next requests to send to the drive off the queue, and puts them in one transfer.
+		// Requests that are held back are skipped, and at least one request mustn't be.
+		static IoTransfer* buildTransfer(IoQueue* queue, uint64_t now)
+		{
+			IoQueueEntry* first = queue->fifoHead;
+			while (first->blocked)
+				first = first->fifoNext;
+			if (first->deadline <= now)
+				queue->stats.nDeadlineExpiries++;
+			else
+			{
+				// C-LOOK: keep going up from where the last transfer ended, then go back to the lowest request.
+				first = queue->sortHead;
+				while (first && (first->blocked || first->request->lbaOffset < queue->lastLba))
+					first = first->sortNext;
+				if (!first)
+					for (first = queue->sortHead; first->blocked; first = first->sortNext);
+			}
+			const bool write = first->request->operation == driverInterface::BlockRequest::OPERATION_WRITE;
+			const uint64_t start = first->request->lbaOffset;
+			uint64_t end = start + first->request->nSectors;
+			size_t maxSectors = IO_QUEUE_MAX_TRANSFER_SIZE / queue->sectorSize;
+			if (maxSectors < first->request->nSectors)
+				maxSectors = first->request->nSectors;
+			const size_t maxGap = write ? 0 : IO_QUEUE_MAX_READ_GAP / queue->sectorSize;
+			IoQueueEntry* cur = first->sortNext;
+			removeEntry(queue, first);
+			IoQueueEntry* last = first;
+			while (cur)
+			{
+				IoQueueEntry* next = cur->sortNext;
+				driverInterface::BlockRequest* request = cur->request;
+				// Requests that aren't held back overlap nothing that's pending or in flight, so they can go in any order.
+				if (cur->blocked)
+				{
+					cur = next;
+					continue;
+				}
+				if ((request->operation == driverInterface::BlockRequest::OPERATION_WRITE) != write)
+					break;
+				if (request->lbaOffset > end + maxGap)
+					break;
+				uint64_t requestEnd = request->lbaOffset + request->nSectors;
+				uint64_t newEnd = requestEnd > end ? requestEnd : end;
+				if (newEnd - start > maxSectors)
+					break;
+				if (request->lbaOffset > end)
+					queue->stats.nGapSectors += request->lbaOffset - end;
+				end = newEnd;
+				removeEntry(queue, cur);
+				last->batchNext = cur;
+				last = cur;
+				queue->stats.nMerged++;
+				cur = next;
+			}
+			queue->lastLba = end;
+			IoTransfer* transfer = new IoTransfer{};
+			transfer->queue = queue;
+			transfer->entries = first;
+			transfer->request.driveId = queue->drive->driveId;
+			transfer->request.operation = first->request->operation;
+			transfer->request.lbaOffset = start;
+			transfer->request.nSectors = end - start;
+			return transfer;
+		}
+
+		static void transferDone(driverInterface::BlockRequest* request)
+		{
+			IoTransfer* transfer = (IoTransfer*)request->userdata;
+			IoQueue* queue = transfer->queue;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			transfer->next = queue->done;
+			queue->done = transfer;
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+			queue->event.WakeOne();
+		}
+		// Sends a transfer to the driver. The requests' buffers are used directly if they line up, otherwise a bounce buffer is used.
+		static void startTransfer(IoQueue* queue, IoTransfer* transfer)
+		{
+			driverInterface::BlockRequest& request = transfer->request;
+			const size_t sectorSize = queue->sectorSize;
+			byte* buffer = (byte*)transfer->entries->request->buffer;
+			bool direct = !((uintptr_t)buffer % IO_QUEUE_BUFFER_ALIGNMENT);
+			uint64_t expected = request.lbaOffset;
+			for (IoQueueEntry* entry = transfer->entries; entry && direct; entry = entry->batchNext)
+			{
+				direct = entry->request->lbaOffset == expected &&
+					(byte*)entry->request->buffer == buffer + (expected - request.lbaOffset) * sectorSize;
+				expected += entry->request->nSectors;
+			}
+			if (direct)
+				request.buffer = buffer;
+			else
+			{
+				transfer->bounceSize = request.nSectors * sectorSize;
+				transfer->bounce = (byte*)memory::VirtualAllocator{ nullptr }.VirtualAlloc(nullptr, transfer->bounceSize, memory::PROT_NO_COW_ON_ALLOCATE);
+				request.buffer = transfer->bounce;
+				if (transfer->bounce && request.operation == driverInterface::BlockRequest::OPERATION_WRITE)
+				{
+					for (IoQueueEntry* entry = transfer->entries; entry; entry = entry->batchNext)
+						utils::memcpy(transfer->bounce + (entry->request->lbaOffset - request.lbaOffset) * sectorSize, entry->request->buffer, entry->request->nSectors * sectorSize);
+				}
+			}
+			request.onCompletion = transferDone;
+			request.userdata = transfer;
+			if (!request.buffer || !driverInterface::SubmitBlockRequest(queue->drive->storageDriver, &request))
+			{
+				request.status = driverInterface::BlockRequest::STATUS_FAILED;
+				request.nSectorsTransferred = 0;
+				transferDone(&request);
+			}
+		}
+		// Completes the requests of every transfer the driver finished.
+		static void reapTransfers(IoQueue* queue)
+		{
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			IoTransfer* transfer = queue->done;
+			queue->done = nullptr;
+			for (IoTransfer* cur = transfer; cur; cur = cur->next)
+			{
+				IoTransfer** link = &queue->inFlight;
+				while (*link != cur)
+					link = &(*link)->inFlightNext;
+				*link = cur->inFlightNext;
+			}
+			if (transfer)
+				unblockEntries(queue);
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+			const size_t sectorSize = queue->sectorSize;
+			while (transfer)
+			{
+				IoTransfer* nextTransfer = transfer->next;
+				const driverInterface::BlockRequest& request = transfer->request;
+				const bool succeeded = request.status == driverInterface::BlockRequest::STATUS_SUCCESS;
+				const uint64_t transferredEnd = request.lbaOffset + request.nSectorsTransferred;
+				const uint64_t now = thread::GetMonotonicTime();
+				for (IoQueueEntry* entry = transfer->entries; entry; )
+				{
+					IoQueueEntry* next = entry->batchNext;
+					driverInterface::BlockRequest* original = entry->request;
+					size_t nTransferred = 0;
+					if (succeeded && transferredEnd > original->lbaOffset)
+						nTransferred = (transferredEnd - original->lbaOffset) < original->nSectors ? (transferredEnd - original->lbaOffset) : original->nSectors;
+					if (nTransferred && transfer->bounce && request.operation == driverInterface::BlockRequest::OPERATION_READ)
+						utils::memcpy(original->buffer, transfer->bounce + (original->lbaOffset - request.lbaOffset) * sectorSize, nTransferred * sectorSize);
+					uint64_t latency = now - entry->submitTime;
+					flags = saveFlagsAndCLI();
+					lockQueue(queue);
+					queue->stats.totalLatency += latency;
+					if (latency > queue->stats.maxLatency)
+						queue->stats.maxLatency = latency;
+					unlockQueue(queue);
+					restorePreviousInterruptStatus(flags);
+					delete entry;
+					driverInterface::CompleteBlockRequest(original, succeeded ? driverInterface::BlockRequest::STATUS_SUCCESS : driverInterface::BlockRequest::STATUS_FAILED, nTransferred);
+					entry = next;
+				}
+				if (transfer->bounce)
+					memory::VirtualAllocator{ nullptr }.VirtualFree(transfer->bounce, transfer->bounceSize);
+				delete transfer;
+				flags = saveFlagsAndCLI();
+				lockQueue(queue);
+				queue->nInFlight--;
+				unlockQueue(queue);
+				restorePreviousInterruptStatus(flags);
+				transfer = nextTransfer;
+			}
+		}
+		// Whether the queue's thread has anything to do. Only the queue's thread removes requests, so this can look at the queue without locking it.
+		static bool hasWork(void* udata)
+		{
+			IoQueue* queue = (IoQueue*)udata;
+			if (queue->done)
+				return true;
+			if (queue->dying && !queue->nPending && !queue->nInFlight)
+				return true;
+			if (queue->nPending == queue->nBlocked || queue->nInFlight >= IO_QUEUE_DEPTH)
+				return false;
+			return !queue->plugCount || queue->fifoHead->deadline <= thread::GetMonotonicTime();
+		}
+		static void queueThread(uintptr_t udata)
+		{
+			IoQueue* queue = (IoQueue*)udata;
+			while (true)
+			{
+				// While the queue is plugged, wake up once the oldest request's deadline passes.
+				uint64_t timeout = 0;
+				uintptr_t flags = saveFlagsAndCLI();
+				lockQueue(queue);
+				if (queue->plugCount && queue->fifoHead)
+				{
+					uint64_t now = thread::GetMonotonicTime();
+					timeout = queue->fifoHead->deadline > now ? queue->fifoHead->deadline - now : 1;
+				}
+				unlockQueue(queue);
+				restorePreviousInterruptStatus(flags);
+				queue->event.WaitFor(hasWork, queue, timeout);
+				reapTransfers(queue);
+				flags = saveFlagsAndCLI();
+				lockQueue(queue);
+				if (queue->dying && !queue->nPending && !queue->nInFlight)
+				{
+					unlockQueue(queue);
+					restorePreviousInterruptStatus(flags);
+					break;
+				}
+				uint64_t now = thread::GetMonotonicTime();
+				while (queue->nPending > queue->nBlocked && queue->nInFlight < IO_QUEUE_DEPTH && (!queue->plugCount || queue->fifoHead->deadline <= now))
+				{
+					IoTransfer* transfer = buildTransfer(queue, now);
+					transfer->inFlightNext = queue->inFlight;
+					queue->inFlight = transfer;
+					queue->nInFlight++;
+					queue->stats.nTransfers++;
+					unlockQueue(queue);
+					restorePreviousInterruptStatus(flags);
+					startTransfer(queue, transfer);
+					flags = saveFlagsAndCLI();
+					lockQueue(queue);
+				}
+				unlockQueue(queue);
+				restorePreviousInterruptStatus(flags);
+			}
+			thread::ExitThread(0);
+		}
+		static bool s_queueCreationLock;
+		static IoQueue* getQueue(DriveEntry* drive)
+		{
+			IoQueue* queue = __atomic_load_n(&drive->ioQueue, __ATOMIC_ACQUIRE);
+			if (queue)
+				return queue;
+			while (!atomic_cmpxchg(&s_queueCreationLock, false, true))
+				pause();
+			queue = drive->ioQueue;
+			uint64_t sectorSize = 0;
+			if (!queue && drive->storageDriver->functionTable.serviceSpecific.storageDevice.QueryDiskInfo(drive->driveId, nullptr, &sectorSize) && sectorSize)
+			{
+				queue = new IoQueue{};
+				queue->drive = drive;
+				queue->sectorSize = sectorSize;
+				// The idle thread's owner is always the kernel's process, which the queue's thread needs to be in to get to kernel memory.
+				if (queue->thread.CreateThread(
+					thread::THREAD_PRIORITY_HIGH,
+					0,
+					queueThread,
+					(uintptr_t)queue,
+					thread::g_defaultAffinity,
+					thread::GetCurrentCpuLocalPtr()->idleThread->owner,
+					false))
+					__atomic_store_n(&drive->ioQueue, queue, __ATOMIC_RELEASE);
+				else
+				{
+					delete queue;
+					queue = nullptr;
+				}
+			}
+			atomic_clear(&s_queueCreationLock);
+			return queue;
+		}
+		// Does a transfer with the driver's synchronous callbacks.
+		static bool transferDirect(DriveEntry* drive, bool write, uint64_t lba, size_t nSectors, void* buff, size_t* nSectorsTransferred)
+		{
+			auto& ftable = drive->storageDriver->functionTable.serviceSpecific.storageDevice;
+			if (write)
+				return ftable.WriteSectors(drive->driveId, lba, nSectors, (char*)buff, nSectorsTransferred);
+			if (ftable.ReadSectorsInto)
+				return ftable.ReadSectorsInto(drive->driveId, lba, nSectors, buff, nSectorsTransferred);
+			uint64_t sectorSize = 0;
+			void* data = nullptr;
+			size_t nRead = 0;
+			if (!ftable.QueryDiskInfo(drive->driveId, nullptr, &sectorSize) || !ftable.ReadSectors(drive->driveId, lba, nSectors, &data, &nRead))
+				return false;
+			if (data)
+			{
+				utils::memcpy(buff, data, nRead * sectorSize);
+				memory::VirtualAllocator{ nullptr }.VirtualFree(data, nRead * sectorSize);
+			}
+			*nSectorsTransferred = nRead;
+			return true;
+		}
+
+		bool IoQueueSubmit(DriveEntry* drive, driverInterface::BlockRequest* request)
+		{
+			if (!drive || !request || !request->buffer || !request->nSectors || request->operation > driverInterface::BlockRequest::OPERATION_WRITE)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			IoQueue* queue = getQueue(drive);
+			if (!queue)
+			{
+				SetLastError(OBOS_ERROR_VFS_DRIVER_FAILURE);
+				return false;
+			}
+			request->driveId = drive->driveId;
+			request->status = driverInterface::BlockRequest::STATUS_PENDING;
+			request->nSectorsTransferred = 0;
+			IoQueueEntry* entry = new IoQueueEntry{};
+			entry->request = request;
+			entry->submitTime = thread::GetMonotonicTime();
+			entry->deadline = entry->submitTime + (request->operation == driverInterface::BlockRequest::OPERATION_WRITE ? IO_QUEUE_WRITE_DEADLINE : IO_QUEUE_READ_DEADLINE);
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			insertEntry(queue, entry);
+			entry->blocked = isBlocked(queue, entry);
+			queue->nBlocked += entry->blocked;
+			queue->stats.nRequests++;
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+			queue->event.WakeOne();
+			return true;
+		}
+		bool IoQueueTransfer(DriveEntry* drive, bool write, uint64_t lba, size_t nSectors, void* buff, size_t* nSectorsTransferred)
+		{
+			if (!drive || !buff)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			size_t nTransferred = 0;
+			bool ret = false;
+			// The queue's thread can't get to user memory, and we can't wait for it with interrupts off.
+			if (!nSectors || !canBlock() || !isKernelAddress(buff))
+				ret = transferDirect(drive, write, lba, nSectors, buff, &nTransferred);
+			else
+			{
+				driverInterface::BlockRequest request{};
+				request.operation = write ? driverInterface::BlockRequest::OPERATION_WRITE : driverInterface::BlockRequest::OPERATION_READ;
+				request.lbaOffset = lba;
+				request.nSectors = nSectors;
+				request.buffer = buff;
+				if (!IoQueueSubmit(drive, &request))
+					ret = transferDirect(drive, write, lba, nSectors, buff, &nTransferred);
+				else
+				{
+					ret = driverInterface::WaitForBlockRequest(drive->storageDriver, &request);
+					nTransferred = request.nSectorsTransferred;
+				}
+			}
+			if (nSectorsTransferred)
+				*nSectorsTransferred = ret ? nTransferred : 0;
+			return ret;
+		}
+		void IoQueuePlug(DriveEntry* drive)
+		{
+			IoQueue* queue = drive ? getQueue(drive) : nullptr;
+			if (!queue)
+				return;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			queue->plugCount++;
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+		}
+		void IoQueueUnplug(DriveEntry* drive)
+		{
+			IoQueue* queue = drive ? __atomic_load_n(&drive->ioQueue, __ATOMIC_ACQUIRE) : nullptr;
+			if (!queue)
+				return;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			if (queue->plugCount)
+				queue->plugCount--;
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+			queue->event.WakeOne();
+		}
+		void IoQueueDestroy(DriveEntry* drive)
+		{
+			IoQueue* queue = drive ? __atomic_exchange_n(&drive->ioQueue, nullptr, __ATOMIC_ACQ_REL) : nullptr;
+			if (!queue)
+				return;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			queue->dying = true;
+			queue->plugCount = 0;
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+			queue->event.WakeOne();
+			queue->thread.WaitForThreadExit();
+			queue->thread.CloseHandle();
+			delete queue;
+		}
+		bool GetIoQueueStatistics(uint32_t driveId, IoQueueStatistics* stats)
+		{
+			if (!stats)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			DriveEntry* drive = g_drives.head;
+			while (drive && drive->driveId != driveId)
+				drive = drive->next;
+			IoQueue* queue = drive ? __atomic_load_n(&drive->ioQueue, __ATOMIC_ACQUIRE) : nullptr;
+			if (!queue)
+			{
+				SetLastError(OBOS_ERROR_NO_SUCH_OBJECT);
+				return false;
+			}
+			uintptr_t flags = saveFlagsAndCLI();
+			lockQueue(queue);
+			*stats = queue->stats;
+			stats->nPending = queue->nPending;
+			stats->nInFlight = queue->nInFlight;
+			unlockQueue(queue);
+			restorePreviousInterruptStatus(flags);
+			return true;
+		}
+	}
+}
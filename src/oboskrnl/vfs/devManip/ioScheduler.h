@@ -0,0 +1,97 @@
+/*
+	oboskrnl/vfs/devManip/ioScheduler.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+// The most transfers a queue has in flight on its drive at once. Requests that come in while the drive is busy are merged.
+#define IO_QUEUE_DEPTH 4
+// The biggest transfer requests are merged into.
+#define IO_QUEUE_MAX_TRANSFER_SIZE 0x100000
+// Reads this close together are merged, and the sectors between them are read and thrown away.
+#define IO_QUEUE_MAX_READ_GAP 0x4000
+// Transfers with a buffer aligned to this are sent to the driver as they are, otherwise they go through a bounce buffer.
+// This is the strictest alignment the storage drivers can DMA to without bouncing (NVMe's PRP entries must be dword-aligned).
+#define IO_QUEUE_BUFFER_ALIGNMENT 4
+// How long a request can be passed over by the elevator, in nanoseconds.
+#define IO_QUEUE_READ_DEADLINE 50000000
+#define IO_QUEUE_WRITE_DEADLINE 500000000
+
+namespace obos
+{
+	namespace driverInterface
+	{
+		struct BlockRequest;
+	}
+	namespace vfs
+	{
+		struct DriveEntry;
+		struct IoQueueStatistics
+		{
+			// Requests submitted to the queue.
+			size_t nRequests;
+			// Requests that were merged into another request's transfer.
+			size_t nMerged;
+			// Transfers sent to the driver.
+			size_t nTransfers;
+			// Transfers that were started by a request whose deadline passed, instead of by the elevator.
+			size_t nDeadlineExpiries;
+			// Sectors read only to merge two reads that weren't contiguous.
+			size_t nGapSectors;
+			// The time from submission to completion, in nanoseconds.
+			uint64_t totalLatency;
+			uint64_t maxLatency;
+			size_t nPending;
+			size_t nInFlight;
+		};
+
+		/// <summary>
+		/// Submits a request to the drive's queue, where it can be merged with other requests to adjacent sectors.<para></para>
+		/// A request that overlaps an earlier request, where either one is a write, is held back until the earlier request completes.<para></para>
+		/// The requests are sent to the driver from the queue's thread, so the buffer must be kernel memory.
+		/// </summary>
+		/// <param name="drive">The drive. The request's driveId is set to its id.</param>
+		/// <param name="request">The request. This must stay valid until it completes.</param>
+		/// <returns>Whether the request was queued. If this returns false, the request won't complete; use GetLastError.</returns>
+		OBOS_EXPORT bool IoQueueSubmit(DriveEntry* drive, driverInterface::BlockRequest* request);
+		/// <summary>
+		/// Reads or writes sectors through the drive's queue, and waits for the transfer.<para></para>
+		/// Buffers in user memory, and transfers with interrupts off, go straight to the driver.
+		/// </summary>
+		/// <param name="drive">The drive.</param>
+		/// <param name="write">Whether to write, instead of read.</param>
+		/// <param name="lba">The first sector, relative to the start of the drive.</param>
+		/// <param name="nSectors">The amount of sectors.</param>
+		/// <param name="buff">The buffer.</param>
+		/// <param name="nSectorsTransferred">[out,opt] The amount of sectors transferred.</param>
+		/// <returns>false if the driver failed the transfer, otherwise true.</returns>
+		bool IoQueueTransfer(DriveEntry* drive, bool write, uint64_t lba, size_t nSectors, void* buff, size_t* nSectorsTransferred);
+		/// <summary>
+		/// Holds back the drive's requests until IoQueueUnplug is called, unless their deadline passes, so a batch of requests can be merged.
+		/// </summary>
+		/// <param name="drive">The drive.</param>
+		OBOS_EXPORT void IoQueuePlug(DriveEntry* drive);
+		/// <summary>
+		/// Undoes a call to IoQueuePlug.
+		/// </summary>
+		/// <param name="drive">The drive.</param>
+		OBOS_EXPORT void IoQueueUnplug(DriveEntry* drive);
+		/// <summary>
+		/// Waits for the drive's queue to empty, then stops its thread.
+		/// </summary>
+		/// <param name="drive">The drive.</param>
+		void IoQueueDestroy(DriveEntry* drive);
+		/// <summary>
+		/// Gets the counters of a drive's queue.
+		/// </summary>
+		/// <param name="driveId">The drive's id.</param>
+		/// <param name="stats">[out] The statistics.</param>
+		/// <returns>Whether the drive has a queue.</returns>
+		OBOS_EXPORT bool GetIoQueueStatistics(uint32_t driveId, IoQueueStatistics* stats);
+	}
+}
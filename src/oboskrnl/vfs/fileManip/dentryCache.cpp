@@ -0,0 +1,291 @@
+/*
+	oboskrnl/vfs/fileManip/dentryCache.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <atomic.h>
+#include <memory_manipulation.h>
+
+#include <vfs/fileManip/dentryCache.h>
+
+#include <vfs/vfsNode.h>
+
+#include <vfs/mount/mount.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#endif
+
+#define DENTRY_CACHE_BUCKETS 1024
+// Directories with fewer children than this don't get a child table, as searching the list is as fast.
+#define DENTRY_CHILD_TABLE_MIN_CHILDREN 8
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct Dentry
+		{
+			GeneralFSNode* parent;
+			size_t hash;
+			char* name;
+			size_t nameLen;
+			// nullptr if the component doesn't exist in the directory.
+			DirectoryEntry* node;
+			Dentry* hashNext;
+			// The LRU list, with the most recently used entry at the head.
+			Dentry *next, *prev;
+		};
+		static Dentry* s_buckets[DENTRY_CACHE_BUCKETS];
+		static Dentry *s_head, *s_tail;
+		static size_t s_nEntries;
+		static bool s_lock;
+		static uint64_t s_nHits, s_nNegativeHits, s_nMisses;
+
+		static void lockCache()
+		{
+			while (!atomic_cmpxchg(&s_lock, false, true))
+				pause();
+		}
+		static void unlockCache()
+		{
+			atomic_clear(&s_lock);
+		}
+		static size_t hashComponent(const GeneralFSNode* parent, const char* name, size_t nameLen)
+		{
+			size_t hash = 0xcbf29ce484222325 ^ (uintptr_t)parent;
+			for (size_t i = 0; i < nameLen; i++)
+				hash = (hash ^ (byte)name[i]) * 0x100000001b3;
+			return hash;
+		}
+		// Returns the last component of an entry's path, as the path is relative to the mount point.
+		static const char* nodeName(const DirectoryEntry* node, size_t& nameLen)
+		{
+			const char* path = node->path.str;
+			size_t len = node->path.strLen;
+			for (; len && path[len - 1] == '/'; len--);
+			size_t start = len;
+			for (; start && path[start - 1] != '/'; start--);
+			nameLen = len - start;
+			return path + start;
+		}
+
+		static size_t childBucket(const DirectoryEntryList& children, const char* name, size_t nameLen)
+		{
+			return hashComponent(nullptr, name, nameLen) & (children.nBuckets - 1);
+		}
+		void DentryBuildChildTable(DirectoryEntryList* children)
+		{
+			if (!children || children->size < DENTRY_CHILD_TABLE_MIN_CHILDREN)
+				return;
+			size_t nBuckets = DENTRY_CHILD_TABLE_MIN_CHILDREN;
+			for (; nBuckets < children->size; nBuckets *= 2);
+			DirectoryEntry** buckets = new DirectoryEntry*[nBuckets];
+			if (!buckets)
+				return;
+			utils::memzero(buckets, nBuckets * sizeof(*buckets));
+			children->buckets = buckets;
+			children->nBuckets = nBuckets;
+			for (DirectoryEntry* node = children->head; node; node = node->next)
+			{
+				size_t nameLen = 0;
+				const char* name = nodeName(node, nameLen);
+				DirectoryEntry*& bucket = buckets[childBucket(*children, name, nameLen)];
+				node->hashNext = bucket;
+				bucket = node;
+			}
+		}
+		// Searches a directory's children, through its child table if it has one.
+		static DirectoryEntry* findChild(const GeneralFSNode* parent, const char* name, size_t nameLen)
+		{
+			const DirectoryEntryList& children = parent->children;
+			DirectoryEntry* node = children.buckets ? children.buckets[childBucket(children, name, nameLen)] : children.head;
+			for (; node; node = children.buckets ? node->hashNext : node->next)
+			{
+				size_t childNameLen = 0;
+				const char* childName = nodeName(node, childNameLen);
+				if (childNameLen == nameLen && utils::memcmp(childName, name, nameLen))
+					break;
+			}
+			return node;
+		}
+
+		// These functions expect the cache to be locked.
+
+		static Dentry* lookup(const GeneralFSNode* parent, size_t hash, const char* name, size_t nameLen)
+		{
+			for (Dentry* entry = s_buckets[hash % DENTRY_CACHE_BUCKETS]; entry; entry = entry->hashNext)
+				if (entry->hash == hash && entry->parent == parent && entry->nameLen == nameLen && utils::memcmp(entry->name, name, nameLen))
+					return entry;
+			return nullptr;
+		}
+		static void unlinkLRU(Dentry* entry)
+		{
+			if (entry->next)
+				entry->next->prev = entry->prev;
+			if (entry->prev)
+				entry->prev->next = entry->next;
+			if (s_head == entry)
+				s_head = entry->next;
+			if (s_tail == entry)
+				s_tail = entry->prev;
+			entry->next = entry->prev = nullptr;
+		}
+		static void pushLRU(Dentry* entry)
+		{
+			entry->next = s_head;
+			if (s_head)
+				s_head->prev = entry;
+			s_head = entry;
+			if (!s_tail)
+				s_tail = entry;
+		}
+		// Removes an entry, and puts it on 'removed' so it can be freed once the cache is unlocked.
+		static void remove(Dentry* entry, Dentry*& removed)
+		{
+			Dentry** link = &s_buckets[entry->hash % DENTRY_CACHE_BUCKETS];
+			while (*link != entry)
+				link = &(*link)->hashNext;
+			*link = entry->hashNext;
+			unlinkLRU(entry);
+			s_nEntries--;
+			entry->hashNext = removed;
+			removed = entry;
+		}
+		static void insert(Dentry* entry, Dentry*& removed)
+		{
+			if (Dentry* old = lookup(entry->parent, entry->hash, entry->name, entry->nameLen))
+				remove(old, removed);
+			while (s_nEntries >= DENTRY_CACHE_MAX_ENTRIES && s_tail)
+				remove(s_tail, removed);
+			Dentry*& bucket = s_buckets[entry->hash % DENTRY_CACHE_BUCKETS];
+			entry->hashNext = bucket;
+			bucket = entry;
+			pushLRU(entry);
+			s_nEntries++;
+		}
+
+		static void freeEntries(Dentry* list)
+		{
+			while (list)
+			{
+				Dentry* next = list->hashNext;
+				delete[] list->name;
+				delete list;
+				list = next;
+			}
+		}
+		// Finds a component in a directory, through the cache.
+		static DirectoryEntry* lookupComponent(GeneralFSNode* parent, const char* name, size_t nameLen)
+		{
+			const size_t hash = hashComponent(parent, name, nameLen);
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			if (Dentry* entry = lookup(parent, hash, name, nameLen))
+			{
+				DirectoryEntry* node = entry->node;
+				unlinkLRU(entry);
+				pushLRU(entry);
+				if (node)
+					s_nHits++;
+				else
+					s_nNegativeHits++;
+				unlockCache();
+				restorePreviousInterruptStatus(flags);
+				return node;
+			}
+			s_nMisses++;
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			// A directory that wasn't populated has no children yet, so don't cache anything from it.
+			if (!PopulateDirectory(parent))
+				return nullptr;
+			// Search the directory without the cache locked.
+			DirectoryEntry* node = findChild(parent, name, nameLen);
+			Dentry* entry = new Dentry{};
+			entry->parent = parent;
+			entry->hash = hash;
+			entry->name = (char*)utils::memcpy(new char[nameLen + 1], name, nameLen);
+			entry->name[nameLen] = 0;
+			entry->nameLen = nameLen;
+			entry->node = node;
+			Dentry* removed = nullptr;
+			flags = saveFlagsAndCLI();
+			lockCache();
+			insert(entry, removed);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(removed);
+			return node;
+		}
+		DirectoryEntry* DentryLookup(MountPoint* point, const char* path)
+		{
+			if (!point || !path)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return nullptr;
+			}
+			GeneralFSNode* parent = point;
+			DirectoryEntry* node = nullptr;
+			while (*path)
+			{
+				for (; *path == '/'; path++);
+				if (!*path)
+					break;
+				size_t len = 0;
+				for (; path[len] && path[len] != '/'; len++);
+				if (node)
+				{
+					// Only directories can have more components after them.
+					while (node->direntType == DIRECTORY_ENTRY_TYPE_SYMLINK && node->linkedNode)
+						node = node->linkedNode;
+					if (node->direntType != DIRECTORY_ENTRY_TYPE_DIRECTORY)
+					{
+						node = nullptr;
+						break;
+					}
+					parent = node;
+				}
+				node = lookupComponent(parent, path, len);
+				if (!node)
+					break;
+				path += len;
+			}
+			if (!node)
+				SetLastError(OBOS_ERROR_VFS_FILE_NOT_FOUND);
+			return node;
+		}
+		void DentryInvalidateDirectory(GeneralFSNode* directory)
+		{
+			Dentry* removed = nullptr;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			for (Dentry* entry = s_head; entry; )
+			{
+				Dentry* next = entry->next;
+				if (entry->parent == directory)
+					remove(entry, removed);
+				entry = next;
+			}
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(removed);
+		}
+		void GetDentryCacheStatistics(DentryCacheStatistics* stats)
+		{
+			if (!stats)
+				return;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			stats->nHits = s_nHits;
+			stats->nNegativeHits = s_nNegativeHits;
+			stats->nMisses = s_nMisses;
+			stats->nEntries = s_nEntries;
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+		}
+	}
+}
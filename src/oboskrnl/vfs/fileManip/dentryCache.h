@@ -0,0 +1,59 @@
+/*
+	oboskrnl/vfs/fileManip/dentryCache.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+// The most lookups the dentry cache remembers. The least recently used ones are dropped past this.
+#define DENTRY_CACHE_MAX_ENTRIES 8192
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct GeneralFSNode;
+		struct DirectoryEntry;
+		struct DirectoryEntryList;
+		struct MountPoint;
+		struct DentryCacheStatistics
+		{
+			// Lookups of a component that was cached, and existed.
+			size_t nHits;
+			// Lookups of a component that was cached as not existing.
+			size_t nNegativeHits;
+			// Lookups that had to search the directory's children.
+			size_t nMisses;
+			size_t nEntries;
+		};
+
+		/// <summary>
+		/// Resolves a path relative to a mount point, one component at a time, through the dentry cache.<para></para>
+		/// Symbolic links in the middle of the path are followed, the last component is returned as-is.
+		/// </summary>
+		/// <param name="point">The mount point the path is in.</param>
+		/// <param name="path">The path, without the mount point's prefix.</param>
+		/// <returns>The path's directory entry, or nullptr if it doesn't exist, or the path is empty.</returns>
+		DirectoryEntry* DentryLookup(MountPoint* point, const char* path);
+		/// <summary>
+		/// Indexes a list of children by name, so a lookup in their directory doesn't search the whole list on a miss.<para></para>
+		/// Must be called before the list is given to the directory, as the table isn't locked.
+		/// </summary>
+		/// <param name="children">The directory's children.</param>
+		void DentryBuildChildTable(DirectoryEntryList* children);
+		/// <summary>
+		/// Drops the cached lookups in a directory, including the negative ones. Must be called when the directory's children change.
+		/// </summary>
+		/// <param name="directory">The directory, or mount point.</param>
+		void DentryInvalidateDirectory(GeneralFSNode* directory);
+		/// <summary>
+		/// Gets the dentry cache's counters.
+		/// </summary>
+		/// <param name="stats">[out] The statistics.</param>
+		OBOS_EXPORT void GetDentryCacheStatistics(DentryCacheStatistics* stats);
+	}
+}
@@ -9,6 +9,7 @@
 #include <error.h>
 
 #include <vfs/fileManip/directoryIterator.h>
+#include <vfs/fileManip/dentryCache.h>
 
 #include <vfs/mount/mount.h>
 
@@ -18,43 +19,8 @@ namespace obos
 {
 	namespace vfs
 	{
-		void dividePathToTokens(const char* filepath, const char**& tokens, size_t& nTokens, bool useOffset = true);
-		bool pathStrcmp(const char* p1, const char* p2)
-		{
-			for (; *p1 == '/'; p1++);
-			for (; *p2 == '/'; p2++);
-			const char** p1Tok = nullptr;
-			size_t nP1Tok = 0;
-			const char** p2Tok = nullptr;
-			size_t nP2Tok = 0;
-			vfs::dividePathToTokens(p1, p1Tok, nP1Tok, false);
-			vfs::dividePathToTokens(p2, p2Tok, nP2Tok, false);
-			bool ret = true;
-			if (nP1Tok != nP2Tok)
-			{
-				ret = false;
-				goto finish;
-			}
-			for (size_t i = 0; i < nP1Tok; i++)
-			{
-				if (!utils::strcmp(p1Tok[i], p2Tok[i]))
-				{
-					ret = false;
-					goto finish;
-				}
-			}
-		finish:
-			for (size_t i = 0; i < nP1Tok; i++)
-				delete[] p1Tok[i];
-			for (size_t i = 0; i < nP2Tok; i++)
-				delete[] p2Tok[i];
-			delete[] p1Tok;
-			delete[] p2Tok;
-			return ret;
-		}
 		extern bool strContains(const char* str, char ch);
 		extern uint32_t getMountId(const char* path, size_t size = 0);
-		extern DirectoryEntry* SearchForNode(DirectoryEntry* root, void* userdata, bool(*compare)(DirectoryEntry* current, void* userdata));
 		bool DirectoryIterator::OpenAt(const char* path)
 		{
 			if (m_currentNode || m_directoryNode)
@@ -74,10 +40,7 @@ namespace obos
 			}
 			// Get the mount point id from the path.
 			uint32_t mountId = getMountId(path);
-			MountPoint* point = nullptr;
-			for (size_t i = 0; i < g_mountPoints.length(); i++)
-				if (g_mountPoints[i]->id == mountId)
-					point = g_mountPoints[i];
+			MountPoint* point = getMountPoint(mountId);
 			if (!point)
 			{
 				SetLastError(OBOS_ERROR_VFS_FILE_NOT_FOUND);
@@ -89,9 +52,7 @@ namespace obos
 			realPath += utils::strCountToChar(path, '/');
 			if (*realPath)
 			{
-				DirectoryEntry* entry = SearchForNode(point->children.head, (void*)realPath, [](DirectoryEntry* current, void* userdata)->bool {
-					return pathStrcmp(current->path.str, (const char*)userdata);
-				});
+				DirectoryEntry* entry = DentryLookup(point, realPath);
 				if (!entry)
 				{
 					SetLastError(OBOS_ERROR_VFS_FILE_NOT_FOUND);
@@ -104,11 +65,15 @@ namespace obos
 				}
 				while (entry->direntType == DIRECTORY_ENTRY_TYPE_SYMLINK)
 					entry = entry->linkedNode;
+				if (!PopulateDirectory(entry))
+					return false;
 				m_directoryNode = entry;
 				m_currentNode = entry->children.head;
 			}
 			else
 			{
+				if (!PopulateDirectory(point))
+					return false;
 				m_directoryNode = point;
 				m_currentNode = point->children.head;
 			}
@@ -10,6 +10,7 @@
 #include <memory_manipulation.h>
 
 #include <vfs/fileManip/fileHandle.h>
+#include <vfs/fileManip/dentryCache.h>
 
 #include <vfs/vfsNode.h>
 
@@ -26,7 +27,6 @@ namespace obos
 {
 	namespace vfs
 	{
-		bool pathStrcmp(const char* p1, const char* p2);
 		// Do not make these next three functions static, as it's used in many places.
 		bool strContains(const char* str, char ch)
 		{
@@ -48,30 +48,6 @@ namespace obos
 			}
 			return ret;
 		}
-		DirectoryEntry* SearchForNode(DirectoryEntry* root, void* userdata, bool(*compare)(DirectoryEntry* current, void* userdata))
-		{
-			if (!root)
-				return nullptr;
-
-			DirectoryEntry* node1 = root;
-			while (node1)
-			{
-				if (compare(node1, userdata))
-					return node1;
-
-				node1 = node1->next;
-			}
-			node1 = root;
-			
-			DirectoryEntry* node2 = nullptr;
-			while (!node2 && node1)
-			{
-				node2 = SearchForNode(node1->children.head, userdata, compare);
-				
-				node1 = node1->next;
-			}
-			return node2;
-		}
 		bool FileHandle::Open(const char* path, OpenOptions options)
 		{
 			if (!(m_flags & FLAGS_CLOSED) || m_node)
@@ -116,10 +92,7 @@ namespace obos
 			}
 			// Get the mount point id from the path.
 			uint32_t mountId = getMountId(path);
-			MountPoint* point = nullptr;
-			for (size_t i = 0; i < g_mountPoints.length(); i++)
-				if (g_mountPoints[i]->id == mountId)
-					point = g_mountPoints[i];
+			MountPoint* point = getMountPoint(mountId);
 			if (!point)
 			{
 				SetLastError(OBOS_ERROR_VFS_FILE_NOT_FOUND);
@@ -129,9 +102,7 @@ namespace obos
 			const char* realPath = path;
 			realPath += utils::strCountToChar(path, ':');
 			realPath += utils::strCountToChar(path, '/');
-			DirectoryEntry* entry = SearchForNode(point->children.head, (void*)realPath, [](DirectoryEntry* current, void* userdata)->bool {
-				return pathStrcmp(current->path.str, (const char*)userdata);
-				});
+			DirectoryEntry* entry = DentryLookup(point, realPath);
 			if (!entry)
 			{
 				SetLastError(OBOS_ERROR_VFS_FILE_NOT_FOUND);
@@ -175,34 +146,20 @@ namespace obos
 			}
 			auto waitForData = [&]()->bool
 				{
-					//// TODO: Make this work with normal file handles.
-					//if (m_flags & FLAGS_IS_INPUT_DEVICE)
-					//{
-					//	// Wait for the buffer to grow.
-					//	driverInterface::InputDevice* node = (driverInterface::InputDevice*)m_node;
-					//	uintptr_t udata[] = { (uintptr_t)node, (uintptr_t)this, nToRead };
-					//	auto currentThread = thread::GetCurrentCpuLocalPtr()->currentThread;
-					//	currentThread->blockCallback.callback = [](thread::Thread*, void* udata)->bool
-					//		{
-					//			uintptr_t *data = (uintptr_t*)udata;
-					//			auto _this = (FileHandle*)data[1];
-					//			auto off = _this->GetPos();
-					//			size_t nToRead = data[2];
-					//			nToRead /= 2;
-					//			driverInterface::InputDevice* node = (driverInterface::InputDevice*)data[0];
-					//			return (off < node->data.length()) && ((off + nToRead) < node->data.length());
-					//		};
-					//	currentThread->blockCallback.userdata = udata;
-					//	currentThread->status = thread::THREAD_STATUS_CAN_RUN | thread::THREAD_STATUS_BLOCKED;
-					//	currentThread->timeSliceIndex = 0;
-					//	currentThread->lastTimePreempted = 0;
-					//	thread::callScheduler(false);
-					//	return true;
-					//}
-					uint32_t divisor = 1;
+					// TODO: Make this work with normal file handles.
 					if (m_flags & FLAGS_IS_INPUT_DEVICE)
-						divisor = 2;
-					while (__TestEof(m_currentFilePos) && __TestEof(m_currentFilePos + nToRead / divisor));
+					{
+						// Sleep until the device's driver writes to the buffer.
+						driverInterface::InputDevice* node = (driverInterface::InputDevice*)m_node;
+						struct waitData { FileHandle* _this; size_t nToRead; } udata = { this, nToRead };
+						return node->dataAvailable.WaitFor([](void* _udata)->bool
+							{
+								waitData* udata = (waitData*)_udata;
+								FileHandle* _this = udata->_this;
+								return !_this->__TestEof(_this->m_currentFilePos) || !_this->__TestEof(_this->m_currentFilePos + udata->nToRead / 2);
+							}, &udata);
+					}
+					while (__TestEof(m_currentFilePos) && __TestEof(m_currentFilePos + nToRead));
 					return true;
 				};
 			if (Eof())
@@ -235,18 +192,18 @@ namespace obos
 				if (!(m_flags & FLAGS_IS_INPUT_DEVICE))
 				{
 					DirectoryEntry* node = (DirectoryEntry*)m_node;
-					auto& functions = node->mountPoint->filesystemDriver->functionTable.serviceSpecific.filesystem;
-
-					uint64_t driveId = node->mountPoint->partition ? node->mountPoint->partition->drive->driveId : 0;
-					uint8_t drivePartitionId = node->mountPoint->partition ? node->mountPoint->partition->partitionId : 0;
-
-					ret = functions.ReadFile(
-						driveId,
-						drivePartitionId,
-						node->path,
-						m_currentFilePos,
-						nToRead,
-						data);
+					if (peek)
+						ret = __ReadFromDriver(data, nToRead, m_currentFilePos);
+					else
+					{
+						// Big reads are split up, so the next part of the file is prefetched while this part is read.
+						for (size_t offset = 0; offset < nToRead && ret; offset += READ_AHEAD_MAX_WINDOW)
+						{
+							size_t nToReadNow = nToRead - offset < READ_AHEAD_MAX_WINDOW ? nToRead - offset : READ_AHEAD_MAX_WINDOW;
+							ReadAheadBeforeRead(&m_readAhead, node, m_currentFilePos + offset, nToReadNow);
+							ret = __ReadFromDriver(data + offset, nToReadNow, m_currentFilePos + offset);
+						}
+					}
 				}
 				else
 				{
@@ -269,6 +226,107 @@ namespace obos
 				m_currentFilePos += nToRead;
 			return ret;
 		}
+		bool FileHandle::ReadAt(char* data, size_t nToRead, uoff_t offset) const
+		{
+			if (m_flags & FLAGS_CLOSED || !m_node)
+			{
+				SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+				return false;
+			}
+			// Input devices are streams, so there's no offset to read at.
+			if (m_flags & FLAGS_IS_INPUT_DEVICE)
+			{
+				SetLastError(OBOS_ERROR_VFS_INVALID_OPERATION_ON_OBJECT);
+				return false;
+			}
+			if (!nToRead)
+				return true;
+			if (offset + nToRead < offset || __TestEof(offset) || __TestEof(offset + (nToRead - 1)))
+			{
+				SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+				return false;
+			}
+			if (!data)
+				return true;
+			if (!__ReadFromDriver(data, nToRead, offset))
+			{
+				SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+				return false;
+			}
+			return true;
+		}
+		bool FileHandle::ReadVectoredAt(const ReadVector* vectors, size_t nVectors, uoff_t offset) const
+		{
+			if (!vectors && nVectors)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			size_t nToRead = 0;
+			for (size_t i = 0; i < nVectors; i++)
+			{
+				if (nToRead + vectors[i].nToRead < nToRead)
+				{
+					SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+					return false;
+				}
+				nToRead += vectors[i].nToRead;
+			}
+			// Check the whole range before reading anything.
+			if (!ReadAt(nullptr, nToRead, offset))
+				return false;
+			if (!nToRead)
+				return true;
+			// The range is read from the filesystem driver in requests of up to a read-ahead window, through one bounce buffer, and scattered into the buffers.
+			// Buffers that are nullptr are gaps, and a window never starts in one, so gaps bigger than a window aren't read at all.
+			const size_t bounceSize = nToRead < READ_AHEAD_MAX_WINDOW ? nToRead : READ_AHEAD_MAX_WINDOW;
+			char* bounce = new char[bounceSize];
+			if (!bounce)
+			{
+				SetLastError(OBOS_ERROR_NO_FREE_REGION);
+				return false;
+			}
+			const uoff_t end = offset + nToRead;
+			uoff_t pos = offset;
+			size_t i = 0, vectorOffset = 0;
+			bool ret = true;
+			while (i < nVectors)
+			{
+				if (!vectors[i].data || vectorOffset == vectors[i].nToRead)
+				{
+					pos += vectors[i].nToRead - vectorOffset;
+					vectorOffset = 0;
+					i++;
+					continue;
+				}
+				size_t windowSize = end - pos < bounceSize ? end - pos : bounceSize;
+				if (!__ReadFromDriver(bounce, windowSize, pos))
+				{
+					ret = false;
+					break;
+				}
+				for (size_t windowOffset = 0; windowOffset < windowSize; )
+				{
+					size_t nToCopy = vectors[i].nToRead - vectorOffset;
+					if (nToCopy > windowSize - windowOffset)
+						nToCopy = windowSize - windowOffset;
+					if (vectors[i].data)
+						utils::memcpy(vectors[i].data + vectorOffset, bounce + windowOffset, nToCopy);
+					windowOffset += nToCopy;
+					vectorOffset += nToCopy;
+					if (vectorOffset == vectors[i].nToRead)
+					{
+						vectorOffset = 0;
+						i++;
+					}
+				}
+				pos += windowSize;
+			}
+			delete[] bounce;
+			if (!ret)
+				SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+			return ret;
+		}
 		bool FileHandle::Write()
 		{
 			SetLastError(OBOS_ERROR_UNIMPLEMENTED_FEATURE);
@@ -293,6 +351,21 @@ namespace obos
 			}
 			return ((DirectoryEntry*)m_node)->filesize;
 		}
+		bool FileHandle::GetReadAheadStatistics(ReadAheadStatistics* stats) const
+		{
+			if (m_flags & FLAGS_CLOSED || !m_node)
+			{
+				SetLastError(OBOS_ERROR_UNOPENED_HANDLE);
+				return false;
+			}
+			if (m_flags & FLAGS_IS_INPUT_DEVICE || !stats)
+			{
+				SetLastError(m_flags & FLAGS_IS_INPUT_DEVICE ? OBOS_ERROR_VFS_INVALID_OPERATION_ON_OBJECT : OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			*stats = m_readAhead.stats;
+			return true;
+		}
 		void FileHandle::GetParent(char* path, size_t* sizePath)
 		{
 			if (m_flags & FLAGS_CLOSED)
@@ -376,6 +449,8 @@ namespace obos
 			}
 			else
 			{
+				// The prefetch uses the node's path, so it has to finish before the handle lets go of the node.
+				ReadAheadReset(&m_readAhead);
 				HandleListNode* nodeInFHR = (HandleListNode*)m_nodeInFileHandlesReferencing;
 				DirectoryEntry* node = (DirectoryEntry*)m_node;
 				if (nodeInFHR->next)
@@ -396,6 +471,22 @@ namespace obos
 			return true;
 		}
 
+		bool FileHandle::__ReadFromDriver(char* data, size_t nToRead, uoff_t offset) const
+		{
+			DirectoryEntry* node = (DirectoryEntry*)m_node;
+			auto& functions = node->mountPoint->filesystemDriver->functionTable.serviceSpecific.filesystem;
+
+			uint64_t driveId = node->mountPoint->partition ? node->mountPoint->partition->drive->driveId : 0;
+			uint8_t drivePartitionId = node->mountPoint->partition ? node->mountPoint->partition->partitionId : 0;
+
+			return functions.ReadFile(
+				driveId,
+				drivePartitionId,
+				node->path,
+				offset,
+				nToRead,
+				data);
+		}
 		bool FileHandle::__TestEof(uoff_t pos) const
 		{
 			if (m_flags & FLAGS_IS_INPUT_DEVICE)
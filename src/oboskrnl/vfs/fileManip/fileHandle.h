@@ -10,6 +10,8 @@
 
 #include <vfs/off_t.h>
 
+#include <vfs/fileManip/readAhead.h>
+
 #define VFS_FILEMANIP_FILEHANDLE_H_INCLUDED
 
 namespace obos
@@ -36,6 +38,13 @@ namespace obos
 				FLAGS_ALLOW_WRITE = 0x2,
 				FLAGS_CLOSED = 0x4,
 			};
+			// One of the buffers of a vectored read.
+			struct ReadVector
+			{
+				// The buffer to read into. If this is nullptr, the bytes are skipped.
+				char* data;
+				size_t nToRead;
+			};
 		public:
 			FileHandle() = default;
 
@@ -57,6 +66,24 @@ namespace obos
 			/// <param name="peek">Whether to increment the stream position.</param>
 			/// <returns>Whether the file could be read (true) or not (false). If it fails, use GetLastError for an error code.</returns>
 			bool Read(char* data, size_t nToRead, bool peek = false);
+			/// <summary>
+			/// Reads "nToRead" bytes at "offset" into "data", without using or changing the stream position.
+			/// This doesn't wait for data, so if the range passes EOF, the function fails with OBOS_ERROR_VFS_READ_ABORTED.
+			/// </summary>
+			/// <param name="data">The buffer to read into.</param>
+			/// <param name="nToRead">The count of bytes to read.</param>
+			/// <param name="offset">The offset in the file to read at.</param>
+			/// <returns>Whether the file could be read (true) or not (false). If it fails, use GetLastError for an error code.</returns>
+			bool ReadAt(char* data, size_t nToRead, uoff_t offset) const;
+			/// <summary>
+			/// Fills several buffers, one after another, from the bytes starting at "offset", without changing the stream position.
+			/// The range is checked against the file's size before anything is read. The range is read from the filesystem driver in requests of up to READ_AHEAD_MAX_WINDOW bytes through one bounce buffer, so a call with many small buffers costs one request per window instead of one per buffer.
+			/// </summary>
+			/// <param name="vectors">The buffers to read into.</param>
+			/// <param name="nVectors">The count of elements in "vectors".</param>
+			/// <param name="offset">The offset in the file of the first buffer.</param>
+			/// <returns>Whether the file could be read (true) or not (false). If it fails, use GetLastError for an error code.</returns>
+			bool ReadVectoredAt(const ReadVector* vectors, size_t nVectors, uoff_t offset) const;
 
 			// TODO: Add a Write syscall when Write is implemented.
 			bool Write(); // Not implemented.
@@ -82,6 +109,12 @@ namespace obos
 			/// <returns>The file's size, or (size_t)-1 on failure</returns>
 			size_t GetFileSize() const;
 			/// <summary>
+			/// Gets the handle's read-ahead counters.
+			/// </summary>
+			/// <param name="stats">[out] The statistics.</param>
+			/// <returns>Whether the statistics could be retrieved (true) or not (false). If it fails, use GetLastError for an error code.</returns>
+			bool GetReadAheadStatistics(ReadAheadStatistics* stats) const;
+			/// <summary>
 			/// Gets the path of the parent directory of the file.
 			/// </summary>
 			/// <param name="path">The buffer to put the path in. This can be nullptr.</param>
@@ -117,11 +150,13 @@ namespace obos
 
 		private:
 			bool __TestEof(uoff_t pos) const;
+			bool __ReadFromDriver(char* data, size_t nToRead, uoff_t offset) const;
 			void* m_pathNode = nullptr; // The node that Open finds.
 			void* m_node = nullptr; // The node that m_pathNode links to if it's a symlink. If m_pathNode is not a symlink, this is the same as m_pathNode.
 			void* m_nodeInFileHandlesReferencing = nullptr;
 			uoff_t m_currentFilePos = 0;
 			uint32_t m_flags = FLAGS_CLOSED;
+			ReadAheadState m_readAhead;
 		};
 	}
 }
\ No newline at end of file
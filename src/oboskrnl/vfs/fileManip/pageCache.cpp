@@ -0,0 +1,340 @@
+/*
+	oboskrnl/vfs/fileManip/pageCache.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <error.h>
+#include <atomic.h>
+#include <memory_manipulation.h>
+
+#include <vfs/fileManip/pageCache.h>
+
+#include <vfs/vfsNode.h>
+
+#include <vfs/mount/mount.h>
+
+#include <driverInterface/struct.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#include <arch/x86_64/memory_manager/physical/allocate.h>
+#include <arch/x86_64/memory_manager/virtual/initialize.h>
+#endif
+
+#define PAGE_CACHE_BUCKETS 1024
+// The cache keeps at most 1/PAGE_CACHE_MEMORY_SHIFT of physical memory in unreferenced pages.
+#define PAGE_CACHE_MEMORY_SHIFT 3
+// Memory is considered under pressure when less than 1/PAGE_CACHE_PRESSURE_SHIFT of it is free.
+#define PAGE_CACHE_PRESSURE_SHIFT 4
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct PageCacheEntry
+		{
+			DirectoryEntry* file;
+			uoff_t offset;
+			uintptr_t phys;
+			// How many times the page is mapped. Pages with references can't be evicted.
+			size_t refs;
+			// The chain of the (file, offset) table.
+			PageCacheEntry* hashNext;
+			// The chain of the physical address table.
+			PageCacheEntry* physNext;
+			// The LRU list of unreferenced pages, with the most recently released page at the head.
+			PageCacheEntry *next, *prev;
+		};
+		static PageCacheEntry* s_buckets[PAGE_CACHE_BUCKETS];
+		static PageCacheEntry* s_physBuckets[PAGE_CACHE_BUCKETS];
+		static PageCacheEntry *s_head, *s_tail;
+		static size_t s_nEntries, s_nReferenced;
+		static size_t s_maxEntries;
+		static bool s_lock;
+		static uint64_t s_nHits, s_nMisses, s_nEvictions;
+
+		static void lockCache()
+		{
+			while (!atomic_cmpxchg(&s_lock, false, true))
+				pause();
+		}
+		static void unlockCache()
+		{
+			atomic_clear(&s_lock);
+		}
+		static size_t hashPage(const DirectoryEntry* file, uoff_t offset)
+		{
+			uint64_t key = (uintptr_t)file ^ (offset / PAGE_CACHE_PAGE_SIZE);
+			key *= 0x9E3779B97F4A7C15;
+			return (key >> 32) % PAGE_CACHE_BUCKETS;
+		}
+		static size_t hashPhys(uintptr_t phys)
+		{
+			uint64_t key = phys / PAGE_CACHE_PAGE_SIZE;
+			key *= 0x9E3779B97F4A7C15;
+			return (key >> 32) % PAGE_CACHE_BUCKETS;
+		}
+		static size_t getMaxEntries()
+		{
+			if (s_maxEntries)
+				return s_maxEntries;
+			memory::PhysicalMemoryStatistics stats{};
+			memory::GetPhysicalMemoryStatistics(&stats);
+			s_maxEntries = stats.totalPages >> PAGE_CACHE_MEMORY_SHIFT;
+			if (!s_maxEntries)
+				s_maxEntries = 16;
+			return s_maxEntries;
+		}
+		static bool memoryUnderPressure()
+		{
+			memory::PhysicalMemoryStatistics stats{};
+			memory::GetPhysicalMemoryStatistics(&stats);
+			return stats.freePages < (stats.totalPages >> PAGE_CACHE_PRESSURE_SHIFT);
+		}
+
+		// These functions expect the cache to be locked.
+
+		static PageCacheEntry* lookup(const DirectoryEntry* file, uoff_t offset)
+		{
+			for (PageCacheEntry* entry = s_buckets[hashPage(file, offset)]; entry; entry = entry->hashNext)
+				if (entry->file == file && entry->offset == offset)
+					return entry;
+			return nullptr;
+		}
+		static PageCacheEntry* lookupPhys(uintptr_t phys)
+		{
+			for (PageCacheEntry* entry = s_physBuckets[hashPhys(phys)]; entry; entry = entry->physNext)
+				if (entry->phys == phys)
+					return entry;
+			return nullptr;
+		}
+		static void unlinkLRU(PageCacheEntry* entry)
+		{
+			if (entry->next)
+				entry->next->prev = entry->prev;
+			if (entry->prev)
+				entry->prev->next = entry->next;
+			if (s_head == entry)
+				s_head = entry->next;
+			if (s_tail == entry)
+				s_tail = entry->prev;
+			entry->next = entry->prev = nullptr;
+		}
+		static void pushLRU(PageCacheEntry* entry)
+		{
+			entry->next = s_head;
+			if (s_head)
+				s_head->prev = entry;
+			s_head = entry;
+			if (!s_tail)
+				s_tail = entry;
+		}
+		static void reference(PageCacheEntry* entry)
+		{
+			if (!entry->refs++)
+			{
+				unlinkLRU(entry);
+				s_nReferenced++;
+			}
+		}
+		static void insert(PageCacheEntry* entry)
+		{
+			PageCacheEntry*& bucket = s_buckets[hashPage(entry->file, entry->offset)];
+			entry->hashNext = bucket;
+			bucket = entry;
+			PageCacheEntry*& physBucket = s_physBuckets[hashPhys(entry->phys)];
+			entry->physNext = physBucket;
+			physBucket = entry;
+			if (entry->refs)
+				s_nReferenced++;
+			else
+				pushLRU(entry);
+			s_nEntries++;
+		}
+		// Removes an unreferenced page, and puts it on 'evicted' so it can be freed once the cache is unlocked.
+		static void remove(PageCacheEntry* entry, PageCacheEntry*& evicted)
+		{
+			PageCacheEntry** link = &s_buckets[hashPage(entry->file, entry->offset)];
+			while (*link != entry)
+				link = &(*link)->hashNext;
+			*link = entry->hashNext;
+			link = &s_physBuckets[hashPhys(entry->phys)];
+			while (*link != entry)
+				link = &(*link)->physNext;
+			*link = entry->physNext;
+			unlinkLRU(entry);
+			s_nEntries--;
+			entry->hashNext = evicted;
+			evicted = entry;
+		}
+		// Evicts the least recently released pages until nPages were evicted, or no unreferenced pages are left.
+		static size_t evict(size_t nPages, PageCacheEntry*& evicted)
+		{
+			size_t nFreed = 0;
+			for (; s_tail && nFreed < nPages; nFreed++)
+			{
+				remove(s_tail, evicted);
+				s_nEvictions++;
+			}
+			return nFreed;
+		}
+		// Makes room for nNew more pages.
+		static void makeRoom(size_t nNew, size_t maxEntries, bool pressure, PageCacheEntry*& evicted)
+		{
+			if (pressure)
+				evict((s_nEntries - s_nReferenced) / 4 + nNew, evicted);
+			else if (s_nEntries + nNew > maxEntries)
+				evict(s_nEntries + nNew - maxEntries, evicted);
+		}
+
+		static void freeEntries(PageCacheEntry* list)
+		{
+			while (list)
+			{
+				PageCacheEntry* next = list->hashNext;
+				memory::freePhysicalPage(list->phys);
+				delete list;
+				list = next;
+			}
+		}
+		// Reads a page of a file into a new physical page.
+		static uintptr_t loadPage(DirectoryEntry* file, uoff_t offset)
+		{
+			uintptr_t phys = memory::allocatePhysicalPage();
+			if (!phys && PageCacheShrink(1))
+				phys = memory::allocatePhysicalPage();
+			if (!phys)
+			{
+				SetLastError(OBOS_ERROR_NO_FREE_REGION);
+				return 0;
+			}
+			byte* data = (byte*)memory::mapPageTable((uintptr_t*)phys);
+			size_t nToRead = file->filesize - offset < PAGE_CACHE_PAGE_SIZE ? file->filesize - offset : PAGE_CACHE_PAGE_SIZE;
+			// The part of the last page past the end of the file must be zero.
+			if (nToRead < PAGE_CACHE_PAGE_SIZE)
+				utils::memzero(data + nToRead, PAGE_CACHE_PAGE_SIZE - nToRead);
+			auto& functions = file->mountPoint->filesystemDriver->functionTable.serviceSpecific.filesystem;
+			uint64_t driveId = file->mountPoint->partition ? file->mountPoint->partition->drive->driveId : 0;
+			uint8_t drivePartitionId = file->mountPoint->partition ? file->mountPoint->partition->partitionId : 0;
+			if (!functions.ReadFile(driveId, drivePartitionId, file->path, offset, nToRead, (char*)data))
+			{
+				memory::freePhysicalPage(phys);
+				SetLastError(OBOS_ERROR_VFS_READ_ABORTED);
+				return 0;
+			}
+			return phys;
+		}
+
+		uintptr_t PageCacheGetPage(DirectoryEntry* file, uoff_t offset)
+		{
+			if (!file || file->direntType == DIRECTORY_ENTRY_TYPE_DIRECTORY || offset % PAGE_CACHE_PAGE_SIZE || offset >= file->filesize)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return 0;
+			}
+			uintptr_t ret = PageCacheFindPage(file, offset);
+			if (ret)
+				return ret;
+			// The page is read with the cache unlocked, so another thread could add it in the meantime.
+			uintptr_t phys = loadPage(file, offset);
+			if (!phys)
+				return 0;
+			PageCacheEntry* entry = new PageCacheEntry{};
+			entry->file = file;
+			entry->offset = offset;
+			entry->phys = phys;
+			entry->refs = 1;
+			PageCacheEntry* evicted = nullptr;
+			size_t maxEntries = getMaxEntries();
+			bool pressure = memoryUnderPressure();
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			s_nMisses++;
+			PageCacheEntry* existing = lookup(file, offset);
+			if (existing)
+			{
+				reference(existing);
+				ret = existing->phys;
+			}
+			else
+			{
+				makeRoom(1, maxEntries, pressure, evicted);
+				insert(entry);
+				ret = phys;
+			}
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			if (existing)
+			{
+				entry->hashNext = evicted;
+				evicted = entry;
+			}
+			freeEntries(evicted);
+			return ret;
+		}
+		uintptr_t PageCacheFindPage(DirectoryEntry* file, uoff_t offset)
+		{
+			uintptr_t ret = 0;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			PageCacheEntry* entry = lookup(file, offset);
+			if (entry)
+			{
+				reference(entry);
+				ret = entry->phys;
+				s_nHits++;
+			}
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			return ret;
+		}
+		bool PageCacheReleasePage(uintptr_t phys)
+		{
+			PageCacheEntry* evicted = nullptr;
+			size_t maxEntries = getMaxEntries();
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			PageCacheEntry* entry = lookupPhys(phys);
+			if (entry && entry->refs && !--entry->refs)
+			{
+				s_nReferenced--;
+				pushLRU(entry);
+				if (s_nEntries > maxEntries)
+					evict(s_nEntries - maxEntries, evicted);
+			}
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(evicted);
+			return entry != nullptr;
+		}
+		size_t PageCacheShrink(size_t nPages)
+		{
+			PageCacheEntry* evicted = nullptr;
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			size_t nFreed = evict(nPages, evicted);
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+			freeEntries(evicted);
+			return nFreed;
+		}
+		void GetPageCacheStatistics(PageCacheStatistics* stats)
+		{
+			if (!stats)
+				return;
+			size_t maxEntries = getMaxEntries();
+			uintptr_t flags = saveFlagsAndCLI();
+			lockCache();
+			stats->nHits = s_nHits;
+			stats->nMisses = s_nMisses;
+			stats->nEvictions = s_nEvictions;
+			stats->nCachedPages = s_nEntries;
+			stats->nReferencedPages = s_nReferenced;
+			stats->maxCachedPages = maxEntries;
+			unlockCache();
+			restorePreviousInterruptStatus(flags);
+		}
+	}
+}
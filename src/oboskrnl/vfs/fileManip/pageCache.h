@@ -0,0 +1,72 @@
+/*
+	oboskrnl/vfs/fileManip/pageCache.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+#include <export.h>
+
+#include <vfs/off_t.h>
+
+// The size of a page in the page cache.
+#define PAGE_CACHE_PAGE_SIZE 4096
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct DirectoryEntry;
+		struct PageCacheStatistics
+		{
+			// Requests for a page that was in the cache.
+			size_t nHits;
+			// Requests for a page that had to be read from the file.
+			size_t nMisses;
+			// Unreferenced pages dropped to make room for others, or because of memory pressure.
+			size_t nEvictions;
+			size_t nCachedPages;
+			// Pages that are mapped somewhere, and so can't be evicted.
+			size_t nReferencedPages;
+			// The cache starts evicting unreferenced pages once nCachedPages reaches this.
+			size_t maxCachedPages;
+		};
+
+		/// <summary>
+		/// Gets the physical page that holds a page of a file, reading it from the file if it isn't cached.<para></para>
+		/// The page is shared by everything that maps it, so it must only be mapped read-only.
+		/// Every successful call must be matched by a call to PageCacheReleasePage.
+		/// </summary>
+		/// <param name="file">The file.</param>
+		/// <param name="offset">The offset of the page in the file. This must be page-aligned, and less than the file's size.</param>
+		/// <returns>The page's physical address, or zero on failure. If it fails, use GetLastError for an error code.</returns>
+		uintptr_t PageCacheGetPage(DirectoryEntry* file, uoff_t offset);
+		/// <summary>
+		/// Like PageCacheGetPage, but never reads from the file.
+		/// </summary>
+		/// <param name="file">The file.</param>
+		/// <param name="offset">The offset of the page in the file. This must be page-aligned.</param>
+		/// <returns>The page's physical address, or zero if the page isn't cached.</returns>
+		uintptr_t PageCacheFindPage(DirectoryEntry* file, uoff_t offset);
+		/// <summary>
+		/// Drops a reference to a page returned by PageCacheGetPage or PageCacheFindPage.
+		/// The page stays cached after its last reference is dropped, until it's evicted.
+		/// </summary>
+		/// <param name="phys">The page's physical address.</param>
+		/// <returns>Whether the page belongs to the page cache (true) or not (false).</returns>
+		bool PageCacheReleasePage(uintptr_t phys);
+		/// <summary>
+		/// Evicts unreferenced pages from the page cache.
+		/// </summary>
+		/// <param name="nPages">The amount of pages to try to free.</param>
+		/// <returns>The amount of pages freed.</returns>
+		OBOS_EXPORT size_t PageCacheShrink(size_t nPages);
+		/// <summary>
+		/// Gets the page cache's counters.
+		/// </summary>
+		/// <param name="stats">[out] The statistics.</param>
+		OBOS_EXPORT void GetPageCacheStatistics(PageCacheStatistics* stats);
+	}
+}
@@ -0,0 +1,217 @@
+/*
+	oboskrnl/vfs/fileManip/readAhead.cpp
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#include <int.h>
+#include <atomic.h>
+
+#include <vfs/fileManip/readAhead.h>
+
+#include <vfs/vfsNode.h>
+
+#include <driverInterface/struct.h>
+
+#include <multitasking/cpu_local.h>
+#include <multitasking/thread.h>
+#include <multitasking/threadAPI/thrHandle.h>
+#include <multitasking/locks/waitQueue.h>
+
+#if defined(__x86_64__) || defined(_WIN64)
+#include <x86_64-utils/asm.h>
+#endif
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct ReadAheadJob
+		{
+			driverInterface::driverIdentity* filesystemDriver;
+			uint32_t driveId;
+			uint8_t partitionId;
+			const char* path;
+			uoff_t offset;
+			size_t size;
+			bool done;
+			// The handle waits on this for the prefetch to finish.
+			locks::WaitQueue event;
+			ReadAheadJob* next;
+		};
+		struct ReadAheadWorker
+		{
+			ReadAheadJob *head, *tail;
+			bool lock;
+			locks::WaitQueue jobsAvailable;
+			thread::ThreadHandle thread;
+		};
+		static ReadAheadWorker* s_worker;
+		static bool s_workerCreationLock;
+
+		static bool hasJobs(void* udata)
+		{
+			return ((ReadAheadWorker*)udata)->head != nullptr;
+		}
+		static bool setDone(thread::Thread*, void* udata)
+		{
+			((ReadAheadJob*)udata)->done = true;
+			return true;
+		}
+		static void readAheadThread(uintptr_t udata)
+		{
+			ReadAheadWorker* worker = (ReadAheadWorker*)udata;
+			char* scratch = new char[READ_AHEAD_CHUNK_SIZE];
+			while (true)
+			{
+				worker->jobsAvailable.WaitFor(hasJobs, worker);
+				uintptr_t flags = saveFlagsAndCLI();
+				while (!atomic_cmpxchg(&worker->lock, false, true))
+					pause();
+				ReadAheadJob* job = worker->head;
+				worker->head = job->next;
+				if (!worker->head)
+					worker->tail = nullptr;
+				atomic_clear(&worker->lock);
+				restorePreviousInterruptStatus(flags);
+				// The data is thrown away; reading it is enough to put it in the buffer cache.
+				auto& functions = job->filesystemDriver->functionTable.serviceSpecific.filesystem;
+				for (size_t offset = 0; offset < job->size; offset += READ_AHEAD_CHUNK_SIZE)
+				{
+					size_t nToRead = job->size - offset < READ_AHEAD_CHUNK_SIZE ? job->size - offset : READ_AHEAD_CHUNK_SIZE;
+					if (!functions.ReadFile(job->driveId, job->partitionId, job->path, job->offset + offset, nToRead, scratch))
+						break;
+				}
+				// The handle can free the job as soon as it sees done, so it's set with the event locked.
+				job->event.WakeOne(setDone, job);
+			}
+		}
+		static ReadAheadWorker* getWorker()
+		{
+			ReadAheadWorker* worker = __atomic_load_n(&s_worker, __ATOMIC_ACQUIRE);
+			if (worker)
+				return worker;
+			while (!atomic_cmpxchg(&s_workerCreationLock, false, true))
+				pause();
+			if (!s_worker)
+			{
+				worker = new ReadAheadWorker{};
+				// The idle thread's owner is always the kernel's process.
+				if (worker->thread.CreateThread(
+					thread::THREAD_PRIORITY_NORMAL,
+					0,
+					readAheadThread,
+					(uintptr_t)worker,
+					thread::g_defaultAffinity,
+					thread::GetCurrentCpuLocalPtr()->idleThread->owner,
+					false))
+					__atomic_store_n(&s_worker, worker, __ATOMIC_RELEASE);
+				else
+					delete worker;
+			}
+			worker = s_worker;
+			atomic_clear(&s_workerCreationLock);
+			return worker;
+		}
+		static ReadAheadJob* startJob(DirectoryEntry* node, uoff_t offset, size_t size)
+		{
+			ReadAheadWorker* worker = getWorker();
+			if (!worker)
+				return nullptr;
+			ReadAheadJob* job = new ReadAheadJob{};
+			job->filesystemDriver = node->mountPoint->filesystemDriver;
+			job->driveId = node->mountPoint->partition->drive->driveId;
+			job->partitionId = node->mountPoint->partition->partitionId;
+			job->path = node->path.str;
+			job->offset = offset;
+			job->size = size;
+			uintptr_t flags = saveFlagsAndCLI();
+			while (!atomic_cmpxchg(&worker->lock, false, true))
+				pause();
+			if (worker->tail)
+				worker->tail->next = job;
+			else
+				worker->head = job;
+			worker->tail = job;
+			atomic_clear(&worker->lock);
+			restorePreviousInterruptStatus(flags);
+			worker->jobsAvailable.WakeOne();
+			return job;
+		}
+		static bool jobDone(void* udata)
+		{
+			return ((ReadAheadJob*)udata)->done;
+		}
+		static void finishJob(ReadAheadState* state)
+		{
+			if (!state->job)
+				return;
+			// This also waits for the worker to unlock the event, as done is checked with it locked.
+			state->job->event.WaitFor(jobDone, state->job);
+			delete state->job;
+			state->job = nullptr;
+		}
+
+		void ReadAheadBeforeRead(ReadAheadState* state, DirectoryEntry* node, uoff_t pos, size_t nToRead)
+		{
+			// Only files on a drive are worth prefetching.
+			if (!state || !node || !nToRead || !node->mountPoint || node->mountPoint->isInitrd || !node->mountPoint->partition)
+				return;
+			ReadAheadJob* job = state->job;
+			// Wait for a prefetch of what we're about to read, instead of reading it twice.
+			if (job && (job->done || (pos < job->offset + job->size && pos + nToRead > job->offset)))
+				finishJob(state);
+			ReadAheadStatistics& stats = state->stats;
+			stats.nReads++;
+			if (pos >= state->prefetchedStart && pos + nToRead <= state->prefetchedEnd)
+				stats.nHits++;
+			const uoff_t readEnd = pos + nToRead;
+			if (pos != state->nextPos)
+			{
+				// Random access: stop prefetching until the handle is read sequentially again.
+				state->nextPos = readEnd;
+				state->window = 0;
+				state->prefetchedStart = state->prefetchedEnd = 0;
+				stats.window = 0;
+				return;
+			}
+			stats.nSequentialReads++;
+			state->nextPos = readEnd;
+			if (!state->window)
+			{
+				state->window = nToRead * 2;
+				if (state->window < READ_AHEAD_MIN_WINDOW)
+					state->window = READ_AHEAD_MIN_WINDOW;
+				if (state->window > READ_AHEAD_MAX_WINDOW)
+					state->window = READ_AHEAD_MAX_WINDOW;
+			}
+			// Prefetch once the reader is half a window away from the end of the prefetched data, so it never catches up.
+			if (state->job || readEnd + state->window / 2 < state->prefetchedEnd)
+				return;
+			uoff_t start = state->prefetchedEnd > readEnd ? state->prefetchedEnd : readEnd;
+			uoff_t end = start + state->window;
+			if (end > node->filesize)
+				end = node->filesize;
+			if (start >= end)
+				return;
+			state->job = startJob(node, start, end - start);
+			if (!state->job)
+				return;
+			if (start != state->prefetchedEnd)
+				state->prefetchedStart = start;
+			state->prefetchedEnd = end;
+			stats.nPrefetches++;
+			stats.bytesPrefetched += end - start;
+			// The handle is being streamed, so prefetch more next time.
+			state->window = state->window * 2 > READ_AHEAD_MAX_WINDOW ? READ_AHEAD_MAX_WINDOW : state->window * 2;
+			stats.window = state->window;
+		}
+		void ReadAheadReset(ReadAheadState* state)
+		{
+			if (!state)
+				return;
+			finishJob(state);
+			*state = ReadAheadState{};
+		}
+	}
+}
@@ -0,0 +1,65 @@
+/*
+	oboskrnl/vfs/fileManip/readAhead.h
+
+	Copyright (c) 2024 Omar Berrow
+*/
+
+#pragma once
+
+#include <int.h>
+
+#include <vfs/off_t.h>
+
+// The first window prefetched when a handle starts being read sequentially.
+#define READ_AHEAD_MIN_WINDOW 0x4000
+// The window doubles on every prefetch, up to this.
+#define READ_AHEAD_MAX_WINDOW 0x40000
+// Prefetches are read in pieces of at most this size, so each one fits in the buffer cache.
+#define READ_AHEAD_CHUNK_SIZE 0x10000
+
+namespace obos
+{
+	namespace vfs
+	{
+		struct DirectoryEntry;
+		struct ReadAheadJob;
+		struct ReadAheadStatistics
+		{
+			// Reads of the file through the handle.
+			size_t nReads;
+			// Reads that started where the last one ended.
+			size_t nSequentialReads;
+			// Reads that were entirely in data that was prefetched.
+			size_t nHits;
+			size_t nPrefetches;
+			size_t bytesPrefetched;
+			// How much is prefetched next.
+			size_t window;
+		};
+		struct ReadAheadState
+		{
+			// Where the next read starts if the handle is being read sequentially.
+			uoff_t nextPos = 0;
+			// The range that was prefetched, or is being prefetched.
+			uoff_t prefetchedStart = 0, prefetchedEnd = 0;
+			size_t window = 0;
+			// The handle's prefetch, if it's still owned by the handle.
+			ReadAheadJob* job = nullptr;
+			ReadAheadStatistics stats{};
+		};
+
+		/// <summary>
+		/// Called before a file handle reads from a file. Detects sequential access, and starts prefetching the next window in the background.
+		/// </summary>
+		/// <param name="state">The handle's read-ahead state.</param>
+		/// <param name="node">The file.</param>
+		/// <param name="pos">Where the read starts.</param>
+		/// <param name="nToRead">The read's size.</param>
+		void ReadAheadBeforeRead(ReadAheadState* state, DirectoryEntry* node, uoff_t pos, size_t nToRead);
+		/// <summary>
+		/// Waits for the handle's prefetch, and resets the state. Called when a handle is closed.
+		/// </summary>
+		/// <param name="state">The handle's read-ahead state.</param>
+		void ReadAheadReset(ReadAheadState* state);
+	}
+}
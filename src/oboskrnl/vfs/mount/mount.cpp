@@ -20,11 +20,18 @@
 
 #include <multitasking/process/process.h>
 
+#include <multitasking/locks/mutex.h>
+
+#include <vfs/fileManip/dentryCache.h>
+
+#include <atomic.h>
+
 namespace obos
 {
 	namespace vfs
 	{
 		utils::Vector<MountPoint*> g_mountPoints;
+		locks::RwLock g_mountPointsLock;
 		// Don't make static!
 		void dividePathToTokens(const char* filepath, const char**& tokens, size_t& nTokens, bool useOffset = true)
 		{
@@ -52,6 +59,13 @@ namespace obos
 				}
 			}
 		}
+		// Builds the child tables of a tree that was read from the filesystem driver all at once.
+		static void buildChildTables(DirectoryEntryList& list)
+		{
+			for (DirectoryEntry* entry = list.head; entry; entry = entry->next)
+				buildChildTables(entry->children);
+			DentryBuildChildTable(&list);
+		}
 		static bool setupMountPointEntries(MountPoint* point)
 		{
 			if (point->filesystemDriver->_serviceType != (point->isInitrd + driverInterface::OBOS_SERVICE_TYPE_FILESYSTEM))
@@ -60,6 +74,12 @@ namespace obos
 				return false;
 			}
 			auto functions = point->filesystemDriver->functionTable.serviceSpecific.filesystem;
+			if (functions.DirectoryIteratorCreate)
+			{
+				// The directories are read as they're looked up, see PopulateDirectory.
+				point->childrenPending = true;
+				return true;
+			}
 			uint32_t driveId = !point->partition ? 0 : point->partition->drive->driveId;
 			uint8_t drivePartitionId = !point->partition ? 0 : point->partition->partitionId;
 			uintptr_t fileIterator = 0;
@@ -237,22 +257,59 @@ namespace obos
 				SetLastError(OBOS_ERROR_VFS_DRIVER_FAILURE);
 				return false;
 			}
+			buildChildTables(point->children);
 
 			return true;
 		}
-		bool mount(uint32_t& point, uint32_t driveId, uint32_t partitionId, bool isInitrd, bool failIfPartitionHasMountPoint)
+		// Expects g_mountPointsLock to be held.
+		static bool mountPointIdUsed(uint32_t id)
+		{
+			for (auto _point : g_mountPoints)
+				if (_point && _point->id == id)
+					return true;
+			return false;
+		}
+		static void freeEntries(DirectoryEntryList& list)
+		{
+			for (DirectoryEntry* entry = list.head; entry; )
+			{
+				DirectoryEntry* next = entry->next;
+				freeEntries(entry->children);
+				delete[] entry->path.str;
+				delete entry;
+				entry = next;
+			}
+			delete[] list.buckets;
+			list = {};
+		}
+		// Gives the mount point its id, and adds it to g_mountPoints.
+		// The id is checked again here, as another mount could've taken it while this one was set up.
+		static bool insertMountPoint(MountPoint* newPoint, uint32_t& point)
 		{
-			if (point != 0xffffffff)
+			g_mountPointsLock.LockExclusive();
+			if (point != 0xffffffff && mountPointIdUsed(point))
 			{
-				uint32_t prevError = GetLastError();
+				g_mountPointsLock.UnlockExclusive();
 				SetLastError(OBOS_ERROR_VFS_ALREADY_MOUNTED);
-				for(auto _point : g_mountPoints)
-					if (_point && _point->id == point)
-						return false;
-				SetLastError(prevError);
+				return false;
 			}
 			if (point == 0xffffffff)
-				point = g_mountPoints.length();
+				for (point = g_mountPoints.length(); mountPointIdUsed(point); point++);
+			newPoint->id = point;
+			g_mountPoints.push_back(newPoint);
+			g_mountPointsLock.UnlockExclusive();
+			return true;
+		}
+		bool mount(uint32_t& point, uint32_t driveId, uint32_t partitionId, bool isInitrd, bool failIfPartitionHasMountPoint)
+		{
+			// The mount point is set up without the lock held, as that reads from the disk.
+			g_mountPointsLock.LockShared();
+			if (point != 0xffffffff && mountPointIdUsed(point))
+			{
+				g_mountPointsLock.UnlockShared();
+				SetLastError(OBOS_ERROR_VFS_ALREADY_MOUNTED);
+				return false;
+			}
 			MountPoint* existingMountPoint = nullptr;
 			for(size_t i = 0; i < g_mountPoints.length(); i++)
 			{
@@ -275,6 +332,7 @@ namespace obos
 					}
 				}
 			}
+			g_mountPointsLock.UnlockShared();
 			if (existingMountPoint && failIfPartitionHasMountPoint)
 			{
 				point = existingMountPoint->id;
@@ -283,20 +341,21 @@ namespace obos
 			}
 			MountPoint* newPoint = new MountPoint;
 			utils::memzero(newPoint, sizeof(*newPoint));
-			newPoint->id = point;
 			newPoint->isInitrd = isInitrd;
 			if (existingMountPoint)
 			{
 				newPoint->filesystemDriver = existingMountPoint->filesystemDriver;
 				newPoint->partition = existingMountPoint->partition;
 				newPoint->children = existingMountPoint->children;
+				newPoint->childrenPending = existingMountPoint->childrenPending;
+				newPoint->populateLock = existingMountPoint->populateLock;
 				newPoint->otherMountPointsReferencing++;
 			}
 			else
 			{
 				if (isInitrd)
 				{
-					newPoint->filesystemDriver = driverInterface::g_driverInterfaces.at(0);
+					newPoint->filesystemDriver = driverInterface::GetDriverInterface(0);
 					newPoint->partition = nullptr;
 				}
 				else 
@@ -325,14 +384,118 @@ namespace obos
 					}
 					delete drv;
 				}
-				bool ret = setupMountPointEntries(newPoint);
-				if (ret)
-					g_mountPoints.push_back(newPoint);
-				return ret;
+				newPoint->populateLock = new locks::Mutex{};
+				if (!setupMountPointEntries(newPoint) || !insertMountPoint(newPoint, point))
+				{
+					freeEntries(newPoint->children);
+					delete newPoint->populateLock;
+					delete newPoint;
+					return false;
+				}
+				return true;
+			}
+			if (!insertMountPoint(newPoint, point))
+			{
+				// The entries belong to the existing mount point.
+				delete newPoint;
+				return false;
 			}
-			g_mountPoints.push_back(newPoint);
 			return true;
 		}
+		bool PopulateDirectory(GeneralFSNode* directory)
+		{
+			if (!directory)
+			{
+				SetLastError(OBOS_ERROR_INVALID_PARAMETER);
+				return false;
+			}
+			if (!atomic_test(&directory->childrenPending))
+				return true;
+			MountPoint* point = directory->type == VFS_NODE_MOUNTPOINT ? (MountPoint*)directory : ((DirectoryEntry*)directory)->mountPoint;
+			const char* dirPath = directory->type == VFS_NODE_MOUNTPOINT ? "" : ((DirectoryEntry*)directory)->path.str;
+			auto functions = point->filesystemDriver->functionTable.serviceSpecific.filesystem;
+			uint32_t driveId = !point->partition ? 0 : point->partition->drive->driveId;
+			uint8_t drivePartitionId = !point->partition ? 0 : point->partition->partitionId;
+			point->populateLock->Lock();
+			// Another thread might've populated the directory while we waited.
+			if (!directory->childrenPending)
+			{
+				point->populateLock->Unlock();
+				return true;
+			}
+			uintptr_t iter = 0;
+			if (!functions.DirectoryIteratorCreate(driveId, drivePartitionId, dirPath, &iter))
+			{
+				point->populateLock->Unlock();
+				SetLastError(OBOS_ERROR_VFS_DRIVER_FAILURE);
+				return false;
+			}
+			// Build the list on the side, so lookups don't see a partial directory.
+			DirectoryEntryList children{};
+			bool ret = true;
+			while (1)
+			{
+				const char* filepath = nullptr;
+				void(*freeFilepath)(void* buff) = nullptr;
+				size_t filesize = 0;
+				driverInterface::fileAttributes fAttributes;
+				if (!functions.FileIteratorNext(iter, &filepath, &freeFilepath, &filesize, &fAttributes))
+				{
+					ret = false;
+					break;
+				}
+				if (fAttributes == driverInterface::FILE_DOESNT_EXIST)
+					break;
+				DirectoryEntry* entry = nullptr;
+				if (fAttributes & driverInterface::FILE_ATTRIBUTES_DIRECTORY)
+				{
+					entry = new Directory{};
+					entry->childrenPending = true;
+				}
+				else
+				{
+					entry = new DirectoryEntry{};
+					entry->direntType = DIRECTORY_ENTRY_TYPE_FILE;
+				}
+				size_t szPath = utils::strlen(filepath);
+				for (; szPath && filepath[szPath - 1] == '/'; szPath--);
+				entry->path = (char*)utils::memcpy(utils::memzero(new char[szPath + 1], szPath + 1), filepath, szPath);
+				freeFilepath((void*)filepath);
+				entry->fileAttrib = fAttributes;
+				entry->filesize = filesize;
+				entry->mountPoint = point;
+				// The entries directly in the mount point don't have a parent.
+				entry->parent = directory->type == VFS_NODE_MOUNTPOINT ? nullptr : (DirectoryEntry*)directory;
+				if (children.tail)
+					children.tail->next = entry;
+				if (!children.head)
+					children.head = entry;
+				entry->prev = children.tail;
+				children.tail = entry;
+				children.size++;
+			}
+			functions.FileIteratorClose(iter);
+			if (ret)
+			{
+				DentryBuildChildTable(&children);
+				directory->children = children;
+				DentryInvalidateDirectory(directory);
+				atomic_clear(&directory->childrenPending);
+			}
+			else
+			{
+				for (DirectoryEntry* entry = children.head; entry; )
+				{
+					DirectoryEntry* next = entry->next;
+					delete[] entry->path.str;
+					delete entry;
+					entry = next;
+				}
+				SetLastError(OBOS_ERROR_VFS_DRIVER_FAILURE);
+			}
+			point->populateLock->Unlock();
+			return ret;
+		}
 		bool unmount(uint32_t /*mountPoint*/)
 		{
 			// TODO: Implement.
@@ -340,20 +503,24 @@ namespace obos
 			return false;
 		}
 
-		uint64_t getPartitionIDForMountPoint(uint32_t mountPoint)
+		MountPoint* getMountPoint(uint32_t mountPoint)
 		{
-			MountPoint* _mountPoint = nullptr;
+			MountPoint* ret = nullptr;
+			g_mountPointsLock.LockShared();
 			for (size_t i = 0; i < g_mountPoints.length(); i++)
 			{
-				if (g_mountPoints[i])
+				if (g_mountPoints[i] && g_mountPoints[i]->id == mountPoint)
 				{
-					if (g_mountPoints[i]->id == mountPoint)
-					{
-						_mountPoint = g_mountPoints[i];
-						break;
-					}
+					ret = g_mountPoints[i];
+					break;
 				}
 			}
+			g_mountPointsLock.UnlockShared();
+			return ret;
+		}
+		uint64_t getPartitionIDForMountPoint(uint32_t mountPoint)
+		{
+			MountPoint* _mountPoint = getMountPoint(mountPoint);
 			if (!_mountPoint)
 				return 0xffffffffffffffff;
 			if (!_mountPoint->partition)
@@ -366,6 +533,7 @@ namespace obos
 			if (!oMountPoints)
 				return;
 			utils::Vector<uint32_t> mPoints;
+			g_mountPointsLock.LockShared();
 			for (size_t i = 0; i < g_mountPoints.length(); i++)
 			{
 				auto mountPoint = g_mountPoints[i];
@@ -373,6 +541,7 @@ namespace obos
 				if (mountPoint->partition->drive->driveId == driveId && mountPoint->partition->partitionId == partitionId)
 					mPoints.push_back(mountPoint->id);
 			}
+			g_mountPointsLock.UnlockShared();
 			if (mPoints.length() == 0)
 				return;
 			*oMountPoints = new uint32_t[mPoints.length()];
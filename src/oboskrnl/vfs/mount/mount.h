@@ -11,11 +11,15 @@
 
 #include <vfs/vfsNode.h>
 
+#include <multitasking/locks/rwLock.h>
+
 namespace obos
 {
 	namespace vfs
 	{
 		extern utils::Vector<MountPoint*> g_mountPoints;
+		// Protects g_mountPoints. Anything that only looks at the mount points only needs to lock it shared.
+		extern locks::RwLock g_mountPointsLock;
 		/// <summary>
 		/// Mounts a partition. You can mount a partition multiple times.
 		/// </summary>
@@ -41,6 +45,13 @@ namespace obos
 		/// <returns>UINT64_MAX on failure, otherwise the top 32-bits are the drive id, and the bottom 32-bits are the partition id</returns>
 		uint64_t getPartitionIDForMountPoint(uint32_t mountPoint);
 
+		/// <summary>
+		/// Finds a mount point from its id.
+		/// </summary>
+		/// <param name="mountPoint">The mount point's id.</param>
+		/// <returns>The mount point, or nullptr if it doesn't exist.</returns>
+		MountPoint* getMountPoint(uint32_t mountPoint);
+
 		/// <summary>
 		/// Gets the mount points for a partition id.
 		/// </summary>
@@ -48,5 +59,13 @@ namespace obos
 		/// <param name="partitionId">The partition id to find.</param>
 		/// <param name="oMountPoints">A pointer to an array allocated by the function containing all the mount points that use partition id.</param>
 		void getMountPointsForPartitionID(uint32_t driveId, uint32_t partitionId, uint32_t** oMountPoints);
+
+		/// <summary>
+		/// Reads a directory's children from the filesystem driver, if they weren't read yet.<para></para>
+		/// This must be called before a directory's or mount point's children are looked at.
+		/// </summary>
+		/// <param name="directory">The directory, or mount point.</param>
+		/// <returns>Whether the function succeeded (true) or not (false)</returns>
+		bool PopulateDirectory(GeneralFSNode* directory);
 	}
 }
\ No newline at end of file
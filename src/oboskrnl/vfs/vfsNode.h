@@ -16,6 +16,10 @@
 
 namespace obos
 {
+	namespace locks
+	{
+		class Mutex;
+	}
 	namespace vfs
 	{
 		struct VFSString
@@ -58,6 +62,10 @@ namespace obos
 		{
 			struct DirectoryEntry *head = nullptr, *tail = nullptr;
 			size_t size = 0;
+			// The entries by name, chained through DirectoryEntry::hashNext. nullptr for small lists, which are searched instead.
+			// See DentryBuildChildTable in vfs/fileManip/dentryCache.h
+			struct DirectoryEntry **buckets = nullptr;
+			size_t nBuckets = 0;
 		};
 		struct VFSNode
 		{
@@ -77,6 +85,8 @@ namespace obos
 			// If this is moved to DirectoryEntry, don't forget to change how SyscallDirectoryIteratorGetParent() works, or you won't have a good time.
 			struct DirectoryEntry *parent = nullptr;
 			DirectoryEntryList children{};
+			// Set while the node's children haven't been read from the filesystem driver yet. See PopulateDirectory in vfs/mount/mount.h
+			bool childrenPending = false;
 		};
 		struct MountPoint : public GeneralFSNode
 		{
@@ -87,6 +97,8 @@ namespace obos
 			bool isInitrd = false;
 			driverInterface::driverIdentity* filesystemDriver = nullptr; // The filesystem driver to invoke.
 			uint32_t otherMountPointsReferencing = 0;
+			// Taken while the mount point's directories are populated.
+			locks::Mutex* populateLock = nullptr;
 
 			void* operator new(size_t)
 			{
@@ -143,6 +155,7 @@ namespace obos
 			size_t filesize = 0;
 			VFSString path{}; // Never should be null.
 			DirectoryEntry* linkedNode = nullptr; // Only non-null when direntType == DIRECTORY_ENTRY_TYPE_SYMLINK
+			DirectoryEntry* hashNext = nullptr; // The next entry in the same bucket of the parent's child table.
 			struct MountPoint* mountPoint = nullptr;
 			HandleList fileHandlesReferencing{};
 			void* operator new(size_t)
@@ -216,6 +229,7 @@ namespace obos
 			uint32_t driveId = 0;
 			bool isReadOnly = false;
 			driverInterface::driverIdentity* storageDriver = nullptr; // The storage driver to invoke.
+			struct IoQueue* ioQueue = nullptr; // Made on the drive's first queued request. See vfs/devManip/ioScheduler.h
 			PartitionEntry *firstPartition = nullptr,
 						   *lastPartition  = nullptr;
 			size_t nPartitions = 0;
@@ -36,6 +36,48 @@ bool ReadFile(uintptr_t hnd, char* buff, size_t nToRead, bool peek = false)
 	} pars{ hnd, buff, nToRead, peek };
 	return syscall(15, &pars);
 }
+bool ReadFileAt(uintptr_t hnd, char* buff, size_t nToRead, uint64_t offset)
+{
+	struct _par
+	{
+		alignas(0x10) uintptr_t hnd;
+		alignas(0x10) char* data;
+		alignas(0x10) size_t nToRead;
+		alignas(0x10) uint64_t offset;
+	} pars{ hnd, buff, nToRead, offset };
+	return syscall(71, &pars);
+}
+struct ReadVector
+{
+	char* data; // nullptr to skip the bytes.
+	size_t nToRead;
+};
+bool ReadFileVectoredAt(uintptr_t hnd, const ReadVector* vectors, size_t nVectors, uint64_t offset)
+{
+	struct _par
+	{
+		alignas(0x10) uintptr_t hnd;
+		alignas(0x10) const ReadVector* vectors;
+		alignas(0x10) size_t nVectors;
+		alignas(0x10) uint64_t offset;
+	} pars{ hnd, vectors, nVectors, offset };
+	return syscall(72, &pars);
+}
+uintptr_t GetFilePos(uintptr_t hnd)
+{
+	uintptr_t pars[2] = { hnd, 0 };
+	return syscall(17, &pars);
+}
+uintptr_t SeekFile(uintptr_t hnd, uintptr_t count, uint32_t from)
+{
+	struct _par
+	{
+		alignas(0x10) uintptr_t hnd;
+		alignas(0x10) uintptr_t count;
+		alignas(0x10) uint32_t from;
+	} pars{ hnd, count, from };
+	return syscall(21, &pars);
+}
 size_t GetFilesize(uintptr_t hnd)
 {
 	uintptr_t pars[2] = { hnd, 0 };
@@ -183,6 +225,214 @@ void *memcpy(void* dest, const void* src, size_t size)
 	return dest;
 }
 
+static uint64_t rdtsc()
+{
+	uint32_t low = 0, high = 0;
+	asm volatile("rdtsc" : "=a"(low), "=d"(high));
+	return ((uint64_t)high << 32) | low;
+}
+static void outputNumber(const char* name, uintptr_t value)
+{
+	char res[21] = {};
+	ConsoleOutput(name);
+	ConsoleOutput(itoa(value, res, 10));
+	ConsoleOutput("\n");
+}
+static bool compare(const char* buf1, const char* buf2, size_t size)
+{
+	for (size_t i = 0; i < size; i++)
+		if (buf1[i] != buf2[i])
+			return false;
+	return true;
+}
+#define N_RECORDS 8
+#define RECORD_SIZE 16
+// Reads records scattered over a file three ways, and compares the syscall counts and the time taken:
+// with a seek then a read for each record, with a positional read for each record, and with one vectored read.
+static uint32_t testPositionalReads()
+{
+	uintptr_t fileHandle = MakeFileHandle();
+	if (!OpenFile(fileHandle, "1:/splash.txt", 1))
+		return 2;
+	size_t fileSize = GetFilesize(fileHandle);
+	if (fileSize < N_RECORDS * RECORD_SIZE * 2)
+	{
+		CloseFileHandle(fileHandle);
+		InvalidateHandle(fileHandle);
+		return 0; // Too small to have gaps between the records.
+	}
+	// The records are spaced evenly, with a gap after each.
+	const size_t stride = fileSize / N_RECORDS;
+	static char seekRead[N_RECORDS][RECORD_SIZE];
+	static char positional[N_RECORDS][RECORD_SIZE];
+	static char vectored[N_RECORDS][RECORD_SIZE];
+
+	uint64_t start = rdtsc();
+	for (size_t i = 0; i < N_RECORDS; i++)
+	{
+		SeekFile(fileHandle, i * stride, 1);
+		if (!ReadFile(fileHandle, seekRead[i], RECORD_SIZE))
+			return 3;
+	}
+	uint64_t seekReadTime = rdtsc() - start;
+	uintptr_t pos = GetFilePos(fileHandle);
+
+	start = rdtsc();
+	for (size_t i = 0; i < N_RECORDS; i++)
+		if (!ReadFileAt(fileHandle, positional[i], RECORD_SIZE, i * stride))
+			return 4;
+	uint64_t positionalTime = rdtsc() - start;
+
+	ReadVector vectors[N_RECORDS * 2 - 1] = {};
+	for (size_t i = 0; i < N_RECORDS; i++)
+	{
+		vectors[i * 2] = { vectored[i], RECORD_SIZE };
+		if (i != N_RECORDS - 1)
+			vectors[i * 2 + 1] = { nullptr, stride - RECORD_SIZE };
+	}
+	start = rdtsc();
+	if (!ReadFileVectoredAt(fileHandle, vectors, N_RECORDS * 2 - 1, 0))
+		return 5;
+	uint64_t vectoredTime = rdtsc() - start;
+
+	uint32_t ret = 0;
+	if (!compare(&seekRead[0][0], &positional[0][0], sizeof(seekRead)) || !compare(&seekRead[0][0], &vectored[0][0], sizeof(seekRead)))
+		ret = 6;
+	// Positional reads must leave the stream position alone.
+	if (GetFilePos(fileHandle) != pos)
+		ret = 7;
+	outputNumber("Seek+read syscalls: ", N_RECORDS * 2);
+	outputNumber("Seek+read cycles: ", seekReadTime);
+	outputNumber("Positional read syscalls: ", N_RECORDS);
+	outputNumber("Positional read cycles: ", positionalTime);
+	outputNumber("Vectored read syscalls: ", 1);
+	outputNumber("Vectored read cycles: ", vectoredTime);
+	outputNumber("Bytes read per run: ", N_RECORDS * RECORD_SIZE);
+	CloseFileHandle(fileHandle);
+	InvalidateHandle(fileHandle);
+	return ret;
+}
+#define N_OPENS 64
+// Measures how long it takes to open a path, and to fail to open a path that doesn't exist.
+// test() already opened the file, so its components are in the dentry cache.
+static uint32_t testOpenLatency()
+{
+	uintptr_t fileHandle = MakeFileHandle();
+	uint64_t openTime = 0;
+	for (size_t i = 0; i < N_OPENS; i++)
+	{
+		uint64_t start = rdtsc();
+		bool opened = OpenFile(fileHandle, "1:/splash.txt", 1);
+		openTime += rdtsc() - start;
+		if (!opened)
+			return 8;
+		CloseFileHandle(fileHandle);
+	}
+	uint64_t failedOpenTime = 0;
+	for (size_t i = 0; i < N_OPENS; i++)
+	{
+		uint64_t start = rdtsc();
+		bool opened = OpenFile(fileHandle, "1:/doesNotExist.txt", 1);
+		failedOpenTime += rdtsc() - start;
+		if (opened)
+			return 9;
+	}
+	outputNumber("Open cycles (average): ", openTime / N_OPENS);
+	outputNumber("Failed open cycles (average): ", failedOpenTime / N_OPENS);
+	InvalidateHandle(fileHandle);
+	return 0;
+}
+#define SEQUENTIAL_READ_SIZE 0x100000
+#define SEQUENTIAL_READ_CHUNK 0x10000
+// Reads 1 MiB sequentially in 64 KiB chunks, and measures the throughput.
+// If the file is smaller than that, it's read from the start again until at least 1 MiB was read.
+static uint32_t testSequentialRead()
+{
+	uintptr_t fileHandle = MakeFileHandle();
+	if (!OpenFile(fileHandle, "1:/splash.txt", 1))
+		return 10;
+	size_t fileSize = GetFilesize(fileHandle);
+	size_t chunkSize = fileSize < SEQUENTIAL_READ_CHUNK ? fileSize : SEQUENTIAL_READ_CHUNK;
+	char* data = (char*)VirtualAlloc(g_vAllocator, nullptr, SEQUENTIAL_READ_CHUNK, 0);
+	if (!data || !chunkSize)
+		return 11;
+	uint64_t offset = 0;
+	size_t nRead = 0;
+	uint64_t start = rdtsc();
+	for (; nRead < SEQUENTIAL_READ_SIZE; nRead += chunkSize)
+	{
+		if (offset + chunkSize > fileSize)
+			offset = 0;
+		if (!ReadFileAt(fileHandle, data, chunkSize, offset))
+			return 12;
+		offset += chunkSize;
+	}
+	uint64_t time = rdtsc() - start;
+	outputNumber("Sequential read bytes: ", nRead);
+	outputNumber("Sequential read cycles: ", time);
+	outputNumber("Sequential read cycles per KiB: ", time / (nRead / 1024));
+	VirtualFree(g_vAllocator, data, SEQUENTIAL_READ_CHUNK);
+	CloseFileHandle(fileHandle);
+	InvalidateHandle(fileHandle);
+	return 0;
+}
+#define N_REPEATED_READS 16
+// Reads the same file several times, and compares the first read with the ones after it, which should come from the caches.
+// This runs before the other tests, so the first read is the first time the file is read.
+static uint32_t testRepeatedReads()
+{
+	uintptr_t fileHandle = MakeFileHandle();
+	if (!OpenFile(fileHandle, "1:/splash.txt", 1))
+		return 13;
+	size_t fileSize = GetFilesize(fileHandle);
+	char* data = (char*)VirtualAlloc(g_vAllocator, nullptr, fileSize, 0);
+	if (!data)
+		return 14;
+	uint64_t start = rdtsc();
+	if (!ReadFileAt(fileHandle, data, fileSize, 0))
+		return 15;
+	uint64_t firstReadTime = rdtsc() - start;
+	uint64_t readTime = 0;
+	for (size_t i = 0; i < N_REPEATED_READS; i++)
+	{
+		start = rdtsc();
+		bool read = ReadFileAt(fileHandle, data, fileSize, 0);
+		readTime += rdtsc() - start;
+		if (!read)
+			return 16;
+	}
+	outputNumber("Repeated read bytes: ", fileSize);
+	outputNumber("First read cycles: ", firstReadTime);
+	outputNumber("Repeated read cycles (average): ", readTime / N_REPEATED_READS);
+	VirtualFree(g_vAllocator, data, fileSize);
+	CloseFileHandle(fileHandle);
+	InvalidateHandle(fileHandle);
+	return 0;
+}
+#define N_SMALL_READS 64
+// Reads one byte of a file many times. Each read goes to the filesystem driver, which has to find the file by its path,
+// so this measures how long the driver's lookup takes. Run it on a volume with many files to see how that scales.
+static uint32_t testSmallReads()
+{
+	uintptr_t fileHandle = MakeFileHandle();
+	if (!OpenFile(fileHandle, "1:/splash.txt", 1))
+		return 17;
+	char byte = 0;
+	uint64_t readTime = 0;
+	for (size_t i = 0; i < N_SMALL_READS; i++)
+	{
+		uint64_t start = rdtsc();
+		bool read = ReadFileAt(fileHandle, &byte, 1, 0);
+		readTime += rdtsc() - start;
+		if (!read)
+			return 18;
+	}
+	outputNumber("One byte read cycles (average): ", readTime / N_SMALL_READS);
+	CloseFileHandle(fileHandle);
+	InvalidateHandle(fileHandle);
+	return 0;
+}
+
 static uint32_t test()
 {
 	// Make a file handle
@@ -210,7 +460,17 @@ static uint32_t test()
 }
 void thrStart(uintptr_t)
 {
-	uint32_t exitCode = test();
+	uint32_t exitCode = testRepeatedReads();
+	if (!exitCode)
+		exitCode = test();
+	if (!exitCode)
+		exitCode = testPositionalReads();
+	if (!exitCode)
+		exitCode = testOpenLatency();
+	if (!exitCode)
+		exitCode = testSequentialRead();
+	if (!exitCode)
+		exitCode = testSmallReads();
 exit:
 	struct
 	{